@@ -1,11 +1,156 @@
 #include "src/engine.h"
 
+#include <cstdlib>
+#include <cstring>
+
 Engine* engine;
 
-int main() {
+// Command line flags:
+// --headless: render offscreen without a window.
+// --frames N: render N frames headless, 100 by default.
+// --output path: where headless rendering writes its last frame, frame.ppm by default.
+// --reference: also trace the scene on the CPU into reference.ppm.
+// --traversal single|stream|packet: how the CPU tracer walks its BVH, packet by default.
+// --lod-error px: with --reference, also trace the levels of detail picked for at most px pixels of error into
+//   reference_lod.ppm and compare them.
+// --single-queue: upload on the graphics queue even when the device has a transfer only queue family.
+// --gpu-mips: blit texture mip chains on the GPU instead of building them on the decode threads.
+// --compression none|bc1|bc7: encode textures to BC formats, cached next to the sources as KTX2 files.
+// --packed-vertices: quantize the vertex buffer to 16 bytes a vertex. With --reference it is also traced into
+//   reference_packed.ppm and compared.
+// --stream-obj: convert the .obj while reading it in bounded windows instead of mapping and parsing it whole.
+// --scene path: load the meshes and instances of a scene manifest instead of the single corgi.
+// --meshlet-benchmark N: rebuild the meshlets of the model N times and report the builder throughput.
+// --loader-benchmark N: load the .obj N times into every vertex type, and streamed, and report the median load
+//   times and peak memory.
+// --frames-benchmark N: check the tangent frames of a quad, then regenerate the normals and tangents of the model
+//   N times on one and on all threads.
+// --layout-benchmark N: time bounds, BVH builds, quantization and normals N times on interleaved vertices and on
+//   vertex streams.
+// --parse-benchmark N: check the .obj number parser against strtod and report its median throughput over N runs.
+// --traversal-benchmark N: render a large synthetic scene N times with every --traversal mode on the CPU.
+// --allocator-check: before starting, check the device memory allocator against a made up memory properties table.
+// --loader-check: before starting, load small .obj files with the reference, parallel and streaming loaders and
+//   compare them.
+int main(int argc, char** argv) {
+	EngineOptions options;
+	bool allocatorCheck = false;
+	bool loaderCheck = false;
+	TraversalMode traversalMode = TRAVERSAL_PACKET;
+	uint32_t frameCount = 100;
+	uint32_t meshletBenchmarkRuns = 0;
+	uint32_t loaderBenchmarkRuns = 0;
+	uint32_t framesBenchmarkRuns = 0;
+	uint32_t layoutBenchmarkRuns = 0;
+	uint32_t parseBenchmarkRuns = 0;
+	uint32_t traversalBenchmarkRuns = 0;
+	float lodPixelError = 0.0f;
+	std::string outputPath = "frame.ppm";
+
+	for (int x = 1; x < argc; x++) {
+		if (strcmp(argv[x], "--headless") == 0) {
+			options.headless = true;
+		} else if (strcmp(argv[x], "--reference") == 0) {
+			options.referenceRenderer = true;
+		} else if (strcmp(argv[x], "--single-queue") == 0) {
+			options.singleQueue = true;
+		} else if (strcmp(argv[x], "--gpu-mips") == 0) {
+			options.gpuMipmaps = true;
+		} else if (strcmp(argv[x], "--packed-vertices") == 0) {
+			options.packedVertices = true;
+		} else if (strcmp(argv[x], "--stream-obj") == 0) {
+			options.streamingObj = true;
+		} else if (strcmp(argv[x], "--allocator-check") == 0) {
+			allocatorCheck = true;
+		} else if (strcmp(argv[x], "--loader-check") == 0) {
+			loaderCheck = true;
+		} else if (strcmp(argv[x], "--compression") == 0 && x + 1 < argc) {
+			x++;
+			if (strcmp(argv[x], "bc1") == 0) {
+				options.textureCompression = TEXTURE_COMPRESSION_BC1;
+			} else if (strcmp(argv[x], "bc7") == 0) {
+				options.textureCompression = TEXTURE_COMPRESSION_BC7;
+			} else {
+				options.textureCompression = TEXTURE_COMPRESSION_NONE;
+			}
+		} else if (strcmp(argv[x], "--traversal") == 0 && x + 1 < argc) {
+			x++;
+			if (strcmp(argv[x], "single") == 0) {
+				traversalMode = TRAVERSAL_SINGLE;
+			} else if (strcmp(argv[x], "stream") == 0) {
+				traversalMode = TRAVERSAL_STREAM;
+			}
+		} else if (strcmp(argv[x], "--meshlet-benchmark") == 0 && x + 1 < argc) {
+			meshletBenchmarkRuns = static_cast<uint32_t>(atoi(argv[++x]));
+		} else if (strcmp(argv[x], "--loader-benchmark") == 0 && x + 1 < argc) {
+			loaderBenchmarkRuns = static_cast<uint32_t>(atoi(argv[++x]));
+		} else if (strcmp(argv[x], "--frames-benchmark") == 0 && x + 1 < argc) {
+			framesBenchmarkRuns = static_cast<uint32_t>(atoi(argv[++x]));
+		} else if (strcmp(argv[x], "--layout-benchmark") == 0 && x + 1 < argc) {
+			layoutBenchmarkRuns = static_cast<uint32_t>(atoi(argv[++x]));
+		} else if (strcmp(argv[x], "--parse-benchmark") == 0 && x + 1 < argc) {
+			parseBenchmarkRuns = static_cast<uint32_t>(atoi(argv[++x]));
+		} else if (strcmp(argv[x], "--traversal-benchmark") == 0 && x + 1 < argc) {
+			traversalBenchmarkRuns = static_cast<uint32_t>(atoi(argv[++x]));
+		} else if (strcmp(argv[x], "--lod-error") == 0 && x + 1 < argc) {
+			lodPixelError = static_cast<float>(atof(argv[++x]));
+		} else if (strcmp(argv[x], "--frames") == 0 && x + 1 < argc) {
+			frameCount = static_cast<uint32_t>(atoi(argv[++x]));
+		} else if (strcmp(argv[x], "--output") == 0 && x + 1 < argc) {
+			outputPath = argv[++x];
+		} else if (strcmp(argv[x], "--scene") == 0 && x + 1 < argc) {
+			options.scenePath = argv[++x];
+		}
+	}
+
+	if (allocatorCheck) {
+		std::string failure;
+		if (checkDeviceAllocator(failure)) {
+			std::cout << "Device allocator check passed" << std::endl;
+		} else {
+			std::cerr << "Device allocator check failed: " << failure << std::endl;
+			return 1;
+		}
+	}
+
+	if (loaderCheck) {
+		std::string failure;
+		if (tinyobj::CheckObjLoaders(&failure)) {
+			std::cout << "Loader check passed" << std::endl;
+		} else {
+			std::cerr << "Loader check failed: " << failure << std::endl;
+			return 1;
+		}
+	}
+
 	engine = new Engine;
-	engine->initialize();
-	engine->start();
+	engine->initialize(options);
+	if (meshletBenchmarkRuns > 0) {
+		engine->benchmarkMeshlets(meshletBenchmarkRuns);
+	}
+	if (loaderBenchmarkRuns > 0) {
+		engine->benchmarkLoader(loaderBenchmarkRuns);
+	}
+	if (framesBenchmarkRuns > 0) {
+		engine->benchmarkVertexFrames(framesBenchmarkRuns);
+	}
+	if (layoutBenchmarkRuns > 0) {
+		engine->benchmarkVertexLayouts(layoutBenchmarkRuns);
+	}
+	if (parseBenchmarkRuns > 0) {
+		engine->benchmarkFloatParser(parseBenchmarkRuns);
+	}
+	if (traversalBenchmarkRuns > 0) {
+		engine->benchmarkTraversal(traversalBenchmarkRuns);
+	}
+	if (options.referenceRenderer) {
+		engine->renderReference("reference.ppm", traversalMode, lodPixelError);
+	}
+	if (options.headless) {
+		engine->renderHeadless(frameCount, outputPath);
+	} else {
+		engine->start();
+	}
 	engine->quit();
 	
 	return 0;
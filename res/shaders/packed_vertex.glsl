@@ -0,0 +1,38 @@
+// Decodes the vertices encodePackedVertices writes, see src/packed_vertex.h. Vertex inputs get the
+// snorm, unorm and half conversions from their formats, hit shaders reading the vertex buffer as
+// uints unpack them here. The quantization comes from the VertexQuantization of the mesh.
+
+struct VertexQuantization {
+	vec3 positionCenter;
+	vec3 positionExtent;
+	vec2 texCoordMin;
+	vec2 texCoordExtent;
+};
+
+vec3 decodePosition(vec3 snorm, VertexQuantization quantization) {
+	return quantization.positionCenter + snorm * quantization.positionExtent;
+}
+
+// the lower half is folded over the diagonals
+vec3 octahedralDecode(vec2 encoded) {
+	vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+	if (normal.z < 0.0) {
+		normal.xy = (1.0 - abs(normal.yx)) * vec2(normal.x >= 0.0 ? 1.0 : -1.0, normal.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return normalize(normal);
+}
+
+vec2 decodeTexCoordUnorm16(vec2 unorm, VertexQuantization quantization) {
+	return quantization.texCoordMin + unorm * quantization.texCoordExtent;
+}
+
+// PACKED_POSITION_SNORM16 and PACKED_TEXCOORD_HALF, 4 uints per vertex
+void unpackVertex(uvec4 packed, VertexQuantization quantization, out vec3 position, out vec3 normal, out vec2 texCoord) {
+	position = decodePosition(vec3(unpackSnorm2x16(packed.x), unpackSnorm2x16(packed.y).x), quantization);
+	normal = octahedralDecode(unpackSnorm2x16(packed.z));
+	texCoord = unpackHalf2x16(packed.w);
+}
+
+vec3 unpackColor(uint packed) {
+	return unpackUnorm4x8(packed).rgb;
+}
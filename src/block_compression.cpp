@@ -0,0 +1,616 @@
+#include "block_compression.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+bool isBlockCompressed(VkFormat format) {
+	return format == VK_FORMAT_BC1_RGB_UNORM_BLOCK || format == VK_FORMAT_BC4_UNORM_BLOCK || format == VK_FORMAT_BC5_UNORM_BLOCK || format == VK_FORMAT_BC7_UNORM_BLOCK;
+}
+
+uint32_t formatBlockExtent(VkFormat format) {
+	return isBlockCompressed(format) ? 4 : 1;
+}
+
+uint32_t formatBlockBytes(VkFormat format) {
+	switch (format) {
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+		return 8;
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+		return 16;
+	default:
+		return 4;
+	}
+}
+
+size_t textureLevelSize(VkFormat format, uint32_t width, uint32_t height) {
+	uint32_t extent = formatBlockExtent(format);
+	return static_cast<size_t>((width + extent - 1) / extent) * ((height + extent - 1) / extent) * formatBlockBytes(format);
+}
+
+size_t textureMipChainSize(VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels) {
+	size_t size = 0;
+	for (uint32_t level = 1; level < mipLevels; level++) {
+		size += textureLevelSize(format, std::max(1u, width >> level), std::max(1u, height >> level));
+	}
+	return size;
+}
+
+const char* textureFormatName(VkFormat format) {
+	switch (format) {
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+		return "BC1";
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+		return "BC4";
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+		return "BC5";
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+		return "BC7";
+	default:
+		return "RGBA8";
+	}
+}
+
+VkFormat compressedFormat(TextureCompression compression, int channels, bool hasAlpha) {
+	if (channels <= 2) {
+		return hasAlpha ? VK_FORMAT_BC5_UNORM_BLOCK : VK_FORMAT_BC4_UNORM_BLOCK;
+	}
+	if (hasAlpha || compression == TEXTURE_COMPRESSION_BC7) {
+		return VK_FORMAT_BC7_UNORM_BLOCK;
+	}
+	return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+}
+
+VkComponentMapping compressedComponentMapping(VkFormat format) {
+	VkComponentMapping components = {};
+	if (format == VK_FORMAT_BC4_UNORM_BLOCK) {
+		components = {VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_ONE};
+	} else if (format == VK_FORMAT_BC5_UNORM_BLOCK) {
+		components = {VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G};
+	}
+	return components;
+}
+
+static uint32_t formatChannels(VkFormat format) {
+	switch (format) {
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+		return 1;
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+		return 2;
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+		return 3;
+	default:
+		return 4;
+	}
+}
+
+// Direction of largest variance of N channel texels, by power iteration on the covariance.
+// Returns false for a block of one color.
+template <int N>
+static bool principalAxis(const float (*texels)[N], int count, float* mean, float* axis) {
+	for (int c = 0; c < N; c++) {
+		mean[c] = 0.0f;
+		for (int x = 0; x < count; x++) {
+			mean[c] += texels[x][c];
+		}
+		mean[c] /= count;
+	}
+
+	float covariance[N][N] = {};
+	for (int x = 0; x < count; x++) {
+		for (int a = 0; a < N; a++) {
+			for (int b = 0; b < N; b++) {
+				covariance[a][b] += (texels[x][a] - mean[a]) * (texels[x][b] - mean[b]);
+			}
+		}
+	}
+
+	// the row of the widest channel is a start that is never orthogonal to the answer
+	int widest = 0;
+	for (int c = 1; c < N; c++) {
+		if (covariance[c][c] > covariance[widest][widest]) {
+			widest = c;
+		}
+	}
+	if (covariance[widest][widest] < 1e-4f) {
+		return false;
+	}
+	for (int c = 0; c < N; c++) {
+		axis[c] = covariance[widest][c];
+	}
+
+	for (int iteration = 0; iteration < 8; iteration++) {
+		float next[N] = {};
+		float length = 0.0f;
+		for (int a = 0; a < N; a++) {
+			for (int b = 0; b < N; b++) {
+				next[a] += covariance[a][b] * axis[b];
+			}
+			length += next[a] * next[a];
+		}
+		if (length < 1e-12f) {
+			break;
+		}
+		length = 1.0f / std::sqrt(length);
+		for (int c = 0; c < N; c++) {
+			axis[c] = next[c] * length;
+		}
+	}
+	return true;
+}
+
+// Endpoints at the extremes of the texels along the principal axis.
+template <int N>
+static void axisEndpoints(const float (*texels)[N], int count, float* high, float* low) {
+	float mean[N], axis[N];
+	if (!principalAxis<N>(texels, count, mean, axis)) {
+		for (int c = 0; c < N; c++) {
+			high[c] = low[c] = mean[c];
+		}
+		return;
+	}
+
+	float minT = std::numeric_limits<float>::max();
+	float maxT = -std::numeric_limits<float>::max();
+	for (int x = 0; x < count; x++) {
+		float t = 0.0f;
+		for (int c = 0; c < N; c++) {
+			t += (texels[x][c] - mean[c]) * axis[c];
+		}
+		minT = std::min(minT, t);
+		maxT = std::max(maxT, t);
+	}
+	for (int c = 0; c < N; c++) {
+		high[c] = std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * maxT));
+		low[c] = std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * minT));
+	}
+}
+
+// Least squares endpoints for fixed interpolation weights, weight[x] being the share of high.
+// Returns false when the weights cannot tell the endpoints apart.
+template <int N>
+static bool fitEndpoints(const float (*texels)[N], int count, const float* weight, float* high, float* low) {
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	float ax[N] = {}, bx[N] = {};
+	for (int x = 0; x < count; x++) {
+		float a = weight[x];
+		float b = 1.0f - a;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (int c = 0; c < N; c++) {
+			ax[c] += a * texels[x][c];
+			bx[c] += b * texels[x][c];
+		}
+	}
+
+	float determinant = aa * bb - ab * ab;
+	if (std::fabs(determinant) < 1e-6f) {
+		return false;
+	}
+	for (int c = 0; c < N; c++) {
+		high[c] = std::min(255.0f, std::max(0.0f, (ax[c] * bb - bx[c] * ab) / determinant));
+		low[c] = std::min(255.0f, std::max(0.0f, (bx[c] * aa - ax[c] * ab) / determinant));
+	}
+	return true;
+}
+
+static uint16_t packRgb565(const float* color) {
+	uint32_t r = static_cast<uint32_t>(color[0] * 31.0f / 255.0f + 0.5f);
+	uint32_t g = static_cast<uint32_t>(color[1] * 63.0f / 255.0f + 0.5f);
+	uint32_t b = static_cast<uint32_t>(color[2] * 31.0f / 255.0f + 0.5f);
+	return static_cast<uint16_t>(r << 11 | g << 5 | b);
+}
+
+static void unpackRgb565(uint16_t packed, int* color) {
+	int r = packed >> 11, g = (packed >> 5) & 63, b = packed & 31;
+	color[0] = r << 3 | r >> 2;
+	color[1] = g << 2 | g >> 4;
+	color[2] = b << 3 | b >> 2;
+}
+
+static void bc1Palette(uint16_t color0, uint16_t color1, int (*palette)[3]) {
+	unpackRgb565(color0, palette[0]);
+	unpackRgb565(color1, palette[1]);
+	for (int c = 0; c < 3; c++) {
+		if (color0 > color1) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		} else {
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+}
+
+// Picks the nearest of the four colors for every texel, color0 >= color1 so the block stays
+// in four color mode.
+static float bc1Indices(const float (*texels)[3], uint16_t color0, uint16_t color1, uint8_t* indices) {
+	int palette[4][3];
+	bc1Palette(color0, color1, palette);
+	if (color0 == color1) {
+		palette[2][0] = palette[3][0] = palette[0][0];
+		palette[2][1] = palette[3][1] = palette[0][1];
+		palette[2][2] = palette[3][2] = palette[0][2];
+	}
+
+	float error = 0.0f;
+	for (int x = 0; x < 16; x++) {
+		float best = std::numeric_limits<float>::max();
+		for (int i = 0; i < 4; i++) {
+			float d0 = texels[x][0] - palette[i][0], d1 = texels[x][1] - palette[i][1], d2 = texels[x][2] - palette[i][2];
+			float distance = d0 * d0 + d1 * d1 + d2 * d2;
+			if (distance < best) {
+				best = distance;
+				indices[x] = static_cast<uint8_t>(i);
+			}
+		}
+		error += best;
+	}
+	return error;
+}
+
+static void encodeBc1(const float (*texels)[3], uint8_t* block) {
+	static const float highWeight[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+
+	float high[3], low[3];
+	axisEndpoints<3>(texels, 16, high, low);
+	uint16_t color0 = packRgb565(high), color1 = packRgb565(low);
+	if (color0 < color1) {
+		std::swap(color0, color1);
+	}
+	uint8_t indices[16];
+	float error = bc1Indices(texels, color0, color1, indices);
+
+	for (int iteration = 0; iteration < 2 && error > 0.0f; iteration++) {
+		float weight[16];
+		for (int x = 0; x < 16; x++) {
+			weight[x] = highWeight[indices[x]];
+		}
+		if (!fitEndpoints<3>(texels, 16, weight, high, low)) {
+			break;
+		}
+
+		uint16_t fitted0 = packRgb565(high), fitted1 = packRgb565(low);
+		if (fitted0 < fitted1) {
+			std::swap(fitted0, fitted1);
+		}
+		uint8_t fittedIndices[16];
+		float fittedError = bc1Indices(texels, fitted0, fitted1, fittedIndices);
+		if (fittedError >= error) {
+			break;
+		}
+		color0 = fitted0;
+		color1 = fitted1;
+		error = fittedError;
+		memcpy(indices, fittedIndices, sizeof(indices));
+	}
+
+	// equal endpoints decode in three color mode, where only index 0 is the same color
+	if (color0 == color1) {
+		memset(indices, 0, sizeof(indices));
+	}
+
+	uint32_t bits = 0;
+	for (int x = 0; x < 16; x++) {
+		bits |= static_cast<uint32_t>(indices[x]) << (x * 2);
+	}
+	block[0] = static_cast<uint8_t>(color0);
+	block[1] = static_cast<uint8_t>(color0 >> 8);
+	block[2] = static_cast<uint8_t>(color1);
+	block[3] = static_cast<uint8_t>(color1 >> 8);
+	memcpy(block + 4, &bits, sizeof(bits));
+}
+
+static void bc4Palette(int value0, int value1, int* palette) {
+	palette[0] = value0;
+	palette[1] = value1;
+	if (value0 > value1) {
+		for (int i = 1; i < 7; i++) {
+			palette[i + 1] = ((7 - i) * value0 + i * value1) / 7;
+		}
+	} else {
+		for (int i = 1; i < 5; i++) {
+			palette[i + 1] = ((5 - i) * value0 + i * value1) / 5;
+		}
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
+// Eight interpolated values between the extremes of the block.
+static void encodeBc4(const uint8_t* values, uint8_t* block) {
+	int high = values[0], low = values[0];
+	for (int x = 1; x < 16; x++) {
+		high = std::max<int>(high, values[x]);
+		low = std::min<int>(low, values[x]);
+	}
+
+	int palette[8];
+	bc4Palette(high, low, palette);
+
+	uint64_t bits = 0;
+	for (int x = 0; x < 16 && high != low; x++) {
+		int best = 0;
+		for (int i = 1; i < 8; i++) {
+			if (std::abs(values[x] - palette[i]) < std::abs(values[x] - palette[best])) {
+				best = i;
+			}
+		}
+		bits |= static_cast<uint64_t>(best) << (x * 3);
+	}
+
+	block[0] = static_cast<uint8_t>(high);
+	block[1] = static_cast<uint8_t>(low);
+	for (int x = 0; x < 6; x++) {
+		block[2 + x] = static_cast<uint8_t>(bits >> (x * 8));
+	}
+}
+
+static const int bc7Weights4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+// Mode 6 endpoints are 7 bits per channel plus one shared low bit per endpoint.
+static void quantizeBc7Endpoint(const float* color, uint8_t* quantized, uint8_t& pBit) {
+	float bestError = std::numeric_limits<float>::max();
+	for (uint8_t p = 0; p < 2; p++) {
+		uint8_t candidate[4];
+		float error = 0.0f;
+		for (int c = 0; c < 4; c++) {
+			int value = static_cast<int>(std::floor((color[c] - p) / 2.0f + 0.5f));
+			candidate[c] = static_cast<uint8_t>(std::min(127, std::max(0, value)));
+			float difference = static_cast<float>(candidate[c] << 1 | p) - color[c];
+			error += difference * difference;
+		}
+		if (error < bestError) {
+			bestError = error;
+			pBit = p;
+			memcpy(quantized, candidate, 4);
+		}
+	}
+}
+
+static float bc7Indices(const float (*texels)[4], const uint8_t* q0, uint8_t p0, const uint8_t* q1, uint8_t p1, uint8_t* indices) {
+	int palette[16][4];
+	for (int c = 0; c < 4; c++) {
+		int e0 = q0[c] << 1 | p0, e1 = q1[c] << 1 | p1;
+		for (int i = 0; i < 16; i++) {
+			palette[i][c] = ((64 - bc7Weights4[i]) * e0 + bc7Weights4[i] * e1 + 32) >> 6;
+		}
+	}
+
+	float error = 0.0f;
+	for (int x = 0; x < 16; x++) {
+		float best = std::numeric_limits<float>::max();
+		for (int i = 0; i < 16; i++) {
+			float distance = 0.0f;
+			for (int c = 0; c < 4; c++) {
+				float difference = texels[x][c] - palette[i][c];
+				distance += difference * difference;
+			}
+			if (distance < best) {
+				best = distance;
+				indices[x] = static_cast<uint8_t>(i);
+			}
+		}
+		error += best;
+	}
+	return error;
+}
+
+static void writeBits(uint8_t* block, uint32_t& position, uint32_t value, uint32_t count) {
+	for (uint32_t x = 0; x < count; x++, position++) {
+		block[position >> 3] |= static_cast<uint8_t>(((value >> x) & 1) << (position & 7));
+	}
+}
+
+static uint32_t readBits(const uint8_t* block, uint32_t& position, uint32_t count) {
+	uint32_t value = 0;
+	for (uint32_t x = 0; x < count; x++, position++) {
+		value |= static_cast<uint32_t>((block[position >> 3] >> (position & 7)) & 1) << x;
+	}
+	return value;
+}
+
+// Mode 6 only: one subset, RGBA endpoints and 4 bit indices, the best single mode for smooth
+// color and alpha, which is what diffuse maps are.
+static void encodeBc7(const float (*texels)[4], uint8_t* block) {
+	float endpoint0[4], endpoint1[4];
+	axisEndpoints<4>(texels, 16, endpoint0, endpoint1);
+
+	uint8_t q0[4], q1[4], p0 = 0, p1 = 0;
+	quantizeBc7Endpoint(endpoint0, q0, p0);
+	quantizeBc7Endpoint(endpoint1, q1, p1);
+	uint8_t indices[16];
+	float error = bc7Indices(texels, q0, p0, q1, p1, indices);
+
+	for (int iteration = 0; iteration < 2 && error > 0.0f; iteration++) {
+		float weight[16];
+		for (int x = 0; x < 16; x++) {
+			weight[x] = 1.0f - bc7Weights4[indices[x]] / 64.0f;
+		}
+		if (!fitEndpoints<4>(texels, 16, weight, endpoint0, endpoint1)) {
+			break;
+		}
+
+		uint8_t fitted0[4], fitted1[4], fittedP0 = 0, fittedP1 = 0;
+		quantizeBc7Endpoint(endpoint0, fitted0, fittedP0);
+		quantizeBc7Endpoint(endpoint1, fitted1, fittedP1);
+		uint8_t fittedIndices[16];
+		float fittedError = bc7Indices(texels, fitted0, fittedP0, fitted1, fittedP1, fittedIndices);
+		if (fittedError >= error) {
+			break;
+		}
+		memcpy(q0, fitted0, 4);
+		memcpy(q1, fitted1, 4);
+		p0 = fittedP0;
+		p1 = fittedP1;
+		error = fittedError;
+		memcpy(indices, fittedIndices, sizeof(indices));
+	}
+
+	// the first index is stored without its top bit, swapping the endpoints clears it
+	if (indices[0] & 8) {
+		std::swap_ranges(q0, q0 + 4, q1);
+		std::swap(p0, p1);
+		for (int x = 0; x < 16; x++) {
+			indices[x] = static_cast<uint8_t>(15 - indices[x]);
+		}
+	}
+
+	memset(block, 0, 16);
+	uint32_t position = 0;
+	writeBits(block, position, 1 << 6, 7);
+	for (int c = 0; c < 4; c++) {
+		writeBits(block, position, q0[c], 7);
+		writeBits(block, position, q1[c], 7);
+	}
+	writeBits(block, position, p0, 1);
+	writeBits(block, position, p1, 1);
+	writeBits(block, position, indices[0], 3);
+	for (int x = 1; x < 16; x++) {
+		writeBits(block, position, indices[x], 4);
+	}
+}
+
+void decompressBlock(VkFormat format, const uint8_t* block, uint8_t* texels) {
+	for (int x = 0; x < 16; x++) {
+		texels[x * 4 + 0] = texels[x * 4 + 1] = texels[x * 4 + 2] = 0;
+		texels[x * 4 + 3] = 255;
+	}
+
+	if (format == VK_FORMAT_BC1_RGB_UNORM_BLOCK) {
+		uint16_t color0 = static_cast<uint16_t>(block[0] | block[1] << 8);
+		uint16_t color1 = static_cast<uint16_t>(block[2] | block[3] << 8);
+		int palette[4][3];
+		bc1Palette(color0, color1, palette);
+		uint32_t bits;
+		memcpy(&bits, block + 4, sizeof(bits));
+		for (int x = 0; x < 16; x++) {
+			int index = (bits >> (x * 2)) & 3;
+			for (int c = 0; c < 3; c++) {
+				texels[x * 4 + c] = static_cast<uint8_t>(palette[index][c]);
+			}
+		}
+	} else if (format == VK_FORMAT_BC4_UNORM_BLOCK || format == VK_FORMAT_BC5_UNORM_BLOCK) {
+		uint32_t channels = format == VK_FORMAT_BC5_UNORM_BLOCK ? 2 : 1;
+		for (uint32_t c = 0; c < channels; c++) {
+			const uint8_t* channelBlock = block + c * 8;
+			int palette[8];
+			bc4Palette(channelBlock[0], channelBlock[1], palette);
+			uint64_t bits = 0;
+			for (int x = 0; x < 6; x++) {
+				bits |= static_cast<uint64_t>(channelBlock[2 + x]) << (x * 8);
+			}
+			for (int x = 0; x < 16; x++) {
+				texels[x * 4 + c] = static_cast<uint8_t>(palette[(bits >> (x * 3)) & 7]);
+			}
+		}
+	} else if (format == VK_FORMAT_BC7_UNORM_BLOCK) {
+		// other modes are never written, they decode to the error color
+		if ((block[0] & 0x7f) != 0x40) {
+			for (int x = 0; x < 16; x++) {
+				texels[x * 4 + 0] = texels[x * 4 + 2] = 255;
+			}
+			return;
+		}
+
+		uint32_t position = 7;
+		int endpoints[2][4];
+		for (int c = 0; c < 4; c++) {
+			endpoints[0][c] = static_cast<int>(readBits(block, position, 7));
+			endpoints[1][c] = static_cast<int>(readBits(block, position, 7));
+		}
+		uint32_t p0 = readBits(block, position, 1);
+		uint32_t p1 = readBits(block, position, 1);
+		for (int c = 0; c < 4; c++) {
+			endpoints[0][c] = endpoints[0][c] << 1 | p0;
+			endpoints[1][c] = endpoints[1][c] << 1 | p1;
+		}
+		for (int x = 0; x < 16; x++) {
+			int weight = bc7Weights4[readBits(block, position, x == 0 ? 3 : 4)];
+			for (int c = 0; c < 4; c++) {
+				texels[x * 4 + c] = static_cast<uint8_t>(((64 - weight) * endpoints[0][c] + weight * endpoints[1][c] + 32) >> 6);
+			}
+		}
+	}
+}
+
+void compressLevel(VkFormat format, const uint8_t* pixels, uint32_t width, uint32_t height, uint8_t* blocks, unsigned int threadCount) {
+	uint32_t blocksWide = (width + 3) / 4;
+	uint32_t blocksHigh = (height + 3) / 4;
+	uint32_t blockBytes = formatBlockBytes(format);
+
+	parallelFor(blocksHigh, threadCount, [&](size_t blockY) {
+		for (uint32_t blockX = 0; blockX < blocksWide; blockX++) {
+			uint8_t texels[16][4];
+			for (uint32_t y = 0; y < 4; y++) {
+				uint32_t sourceY = std::min<uint32_t>(static_cast<uint32_t>(blockY) * 4 + y, height - 1);
+				for (uint32_t x = 0; x < 4; x++) {
+					uint32_t sourceX = std::min(blockX * 4 + x, width - 1);
+					memcpy(texels[y * 4 + x], pixels + (static_cast<size_t>(sourceY) * width + sourceX) * 4, 4);
+				}
+			}
+
+			uint8_t* block = blocks + (blockY * blocksWide + blockX) * blockBytes;
+			if (format == VK_FORMAT_BC1_RGB_UNORM_BLOCK) {
+				float rgb[16][3];
+				for (int x = 0; x < 16; x++) {
+					rgb[x][0] = texels[x][0];
+					rgb[x][1] = texels[x][1];
+					rgb[x][2] = texels[x][2];
+				}
+				encodeBc1(rgb, block);
+			} else if (format == VK_FORMAT_BC7_UNORM_BLOCK) {
+				float rgba[16][4];
+				for (int x = 0; x < 16; x++) {
+					for (int c = 0; c < 4; c++) {
+						rgba[x][c] = texels[x][c];
+					}
+				}
+				encodeBc7(rgba, block);
+			} else {
+				for (uint32_t c = 0; c < formatChannels(format); c++) {
+					uint8_t values[16];
+					for (int x = 0; x < 16; x++) {
+						values[x] = texels[x][c];
+					}
+					encodeBc4(values, block + c * 8);
+				}
+			}
+		}
+	});
+}
+
+double compressedLevelPsnr(VkFormat format, const uint8_t* pixels, uint32_t width, uint32_t height, const uint8_t* blocks) {
+	uint32_t blocksWide = (width + 3) / 4;
+	uint32_t channels = formatChannels(format);
+	uint32_t blockBytes = formatBlockBytes(format);
+
+	double squaredError = 0.0;
+	for (uint32_t blockY = 0; blockY < (height + 3) / 4; blockY++) {
+		for (uint32_t blockX = 0; blockX < blocksWide; blockX++) {
+			uint8_t texels[64];
+			decompressBlock(format, blocks + (static_cast<size_t>(blockY) * blocksWide + blockX) * blockBytes, texels);
+			for (uint32_t y = blockY * 4; y < std::min(height, blockY * 4 + 4); y++) {
+				for (uint32_t x = blockX * 4; x < std::min(width, blockX * 4 + 4); x++) {
+					const uint8_t* source = pixels + (static_cast<size_t>(y) * width + x) * 4;
+					const uint8_t* decoded = texels + ((y - blockY * 4) * 4 + (x - blockX * 4)) * 4;
+					for (uint32_t c = 0; c < channels; c++) {
+						double difference = static_cast<double>(source[c]) - decoded[c];
+						squaredError += difference * difference;
+					}
+				}
+			}
+		}
+	}
+
+	double meanSquaredError = squaredError / (static_cast<double>(width) * height * channels);
+	if (meanSquaredError == 0.0) {
+		return std::numeric_limits<double>::infinity();
+	}
+	return 10.0 * std::log10(255.0 * 255.0 / meanSquaredError);
+}
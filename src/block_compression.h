@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include <vulkan/vulkan.h>
+
+// What textures are encoded to. BC1 keeps opaque color at 4 bits per texel, BC7 at 8 bits
+// with noticeably better quality. Textures with alpha always use BC7 and grey textures BC4,
+// or BC5 with their alpha, whatever the mode.
+enum TextureCompression {
+	TEXTURE_COMPRESSION_NONE,
+	TEXTURE_COMPRESSION_BC1,
+	TEXTURE_COMPRESSION_BC7
+};
+
+// Texel blocks of the formats textures are uploaded in: 1x1 texels of 4 bytes for
+// R8G8B8A8_UNORM, 4x4 texels of 8 (BC1, BC4) or 16 (BC5, BC7) bytes for the rest.
+bool isBlockCompressed(VkFormat format);
+uint32_t formatBlockExtent(VkFormat format);
+uint32_t formatBlockBytes(VkFormat format);
+size_t textureLevelSize(VkFormat format, uint32_t width, uint32_t height);
+// Bytes of levels 1 and below, packed one after the other.
+size_t textureMipChainSize(VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels);
+
+// Short name for logs, BC1 to BC7 or RGBA8.
+const char* textureFormatName(VkFormat format);
+// Format for a source image with the given channel count (as stbi reports it) and whether any
+// texel has alpha below 255.
+VkFormat compressedFormat(TextureCompression compression, int channels, bool hasAlpha);
+// BC4 and BC5 hold grey and grey plus alpha in red and green, the view spreads them back out.
+VkComponentMapping compressedComponentMapping(VkFormat format);
+
+// Encodes an RGBA8 level into BC1 (RGB), BC4 (R), BC5 (RG) or BC7 (RGBA, mode 6 only). Blocks
+// that hang over the edge repeat the last row and column. Rows of blocks are spread over
+// threadCount threads, 0 uses every core.
+void compressLevel(VkFormat format, const uint8_t* pixels, uint32_t width, uint32_t height, uint8_t* blocks, unsigned int threadCount = 1);
+// Decodes one block of any of the formats above into 16 RGBA8 texels; BC4 and BC5 leave the
+// missing channels at 0 and alpha at 255.
+void decompressBlock(VkFormat format, const uint8_t* block, uint8_t* texels);
+
+// Peak signal to noise ratio of the encoded level against the source, over the channels the
+// format stores. Infinity when they match.
+double compressedLevelPsnr(VkFormat format, const uint8_t* pixels, uint32_t width, uint32_t height, const uint8_t* blocks);
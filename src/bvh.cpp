@@ -0,0 +1,269 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <cmath>
+
+struct BvhBin {
+	glm::vec3 boundsMin = glm::vec3(FLT_MAX);
+	glm::vec3 boundsMax = glm::vec3(-FLT_MAX);
+	uint32_t count = 0;
+};
+
+struct BvhBuildTask {
+	uint32_t node;
+	uint32_t depth;
+};
+
+static inline bool intersectBounds(const BvhNode& node, const glm::vec3& origin, const glm::vec3& inverseDirection, float tMin, float tMax, float& tEntry) {
+	glm::vec3 t0 = (node.boundsMin - origin) * inverseDirection;
+	glm::vec3 t1 = (node.boundsMax - origin) * inverseDirection;
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+
+	tEntry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, tMin));
+	float tExit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+	return tEntry <= tExit;
+}
+
+void Bvh::build(const glm::vec3* positions, const uint32_t* indices, uint32_t triangleCount) {
+	nodes.clear();
+	triangles.clear();
+	triangleIndices.clear();
+	if (triangleCount == 0) {
+		return;
+	}
+
+	std::vector<glm::vec3> triangleMin(triangleCount);
+	std::vector<glm::vec3> triangleMax(triangleCount);
+	std::vector<glm::vec3> centroids(triangleCount);
+	triangleIndices.resize(triangleCount);
+
+	for (uint32_t x = 0; x < triangleCount; x++) {
+		const glm::vec3& v0 = positions[indices[x * 3 + 0]];
+		const glm::vec3& v1 = positions[indices[x * 3 + 1]];
+		const glm::vec3& v2 = positions[indices[x * 3 + 2]];
+		triangleMin[x] = glm::min(glm::min(v0, v1), v2);
+		triangleMax[x] = glm::max(glm::max(v0, v1), v2);
+		centroids[x] = (triangleMin[x] + triangleMax[x]) * 0.5f;
+		triangleIndices[x] = x;
+	}
+
+	// a binary tree over n leaves never has more than 2n - 1 nodes, so references stay valid
+	nodes.reserve(triangleCount * 2);
+	nodes.push_back({glm::vec3(0.0f), 0, glm::vec3(0.0f), triangleCount});
+
+	std::vector<BvhBuildTask> stack;
+	stack.push_back({0, 0});
+	while (!stack.empty()) {
+		BvhBuildTask task = stack.back();
+		stack.pop_back();
+
+		BvhNode& node = nodes[task.node];
+		uint32_t first = node.leftFirst;
+		uint32_t count = node.triangleCount;
+
+		glm::vec3 centroidMin(FLT_MAX);
+		glm::vec3 centroidMax(-FLT_MAX);
+		node.boundsMin = glm::vec3(FLT_MAX);
+		node.boundsMax = glm::vec3(-FLT_MAX);
+		for (uint32_t x = first; x < first + count; x++) {
+			uint32_t triangle = triangleIndices[x];
+			node.boundsMin = glm::min(node.boundsMin, triangleMin[triangle]);
+			node.boundsMax = glm::max(node.boundsMax, triangleMax[triangle]);
+			centroidMin = glm::min(centroidMin, centroids[triangle]);
+			centroidMax = glm::max(centroidMax, centroids[triangle]);
+		}
+
+		if (count == 1 || task.depth >= BVH_MAX_DEPTH) {
+			continue;
+		}
+
+		// evaluate the SAH at the BVH_BIN_COUNT - 1 bin boundaries of every axis
+		int bestAxis = -1;
+		int bestSplit = 0;
+		float bestCost = FLT_MAX;
+		for (int axis = 0; axis < 3; axis++) {
+			float extent = centroidMax[axis] - centroidMin[axis];
+			if (extent <= 0.0f) {
+				continue;
+			}
+
+			BvhBin bins[BVH_BIN_COUNT];
+			float scale = BVH_BIN_COUNT / extent;
+			for (uint32_t x = first; x < first + count; x++) {
+				uint32_t triangle = triangleIndices[x];
+				int bin = std::min(BVH_BIN_COUNT - 1, static_cast<int>((centroids[triangle][axis] - centroidMin[axis]) * scale));
+				bins[bin].boundsMin = glm::min(bins[bin].boundsMin, triangleMin[triangle]);
+				bins[bin].boundsMax = glm::max(bins[bin].boundsMax, triangleMax[triangle]);
+				bins[bin].count++;
+			}
+
+			float leftArea[BVH_BIN_COUNT - 1];
+			uint32_t leftCount[BVH_BIN_COUNT - 1];
+			BvhBin left;
+			for (int x = 0; x < BVH_BIN_COUNT - 1; x++) {
+				left.boundsMin = glm::min(left.boundsMin, bins[x].boundsMin);
+				left.boundsMax = glm::max(left.boundsMax, bins[x].boundsMax);
+				left.count += bins[x].count;
+				leftArea[x] = left.count > 0 ? surfaceArea(left.boundsMin, left.boundsMax) : 0.0f;
+				leftCount[x] = left.count;
+			}
+
+			BvhBin right;
+			for (int x = BVH_BIN_COUNT - 1; x > 0; x--) {
+				right.boundsMin = glm::min(right.boundsMin, bins[x].boundsMin);
+				right.boundsMax = glm::max(right.boundsMax, bins[x].boundsMax);
+				right.count += bins[x].count;
+				if (leftCount[x - 1] == 0 || right.count == 0) {
+					continue;
+				}
+
+				float cost = leftArea[x - 1] * leftCount[x - 1] + surfaceArea(right.boundsMin, right.boundsMax) * right.count;
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = x - 1;
+				}
+			}
+		}
+
+		if (bestAxis < 0) {
+			continue;
+		}
+
+		// traversal is taken to cost as much as one triangle test
+		float nodeArea = surfaceArea(node.boundsMin, node.boundsMax);
+		float splitCost = 1.0f + (nodeArea > 0.0f ? bestCost / nodeArea : 0.0f);
+		if (count <= BVH_MAX_LEAF_SIZE && splitCost >= static_cast<float>(count)) {
+			continue;
+		}
+
+		float scale = BVH_BIN_COUNT / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+		uint32_t* middle = std::partition(triangleIndices.data() + first, triangleIndices.data() + first + count, [&](uint32_t triangle) {
+			int bin = std::min(BVH_BIN_COUNT - 1, static_cast<int>((centroids[triangle][bestAxis] - centroidMin[bestAxis]) * scale));
+			return bin <= bestSplit;
+		});
+		uint32_t leftCount = static_cast<uint32_t>(middle - triangleIndices.data()) - first;
+
+		uint32_t leftIndex = static_cast<uint32_t>(nodes.size());
+		nodes.push_back({glm::vec3(0.0f), first, glm::vec3(0.0f), leftCount});
+		nodes.push_back({glm::vec3(0.0f), first + leftCount, glm::vec3(0.0f), count - leftCount});
+		node.leftFirst = leftIndex;
+		node.triangleCount = 0;
+
+		stack.push_back({leftIndex + 1, task.depth + 1});
+		stack.push_back({leftIndex, task.depth + 1});
+	}
+
+	// store the triangles in leaf order so a leaf reads one contiguous range
+	triangles.resize(triangleCount);
+	for (uint32_t x = 0; x < triangleCount; x++) {
+		uint32_t triangle = triangleIndices[x];
+		const glm::vec3& v0 = positions[indices[triangle * 3 + 0]];
+		const glm::vec3& v1 = positions[indices[triangle * 3 + 1]];
+		const glm::vec3& v2 = positions[indices[triangle * 3 + 2]];
+		triangles[x] = {v0, v1 - v0, v2 - v0};
+	}
+}
+
+bool Bvh::intersect(const Ray& ray, RayHit& hit) const {
+	if (nodes.empty()) {
+		return false;
+	}
+
+	glm::vec3 inverseDirection = safeInverse(ray.direction);
+	float tMax = ray.tMax;
+	bool found = false;
+
+	float tEntry;
+	if (!intersectBounds(nodes[0], ray.origin, inverseDirection, ray.tMin, tMax, tEntry)) {
+		return false;
+	}
+
+	uint32_t stack[BVH_STACK_SIZE];
+	uint32_t stackSize = 0;
+	uint32_t nodeIndex = 0;
+	while (true) {
+		const BvhNode& node = nodes[nodeIndex];
+		if (node.triangleCount > 0) {
+			for (uint32_t x = node.leftFirst; x < node.leftFirst + node.triangleCount; x++) {
+				float t, u, v;
+				if (intersectTriangle(triangles[x], ray, tMax, t, u, v)) {
+					tMax = t;
+					hit.t = t;
+					hit.u = u;
+					hit.v = v;
+					hit.triangle = triangleIndices[x];
+					found = true;
+				}
+			}
+		} else {
+			// visit the nearer child first, the other one is pushed and culled against the shrunken tMax later
+			uint32_t near = node.leftFirst;
+			uint32_t far = node.leftFirst + 1;
+			float tNear, tFar;
+			bool hitNear = intersectBounds(nodes[near], ray.origin, inverseDirection, ray.tMin, tMax, tNear);
+			bool hitFar = intersectBounds(nodes[far], ray.origin, inverseDirection, ray.tMin, tMax, tFar);
+			if (hitNear && hitFar) {
+				if (tFar < tNear) {
+					std::swap(near, far);
+				}
+				stack[stackSize++] = far;
+				nodeIndex = near;
+				continue;
+			}
+			if (hitNear || hitFar) {
+				nodeIndex = hitNear ? near : far;
+				continue;
+			}
+		}
+
+		bool popped = false;
+		while (stackSize > 0) {
+			nodeIndex = stack[--stackSize];
+			if (intersectBounds(nodes[nodeIndex], ray.origin, inverseDirection, ray.tMin, tMax, tEntry)) {
+				popped = true;
+				break;
+			}
+		}
+		if (!popped) {
+			break;
+		}
+	}
+
+	return found;
+}
+
+bool Bvh::occluded(const Ray& ray) const {
+	if (nodes.empty()) {
+		return false;
+	}
+
+	glm::vec3 inverseDirection = safeInverse(ray.direction);
+
+	uint32_t stack[BVH_STACK_SIZE];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0) {
+		const BvhNode& node = nodes[stack[--stackSize]];
+
+		float tEntry;
+		if (!intersectBounds(node, ray.origin, inverseDirection, ray.tMin, ray.tMax, tEntry)) {
+			continue;
+		}
+
+		if (node.triangleCount > 0) {
+			for (uint32_t x = node.leftFirst; x < node.leftFirst + node.triangleCount; x++) {
+				float t, u, v;
+				if (intersectTriangle(triangles[x], ray, ray.tMax, t, u, v)) {
+					return true;
+				}
+			}
+		} else {
+			stack[stackSize++] = node.leftFirst + 1;
+			stack[stackSize++] = node.leftFirst;
+		}
+	}
+
+	return false;
+}
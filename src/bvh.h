@@ -0,0 +1,110 @@
+#pragma once
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Binned SAH build parameters. Leaves are only forced once the tree gets deeper than
+// BVH_MAX_DEPTH, which also bounds the traversal stack.
+#define BVH_BIN_COUNT 16
+#define BVH_MAX_LEAF_SIZE 4
+#define BVH_MAX_DEPTH 60
+#define BVH_STACK_SIZE 64
+#define BVH_INVALID_INDEX 0xffffffffu
+
+struct Ray {
+	glm::vec3 origin;
+	glm::vec3 direction;
+	float tMin = 0.0f;
+	float tMax = FLT_MAX;
+};
+
+struct RayHit {
+	float t = FLT_MAX;
+	float u = 0.0f;
+	float v = 0.0f;
+	uint32_t triangle = BVH_INVALID_INDEX;
+};
+
+// 32 bytes, two nodes per cache line. Inner nodes store the index of their left child,
+// the right child follows it. Leaves store their first triangle and a non-zero count.
+struct BvhNode {
+	glm::vec3 boundsMin;
+	uint32_t leftFirst;
+	glm::vec3 boundsMax;
+	uint32_t triangleCount;
+};
+
+// precomputed for Moller-Trumbore
+struct BvhTriangle {
+	glm::vec3 v0;
+	glm::vec3 edge1;
+	glm::vec3 edge2;
+};
+
+// shared by Bvh and Bvh4
+
+inline float surfaceArea(const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+	glm::vec3 extent = boundsMax - boundsMin;
+	return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+inline bool intersectTriangle(const BvhTriangle& triangle, const Ray& ray, float tMax, float& t, float& u, float& v) {
+	glm::vec3 p = glm::cross(ray.direction, triangle.edge2);
+	float determinant = glm::dot(triangle.edge1, p);
+	if (std::fabs(determinant) < 1e-12f) {
+		return false;
+	}
+
+	float inverseDeterminant = 1.0f / determinant;
+	glm::vec3 s = ray.origin - triangle.v0;
+	u = glm::dot(s, p) * inverseDeterminant;
+	if (u < 0.0f || u > 1.0f) {
+		return false;
+	}
+
+	glm::vec3 q = glm::cross(s, triangle.edge1);
+	v = glm::dot(ray.direction, q) * inverseDeterminant;
+	if (v < 0.0f || u + v > 1.0f) {
+		return false;
+	}
+
+	t = glm::dot(triangle.edge2, q) * inverseDeterminant;
+	return t >= ray.tMin && t < tMax;
+}
+
+// axis aligned rays would divide by zero, a huge value keeps the slab test NaN free
+inline glm::vec3 safeInverse(const glm::vec3& direction) {
+	glm::vec3 inverse;
+	for (int x = 0; x < 3; x++) {
+		inverse[x] = std::fabs(direction[x]) > 1e-20f ? 1.0f / direction[x] : std::copysign(1e20f, direction[x]);
+	}
+	return inverse;
+}
+
+class Bvh {
+private:
+	std::vector<BvhNode> nodes;
+	std::vector<BvhTriangle> triangles;
+	std::vector<uint32_t> triangleIndices;
+
+public:
+	// Builds over triangleCount triangles given as three indices each into positions.
+	void build(const glm::vec3* positions, const uint32_t* indices, uint32_t triangleCount);
+
+	// Closest hit in [ray.tMin, ray.tMax]. hit.triangle is the index of the triangle as passed to build().
+	bool intersect(const Ray& ray, RayHit& hit) const;
+	// Any hit in [ray.tMin, ray.tMax], for shadow rays.
+	bool occluded(const Ray& ray) const;
+
+	const std::vector<BvhNode>& getNodes() const { return nodes; }
+	const std::vector<BvhTriangle>& getTriangles() const { return triangles; }
+	const std::vector<uint32_t>& getTriangleIndices() const { return triangleIndices; }
+
+	size_t nodeCount() const { return nodes.size(); }
+	size_t triangleCount() const { return triangles.size(); }
+	glm::vec3 boundsMin() const { return nodes.empty() ? glm::vec3(0.0f) : nodes[0].boundsMin; }
+	glm::vec3 boundsMax() const { return nodes.empty() ? glm::vec3(0.0f) : nodes[0].boundsMax; }
+};
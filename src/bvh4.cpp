@@ -0,0 +1,529 @@
+#include "bvh4.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+// one float per child of a node
+typedef __m128 Bvh4Lanes;
+
+static inline Bvh4Lanes splatLanes(float value) {
+	return _mm_set1_ps(value);
+}
+#else
+struct Bvh4Lanes {
+	float lane[4];
+};
+
+static inline Bvh4Lanes splatLanes(float value) {
+	return {{value, value, value, value}};
+}
+#endif
+
+struct Bvh4BuildTask {
+	uint32_t node;
+	uint32_t source;
+};
+
+struct Bvh4StackEntry {
+	uint32_t node;
+	float tEntry;
+};
+
+// A ray of a stream in the form intersectChildren() takes it, set up once per traversal.
+struct Bvh4StreamRay {
+	Bvh4Lanes origin[3];
+	Bvh4Lanes inverseDirection[3];
+	Bvh4Lanes tMin;
+};
+
+// A node and the rays that reach it, rayCount ids from first on in the ray list.
+struct Bvh4StreamEntry {
+	uint32_t node;
+	uint32_t first;
+	uint32_t rayCount;
+};
+
+// slab test of one ray against the four children, returns a bit per child that is hit
+#if defined(__SSE2__)
+static inline uint32_t intersectChildren(const Bvh4Node& node, const Bvh4Lanes origin[3], const Bvh4Lanes inverseDirection[3], Bvh4Lanes tMin, Bvh4Lanes tMax, float* tEntry) {
+	__m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.boundsMinX), origin[0]), inverseDirection[0]);
+	__m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.boundsMinY), origin[1]), inverseDirection[1]);
+	__m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.boundsMinZ), origin[2]), inverseDirection[2]);
+	__m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.boundsMaxX), origin[0]), inverseDirection[0]);
+	__m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.boundsMaxY), origin[1]), inverseDirection[1]);
+	__m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.boundsMaxZ), origin[2]), inverseDirection[2]);
+
+	__m128 tNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_max_ps(_mm_min_ps(t0z, t1z), tMin));
+	__m128 tFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_min_ps(_mm_max_ps(t0z, t1z), tMax));
+	_mm_store_ps(tEntry, tNear);
+
+	__m128i unused = _mm_cmpeq_epi32(_mm_load_si128(reinterpret_cast<const __m128i*>(node.child)), _mm_set1_epi32(-1));
+	return static_cast<uint32_t>(_mm_movemask_ps(_mm_andnot_ps(_mm_castsi128_ps(unused), _mm_cmple_ps(tNear, tFar))));
+}
+#else
+// the operand order of _mm_min_ps and _mm_max_ps, so NaNs resolve the same way
+static inline float laneMin(float a, float b) {
+	return a < b ? a : b;
+}
+
+static inline float laneMax(float a, float b) {
+	return a > b ? a : b;
+}
+
+static inline uint32_t intersectChildren(const Bvh4Node& node, const Bvh4Lanes origin[3], const Bvh4Lanes inverseDirection[3], Bvh4Lanes tMin, Bvh4Lanes tMax, float* tEntry) {
+	uint32_t mask = 0;
+	for (uint32_t x = 0; x < 4; x++) {
+		float t0x = (node.boundsMinX[x] - origin[0].lane[x]) * inverseDirection[0].lane[x];
+		float t0y = (node.boundsMinY[x] - origin[1].lane[x]) * inverseDirection[1].lane[x];
+		float t0z = (node.boundsMinZ[x] - origin[2].lane[x]) * inverseDirection[2].lane[x];
+		float t1x = (node.boundsMaxX[x] - origin[0].lane[x]) * inverseDirection[0].lane[x];
+		float t1y = (node.boundsMaxY[x] - origin[1].lane[x]) * inverseDirection[1].lane[x];
+		float t1z = (node.boundsMaxZ[x] - origin[2].lane[x]) * inverseDirection[2].lane[x];
+
+		float tNear = laneMax(laneMax(laneMin(t0x, t1x), laneMin(t0y, t1y)), laneMax(laneMin(t0z, t1z), tMin.lane[x]));
+		float tFar = laneMin(laneMin(laneMax(t0x, t1x), laneMax(t0y, t1y)), laneMin(laneMax(t0z, t1z), tMax.lane[x]));
+		tEntry[x] = tNear;
+		if (node.child[x] != UINT32_MAX && tNear <= tFar) {
+			mask |= 1u << x;
+		}
+	}
+	return mask;
+}
+#endif
+
+// Walks nodes once for count rays. tMax holds the far distance of every ray, leaf(ray, firstTriangle,
+// triangleCount) tests one ray against a leaf and may shrink it; rays whose tMax drops below tMin drop
+// out of the stream.
+template <class Leaf>
+static void traverseStream(const std::vector<Bvh4Node>& nodes, const Ray* rays, float* tMax, uint32_t count, Leaf leaf) {
+	std::vector<Bvh4StreamRay> streamRays(count);
+	std::vector<uint32_t> rayList(count);
+	for (uint32_t x = 0; x < count; x++) {
+		glm::vec3 inverse = safeInverse(rays[x].direction);
+		Bvh4StreamRay& streamRay = streamRays[x];
+		streamRay.origin[0] = splatLanes(rays[x].origin.x);
+		streamRay.origin[1] = splatLanes(rays[x].origin.y);
+		streamRay.origin[2] = splatLanes(rays[x].origin.z);
+		streamRay.inverseDirection[0] = splatLanes(inverse.x);
+		streamRay.inverseDirection[1] = splatLanes(inverse.y);
+		streamRay.inverseDirection[2] = splatLanes(inverse.z);
+		streamRay.tMin = splatLanes(rays[x].tMin);
+		rayList[x] = x;
+	}
+
+	// the rays of every child of the current node, count apart
+	std::vector<uint32_t> childRays(4 * static_cast<size_t>(count));
+
+	// the lists of the entries on the stack lie back to back in rayList, the top one last
+	Bvh4StreamEntry stack[BVH4_STACK_SIZE];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = {0, 0, count};
+	while (stackSize > 0) {
+		Bvh4StreamEntry entry = stack[--stackSize];
+		const Bvh4Node& node = nodes[entry.node];
+
+		uint32_t childCount[4] = {0, 0, 0, 0};
+		float childEntry[4] = {FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX};
+		for (uint32_t x = entry.first; x < entry.first + entry.rayCount; x++) {
+			uint32_t ray = rayList[x];
+			if (tMax[ray] < rays[ray].tMin) {
+				continue;
+			}
+
+			const Bvh4StreamRay& streamRay = streamRays[ray];
+			alignas(16) float tEntry[4];
+			uint32_t mask = intersectChildren(node, streamRay.origin, streamRay.inverseDirection, streamRay.tMin, splatLanes(tMax[ray]), tEntry);
+			for (uint32_t y = 0; y < 4; y++) {
+				if (mask & (1u << y)) {
+					childRays[y * count + childCount[y]++] = ray;
+					childEntry[y] = std::min(childEntry[y], tEntry[y]);
+				}
+			}
+		}
+
+		// leaves are tested right away to shrink tMax, inner children are pushed far to near by their
+		// nearest entry over the stream
+		Bvh4StackEntry inner[4];
+		uint32_t innerCount = 0;
+		for (uint32_t x = 0; x < 4; x++) {
+			if (childCount[x] == 0) {
+				continue;
+			}
+
+			if (node.triangleCount[x] > 0) {
+				for (uint32_t y = 0; y < childCount[x]; y++) {
+					leaf(childRays[x * count + y], node.child[x], node.triangleCount[x]);
+				}
+			} else {
+				uint32_t y = innerCount++;
+				for (; y > 0 && inner[y - 1].tEntry < childEntry[x]; y--) {
+					inner[y] = inner[y - 1];
+				}
+				// node holds the child slot here
+				inner[y] = {x, childEntry[x]};
+			}
+		}
+
+		// the popped list is dead, the children's lists take its place
+		uint32_t first = entry.first;
+		for (uint32_t x = 0; x < innerCount; x++) {
+			uint32_t child = inner[x].node;
+			if (rayList.size() < first + childCount[child]) {
+				rayList.resize(first + childCount[child]);
+			}
+			std::copy(&childRays[child * count], &childRays[child * count] + childCount[child], &rayList[first]);
+			stack[stackSize++] = {node.child[child], first, childCount[child]};
+			first += childCount[child];
+		}
+	}
+}
+
+void Bvh4::build(const Bvh& bvh) {
+	const std::vector<BvhNode>& binaryNodes = bvh.getNodes();
+	nodes.clear();
+	triangles = bvh.getTriangles();
+	triangleIndices = bvh.getTriangleIndices();
+	if (binaryNodes.empty()) {
+		return;
+	}
+
+	nodes.reserve(binaryNodes.size() / 2 + 1);
+	nodes.push_back({});
+
+	std::vector<Bvh4BuildTask> stack;
+	stack.push_back({0, 0});
+	while (!stack.empty()) {
+		Bvh4BuildTask task = stack.back();
+		stack.pop_back();
+
+		// pull grandchildren up by opening the largest inner child until there are four
+		uint32_t children[4];
+		uint32_t childCount = 0;
+		const BvhNode& source = binaryNodes[task.source];
+		if (source.triangleCount > 0) {
+			children[childCount++] = task.source;
+		} else {
+			children[childCount++] = source.leftFirst;
+			children[childCount++] = source.leftFirst + 1;
+		}
+		while (childCount < 4) {
+			int largest = -1;
+			float largestArea = -1.0f;
+			for (uint32_t x = 0; x < childCount; x++) {
+				const BvhNode& child = binaryNodes[children[x]];
+				float area = surfaceArea(child.boundsMin, child.boundsMax);
+				if (child.triangleCount == 0 && area > largestArea) {
+					largest = static_cast<int>(x);
+					largestArea = area;
+				}
+			}
+			if (largest < 0) {
+				break;
+			}
+
+			uint32_t opened = children[largest];
+			children[largest] = binaryNodes[opened].leftFirst;
+			children[childCount++] = binaryNodes[opened].leftFirst + 1;
+		}
+
+		Bvh4Node node = {};
+		for (uint32_t x = 0; x < 4; x++) {
+			if (x >= childCount) {
+				node.child[x] = BVH_INVALID_INDEX;
+				continue;
+			}
+
+			const BvhNode& child = binaryNodes[children[x]];
+			node.boundsMinX[x] = child.boundsMin.x;
+			node.boundsMinY[x] = child.boundsMin.y;
+			node.boundsMinZ[x] = child.boundsMin.z;
+			node.boundsMaxX[x] = child.boundsMax.x;
+			node.boundsMaxY[x] = child.boundsMax.y;
+			node.boundsMaxZ[x] = child.boundsMax.z;
+			if (child.triangleCount > 0) {
+				node.child[x] = child.leftFirst;
+				node.triangleCount[x] = child.triangleCount;
+			} else {
+				node.child[x] = static_cast<uint32_t>(nodes.size());
+				nodes.push_back({});
+				stack.push_back({node.child[x], children[x]});
+			}
+		}
+		nodes[task.node] = node;
+	}
+}
+
+bool Bvh4::intersect(const Ray& ray, RayHit& hit) const {
+	if (nodes.empty()) {
+		return false;
+	}
+
+	glm::vec3 inverse = safeInverse(ray.direction);
+	Bvh4Lanes origin[3] = {splatLanes(ray.origin.x), splatLanes(ray.origin.y), splatLanes(ray.origin.z)};
+	Bvh4Lanes inverseDirection[3] = {splatLanes(inverse.x), splatLanes(inverse.y), splatLanes(inverse.z)};
+	Bvh4Lanes tMin = splatLanes(ray.tMin);
+	float tMax = ray.tMax;
+	bool found = false;
+
+	Bvh4StackEntry stack[BVH4_STACK_SIZE];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = {0, ray.tMin};
+	while (stackSize > 0) {
+		Bvh4StackEntry entry = stack[--stackSize];
+		if (entry.tEntry > tMax) {
+			continue;
+		}
+
+		const Bvh4Node& node = nodes[entry.node];
+		alignas(16) float tEntry[4];
+		uint32_t mask = intersectChildren(node, origin, inverseDirection, tMin, splatLanes(tMax), tEntry);
+
+		// leaves are tested right away to shrink tMax, inner children are pushed far to near
+		Bvh4StackEntry inner[4];
+		uint32_t innerCount = 0;
+		for (uint32_t x = 0; x < 4; x++) {
+			if ((mask & (1u << x)) == 0) {
+				continue;
+			}
+
+			if (node.triangleCount[x] > 0) {
+				for (uint32_t y = node.child[x]; y < node.child[x] + node.triangleCount[x]; y++) {
+					float t, u, v;
+					if (intersectTriangle(triangles[y], ray, tMax, t, u, v)) {
+						tMax = t;
+						hit.t = t;
+						hit.u = u;
+						hit.v = v;
+						hit.triangle = triangleIndices[y];
+						found = true;
+					}
+				}
+			} else {
+				uint32_t y = innerCount++;
+				for (; y > 0 && inner[y - 1].tEntry < tEntry[x]; y--) {
+					inner[y] = inner[y - 1];
+				}
+				inner[y] = {node.child[x], tEntry[x]};
+			}
+		}
+		for (uint32_t x = 0; x < innerCount; x++) {
+			stack[stackSize++] = inner[x];
+		}
+	}
+
+	return found;
+}
+
+bool Bvh4::occluded(const Ray& ray) const {
+	if (nodes.empty()) {
+		return false;
+	}
+
+	glm::vec3 inverse = safeInverse(ray.direction);
+	Bvh4Lanes origin[3] = {splatLanes(ray.origin.x), splatLanes(ray.origin.y), splatLanes(ray.origin.z)};
+	Bvh4Lanes inverseDirection[3] = {splatLanes(inverse.x), splatLanes(inverse.y), splatLanes(inverse.z)};
+	Bvh4Lanes tMin = splatLanes(ray.tMin);
+	Bvh4Lanes tMax = splatLanes(ray.tMax);
+
+	uint32_t stack[BVH4_STACK_SIZE];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0) {
+		const Bvh4Node& node = nodes[stack[--stackSize]];
+		alignas(16) float tEntry[4];
+		uint32_t mask = intersectChildren(node, origin, inverseDirection, tMin, tMax, tEntry);
+
+		for (uint32_t x = 0; x < 4; x++) {
+			if ((mask & (1u << x)) == 0) {
+				continue;
+			}
+
+			if (node.triangleCount[x] > 0) {
+				for (uint32_t y = node.child[x]; y < node.child[x] + node.triangleCount[x]; y++) {
+					float t, u, v;
+					if (intersectTriangle(triangles[y], ray, ray.tMax, t, u, v)) {
+						return true;
+					}
+				}
+			} else {
+				stack[stackSize++] = node.child[x];
+			}
+		}
+	}
+
+	return false;
+}
+
+uint32_t Bvh4::intersectStream(const Ray* rays, RayHit* hits, uint32_t count) const {
+	if (nodes.empty() || count == 0) {
+		return 0;
+	}
+
+	std::vector<float> tMax(count);
+	for (uint32_t x = 0; x < count; x++) {
+		tMax[x] = rays[x].tMax;
+	}
+
+	traverseStream(nodes, rays, tMax.data(), count, [&](uint32_t ray, uint32_t firstTriangle, uint32_t triangleCount) {
+		for (uint32_t y = firstTriangle; y < firstTriangle + triangleCount; y++) {
+			float t, u, v;
+			if (intersectTriangle(triangles[y], rays[ray], tMax[ray], t, u, v)) {
+				tMax[ray] = t;
+				hits[ray].t = t;
+				hits[ray].u = u;
+				hits[ray].v = v;
+				hits[ray].triangle = triangleIndices[y];
+			}
+		}
+	});
+
+	uint32_t hitCount = 0;
+	for (uint32_t x = 0; x < count; x++) {
+		hitCount += tMax[x] < rays[x].tMax ? 1 : 0;
+	}
+	return hitCount;
+}
+
+uint32_t Bvh4::occludedStream(const Ray* rays, bool* occluded, uint32_t count) const {
+	std::fill(occluded, occluded + count, false);
+	if (nodes.empty() || count == 0) {
+		return 0;
+	}
+
+	// an occluded ray gets a tMax below its tMin, which takes it out of the stream
+	std::vector<float> tMax(count);
+	for (uint32_t x = 0; x < count; x++) {
+		tMax[x] = rays[x].tMax;
+	}
+
+	uint32_t occludedCount = 0;
+	traverseStream(nodes, rays, tMax.data(), count, [&](uint32_t ray, uint32_t firstTriangle, uint32_t triangleCount) {
+		for (uint32_t y = firstTriangle; y < firstTriangle + triangleCount && !occluded[ray]; y++) {
+			float t, u, v;
+			if (intersectTriangle(triangles[y], rays[ray], rays[ray].tMax, t, u, v)) {
+				occluded[ray] = true;
+				tMax[ray] = -FLT_MAX;
+				occludedCount++;
+			}
+		}
+	});
+	return occludedCount;
+}
+
+uint32_t Bvh4::intersectPacket(const RayPacket& packet, RayPacketHit& hit) const {
+	for (int x = 0; x < SIMD_WIDTH; x++) {
+		hit.t[x] = FLT_MAX;
+		hit.u[x] = 0.0f;
+		hit.v[x] = 0.0f;
+		hit.triangle[x] = BVH_INVALID_INDEX;
+	}
+	if (nodes.empty()) {
+		return 0;
+	}
+
+	alignas(64) float inverseX[SIMD_WIDTH];
+	alignas(64) float inverseY[SIMD_WIDTH];
+	alignas(64) float inverseZ[SIMD_WIDTH];
+	for (int x = 0; x < SIMD_WIDTH; x++) {
+		glm::vec3 inverse = safeInverse(glm::vec3(packet.directionX[x], packet.directionY[x], packet.directionZ[x]));
+		inverseX[x] = inverse.x;
+		inverseY[x] = inverse.y;
+		inverseZ[x] = inverse.z;
+	}
+
+	SimdVec3 origin = {simdLoad(packet.originX), simdLoad(packet.originY), simdLoad(packet.originZ)};
+	SimdVec3 direction = {simdLoad(packet.directionX), simdLoad(packet.directionY), simdLoad(packet.directionZ)};
+	SimdVec3 inverseDirection = {simdLoad(inverseX), simdLoad(inverseY), simdLoad(inverseZ)};
+	// the slab distances become bounds * inverse - origin * inverse, one multiply fewer per plane
+	SimdVec3 scaledOrigin = {simdMul(origin.x, inverseDirection.x), simdMul(origin.y, inverseDirection.y), simdMul(origin.z, inverseDirection.z)};
+	SimdFloat tMin = simdLoad(packet.tMin);
+	SimdFloat tMax = simdLoad(packet.tMax);
+	SimdFloat hitU = simdSet1(0.0f);
+	SimdFloat hitV = simdSet1(0.0f);
+	uint32_t hitBits = 0;
+
+	uint32_t stack[BVH4_STACK_SIZE];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0) {
+		const Bvh4Node& node = nodes[stack[--stackSize]];
+
+		Bvh4StackEntry inner[4];
+		uint32_t innerCount = 0;
+		for (uint32_t x = 0; x < 4; x++) {
+			if (node.child[x] == BVH_INVALID_INDEX) {
+				continue;
+			}
+
+			SimdFloat t0x = simdSub(simdMul(simdSet1(node.boundsMinX[x]), inverseDirection.x), scaledOrigin.x);
+			SimdFloat t0y = simdSub(simdMul(simdSet1(node.boundsMinY[x]), inverseDirection.y), scaledOrigin.y);
+			SimdFloat t0z = simdSub(simdMul(simdSet1(node.boundsMinZ[x]), inverseDirection.z), scaledOrigin.z);
+			SimdFloat t1x = simdSub(simdMul(simdSet1(node.boundsMaxX[x]), inverseDirection.x), scaledOrigin.x);
+			SimdFloat t1y = simdSub(simdMul(simdSet1(node.boundsMaxY[x]), inverseDirection.y), scaledOrigin.y);
+			SimdFloat t1z = simdSub(simdMul(simdSet1(node.boundsMaxZ[x]), inverseDirection.z), scaledOrigin.z);
+			SimdFloat tNear = simdMax(simdMax(simdMin(t0x, t1x), simdMin(t0y, t1y)), simdMax(simdMin(t0z, t1z), tMin));
+			SimdFloat tFar = simdMin(simdMin(simdMax(t0x, t1x), simdMax(t0y, t1y)), simdMin(simdMax(t0z, t1z), tMax));
+			SimdMask active = simdLessEqual(tNear, tFar);
+			if (simdMaskBits(active) == 0) {
+				continue;
+			}
+
+			if (node.triangleCount[x] == 0) {
+				// order by the nearest entry of any ray in the packet
+				float tEntry = simdReduceMin(simdSelect(active, tNear, simdSet1(FLT_MAX)));
+				uint32_t y = innerCount++;
+				for (; y > 0 && inner[y - 1].tEntry < tEntry; y--) {
+					inner[y] = inner[y - 1];
+				}
+				inner[y] = {node.child[x], tEntry};
+				continue;
+			}
+
+			for (uint32_t y = node.child[x]; y < node.child[x] + node.triangleCount[x]; y++) {
+				const BvhTriangle& triangle = triangles[y];
+				SimdVec3 edge1 = simdSet1(triangle.edge1.x, triangle.edge1.y, triangle.edge1.z);
+				SimdVec3 edge2 = simdSet1(triangle.edge2.x, triangle.edge2.y, triangle.edge2.z);
+
+				SimdVec3 p = simdCross(direction, edge2);
+				SimdFloat determinant = simdDot(edge1, p);
+				SimdFloat inverseDeterminant = simdDiv(simdSet1(1.0f), determinant);
+				SimdVec3 s = simdSub(origin, simdSet1(triangle.v0.x, triangle.v0.y, triangle.v0.z));
+				SimdFloat u = simdMul(simdDot(s, p), inverseDeterminant);
+				SimdVec3 q = simdCross(s, edge1);
+				SimdFloat v = simdMul(simdDot(direction, q), inverseDeterminant);
+				SimdFloat t = simdMul(simdDot(edge2, q), inverseDeterminant);
+
+				// same acceptance as intersectTriangle(), inactive lanes fail the t < tMax test
+				SimdMask accepted = simdGreaterEqual(simdAbs(determinant), simdSet1(1e-12f));
+				accepted = simdAnd(accepted, simdAnd(simdGreaterEqual(u, simdSet1(0.0f)), simdLessEqual(u, simdSet1(1.0f))));
+				accepted = simdAnd(accepted, simdAnd(simdGreaterEqual(v, simdSet1(0.0f)), simdLessEqual(simdAdd(u, v), simdSet1(1.0f))));
+				accepted = simdAnd(accepted, simdAnd(simdGreaterEqual(t, tMin), simdLess(t, tMax)));
+				uint32_t acceptedBits = simdMaskBits(accepted);
+				if (acceptedBits == 0) {
+					continue;
+				}
+
+				tMax = simdSelect(accepted, t, tMax);
+				hitU = simdSelect(accepted, u, hitU);
+				hitV = simdSelect(accepted, v, hitV);
+				hitBits |= acceptedBits;
+				for (int lane = 0; lane < SIMD_WIDTH; lane++) {
+					if (acceptedBits & (1u << lane)) {
+						hit.triangle[lane] = triangleIndices[y];
+					}
+				}
+			}
+		}
+		for (uint32_t x = 0; x < innerCount; x++) {
+			stack[stackSize++] = inner[x].node;
+		}
+	}
+
+	SimdMask hitMask = simdMaskFromBits(hitBits);
+	simdStore(hit.t, simdSelect(hitMask, tMax, simdSet1(FLT_MAX)));
+	simdStore(hit.u, hitU);
+	simdStore(hit.v, hitV);
+	return hitBits;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "bvh.h"
+#include "simd.h"
+
+// Every node can push up to three children, once per level of the collapsed tree.
+#define BVH4_STACK_SIZE (BVH_MAX_DEPTH * 3 + 4)
+
+// 128 bytes, two cache lines. The bounds of the four children are stored per axis so one
+// SSE compare tests all of them. Leaf children store their first triangle in child and a
+// non-zero triangleCount, inner children their node index and a zero count. Unused slots
+// have child set to BVH_INVALID_INDEX.
+struct alignas(16) Bvh4Node {
+	float boundsMinX[4];
+	float boundsMinY[4];
+	float boundsMinZ[4];
+	float boundsMaxX[4];
+	float boundsMaxY[4];
+	float boundsMaxZ[4];
+	uint32_t child[4];
+	uint32_t triangleCount[4];
+};
+
+// SIMD_WIDTH rays in structure of arrays form. Lanes with tMax < tMin are inactive.
+struct alignas(64) RayPacket {
+	float originX[SIMD_WIDTH];
+	float originY[SIMD_WIDTH];
+	float originZ[SIMD_WIDTH];
+	float directionX[SIMD_WIDTH];
+	float directionY[SIMD_WIDTH];
+	float directionZ[SIMD_WIDTH];
+	float tMin[SIMD_WIDTH];
+	float tMax[SIMD_WIDTH];
+};
+
+struct alignas(64) RayPacketHit {
+	float t[SIMD_WIDTH];
+	float u[SIMD_WIDTH];
+	float v[SIMD_WIDTH];
+	uint32_t triangle[SIMD_WIDTH];
+};
+
+// Four wide BVH collapsed from a binary Bvh. Single rays test four boxes at once. Incoherent
+// rays are traced as a stream that walks the tree once, carrying the list of rays still active
+// at every node; coherent rays can instead be traced as a packet that shares one traversal over
+// SIMD_WIDTH rays.
+class Bvh4 {
+private:
+	std::vector<Bvh4Node> nodes;
+	std::vector<BvhTriangle> triangles;
+	std::vector<uint32_t> triangleIndices;
+
+public:
+	void build(const Bvh& bvh);
+
+	// Same results as Bvh::intersect() and Bvh::occluded().
+	bool intersect(const Ray& ray, RayHit& hit) const;
+	bool occluded(const Ray& ray) const;
+
+	// One traversal per packet. Returns a bit per lane that hit something.
+	uint32_t intersectPacket(const RayPacket& packet, RayPacketHit& hit) const;
+
+	// One traversal for count rays, with the same results as intersect() and occluded() on
+	// every ray. Each node is fetched once for all the rays that reach it and splits their
+	// list between its children. Return how many rays hit something / are occluded.
+	uint32_t intersectStream(const Ray* rays, RayHit* hits, uint32_t count) const;
+	uint32_t occludedStream(const Ray* rays, bool* occluded, uint32_t count) const;
+
+	size_t nodeCount() const { return nodes.size(); }
+};
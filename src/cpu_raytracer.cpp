@@ -0,0 +1,223 @@
+#include "cpu_raytracer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include "parallel.h"
+
+#define CPU_RAYTRACER_TILE_SIZE 16
+#define CPU_RAYTRACER_TILE_PIXELS (CPU_RAYTRACER_TILE_SIZE * CPU_RAYTRACER_TILE_SIZE)
+
+static const char* traversalModeName(TraversalMode mode) {
+	switch (mode) {
+	case TRAVERSAL_SINGLE:
+		return "single";
+	case TRAVERSAL_STREAM:
+		return "stream";
+	default:
+		return "packet";
+	}
+}
+
+// Consecutive rays go into one packet; the lanes past count are left inactive.
+static void tracePackets(const Bvh4& bvh, const Ray* rays, RayHit* hits, uint32_t count) {
+	RayPacket packet;
+	RayPacketHit packetHit;
+	for (uint32_t first = 0; first < count; first += SIMD_WIDTH) {
+		for (uint32_t x = 0; x < SIMD_WIDTH; x++) {
+			const Ray& ray = rays[std::min(first + x, count - 1)];
+			packet.originX[x] = ray.origin.x;
+			packet.originY[x] = ray.origin.y;
+			packet.originZ[x] = ray.origin.z;
+			packet.directionX[x] = ray.direction.x;
+			packet.directionY[x] = ray.direction.y;
+			packet.directionZ[x] = ray.direction.z;
+			packet.tMin[x] = ray.tMin;
+			packet.tMax[x] = first + x < count ? ray.tMax : -1.0f;
+		}
+
+		bvh.intersectPacket(packet, packetHit);
+
+		for (uint32_t x = 0; x < SIMD_WIDTH && first + x < count; x++) {
+			RayHit& hit = hits[first + x];
+			hit.t = packetHit.t[x];
+			hit.u = packetHit.u[x];
+			hit.v = packetHit.v[x];
+			hit.triangle = packetHit.triangle[x];
+		}
+	}
+}
+
+void CpuRayTracer::build() {
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	bvh.build(positions.data(), indices.data(), static_cast<uint32_t>(indices.size() / 3));
+	wideBvh.build(bvh);
+
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+	std::cout << "Built BVH over " << bvh.triangleCount() << " triangles (" << bvh.nodeCount() << " nodes, " << wideBvh.nodeCount() << " wide nodes) in " << elapsed.count() << " ms" << std::endl;
+}
+
+CpuCamera CpuRayTracer::fitCamera(float fovY) const {
+	glm::vec3 boundsMin = bvh.boundsMin();
+	glm::vec3 boundsMax = bvh.boundsMax();
+	glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+	float radius = std::max(glm::length(boundsMax - boundsMin) * 0.5f, 1e-3f);
+
+	CpuCamera camera;
+	camera.fovY = fovY;
+	camera.target = center;
+	camera.position = center + glm::normalize(glm::vec3(0.0f, 0.3f, 1.0f)) * (radius / std::sin(glm::radians(fovY) * 0.5f));
+	return camera;
+}
+
+bool CpuRayTracer::shade(const Ray& ray, const RayHit& hit, glm::vec3& albedo, float& diffuse, Ray& shadowRay) const {
+	uint32_t i0 = indices[hit.triangle * 3 + 0];
+	uint32_t i1 = indices[hit.triangle * 3 + 1];
+	uint32_t i2 = indices[hit.triangle * 3 + 2];
+
+	glm::vec3 geometricNormal = glm::cross(positions[i1] - positions[i0], positions[i2] - positions[i0]);
+	geometricNormal = glm::normalize(geometricNormal);
+	if (glm::dot(geometricNormal, ray.direction) > 0.0f) {
+		geometricNormal = -geometricNormal;
+	}
+
+	// fall back to the face normal where the mesh has no usable vertex normals
+	glm::vec3 normal = normals[i0] * (1.0f - hit.u - hit.v) + normals[i1] * hit.u + normals[i2] * hit.v;
+	float normalLength = glm::length(normal);
+	normal = normalLength > 1e-6f ? normal / normalLength : geometricNormal;
+	if (glm::dot(normal, geometricNormal) < 0.0f) {
+		normal = -normal;
+	}
+
+	albedo = glm::vec3(0.7f);
+	int material = triangleMaterials[hit.triangle];
+	if (material >= 0 && material < static_cast<int>(materials.size())) {
+		albedo = materials[material].diffuse;
+	}
+
+	glm::vec3 light = glm::normalize(lightDirection);
+	diffuse = std::max(glm::dot(normal, light), 0.0f);
+	if (diffuse <= 0.0f) {
+		return false;
+	}
+
+	// offset along the face normal, scaled with the scene, so the shadow ray does not hit its own triangle
+	float epsilon = 1e-4f * glm::length(bvh.boundsMax() - bvh.boundsMin());
+	shadowRay.origin = ray.origin + ray.direction * hit.t + geometricNormal * epsilon;
+	shadowRay.direction = light;
+	return true;
+}
+
+CpuRenderStats CpuRayTracer::render(const CpuCamera& camera, uint32_t width, uint32_t height, std::vector<uint8_t>& rgba, unsigned int threadCount) const {
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	rgba.assign(static_cast<size_t>(width) * height * 4, 0);
+
+	glm::vec3 forward = glm::normalize(camera.target - camera.position);
+	glm::vec3 right = glm::normalize(glm::cross(forward, camera.up));
+	glm::vec3 up = glm::cross(right, forward);
+	float tanHalfFov = std::tan(glm::radians(camera.fovY) * 0.5f);
+	float aspect = static_cast<float>(width) / static_cast<float>(height);
+
+	uint32_t tilesX = (width + CPU_RAYTRACER_TILE_SIZE - 1) / CPU_RAYTRACER_TILE_SIZE;
+	uint32_t tilesY = (height + CPU_RAYTRACER_TILE_SIZE - 1) / CPU_RAYTRACER_TILE_SIZE;
+
+	// per tile counters, summed afterwards instead of sharing an atomic
+	std::vector<uint64_t> tileShadowRays(tilesX * tilesY, 0);
+
+	parallelFor(tilesX * tilesY, threadCount, [&](size_t tile) {
+		uint32_t startX = static_cast<uint32_t>(tile % tilesX) * CPU_RAYTRACER_TILE_SIZE;
+		uint32_t startY = static_cast<uint32_t>(tile / tilesX) * CPU_RAYTRACER_TILE_SIZE;
+		uint32_t endX = std::min(startX + CPU_RAYTRACER_TILE_SIZE, width);
+		uint32_t endY = std::min(startY + CPU_RAYTRACER_TILE_SIZE, height);
+
+		uint32_t tileWidth = endX - startX;
+		uint32_t pixelCount = tileWidth * (endY - startY);
+
+		Ray rays[CPU_RAYTRACER_TILE_PIXELS];
+		for (uint32_t y = startY; y < endY; y++) {
+			for (uint32_t x = startX; x < endX; x++) {
+				float px = (2.0f * (x + 0.5f) / width - 1.0f) * aspect * tanHalfFov;
+				float py = (1.0f - 2.0f * (y + 0.5f) / height) * tanHalfFov;
+
+				Ray& ray = rays[(y - startY) * tileWidth + (x - startX)];
+				ray.origin = camera.position;
+				ray.direction = glm::normalize(forward + right * px + up * py);
+			}
+		}
+
+		RayHit hits[CPU_RAYTRACER_TILE_PIXELS];
+		if (traversalMode == TRAVERSAL_PACKET) {
+			tracePackets(wideBvh, rays, hits, pixelCount);
+		} else if (traversalMode == TRAVERSAL_STREAM) {
+			wideBvh.intersectStream(rays, hits, pixelCount);
+		} else {
+			for (uint32_t x = 0; x < pixelCount; x++) {
+				bvh.intersect(rays[x], hits[x]);
+			}
+		}
+
+		// shadow rays scatter with the surface they start on, too incoherent for packets
+		glm::vec3 albedo[CPU_RAYTRACER_TILE_PIXELS];
+		float diffuse[CPU_RAYTRACER_TILE_PIXELS];
+		Ray shadowRays[CPU_RAYTRACER_TILE_PIXELS];
+		uint32_t shadowPixels[CPU_RAYTRACER_TILE_PIXELS];
+		uint32_t shadowRayCount = 0;
+		for (uint32_t x = 0; x < pixelCount; x++) {
+			if (hits[x].triangle == BVH_INVALID_INDEX) {
+				continue;
+			}
+			if (shade(rays[x], hits[x], albedo[x], diffuse[x], shadowRays[shadowRayCount])) {
+				shadowPixels[shadowRayCount++] = x;
+			}
+		}
+		bool occluded[CPU_RAYTRACER_TILE_PIXELS];
+		if (traversalMode == TRAVERSAL_SINGLE) {
+			for (uint32_t x = 0; x < shadowRayCount; x++) {
+				occluded[x] = bvh.occluded(shadowRays[x]);
+			}
+		} else {
+			wideBvh.occludedStream(shadowRays, occluded, shadowRayCount);
+		}
+		for (uint32_t x = 0; x < shadowRayCount; x++) {
+			if (occluded[x]) {
+				diffuse[shadowPixels[x]] = 0.0f;
+			}
+		}
+
+		for (uint32_t y = startY; y < endY; y++) {
+			for (uint32_t x = startX; x < endX; x++) {
+				uint32_t index = (y - startY) * tileWidth + (x - startX);
+				glm::vec3 color = backgroundColor;
+				if (hits[index].triangle != BVH_INVALID_INDEX) {
+					color = albedo[index] * (0.15f + 0.85f * diffuse[index]);
+				}
+
+				uint8_t* pixel = &rgba[(static_cast<size_t>(y) * width + x) * 4];
+				for (int c = 0; c < 3; c++) {
+					float srgb = std::pow(std::min(std::max(color[c], 0.0f), 1.0f), 1.0f / 2.2f);
+					pixel[c] = static_cast<uint8_t>(srgb * 255.0f + 0.5f);
+				}
+				pixel[3] = 255;
+			}
+		}
+		tileShadowRays[tile] = shadowRayCount;
+	});
+
+	CpuRenderStats stats;
+	stats.primaryRays = static_cast<uint64_t>(width) * height;
+	for (uint64_t shadowRays : tileShadowRays) {
+		stats.shadowRays += shadowRays;
+	}
+
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+	stats.milliseconds = elapsed.count();
+
+	uint64_t rays = stats.primaryRays + stats.shadowRays;
+	std::cout << "Traced (" << traversalModeName(traversalMode) << ") " << stats.primaryRays << " primary and " << stats.shadowRays << " shadow rays in " << stats.milliseconds << " ms (" << rays / (stats.milliseconds * 1000.0) << " Mrays/s)" << std::endl;
+
+	return stats;
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+#include "bvh4.h"
+#include "obj_loader.h"
+
+struct CpuCamera {
+	glm::vec3 position;
+	glm::vec3 target;
+	glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f);
+	float fovY = 45.0f;
+};
+
+// How render() traces its rays. SINGLE walks the binary BVH one ray at a time. STREAM traces
+// the primary and the shadow rays of a tile as two streams through the four wide BVH, each
+// walking the tree once with the list of rays that reach every node. PACKET traces primary
+// rays as SIMD_WIDTH wide packets and shadow rays as a stream, since only primary rays are
+// coherent enough to share a traversal.
+enum TraversalMode {
+	TRAVERSAL_SINGLE,
+	TRAVERSAL_STREAM,
+	TRAVERSAL_PACKET
+};
+
+struct CpuRenderStats {
+	uint64_t primaryRays = 0;
+	uint64_t shadowRays = 0;
+	double milliseconds = 0.0;
+};
+
+// Ray caster that needs no ray tracing hardware, used as a reference for the GPU path and
+// as a fallback renderer. Every pixel casts one primary ray, every hit one shadow ray
+// towards a directional light.
+class CpuRayTracer {
+private:
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> normals;
+	std::vector<uint32_t> indices;
+	std::vector<int> triangleMaterials;
+	std::vector<MatrialObj> materials;
+	Bvh bvh;
+	Bvh4 wideBvh;
+
+	// Returns true if the hit needs a shadow ray, diffuse is the unshadowed light.
+	bool shade(const Ray& ray, const RayHit& hit, glm::vec3& albedo, float& diffuse, Ray& shadowRay) const;
+
+public:
+	glm::vec3 lightDirection = glm::vec3(0.42f, 0.84f, 0.34f);
+	glm::vec3 backgroundColor = glm::vec3(0.1f, 0.1f, 0.15f);
+	TraversalMode traversalMode = TRAVERSAL_PACKET;
+
+	// Appends a mesh placed with transform, the same way a GeometryInstance places it. triangleMaterialIds
+	// holds the material of every triangle.
+	template <class TVert>
+	void addInstance(const TVert* vertices, uint32_t vertexCount, const uint32_t* instanceIndices, uint32_t indexCount, const int32_t* triangleMaterialIds, const glm::mat4& transform);
+	void setMaterials(const std::vector<MatrialObj>& materialList) { materials = materialList; }
+
+	// Builds both BVHs over everything added so far, call it before render().
+	void build();
+
+	// Looks at the whole scene from the front and slightly above.
+	CpuCamera fitCamera(float fovY = 45.0f) const;
+
+	// Renders into tightly packed RGBA8 pixels on threadCount threads (0 = all cores).
+	CpuRenderStats render(const CpuCamera& camera, uint32_t width, uint32_t height, std::vector<uint8_t>& rgba, unsigned int threadCount = 0) const;
+};
+
+template <class TVert>
+void CpuRayTracer::addInstance(const TVert* vertices, uint32_t vertexCount, const uint32_t* instanceIndices, uint32_t indexCount, const int32_t* triangleMaterialIds, const glm::mat4& transform) {
+	uint32_t baseVertex = static_cast<uint32_t>(positions.size());
+	glm::mat4 normalTransform = glm::transpose(glm::inverse(transform));
+
+	for (uint32_t x = 0; x < vertexCount; x++) {
+		positions.push_back(glm::vec3(transform * glm::vec4(vertices[x].pos, 1.0f)));
+		normals.push_back(glm::vec3(normalTransform * glm::vec4(vertices[x].nrm, 0.0f)));
+	}
+
+	for (uint32_t x = 0; x + 2 < indexCount; x += 3) {
+		indices.push_back(baseVertex + instanceIndices[x + 0]);
+		indices.push_back(baseVertex + instanceIndices[x + 1]);
+		indices.push_back(baseVertex + instanceIndices[x + 2]);
+		triangleMaterials.push_back(triangleMaterialIds[x / 3]);
+	}
+}
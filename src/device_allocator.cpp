@@ -0,0 +1,582 @@
+#include "device_allocator.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+static uint32_t ceilLog2(VkDeviceSize value) {
+	uint32_t order = 0;
+	while ((VkDeviceSize(1) << order) < value) {
+		order++;
+	}
+	return order;
+}
+
+uint32_t findMemoryTypeIndex(const VkPhysicalDeviceMemoryProperties& memoryProperties, uint32_t typeBits, VkMemoryPropertyFlags properties) {
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+		if ((typeBits & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+			return i;
+		}
+	}
+	return DEVICE_ALLOCATOR_NO_MEMORY_TYPE;
+}
+
+void BuddyAllocator::init(VkDeviceSize size, VkDeviceSize minSize) {
+	minOrder = ceilLog2(minSize);
+	maxOrder = ceilLog2(size);
+	freeLists.assign(maxOrder - minOrder + 1, std::set<VkDeviceSize>());
+	freeLists[maxOrder - minOrder].insert(0);
+	allocatedOrders.clear();
+	usedBytes = 0;
+}
+
+bool BuddyAllocator::allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset) {
+	uint32_t order = std::max(minOrder, ceilLog2(std::max(size, alignment)));
+	if (order > maxOrder) {
+		return false;
+	}
+
+	uint32_t available = order;
+	while (available <= maxOrder && freeLists[available - minOrder].empty()) {
+		available++;
+	}
+	if (available > maxOrder) {
+		return false;
+	}
+
+	std::set<VkDeviceSize>& freeList = freeLists[available - minOrder];
+	offset = *freeList.begin();
+	freeList.erase(freeList.begin());
+
+	// keep the lower half at every split, the upper halves become free pieces
+	while (available > order) {
+		available--;
+		freeLists[available - minOrder].insert(offset + (VkDeviceSize(1) << available));
+	}
+
+	allocatedOrders[offset] = order;
+	usedBytes += VkDeviceSize(1) << order;
+	return true;
+}
+
+void BuddyAllocator::free(VkDeviceSize offset) {
+	auto allocated = allocatedOrders.find(offset);
+	if (allocated == allocatedOrders.end()) {
+		return;
+	}
+
+	uint32_t order = allocated->second;
+	allocatedOrders.erase(allocated);
+	usedBytes -= VkDeviceSize(1) << order;
+
+	// merge with the buddy for as long as it is free too
+	while (order < maxOrder) {
+		VkDeviceSize buddy = offset ^ (VkDeviceSize(1) << order);
+		std::set<VkDeviceSize>& freeList = freeLists[order - minOrder];
+		auto free = freeList.find(buddy);
+		if (free == freeList.end()) {
+			break;
+		}
+		freeList.erase(free);
+		offset = std::min(offset, buddy);
+		order++;
+	}
+	freeLists[order - minOrder].insert(offset);
+}
+
+VkDeviceSize BuddyAllocator::getAllocationSize(VkDeviceSize offset) const {
+	auto allocated = allocatedOrders.find(offset);
+	return allocated == allocatedOrders.end() ? 0 : VkDeviceSize(1) << allocated->second;
+}
+
+void DeviceAllocator::create(VkDevice device, const VkPhysicalDeviceMemoryProperties& memoryProperties, VkDeviceSize blockSize, const DeviceAllocatorFunctions& functions) {
+	this->device = device;
+	this->memoryProperties = memoryProperties;
+	this->functions = functions;
+
+	blockSize = VkDeviceSize(1) << ceilLog2(blockSize);
+	pools.clear();
+	pools.resize(memoryProperties.memoryTypeCount * DEVICE_RESOURCE_KIND_COUNT);
+	for (uint32_t x = 0; x < memoryProperties.memoryTypeCount; x++) {
+		// small heaps such as the host visible part of VRAM get smaller blocks
+		VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[x].heapIndex].size;
+		VkDeviceSize poolBlockSize = blockSize;
+		while (poolBlockSize > 1024 * 1024 && poolBlockSize > heapSize / 8) {
+			poolBlockSize /= 2;
+		}
+
+		for (uint32_t kind = 0; kind < DEVICE_RESOURCE_KIND_COUNT; kind++) {
+			pools[x * DEVICE_RESOURCE_KIND_COUNT + kind].memoryType = x;
+			pools[x * DEVICE_RESOURCE_KIND_COUNT + kind].blockSize = poolBlockSize;
+		}
+	}
+}
+
+void DeviceAllocator::destroy() {
+	for (auto& pool : pools) {
+		for (uint32_t x = 0; x < pool.blocks.size(); x++) {
+			if (pool.blocks[x]) {
+				releaseBlock(pool, x);
+			}
+		}
+	}
+	for (const auto& dedicated : dedicatedAllocations) {
+		functions.freeMemory(device, dedicated.first, nullptr);
+	}
+	dedicatedAllocations.clear();
+	pools.clear();
+}
+
+uint8_t* DeviceAllocator::mapIfHostVisible(VkDeviceMemory memory, uint32_t memoryType, VkDeviceSize size) {
+	if ((memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == 0) {
+		return nullptr;
+	}
+
+	void* data;
+	if (functions.mapMemory(device, memory, 0, size, 0, &data) != VK_SUCCESS) {
+		throw std::runtime_error("failed to map device memory!");
+	}
+	return static_cast<uint8_t*>(data);
+}
+
+VkDeviceMemory DeviceAllocator::allocateMemory(uint32_t memoryType, VkDeviceSize size) {
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryType;
+
+	VkDeviceMemory memory;
+	if (functions.allocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+		throw std::runtime_error("failed to allocate device memory!");
+	}
+	return memory;
+}
+
+void DeviceAllocator::allocateFromPool(uint32_t poolIndex, VkDeviceSize size, VkDeviceSize alignment, void* userData, DeviceAllocation& allocation) {
+	Pool& pool = pools[poolIndex];
+
+	uint32_t blockIndex = 0;
+	VkDeviceSize offset = 0;
+	for (; blockIndex < pool.blocks.size(); blockIndex++) {
+		if (pool.blocks[blockIndex] && pool.blocks[blockIndex]->space.allocate(size, alignment, offset)) {
+			break;
+		}
+	}
+
+	if (blockIndex == pool.blocks.size()) {
+		std::unique_ptr<Block> block(new Block);
+		block->memory = allocateMemory(pool.memoryType, pool.blockSize);
+		block->mapped = mapIfHostVisible(block->memory, pool.memoryType, pool.blockSize);
+		block->space.init(pool.blockSize, DEVICE_ALLOCATOR_MIN_ALLOCATION);
+		block->space.allocate(size, alignment, offset);
+
+		// reuse the slot of a released block if there is one
+		blockIndex = 0;
+		while (blockIndex < pool.blocks.size() && pool.blocks[blockIndex]) {
+			blockIndex++;
+		}
+		if (blockIndex == pool.blocks.size()) {
+			pool.blocks.push_back(nullptr);
+		}
+		pool.blocks[blockIndex] = std::move(block);
+	}
+
+	Block& block = *pool.blocks[blockIndex];
+	block.allocations[offset] = {size, userData};
+
+	allocation.memory = block.memory;
+	allocation.offset = offset;
+	allocation.size = size;
+	allocation.mapped = block.mapped ? block.mapped + offset : nullptr;
+	allocation.pool = poolIndex;
+	allocation.block = blockIndex;
+	allocation.userData = userData;
+}
+
+void DeviceAllocator::releaseBlock(Pool& pool, uint32_t blockIndex) {
+	// freeing mapped memory unmaps it
+	functions.freeMemory(device, pool.blocks[blockIndex]->memory, nullptr);
+	pool.blocks[blockIndex].reset();
+}
+
+DeviceAllocation DeviceAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, DeviceResourceKind kind, void* userData) {
+	uint32_t memoryType = findMemoryTypeIndex(memoryProperties, requirements.memoryTypeBits, properties);
+	if (memoryType == DEVICE_ALLOCATOR_NO_MEMORY_TYPE) {
+		throw std::runtime_error("failed to find suitable memory type!");
+	}
+
+	DeviceAllocation allocation;
+	uint32_t poolIndex = memoryType * DEVICE_RESOURCE_KIND_COUNT + kind;
+	if (requirements.size < pools[poolIndex].blockSize / 2 && requirements.alignment <= pools[poolIndex].blockSize) {
+		allocateFromPool(poolIndex, requirements.size, requirements.alignment, userData, allocation);
+		return allocation;
+	}
+
+	allocation.memory = allocateMemory(memoryType, requirements.size);
+	allocation.size = requirements.size;
+	allocation.mapped = mapIfHostVisible(allocation.memory, memoryType, requirements.size);
+	allocation.userData = userData;
+	dedicatedAllocations[allocation.memory] = {requirements.size, userData};
+	return allocation;
+}
+
+void DeviceAllocator::free(DeviceAllocation& allocation) {
+	if (allocation.memory == VK_NULL_HANDLE) {
+		return;
+	}
+
+	if (allocation.pool == DEVICE_ALLOCATOR_DEDICATED) {
+		functions.freeMemory(device, allocation.memory, nullptr);
+		dedicatedAllocations.erase(allocation.memory);
+		allocation = DeviceAllocation();
+		return;
+	}
+
+	Pool& pool = pools[allocation.pool];
+	Block& block = *pool.blocks[allocation.block];
+	block.space.free(allocation.offset);
+	block.allocations.erase(allocation.offset);
+
+	// keep one empty block around so a free followed by an allocate does not hit the driver
+	if (block.space.isEmpty()) {
+		uint32_t blockCount = 0;
+		for (const auto& other : pool.blocks) {
+			blockCount += other ? 1 : 0;
+		}
+		if (blockCount > 1) {
+			releaseBlock(pool, allocation.block);
+		}
+	}
+	allocation = DeviceAllocation();
+}
+
+uint32_t DeviceAllocator::defragment(const std::function<bool(const DeviceAllocation& from, const DeviceAllocation& to)>& move) {
+	uint32_t moved = 0;
+	for (uint32_t poolIndex = 0; poolIndex < pools.size(); poolIndex++) {
+		Pool& pool = pools[poolIndex];
+
+		std::vector<uint32_t> order;
+		for (uint32_t x = 0; x < pool.blocks.size(); x++) {
+			if (pool.blocks[x]) {
+				order.push_back(x);
+			}
+		}
+		if (order.size() < 2) {
+			continue;
+		}
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+			return pool.blocks[a]->space.getUsedBytes() < pool.blocks[b]->space.getUsedBytes();
+		});
+
+		// empty blocks from the front of the order into the fuller ones behind them; a block that
+		// took allocations in stays put, otherwise they could move twice
+		std::vector<bool> received(order.size(), false);
+		for (uint32_t source = 0; source + 1 < order.size(); source++) {
+			if (received[source]) {
+				continue;
+			}
+			Block& sourceBlock = *pool.blocks[order[source]];
+			std::map<VkDeviceSize, LiveAllocation> allocations = sourceBlock.allocations;
+
+			for (const auto& live : allocations) {
+				// the piece size is a power of two at least as large as the original alignment
+				VkDeviceSize pieceSize = sourceBlock.space.getAllocationSize(live.first);
+
+				// fullest blocks first, so the fewest blocks end up taking allocations in
+				for (uint32_t target = static_cast<uint32_t>(order.size()) - 1; target > source; target--) {
+					Block& targetBlock = *pool.blocks[order[target]];
+					VkDeviceSize offset;
+					if (!targetBlock.space.allocate(pieceSize, pieceSize, offset)) {
+						continue;
+					}
+
+					DeviceAllocation from;
+					from.memory = sourceBlock.memory;
+					from.offset = live.first;
+					from.size = live.second.size;
+					from.mapped = sourceBlock.mapped ? sourceBlock.mapped + live.first : nullptr;
+					from.pool = poolIndex;
+					from.block = order[source];
+					from.userData = live.second.userData;
+
+					DeviceAllocation to = from;
+					to.memory = targetBlock.memory;
+					to.offset = offset;
+					to.mapped = targetBlock.mapped ? targetBlock.mapped + offset : nullptr;
+					to.block = order[target];
+
+					if (!move(from, to)) {
+						targetBlock.space.free(offset);
+						break;
+					}
+
+					targetBlock.allocations[offset] = live.second;
+					received[target] = true;
+					sourceBlock.space.free(live.first);
+					sourceBlock.allocations.erase(live.first);
+					moved++;
+					break;
+				}
+			}
+
+			if (sourceBlock.space.isEmpty()) {
+				releaseBlock(pool, order[source]);
+			}
+		}
+	}
+	return moved;
+}
+
+DeviceAllocatorStats DeviceAllocator::getStats() const {
+	DeviceAllocatorStats stats;
+	for (const auto& pool : pools) {
+		for (const auto& block : pool.blocks) {
+			if (!block) {
+				continue;
+			}
+			stats.blockCount++;
+			stats.reservedBytes += block->space.getSize();
+			stats.usedBytes += block->space.getUsedBytes();
+			for (const auto& live : block->allocations) {
+				stats.allocationCount++;
+				stats.requestedBytes += live.second.size;
+			}
+		}
+	}
+	for (const auto& dedicated : dedicatedAllocations) {
+		stats.dedicatedCount++;
+		stats.allocationCount++;
+		stats.reservedBytes += dedicated.second.size;
+		stats.usedBytes += dedicated.second.size;
+		stats.requestedBytes += dedicated.second.size;
+	}
+	return stats;
+}
+
+// The made up device checkDeviceAllocator() runs against. Memory handles are counters, mapping hands out
+// host memory of the allocation's size.
+struct MockDeviceMemory {
+	uint32_t memoryType;
+	VkDeviceSize size;
+	std::vector<uint8_t> host;
+};
+
+static std::map<VkDeviceMemory, MockDeviceMemory> mockMemory;
+static uint64_t mockNextMemory = 1;
+static uint32_t mockAllocationCount = 0;
+static uint32_t mockBadFreeCount = 0;
+
+static VkResult mockAllocateMemory(VkDevice, const VkMemoryAllocateInfo* allocateInfo, const VkAllocationCallbacks*, VkDeviceMemory* memory) {
+	*memory = (VkDeviceMemory)(uintptr_t)mockNextMemory++;
+	mockMemory[*memory] = {allocateInfo->memoryTypeIndex, allocateInfo->allocationSize, std::vector<uint8_t>()};
+	mockAllocationCount++;
+	return VK_SUCCESS;
+}
+
+static void mockFreeMemory(VkDevice, VkDeviceMemory memory, const VkAllocationCallbacks*) {
+	mockBadFreeCount += mockMemory.erase(memory) == 0 ? 1 : 0;
+}
+
+static VkResult mockMapMemory(VkDevice, VkDeviceMemory memory, VkDeviceSize offset, VkDeviceSize, VkFlags, void** data) {
+	auto mock = mockMemory.find(memory);
+	if (mock == mockMemory.end()) {
+		return VK_ERROR_MEMORY_MAP_FAILED;
+	}
+	mock->second.host.resize(mock->second.size);
+	*data = mock->second.host.data() + offset;
+	return VK_SUCCESS;
+}
+
+// Whether the allocations stay inside their memory and none of them overlap.
+static bool allocationsDisjoint(std::vector<DeviceAllocation> allocations) {
+	std::sort(allocations.begin(), allocations.end(), [](const DeviceAllocation& a, const DeviceAllocation& b) {
+		return a.memory != b.memory ? a.memory < b.memory : a.offset < b.offset;
+	});
+	for (size_t x = 0; x < allocations.size(); x++) {
+		auto mock = mockMemory.find(allocations[x].memory);
+		if (mock == mockMemory.end() || allocations[x].offset + allocations[x].size > mock->second.size) {
+			return false;
+		}
+		if (x > 0 && allocations[x - 1].memory == allocations[x].memory && allocations[x - 1].offset + allocations[x - 1].size > allocations[x].offset) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool checkDeviceAllocator(std::string& failure) {
+	mockMemory.clear();
+	mockAllocationCount = 0;
+	mockBadFreeCount = 0;
+	failure.clear();
+	auto expect = [&](bool condition, const char* check) {
+		if (!condition && failure.empty()) {
+			failure = check;
+		}
+	};
+
+	// a discrete GPU: VRAM, system memory, a 256 MB host visible window into VRAM and cached system memory
+	VkPhysicalDeviceMemoryProperties memoryProperties = {};
+	memoryProperties.memoryHeapCount = 3;
+	memoryProperties.memoryHeaps[0].size = 8ull << 30;
+	memoryProperties.memoryHeaps[1].size = 16ull << 30;
+	memoryProperties.memoryHeaps[2].size = 256ull << 20;
+	memoryProperties.memoryTypeCount = 4;
+	memoryProperties.memoryTypes[0] = {VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0};
+	memoryProperties.memoryTypes[1] = {VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 1};
+	memoryProperties.memoryTypes[2] = {VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 2};
+	memoryProperties.memoryTypes[3] = {VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT, 1};
+
+	expect(findMemoryTypeIndex(memoryProperties, 0xf, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) == 0, "device local memory type");
+	expect(findMemoryTypeIndex(memoryProperties, 0xf, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == 1, "host visible memory type");
+	expect(findMemoryTypeIndex(memoryProperties, 0xd, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == 2, "memory type within typeBits");
+	expect(findMemoryTypeIndex(memoryProperties, 0xf, VK_MEMORY_PROPERTY_HOST_CACHED_BIT) == 3, "host cached memory type");
+	expect(findMemoryTypeIndex(memoryProperties, 0x3, VK_MEMORY_PROPERTY_HOST_CACHED_BIT) == DEVICE_ALLOCATOR_NO_MEMORY_TYPE, "no memory type");
+
+	DeviceAllocatorFunctions functions;
+	functions.allocateMemory = mockAllocateMemory;
+	functions.freeMemory = mockFreeMemory;
+	functions.mapMemory = mockMapMemory;
+	const VkMemoryPropertyFlags hostVisible = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+
+	// full sized blocks: the host visible window gets smaller ones, so less goes into it before it is dedicated
+	{
+		DeviceAllocator allocator;
+		allocator.create(VK_NULL_HANDLE, memoryProperties, DEVICE_ALLOCATOR_BLOCK_SIZE, functions);
+		DeviceAllocation pooled = allocator.allocate({20ull << 20, 256, 0x1}, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, DEVICE_RESOURCE_LINEAR);
+		DeviceAllocation large = allocator.allocate({40ull << 20, 256, 0x1}, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, DEVICE_RESOURCE_LINEAR);
+		DeviceAllocation window = allocator.allocate({20ull << 20, 256, 0x4}, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | hostVisible, DEVICE_RESOURCE_LINEAR);
+		expect(pooled.pool != DEVICE_ALLOCATOR_DEDICATED && mockMemory[pooled.memory].size == DEVICE_ALLOCATOR_BLOCK_SIZE, "pooled below half a block");
+		expect(large.pool == DEVICE_ALLOCATOR_DEDICATED && mockMemory[large.memory].size == large.size, "dedicated from half a block");
+		expect(window.pool == DEVICE_ALLOCATOR_DEDICATED && mockMemory[window.memory].memoryType == 2 && window.mapped != nullptr, "smaller blocks on a small heap");
+
+		bool threw = false;
+		try {
+			allocator.allocate({256, 256, 0x3}, VK_MEMORY_PROPERTY_HOST_CACHED_BIT, DEVICE_RESOURCE_LINEAR);
+		} catch (const std::runtime_error&) {
+			threw = true;
+		}
+		expect(threw, "allocating without a memory type throws");
+
+		allocator.free(pooled);
+		allocator.free(large);
+		allocator.free(window);
+		expect(allocator.getStats().allocationCount == 0 && allocator.getStats().dedicatedCount == 0, "freeing dedicated and pooled memory");
+		allocator.destroy();
+		expect(mockMemory.empty(), "destroy frees every block");
+	}
+
+	// 1 MB blocks for the rest, so the mapped mock memory stays small
+	const VkDeviceSize blockSize = 1 << 20;
+	DeviceAllocator allocator;
+	allocator.create(VK_NULL_HANDLE, memoryProperties, blockSize, functions);
+
+	// small resources share one block, aligned and without overlapping
+	mockAllocationCount = 0;
+	std::vector<DeviceAllocation> linear;
+	for (uint32_t x = 0; x < 200; x++) {
+		linear.push_back(allocator.allocate({1000, 256, 0xf}, hostVisible, DEVICE_RESOURCE_LINEAR));
+	}
+	bool oneBlock = mockAllocationCount == 1;
+	for (const DeviceAllocation& allocation : linear) {
+		oneBlock = oneBlock && allocation.memory == linear[0].memory && mockMemory[allocation.memory].memoryType == 1;
+		expect(allocation.offset % 256 == 0, "offsets keep the alignment");
+		expect(allocation.mapped == mockMemory[allocation.memory].host.data() + allocation.offset, "mapped pointers point at the offset");
+	}
+	expect(oneBlock, "small allocations share a block");
+	expect(allocationsDisjoint(linear), "allocations do not overlap");
+
+	// any size with any alignment up to a block
+	std::vector<DeviceAllocation> aligned;
+	for (VkDeviceSize size : {1ull, 300ull, 5000ull, 70000ull}) {
+		for (VkDeviceSize alignment : {1ull, 256ull, 4096ull, 65536ull}) {
+			DeviceAllocation allocation = allocator.allocate({size, alignment, 0xf}, hostVisible, DEVICE_RESOURCE_LINEAR);
+			expect(allocation.offset % alignment == 0, "offsets keep large alignments");
+			aligned.push_back(allocation);
+		}
+	}
+	std::vector<DeviceAllocation> all = linear;
+	all.insert(all.end(), aligned.begin(), aligned.end());
+	expect(allocationsDisjoint(all), "aligned allocations do not overlap");
+
+	// optimally tiled images never share a block with buffers and linear images
+	DeviceAllocation optimal = allocator.allocate({1000, 256, 0xf}, hostVisible, DEVICE_RESOURCE_OPTIMAL);
+	bool separate = optimal.pool != linear[0].pool;
+	for (const DeviceAllocation& allocation : all) {
+		separate = separate && allocation.memory != optimal.memory;
+	}
+	expect(separate, "linear and optimal resources use separate blocks");
+	DeviceAllocation dedicated = allocator.allocate({blockSize / 2, 256, 0xf}, hostVisible, DEVICE_RESOURCE_LINEAR);
+	expect(dedicated.pool == DEVICE_ALLOCATOR_DEDICATED && mockMemory[dedicated.memory].size == blockSize / 2, "half a block is dedicated");
+
+	DeviceAllocatorStats stats = allocator.getStats();
+	VkDeviceSize requested = optimal.size + dedicated.size;
+	for (const DeviceAllocation& allocation : all) {
+		requested += allocation.size;
+	}
+	expect(stats.allocationCount == all.size() + 2 && stats.dedicatedCount == 1 && stats.requestedBytes == requested, "stats count every allocation");
+	expect(stats.reservedBytes == (stats.blockCount * blockSize) + dedicated.size && stats.usedBytes >= stats.requestedBytes, "stats add up");
+
+	for (DeviceAllocation& allocation : all) {
+		allocator.free(allocation);
+	}
+	allocator.free(optimal);
+	allocator.free(dedicated);
+	expect(allocator.getStats().allocationCount == 0 && allocator.getStats().blockCount <= 2, "freeing keeps one empty block per pool");
+
+	// spread a third of the allocations over several blocks, each tagged with its index
+	struct Tracked {
+		DeviceAllocation allocation;
+		uint32_t value;
+	};
+	std::vector<Tracked> tracked(3000);
+	for (uint32_t x = 0; x < tracked.size(); x++) {
+		tracked[x].allocation = allocator.allocate({1000, 256, 0xf}, hostVisible, DEVICE_RESOURCE_LINEAR, &tracked[x]);
+		tracked[x].value = x;
+		memset(tracked[x].allocation.mapped, static_cast<int>(x & 0xff), 1000);
+	}
+	std::vector<Tracked*> kept;
+	for (uint32_t x = 0; x < tracked.size(); x++) {
+		if (x % 3 == 0) {
+			kept.push_back(&tracked[x]);
+		} else {
+			allocator.free(tracked[x].allocation);
+		}
+	}
+
+	// one allocation refuses to move and has to stay where it is
+	DeviceAllocation pinned = kept[0]->allocation;
+	uint32_t blocksBefore = allocator.getStats().blockCount;
+	uint32_t moved = allocator.defragment([&](const DeviceAllocation& from, const DeviceAllocation& to) {
+		Tracked* owner = static_cast<Tracked*>(from.userData);
+		if (owner == kept[0]) {
+			return false;
+		}
+		memcpy(to.mapped, from.mapped, from.size);
+		owner->allocation = to;
+		return true;
+	});
+	uint32_t blocksAfter = allocator.getStats().blockCount;
+	expect(moved > 0 && blocksAfter < blocksBefore, "defragment empties blocks");
+	expect(kept[0]->allocation.memory == pinned.memory && kept[0]->allocation.offset == pinned.offset, "refused moves stay put");
+
+	std::vector<DeviceAllocation> live;
+	bool intact = true;
+	for (Tracked* owner : kept) {
+		live.push_back(owner->allocation);
+		for (uint32_t x = 0; x < 1000 && owner->allocation.mapped; x++) {
+			intact = intact && owner->allocation.mapped[x] == static_cast<uint8_t>(owner->value & 0xff);
+		}
+	}
+	expect(intact, "moved allocations keep their contents");
+	expect(allocationsDisjoint(live), "moved allocations do not overlap");
+	expect(allocator.getStats().allocationCount == kept.size(), "defragment keeps every allocation");
+
+	for (Tracked* owner : kept) {
+		allocator.free(owner->allocation);
+	}
+	allocator.destroy();
+	expect(mockMemory.empty() && mockBadFreeCount == 0, "every block is freed once");
+	mockMemory.clear();
+	return failure.empty();
+}
@@ -0,0 +1,143 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// Blocks are split into power of two pieces no smaller than DEVICE_ALLOCATOR_MIN_ALLOCATION.
+// Resources of at least half a block get memory of their own instead.
+#define DEVICE_ALLOCATOR_BLOCK_SIZE (64ull * 1024 * 1024)
+#define DEVICE_ALLOCATOR_MIN_ALLOCATION 256
+#define DEVICE_ALLOCATOR_DEDICATED 0xffffffffu
+#define DEVICE_ALLOCATOR_NO_MEMORY_TYPE 0xffffffffu
+
+// Buffers and linear images may share a bufferImageGranularity page with each other but not
+// with optimally tiled images, so the two kinds are never placed in the same block.
+enum DeviceResourceKind {
+	DEVICE_RESOURCE_LINEAR = 0,
+	DEVICE_RESOURCE_OPTIMAL,
+	DEVICE_RESOURCE_KIND_COUNT
+};
+
+struct DeviceAllocation {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	// persistently mapped pointer to offset, null unless the memory is host visible
+	uint8_t* mapped = nullptr;
+
+	uint32_t pool = DEVICE_ALLOCATOR_DEDICATED;
+	uint32_t block = 0;
+	// handed back to defragment() callbacks so the owner can find its resource
+	void* userData = nullptr;
+};
+
+struct DeviceAllocatorStats {
+	uint32_t blockCount = 0;
+	uint32_t dedicatedCount = 0;
+	uint32_t allocationCount = 0;
+	// device memory taken from the driver
+	VkDeviceSize reservedBytes = 0;
+	// what the resources asked for, and what they occupy after rounding up to a power of two
+	VkDeviceSize requestedBytes = 0;
+	VkDeviceSize usedBytes = 0;
+
+	VkDeviceSize wastedBytes() const { return usedBytes - requestedBytes; }
+	VkDeviceSize freeBytes() const { return reservedBytes - usedBytes; }
+};
+
+// The Vulkan calls the allocator makes, replaceable so that it can run against a made up device.
+struct DeviceAllocatorFunctions {
+	PFN_vkAllocateMemory allocateMemory = vkAllocateMemory;
+	PFN_vkFreeMemory freeMemory = vkFreeMemory;
+	PFN_vkMapMemory mapMemory = vkMapMemory;
+};
+
+// First memory type allowed by typeBits that has all of properties, or DEVICE_ALLOCATOR_NO_MEMORY_TYPE.
+uint32_t findMemoryTypeIndex(const VkPhysicalDeviceMemoryProperties& memoryProperties, uint32_t typeBits, VkMemoryPropertyFlags properties);
+
+// Buddy placement inside one block, without any Vulkan calls. Every piece is aligned to its own
+// size, so alignment only has to be folded into the size that is rounded up.
+class BuddyAllocator {
+private:
+	uint32_t minOrder = 0;
+	uint32_t maxOrder = 0;
+	// free piece offsets per order, lowest first so allocations pack towards the start
+	std::vector<std::set<VkDeviceSize>> freeLists;
+	std::map<VkDeviceSize, uint32_t> allocatedOrders;
+	VkDeviceSize usedBytes = 0;
+
+public:
+	// size and minSize have to be powers of two.
+	void init(VkDeviceSize size, VkDeviceSize minSize);
+
+	bool allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+	void free(VkDeviceSize offset);
+
+	// size of the piece an allocation at offset occupies, 0 if there is none
+	VkDeviceSize getAllocationSize(VkDeviceSize offset) const;
+	VkDeviceSize getSize() const { return VkDeviceSize(1) << maxOrder; }
+	VkDeviceSize getUsedBytes() const { return usedBytes; }
+	bool isEmpty() const { return allocatedOrders.empty(); }
+};
+
+// Hands out device memory by sub-allocating large blocks, one pool of blocks per memory type
+// and resource kind. Keeps vkAllocateMemory calls far below maxMemoryAllocationCount.
+class DeviceAllocator {
+private:
+	struct LiveAllocation {
+		VkDeviceSize size;
+		void* userData;
+	};
+
+	struct Block {
+		VkDeviceMemory memory;
+		uint8_t* mapped;
+		BuddyAllocator space;
+		std::map<VkDeviceSize, LiveAllocation> allocations;
+	};
+
+	struct Pool {
+		uint32_t memoryType;
+		VkDeviceSize blockSize;
+		std::vector<std::unique_ptr<Block>> blocks;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	DeviceAllocatorFunctions functions;
+	std::vector<Pool> pools;
+	std::map<VkDeviceMemory, LiveAllocation> dedicatedAllocations;
+
+	uint8_t* mapIfHostVisible(VkDeviceMemory memory, uint32_t memoryType, VkDeviceSize size);
+	VkDeviceMemory allocateMemory(uint32_t memoryType, VkDeviceSize size);
+	void allocateFromPool(uint32_t poolIndex, VkDeviceSize size, VkDeviceSize alignment, void* userData, DeviceAllocation& allocation);
+	// Slots of released blocks stay empty so DeviceAllocation::block indices remain valid.
+	void releaseBlock(Pool& pool, uint32_t blockIndex);
+
+public:
+	void create(VkDevice device, const VkPhysicalDeviceMemoryProperties& memoryProperties, VkDeviceSize blockSize = DEVICE_ALLOCATOR_BLOCK_SIZE,
+		const DeviceAllocatorFunctions& functions = DeviceAllocatorFunctions());
+	void destroy();
+
+	DeviceAllocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, DeviceResourceKind kind, void* userData = nullptr);
+	void free(DeviceAllocation& allocation);
+
+	// Moves allocations out of the emptiest blocks into free space in fuller blocks of the same
+	// pool. move(from, to) has to copy the contents and bind a new resource to to, then return
+	// true; returning false leaves the allocation where it is. Blocks left empty are released.
+	// Returns how many allocations moved.
+	uint32_t defragment(const std::function<bool(const DeviceAllocation& from, const DeviceAllocation& to)>& move);
+
+	DeviceAllocatorStats getStats() const;
+};
+
+// Runs a DeviceAllocator against a made up memory properties table and checks type selection, placement,
+// alignment, the separation of linear and optimal resources, dedicated allocations and defragment().
+// Needs no device. Returns false with the first failed check in failure.
+bool checkDeviceAllocator(std::string& failure);
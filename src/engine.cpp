@@ -1,47 +1,184 @@
 #include "engine.h"
+#include "parallel.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <unordered_map>
+
 const int SCREENWIDTH = 1000;
 const int SCREENHEIGHT = 600;
 
+// what the engine shows without a scene manifest
+const char* const DEFAULT_MODEL_PATH = "res/models/13467_Cardigan_Welsh_Corgi_v1_L3.obj";
+
 const std::vector<const char*> instanceExtensions = {
 	VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME
 };
 
 const std::vector<const char*> deviceExtensions = {
-	VK_KHR_SWAPCHAIN_EXTENSION_NAME,
-	VK_NV_RAY_TRACING_EXTENSION_NAME,
 	VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME
 };
 
+// only needed when presenting to a window
+const std::vector<const char*> swapchainDeviceExtensions = {
+	VK_KHR_SWAPCHAIN_EXTENSION_NAME
+};
+
 const bool enableValidationLayers = true;
 const std::vector<const char*> validationLayers = {
 	"VK_LAYER_KHRONOS_validation"
 };
 
-void Engine::initialize() {
-	initializeWindow();
+static bool validationLayersAvailable() {
+	uint32_t layerCount = 0;
+	vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+	std::vector<VkLayerProperties> layers(layerCount);
+	vkEnumerateInstanceLayerProperties(&layerCount, layers.data());
+
+	for (const char* layerName : validationLayers) {
+		bool found = false;
+		for (const auto& layer : layers) {
+			if (strcmp(layerName, layer.layerName) == 0) {
+				found = true;
+				break;
+			}
+		}
+		if (!found) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool hasExtension(const std::vector<VkExtensionProperties>& extensions, const char* extensionName) {
+	for (const auto& extension : extensions) {
+		if (strcmp(extensionName, extension.extensionName) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool writePPM(const std::string& filename, uint32_t width, uint32_t height, const std::vector<uint8_t>& rgba) {
+	std::ofstream stream(filename, std::ios::binary | std::ios::trunc);
+	if (!stream) {
+		return false;
+	}
+
+	stream << "P6\n" << width << " " << height << "\n255\n";
+	std::vector<uint8_t> row(width * 3);
+	for (uint32_t y = 0; y < height; y++) {
+		const uint8_t* pixel = rgba.data() + static_cast<size_t>(y) * width * 4;
+		for (uint32_t x = 0; x < width; x++) {
+			row[x * 3 + 0] = pixel[x * 4 + 0];
+			row[x * 3 + 1] = pixel[x * 4 + 1];
+			row[x * 3 + 2] = pixel[x * 4 + 2];
+		}
+		stream.write(reinterpret_cast<const char*>(row.data()), row.size());
+	}
+	return static_cast<bool>(stream);
+}
+
+static std::string suffixedPath(const std::string& path, const char* suffix) {
+	std::string suffixed = path;
+	size_t extension = suffixed.find_last_of('.');
+	suffixed.insert(extension == std::string::npos ? suffixed.size() : extension, suffix);
+	return suffixed;
+}
+
+// PSNR of the RGB channels of b against a, infinite when they match.
+static double comparePixels(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b, int& maxDifference) {
+	maxDifference = 0;
+	double squaredError = 0.0;
+	for (size_t x = 0; x < a.size(); x++) {
+		if (x % 4 == 3) {
+			continue;
+		}
+		int difference = std::abs(static_cast<int>(a[x]) - static_cast<int>(b[x]));
+		maxDifference = std::max(maxDifference, difference);
+		squaredError += static_cast<double>(difference) * difference;
+	}
+	double meanSquaredError = squaredError / (a.size() / 4 * 3);
+	return meanSquaredError > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / meanSquaredError) : std::numeric_limits<double>::infinity();
+}
+
+void Engine::initialize(const EngineOptions& options) {
+	// a broken manifest fails before any window or device exists
+	SceneDescription scene;
+	if (options.scenePath.empty()) {
+		// the corgi is modeled Z up
+		scene = singleMeshScene(DEFAULT_MODEL_PATH, glm::rotate(glm::mat4(1.0f), glm::radians(270.0f), glm::vec3(1.0f, 0.0f, 0.0f)));
+	} else {
+		std::string error;
+		if (!loadSceneDescription(options.scenePath, scene, error)) {
+			throw std::runtime_error(error);
+		}
+	}
+
+	headless = options.headless;
+	singleQueue = options.singleQueue;
+	gpuMipmaps = options.gpuMipmaps;
+	textureCompression = options.textureCompression;
+	packedVertices = options.packedVertices;
+	streamingObj = options.streamingObj;
+	retainHostGeometry = options.referenceRenderer;
+
+	if (!headless) {
+		initializeWindow();
+	}
 	initializeInstance();
 	initializePhysicalDevice();
-	initializeSurface();
+	if (headless) {
+		initializeOffscreenFormat();
+	} else {
+		initializeSurface();
+	}
 	initializeLogicalDevice();
 	initializeCommandBuffers();
 	initializeDescriptorPool();
+	initializeDeviceAllocator();
+	initializeStagingRing();
+	initializeMipmapMode();
 
-	initializeSwapchain();
+	if (headless) {
+		initializeOffscreenImages();
+		initializeReadbackBuffers();
+	} else {
+		initializeSwapchain();
+	}
 	initializeRenderPass();
 	initializeImageViews();
 	initializeDepthResources();
 	initializeFrameBuffer();
 
-	initializeModel("res/models/13467_Cardigan_Welsh_Corgi_v1_L3.obj");
+	auto uploadStartTime = std::chrono::high_resolution_clock::now();
+	initializeScene(scene);
+	// everything recorded so far goes out in one submission, the rest of the setup overlaps with it
+	UploadTicket sceneUpload = uploadBatch.submit();
+
 	initializeDescriptorSetLayout();
 	initializeUniformBuffer();
 
 	initializeRayTracing();
-	initializeGeometryInstances();
+	initializeGeometryInstances(scene);
+
+	// the first frame reads what the scene uploaded
+	uploadBatch.wait(sceneUpload);
+	std::chrono::duration<double, std::milli> uploadTime = std::chrono::high_resolution_clock::now() - uploadStartTime;
+	const StagingRingStats& stagingStats = stagingRing.getStats();
+	std::cout << "Staged " << stagingStats.uploadedBytes / (1024.0 * 1024.0) << " MB in " << stagingStats.submissions << " submissions (" << stagingStats.stalls << " stalls), loaded in " << uploadTime.count() << " ms" << std::endl;
+	DeviceAllocatorStats memoryStats = deviceAllocator.getStats();
+	std::cout << "Device memory: " << memoryStats.allocationCount << " allocations in " << memoryStats.blockCount << " blocks and " << memoryStats.dedicatedCount << " dedicated allocations, "
+		<< memoryStats.reservedBytes / (1024.0 * 1024.0) << " MB reserved, " << memoryStats.usedBytes / (1024.0 * 1024.0) << " MB used, " << memoryStats.wastedBytes() / (1024.0 * 1024.0) << " MB wasted" << std::endl;
 }
 
 void Engine::initializeWindow() {
@@ -53,18 +190,29 @@ void Engine::initializeWindow() {
 }
 
 void Engine::initializeInstance() {
-	uint32_t glfwExtensionCount = 0;
-	const char** glfwExtensions;
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+	std::vector<const char*> extensions;
+	if (!headless) {
+		uint32_t glfwExtensionCount = 0;
+		const char** glfwExtensions;
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
-	std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+		extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+	}
 
 	for (int x = 0; x < instanceExtensions.size(); x++) {
 		extensions.push_back(instanceExtensions[x]);
 	}
 
-	if (enableValidationLayers) {
-		extensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
+	// CI machines and software drivers often come without the SDK layers
+	bool useValidationLayers = enableValidationLayers && validationLayersAvailable();
+	if (enableValidationLayers && !useValidationLayers) {
+		std::cerr << "validation layers requested, but not available" << std::endl;
+	}
+
+	if (useValidationLayers) {
+		if (!headless) {
+			extensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
+		}
 		extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
 	}
 
@@ -78,7 +226,7 @@ void Engine::initializeInstance() {
 	createInfo.enabledExtensionCount = extensions.size();
 	createInfo.ppEnabledExtensionNames = extensions.data();
 
-	if (enableValidationLayers) {
+	if (useValidationLayers) {
 		createInfo.enabledLayerCount = validationLayers.size();
 		createInfo.ppEnabledLayerNames = validationLayers.data();
 	} else {
@@ -93,6 +241,9 @@ void Engine::initializeInstance() {
 void Engine::initializePhysicalDevice() {
 	uint32_t deviceCount = 0;
 	vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+	if (deviceCount == 0) {
+		throw std::runtime_error("failed to find GPUs with Vulkan support!");
+	}
 	std::vector<VkPhysicalDevice> devices(deviceCount);
 	vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
 
@@ -100,24 +251,59 @@ void Engine::initializePhysicalDevice() {
 }
 
 void Engine::initializeLogicalDevice() {
-	graphicsQueueIndex = -1;
+	// UINT32_MAX until a family is found
+	graphicsQueueIndex = UINT32_MAX;
+	transferQueueIndex = UINT32_MAX;
 
 	uint32_t queueFamilyCount = 0;
 	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
 	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
 	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
 
-	for (int x = 0; x < queueFamilies.size(); x++) {
-		if (queueFamilies[x].queueCount > 0 && graphicsQueueIndex == -1 && queueFamilies[x].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+	for (uint32_t x = 0; x < queueFamilies.size(); x++) {
+		if (queueFamilies[x].queueCount > 0 && graphicsQueueIndex == UINT32_MAX && queueFamilies[x].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
 			graphicsQueueIndex = x;
 		}
+		// a family with nothing but transfer usually maps to the copy engines, which run beside rendering
+		if (queueFamilies[x].queueCount > 0 && transferQueueIndex == UINT32_MAX && (queueFamilies[x].queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT)) == VK_QUEUE_TRANSFER_BIT) {
+			transferQueueIndex = x;
+		}
+
+		if (!headless) {
+			VkBool32 presentSupport = false;
+			vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, x, surface, &presentSupport);
+		}
+	}
+
+	uint32_t availableExtensionCount = 0;
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &availableExtensionCount, nullptr);
+	std::vector<VkExtensionProperties> availableExtensions(availableExtensionCount);
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &availableExtensionCount, availableExtensions.data());
+
+	std::vector<const char*> extensions = deviceExtensions;
+	if (!headless) {
+		extensions.insert(extensions.end(), swapchainDeviceExtensions.begin(), swapchainDeviceExtensions.end());
+	}
+
+	// software implementations such as lavapipe have no ray tracing, everything else still works without it
+	rayTracingSupported = hasExtension(availableExtensions, VK_NV_RAY_TRACING_EXTENSION_NAME);
+	if (rayTracingSupported) {
+		extensions.push_back(VK_NV_RAY_TRACING_EXTENSION_NAME);
+	} else {
+		std::cout << VK_NV_RAY_TRACING_EXTENSION_NAME << " is not supported, ray tracing is disabled" << std::endl;
+	}
 
-		VkBool32 presentSupport = false;
-    	vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, x, surface, &presentSupport);
+	// without a transfer only family, or when asked to, uploads share the graphics queue
+	if (transferQueueIndex == UINT32_MAX || singleQueue) {
+		transferQueueIndex = graphicsQueueIndex;
 	}
+	std::cout << (transferQueueIndex != graphicsQueueIndex ? "Uploading on transfer queue family " : "Uploading on graphics queue family ") << transferQueueIndex << std::endl;
 
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 	std::vector<uint32_t> uniqueQueueFamilies = {graphicsQueueIndex};
+	if (transferQueueIndex != graphicsQueueIndex) {
+		uniqueQueueFamilies.push_back(transferQueueIndex);
+	}
 
 	float queuePriority = 1.0f;
 	for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -130,21 +316,33 @@ void Engine::initializeLogicalDevice() {
 		queueCreateInfos.push_back(queueCreateInfo);
 	}
 
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+
 	VkPhysicalDeviceFeatures deviceFeatures = {};
+	if (textureCompression != TEXTURE_COMPRESSION_NONE) {
+		if (supportedFeatures.textureCompressionBC) {
+			deviceFeatures.textureCompressionBC = VK_TRUE;
+		} else {
+			std::cout << "BC texture compression is not supported, textures are uploaded as RGBA8" << std::endl;
+			textureCompression = TEXTURE_COMPRESSION_NONE;
+		}
+	}
 
 	VkDeviceCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	createInfo.queueCreateInfoCount = queueCreateInfos.size();
 	createInfo.pQueueCreateInfos = queueCreateInfos.data();
 	createInfo.pEnabledFeatures = &deviceFeatures;
-	createInfo.enabledExtensionCount = deviceExtensions.size();
-	createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+	createInfo.enabledExtensionCount = extensions.size();
+	createInfo.ppEnabledExtensionNames = extensions.data();
 	createInfo.enabledLayerCount = 0;
 
 	if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &logicalDevice) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create logical device!");
 	}
 	vkGetDeviceQueue(logicalDevice, graphicsQueueIndex, 0, &graphicsQueue);
+	vkGetDeviceQueue(logicalDevice, transferQueueIndex, 0, &transferQueue);
 }
 
 void Engine::initializeSurface() {
@@ -260,13 +458,39 @@ void Engine::initializeDescriptorPool() {
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
 	poolInfo.maxSets = 1000;
-	poolInfo.poolSizeCount = _countof(poolSize);
+	poolInfo.poolSizeCount = sizeof(poolSize) / sizeof(poolSize[0]);
 	poolInfo.pPoolSizes = poolSize;
 	if (vkCreateDescriptorPool(logicalDevice, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create descriptor pool!");
 	}
 }
 
+void Engine::initializeDeviceAllocator() {
+	VkPhysicalDeviceMemoryProperties memProperties;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+	deviceAllocator.create(logicalDevice, memProperties);
+}
+
+void Engine::initializeMipmapMode() {
+	if (!gpuMipmaps) {
+		return;
+	}
+
+	// blitted mips need linear filtering on the texture format, otherwise the decoder builds them
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, VK_FORMAT_R8G8B8A8_UNORM, &formatProperties);
+	VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	if ((formatProperties.optimalTilingFeatures & blitFeatures) != blitFeatures) {
+		std::cout << "linear blits are not supported, mip chains are built on the CPU" << std::endl;
+		gpuMipmaps = false;
+	}
+}
+
+void Engine::initializeStagingRing() {
+	stagingRing.create(logicalDevice, physicalDevice, transferQueueIndex, transferQueue, graphicsQueueIndex, graphicsQueue);
+	uploadBatch = UploadBatch(stagingRing);
+}
+
 void Engine::initializeSwapchain() {
 	VkSwapchainCreateInfoKHR info = {};
 	info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
@@ -326,7 +550,7 @@ void Engine::initializeRenderPass() {
 	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	colorAttachment.finalLayout = headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
 	VkAttachmentReference color_attachment = {};
 	color_attachment.attachment = 0;
@@ -446,7 +670,7 @@ void Engine::initializeDepthResources() {
 	createImage(frameBufferWidth, frameBufferHeight, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
 	depthImageView = createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
 
-	transitionImageLayout(depthImage, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+	uploadBatch.transitionImageLayout(depthImage, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
 }
 
 void Engine::initializeFrameBuffer() {
@@ -467,109 +691,503 @@ void Engine::initializeFrameBuffer() {
 	}
 }
 
-void Engine::initializeModel(const std::string& filename) {
+void Engine::initializeOffscreenFormat() {
+	VkFormat requestImageFormat[] = {VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_B8G8R8A8_UNORM};
+	VkFormatFeatureFlags requiredFeatures = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_TRANSFER_SRC_BIT;
+
+	bool requestedFound = false;
+	for (size_t i = 0; i < sizeof(requestImageFormat) / sizeof(requestImageFormat[0]); i++) {
+		VkFormatProperties props;
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, requestImageFormat[i], &props);
+
+		if ((props.optimalTilingFeatures & requiredFeatures) == requiredFeatures) {
+			surfaceFormat.format = requestImageFormat[i];
+			surfaceFormat.colorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
+			requestedFound = true;
+			break;
+		}
+	}
+
+	if (!requestedFound) {
+		throw std::runtime_error("failed to find a format for offscreen rendering!");
+	}
+
+	frameBufferWidth = SCREENWIDTH;
+	frameBufferHeight = SCREENHEIGHT;
+}
+
+void Engine::initializeOffscreenImages() {
+	VkImageUsageFlags usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+
+	// swapchain images double as ray tracing output, keep that where the format allows it
+	VkFormatProperties props;
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, surfaceFormat.format, &props);
+	if (props.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT) {
+		usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+	}
+
+	backBufferCount = VK_QUEUED_FRAMES;
+	for (uint32_t i = 0; i < backBufferCount; i++) {
+		createImage(frameBufferWidth, frameBufferHeight, surfaceFormat.format, VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, backBuffer[i], backBufferMemory[i]);
+	}
+}
+
+void Engine::initializeReadbackBuffers() {
+	VkDeviceSize bufferSize = static_cast<VkDeviceSize>(frameBufferWidth) * frameBufferHeight * 4;
+	for (uint32_t i = 0; i < backBufferCount; i++) {
+		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, readbackBuffer[i], readbackBufferMemory[i]);
+	}
+}
+
+// One mesh of the scene as its loader thread leaves it: mapped from its mesh cache, or parsed into the owned
+// arrays. Nothing in it touches the device, the uploads run on the main thread once every mesh is in.
+struct LoadedMesh {
+	MeshCache cache;
+	std::vector<Vertex> ownedVertices;
+	std::vector<uint32_t> ownedIndices;
+	std::vector<int32_t> ownedMaterialIndices;
+
+	const Vertex* vertices = nullptr;
+	uint32_t vertexCount = 0;
+	const uint32_t* indices = nullptr;
+	uint32_t indexCount = 0;
+	// one per source triangle
+	const int32_t* materialIndices = nullptr;
+
+	std::vector<MatrialObj> materials;
+	std::vector<std::string> textures;
+	std::vector<MaterialRange> materialRanges;
+	MeshletData meshlets;
+	MeshLodData lods;
+	glm::vec3 center = glm::vec3(0.0f);
+	float radius = 0.0f;
+
+	// where the materials of the mesh start in the material buffer
+	int32_t firstMaterial = 0;
+	// what loading printed, written out in scene order once every mesh is in
+	std::ostringstream log;
+	// why the mesh failed to load, empty when it did not
+	std::string error;
+	// a problem that did not stop the mesh from loading, like a cache that could not be written
+	std::string warning;
+};
+
+// How far the resident set size peaked above residentBefore since the last resetPeakResidentBytes(), in MB.
+static double peakGrowthMegabytes(uint64_t residentBefore) {
+	uint64_t peak = peakResidentBytes();
+	return peak > residentBefore ? (peak - residentBefore) / (1024.0 * 1024.0) : 0.0;
+}
+
+// Bounding sphere around the center of the bounding box of count vertices.
+static void meshBounds(const Vertex* vertices, uint32_t count, glm::vec3& center, float& radius) {
+	glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+	for (uint32_t x = 0; x < count; x++) {
+		boundsMin = glm::min(boundsMin, vertices[x].pos);
+		boundsMax = glm::max(boundsMax, vertices[x].pos);
+	}
+	center = count > 0 ? (boundsMin + boundsMax) * 0.5f : glm::vec3(0.0f);
+	radius = 0.0f;
+	for (uint32_t x = 0; x < count; x++) {
+		radius = std::max(radius, glm::length(vertices[x].pos - center));
+	}
+}
+
+// The loader settings loadMesh builds mesh caches with, anything that opens them has to ask for the same.
+static MeshCacheSettings meshCacheSettings(bool streamingObj) {
 	ObjLoader<Vertex> loader;
+	loader.m_streaming = streamingObj;
+	return MeshCacheSettings::of(loader);
+}
+
+// Maps filename from its mesh cache, or parses, optimizes and caches it. Safe to run for several meshes at
+// once as long as their files differ, so every cache file has one writer.
+static void loadMesh(const std::string& filename, bool streamingObj, LoadedMesh& mesh) {
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	std::string cachePath = MeshCache::cachePathFor(filename);
+	if (mesh.cache.open(cachePath, filename, sizeof(Vertex), meshCacheSettings(streamingObj))) {
+		mesh.vertices = mesh.cache.vertices<Vertex>();
+		mesh.vertexCount = mesh.cache.vertexCount();
+		mesh.indices = mesh.cache.indices();
+		mesh.indexCount = mesh.cache.indexCount();
+		mesh.materialIndices = mesh.cache.materialIndices();
+		mesh.materials = mesh.cache.materials();
+		mesh.textures = mesh.cache.textures();
+		mesh.materialRanges = mesh.cache.materialRanges();
+		mesh.meshlets = mesh.cache.meshlets();
+		mesh.lods = mesh.cache.lods();
+		meshBounds(mesh.vertices, mesh.vertexCount, mesh.center, mesh.radius);
+
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+		mesh.log << "Loaded " << cachePath << " in " << elapsed.count() << " ms" << std::endl;
+		return;
+	}
+
+	ObjLoader<Vertex> loader;
+	loader.m_streaming = streamingObj;
+	loader.m_log = &mesh.log;
 	loader.loadModel(filename);
 
-	indexCount = static_cast<uint32_t>(loader.m_indices.size());
-	vertexCount = static_cast<uint32_t>(loader.m_vertices.size());
-	initializeVertexBuffer(loader.m_vertices);
-	initializeIndexBuffer(loader.m_indices);
-	initializeMaterialBuffer(loader.m_materials);
-	initializeTextureImages(loader.m_textures);
+	// the cache stores the optimized order, so this only runs when it is rebuilt. Triangles stay in their
+	// material range, so the per triangle materials still line up.
+	std::vector<uint32_t> materialStarts;
+	for (const auto& range : loader.m_materialRanges) {
+		materialStarts.push_back(range.firstIndex / 3);
+	}
+	MeshOptimizationStats optimization = optimizeMesh(loader.m_vertices, loader.m_indices, materialStarts);
+	mesh.log << "Optimized " << optimization.before.triangleCount << " triangles in " << optimization.milliseconds << " ms: ACMR " << optimization.before.acmr << " -> " << optimization.after.acmr
+		<< ", ATVR " << optimization.before.atvr << " -> " << optimization.after.atvr << ", " << optimization.clusterCount << " overdraw clusters in " << materialStarts.size() << " material ranges" << std::endl;
+
+	MeshletBuildStats meshletStats = buildMeshlets(mesh.meshlets, loader.m_vertices.data(), static_cast<uint32_t>(loader.m_vertices.size()), loader.m_indices.data(), loader.m_indices.size(), materialStarts);
+	mesh.log << "Built " << meshletStats.meshletCount << " meshlets in " << meshletStats.milliseconds << " ms (" << meshletStats.trianglesPerSecond / 1e6 << " Mtriangles/s): "
+		<< meshletStats.averageVertexCount << " vertices and " << meshletStats.averageTriangleCount << " triangles on average" << std::endl;
+
+	// material ranges simplify independently, so materials never bleed into each other
+	double lodMilliseconds = buildLodChain(mesh.lods, loader.m_vertices.data(), static_cast<uint32_t>(loader.m_vertices.size()), loader.m_indices.data(), loader.m_indices.size(), loader.m_matIndx.data(),
+		materialStarts);
+	mesh.log << "Built " << mesh.lods.levels.size() << " levels of detail in " << lodMilliseconds << " ms:";
+	for (const auto& level : mesh.lods.levels) {
+		mesh.log << " " << level.indexCount / 3 << " triangles (error " << level.error << ")";
+	}
+	mesh.log << std::endl;
+
+	if (!MeshCache::write(cachePath, filename, loader, mesh.meshlets, mesh.lods)) {
+		mesh.warning = "failed to write mesh cache " + cachePath;
+	}
+
+	// the loader is done with its buffers, the mesh takes them over as they are
+	mesh.ownedVertices = std::move(loader.m_vertices);
+	mesh.ownedIndices = std::move(loader.m_indices);
+	mesh.ownedMaterialIndices = std::move(loader.m_matIndx);
+	mesh.vertices = mesh.ownedVertices.data();
+	mesh.vertexCount = static_cast<uint32_t>(mesh.ownedVertices.size());
+	mesh.indices = mesh.ownedIndices.data();
+	mesh.indexCount = static_cast<uint32_t>(mesh.ownedIndices.size());
+	mesh.materialIndices = mesh.ownedMaterialIndices.data();
+	mesh.materials = std::move(loader.m_materials);
+	mesh.textures = std::move(loader.m_textures);
+	mesh.materialRanges = std::move(loader.m_materialRanges);
+	meshBounds(mesh.vertices, mesh.vertexCount, mesh.center, mesh.radius);
+
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+	mesh.log << "Parsed " << filename << " in " << elapsed.count() << " ms" << std::endl;
 }
 
-void Engine::initializeVertexBuffer(const std::vector<Vertex>& vertex) {
-	VkDeviceSize bufferSize = sizeof(vertex[0]) * vertex.size();
+void Engine::initializeScene(const SceneDescription& scene) {
+	resetPeakResidentBytes();
+	uint64_t residentBefore = residentBytes();
+	auto startTime = std::chrono::high_resolution_clock::now();
+	modelPath = scene.meshes.empty() ? std::string() : scene.meshes[0].path;
+
+	std::vector<LoadedMesh> meshes(scene.meshes.size());
+	parallelFor(meshes.size(), 0, [&](size_t x) {
+		// an exception leaving a worker thread terminates, failures are reported once every mesh is done
+		try {
+			loadMesh(scene.meshes[x].path, streamingObj, meshes[x]);
+		} catch (const std::exception& exception) {
+			meshes[x].error = exception.what();
+		}
+	});
+	std::string error;
+	for (const auto& mesh : meshes) {
+		std::cout << mesh.log.str();
+		if (!mesh.warning.empty()) {
+			std::cerr << mesh.warning << std::endl;
+		}
+		if (!mesh.error.empty()) {
+			std::cerr << "failed to load mesh: " << mesh.error << std::endl;
+			error = error.empty() ? mesh.error : error;
+		}
+	}
+	if (!error.empty()) {
+		throw std::runtime_error(error);
+	}
+
+	// the meshes go one after the other into every buffer, the simplified levels of a mesh right after its
+	// source triangles. Materials are appended too, the textures they sample load once however many meshes use them.
+	std::vector<MatrialObj> materials;
+	std::vector<std::string> textures;
+	std::unordered_map<std::string, int> textureSlots;
+	sceneMeshes.resize(meshes.size());
+	vertexCount = 0;
+	indexCount = 0;
+	uint32_t firstIndex = 0;
+	for (size_t x = 0; x < meshes.size(); x++) {
+		LoadedMesh& mesh = meshes[x];
+		SceneMeshRange& range = sceneMeshes[x];
+		range.firstVertex = vertexCount;
+		range.vertexCount = mesh.vertexCount;
+		range.firstIndex = firstIndex;
+		range.indexCount = mesh.indexCount;
+		range.lods = mesh.lods.levels;
+		range.center = mesh.center;
+		range.radius = mesh.radius;
+		vertexCount += mesh.vertexCount;
+		indexCount += mesh.indexCount;
+		firstIndex += mesh.indexCount + static_cast<uint32_t>(mesh.lods.indices.size());
+
+		mesh.firstMaterial = static_cast<int32_t>(materials.size());
+		for (MatrialObj material : mesh.materials) {
+			if (material.textureID >= 0 && material.textureID < static_cast<int>(mesh.textures.size())) {
+				auto slot = textureSlots.emplace(mesh.textures[material.textureID], static_cast<int>(textures.size()));
+				if (slot.second) {
+					textures.push_back(mesh.textures[material.textureID]);
+				}
+				material.textureID = slot.first->second;
+			}
+			materials.push_back(material);
+		}
 
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+		uint32_t firstRange = static_cast<uint32_t>(materialRanges.size());
+		for (MaterialRange materialRange : mesh.materialRanges) {
+			materialRange.material += mesh.firstMaterial;
+			materialRange.firstIndex += range.firstIndex;
+			materialRanges.push_back(materialRange);
+		}
+		uint32_t firstMeshletVertex = static_cast<uint32_t>(meshlets.vertices.size());
+		uint32_t firstMeshletTriangle = static_cast<uint32_t>(meshlets.triangles.size());
+		for (Meshlet meshlet : mesh.meshlets.meshlets) {
+			meshlet.range += firstRange;
+			meshlet.vertexOffset += firstMeshletVertex;
+			meshlet.triangleOffset += firstMeshletTriangle;
+			meshlets.meshlets.push_back(meshlet);
+		}
+		meshlets.vertices.insert(meshlets.vertices.end(), mesh.meshlets.vertices.begin(), mesh.meshlets.vertices.end());
+		meshlets.triangles.insert(meshlets.triangles.end(), mesh.meshlets.triangles.begin(), mesh.meshlets.triangles.end());
+	}
 
-	void* data;
-	vkMapMemory(logicalDevice, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, vertex.data(), static_cast<size_t>(bufferSize));
-	vkUnmapMemory(logicalDevice, stagingBufferMemory);
+	initializeVertexBuffer(meshes);
+	initializeIndexBuffer(meshes);
+	initializeMaterialBuffer(materials);
+	initializeMaterialIndexBuffer(meshes);
 
-	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+	std::cout << "Loaded " << meshes.size() << " meshes (" << vertexCount << " vertices, " << indexCount / 3 << " triangles, " << materials.size() << " materials) in " << elapsed.count()
+		<< " ms, peak memory growth " << peakGrowthMegabytes(residentBefore) << " MB" << std::endl;
 
-	copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
+	if (retainHostGeometry) {
+		initializeHostGeometry(meshes, materials);
+	}
 
-	vkDestroyBuffer(logicalDevice, stagingBuffer, nullptr);
-	vkFreeMemory(logicalDevice, stagingBufferMemory, nullptr);
+	initializeTextureImages(textures);
 }
 
-void Engine::initializeIndexBuffer(const std::vector<uint32_t>& indices) {
-	VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
-
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+void Engine::initializeVertexBuffer(const std::vector<LoadedMesh>& meshes) {
+	if (!packedVertices) {
+		VkDeviceSize bufferSize = sizeof(Vertex) * vertexCount;
+		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
+		for (size_t x = 0; x < meshes.size(); x++) {
+			uploadBatch.copyToBuffer(meshes[x].vertices, sizeof(Vertex) * meshes[x].vertexCount, vertexBuffer, sizeof(Vertex) * sceneMeshes[x].firstVertex);
+		}
+		return;
+	}
 
-	void* data;
-	vkMapMemory(logicalDevice, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, indices.data(), static_cast<size_t>(bufferSize));
-	vkUnmapMemory(logicalDevice, stagingBufferMemory);
+	std::vector<PackedVertexSource> sources;
+	for (const auto& mesh : meshes) {
+		sources.push_back(packedVertexSource(mesh.vertices, mesh.vertexCount));
+	}
+	packedVertexLayout.finalize();
+	// shaders decode every mesh in the buffer the same way, so the quantization spans all of them
+	vertexQuantization = computeVertexQuantization(sources.data(), sources.size());
 
-	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+	uint32_t stride = packedVertexLayout.stride;
+	VkDeviceSize bufferSize = static_cast<VkDeviceSize>(stride) * vertexCount;
+	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
+	// encoded piece by piece straight into the staging ring, the packed vertices never get a host buffer of their own
+	for (size_t x = 0; x < meshes.size(); x++) {
+		const Vertex* vertices = meshes[x].vertices;
+		uploadBatch.writeToBuffer(static_cast<VkDeviceSize>(stride) * meshes[x].vertexCount, vertexBuffer, static_cast<VkDeviceSize>(stride) * sceneMeshes[x].firstVertex, stride,
+			[&](void* destination, VkDeviceSize offset, VkDeviceSize size) {
+			PackedVertexSource piece = packedVertexSource(vertices + offset / stride, static_cast<uint32_t>(size / stride));
+			encodePackedVertices(piece, packedVertexLayout, vertexQuantization, static_cast<uint8_t*>(destination));
+		});
+	}
+	std::cout << "Packed " << vertexCount << " vertices from " << sizeof(Vertex) << " to " << stride << " bytes each" << std::endl;
 
-	copyBuffer(stagingBuffer, indexBuffer, bufferSize);
+	if (retainHostGeometry) {
+		hostPackedVertices.resize(static_cast<size_t>(bufferSize));
+		for (size_t x = 0; x < meshes.size(); x++) {
+			encodePackedVertices(sources[x], packedVertexLayout, vertexQuantization, hostPackedVertices.data() + static_cast<size_t>(stride) * sceneMeshes[x].firstVertex);
+		}
+	}
+}
 
-	vkDestroyBuffer(logicalDevice, stagingBuffer, nullptr);
-	vkFreeMemory(logicalDevice, stagingBufferMemory, nullptr);
+void Engine::initializeIndexBuffer(const std::vector<LoadedMesh>& meshes) {
+	VkDeviceSize bufferSize = 0;
+	for (const auto& mesh : meshes) {
+		bufferSize += sizeof(uint32_t) * (mesh.indexCount + mesh.lods.indices.size());
+	}
+	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+	for (size_t x = 0; x < meshes.size(); x++) {
+		const LoadedMesh& mesh = meshes[x];
+		VkDeviceSize offset = sizeof(uint32_t) * sceneMeshes[x].firstIndex;
+		VkDeviceSize sourceSize = sizeof(uint32_t) * mesh.indexCount;
+		uploadBatch.copyToBuffer(mesh.indices, sourceSize, indexBuffer, offset);
+		if (!mesh.lods.indices.empty()) {
+			uploadBatch.copyToBuffer(mesh.lods.indices.data(), sizeof(uint32_t) * mesh.lods.indices.size(), indexBuffer, offset + sourceSize);
+		}
+	}
 }
 
 void Engine::initializeMaterialBuffer(const std::vector<MatrialObj>& materials) {
 	VkDeviceSize bufferSize = materials.size() * sizeof(MatrialObj);
 	createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, matColorBuffer, matColorBufferMemory);
 	
-	void* data;
-	vkMapMemory(logicalDevice, matColorBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, materials.data(), bufferSize);
-	vkUnmapMemory(logicalDevice, matColorBufferMemory);
+	memcpy(matColorBufferMemory.mapped, materials.data(), bufferSize);
+}
+
+void Engine::initializeMaterialIndexBuffer(const std::vector<LoadedMesh>& meshes) {
+	VkDeviceSize bufferSize = 0;
+	for (const auto& mesh : meshes) {
+		bufferSize += sizeof(int32_t) * (mesh.indexCount / 3 + mesh.lods.materials.size());
+	}
+	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, matIndexBuffer, matIndexBufferMemory);
+
+	// the materials of every mesh but the first move up by where its materials start in the material buffer
+	auto copyMaterials = [&](const int32_t* materials, size_t count, int32_t firstMaterial, VkDeviceSize dstOffset) {
+		if (firstMaterial == 0) {
+			uploadBatch.copyToBuffer(materials, sizeof(int32_t) * count, matIndexBuffer, dstOffset);
+			return;
+		}
+		uploadBatch.writeToBuffer(sizeof(int32_t) * count, matIndexBuffer, dstOffset, sizeof(int32_t), [&](void* destination, VkDeviceSize offset, VkDeviceSize size) {
+			const int32_t* source = materials + offset / sizeof(int32_t);
+			int32_t* rebased = static_cast<int32_t*>(destination);
+			for (size_t x = 0; x < size / sizeof(int32_t); x++) {
+				rebased[x] = source[x] + firstMaterial;
+			}
+		});
+	};
+	for (size_t x = 0; x < meshes.size(); x++) {
+		const LoadedMesh& mesh = meshes[x];
+		// one material per triangle, so the materials of a mesh start a third as far in as its indices
+		VkDeviceSize offset = sizeof(int32_t) * (sceneMeshes[x].firstIndex / 3);
+		uint32_t triangleCount = mesh.indexCount / 3;
+		copyMaterials(mesh.materialIndices, triangleCount, mesh.firstMaterial, offset);
+		if (!mesh.lods.materials.empty()) {
+			copyMaterials(mesh.lods.materials.data(), mesh.lods.materials.size(), mesh.firstMaterial, offset + sizeof(int32_t) * triangleCount);
+		}
+	}
+}
+
+// Appends count elements at source to destination. An empty destination takes owned over instead when source
+// is its data, so a single parsed mesh becomes the host copy as it is.
+template <class T>
+static void appendHostCopy(std::vector<T>& destination, std::vector<T>& owned, const T* source, size_t count) {
+	if (destination.empty() && !owned.empty() && owned.data() == source) {
+		destination = std::move(owned);
+		return;
+	}
+	destination.insert(destination.end(), source, source + count);
+}
+
+void Engine::initializeHostGeometry(std::vector<LoadedMesh>& meshes, std::vector<MatrialObj>& materials) {
+	if (meshes.size() > 1) {
+		hostVertices.reserve(vertexCount);
+	}
+	for (auto& mesh : meshes) {
+		appendHostCopy(hostVertices, mesh.ownedVertices, mesh.vertices, mesh.vertexCount);
+
+		appendHostCopy(hostIndices, mesh.ownedIndices, mesh.indices, mesh.indexCount);
+		hostIndices.insert(hostIndices.end(), mesh.lods.indices.begin(), mesh.lods.indices.end());
+
+		size_t firstTriangle = hostMaterialIndices.size();
+		appendHostCopy(hostMaterialIndices, mesh.ownedMaterialIndices, mesh.materialIndices, mesh.indexCount / 3);
+		hostMaterialIndices.insert(hostMaterialIndices.end(), mesh.lods.materials.begin(), mesh.lods.materials.end());
+		for (size_t x = firstTriangle; x < hostMaterialIndices.size(); x++) {
+			hostMaterialIndices[x] += mesh.firstMaterial;
+		}
+	}
+	hostMaterials = std::move(materials);
 }
 
 void Engine::initializeTextureImages(const std::vector<std::string>& textures) {
 	if (textures.empty()) {
 		int texWidth = 1, texHeight = 1;
-		int texChannels = 4;
 		glm::u8vec4* color = new glm::u8vec4(255, 0, 255, 255);
 		stbi_uc* pixels = reinterpret_cast<stbi_uc*>(color);
 
 		VkImage textureImage;
-		VkDeviceMemory textureImageMemory;
-		createTextureImage(pixels, texWidth, texHeight, texChannels, textureImage, textureImageMemory);
+		DeviceAllocation textureImageMemory;
+		createTextureImage(pixels, texWidth, texHeight, VK_FORMAT_R8G8B8A8_UNORM, nullptr, 1, textureImage, textureImageMemory);
 		textureImageList.push_back(textureImage);
 		textureImageMemoryList.push_back(textureImageMemory);
 		textureImageViewList.push_back(createImageView(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT));
-		textureSamplerList.push_back(createTextureSampler());
+		textureSamplerList.push_back(createTextureSampler(1));
 		return;
 	}
 
-
+	std::vector<std::string> paths;
 	for (const auto& texture : textures) {
 		std::stringstream o;
-		int texWidth, texHeight, texChannels;
 		o << "res/textures/" << texture;
+		paths.push_back(o.str());
+	}
 
-		stbi_uc* pixels = stbi_load(o.str().c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-
+	// decoding runs on every core, this thread uploads whatever finished first into its slot
+	auto startTime = std::chrono::high_resolution_clock::now();
+	TextureDecoder decoder;
+	decoder.start(paths, !gpuMipmaps, textureCompression);
+	unsigned int threadCount = decoder.getThreadCount();
+
+	textureImageList.resize(textures.size());
+	textureImageMemoryList.resize(textures.size());
+	textureImageViewList.resize(textures.size());
+	textureSamplerList.resize(textures.size());
+
+	uint32_t encodedCount = 0;
+	double encodeMilliseconds = 0.0;
+	double lowestPsnr = std::numeric_limits<double>::infinity();
+
+	DecodedTexture decoded;
+	while (decoder.next(decoded)) {
+		size_t x = decoded.index;
+		int texWidth = decoded.width, texHeight = decoded.height;
+		stbi_uc* pixels = decoded.pixels;
+		VkFormat format = decoded.format;
+		// the decoder built the chain unless the GPU blits it, it always builds block compressed ones
+		uint32_t mipLevels = gpuMipmaps && !decoded.mips ? mipLevelCount(texWidth, texHeight) : decoded.mipLevels;
+
+		glm::u8vec4 color(255, 0, 255, 255);
 		if (!pixels) {
 			texWidth = texHeight = 1;
-			texChannels = 4;
-			glm::u8vec4* color = new glm::u8vec4(255, 0, 255, 255);
-			pixels = reinterpret_cast<stbi_uc*>(color);
+			mipLevels = 1;
+			format = VK_FORMAT_R8G8B8A8_UNORM;
+			pixels = reinterpret_cast<stbi_uc*>(&color);
 		}
 
-		VkImage textureImage;
-		VkDeviceMemory textureImageMemory;
-		createTextureImage(pixels, texWidth, texHeight, texChannels, textureImage, textureImageMemory);
-		textureImageList.push_back(textureImage);
-		textureImageMemoryList.push_back(textureImageMemory);
-		stbi_image_free(pixels);
-
-		textureImageViewList.push_back(createImageView(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT));
-		textureSamplerList.push_back(createTextureSampler());
+		createTextureImage(pixels, texWidth, texHeight, format, decoded.mips, mipLevels, textureImageList[x], textureImageMemoryList[x]);
+		// the pixels are in the staging ring now
+		decoder.release(decoded);
+
+		textureImageViewList[x] = createImageView(textureImageList[x], format, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels, compressedComponentMapping(format));
+		textureSamplerList[x] = createTextureSampler(mipLevels);
+		if (decoded.cached) {
+			std::cout << "Loaded " << textures[x] << " (" << texWidth << "x" << texHeight << " " << textureFormatName(format) << ") from the texture cache in " << decoded.decodeMilliseconds << " ms" << std::endl;
+		} else if (isBlockCompressed(format)) {
+			std::cout << "Decoded " << textures[x] << " (" << texWidth << "x" << texHeight << ") in " << decoded.decodeMilliseconds << " ms, encoded to " << textureFormatName(format) << " in "
+				<< decoded.encodeMilliseconds << " ms at " << decoded.psnr << " dB PSNR" << std::endl;
+			encodedCount++;
+			encodeMilliseconds += decoded.encodeMilliseconds;
+			lowestPsnr = std::min(lowestPsnr, decoded.psnr);
+		} else {
+			std::cout << "Decoded " << textures[x] << " (" << texWidth << "x" << texHeight << ") in " << decoded.decodeMilliseconds << " ms" << std::endl;
+		}
+	}
+	decoder.finish();
+
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+	TextureDecoderStats decoderStats = decoder.getStats();
+	std::cout << "Loaded " << textures.size() << " textures (" << decoderStats.decodedBytes / (1024.0 * 1024.0) << " MB) on " << threadCount << " threads in " << elapsed.count() << " ms, "
+		<< decoderStats.peakBytes / (1024.0 * 1024.0) << " MB decoded at peak, " << decoderStats.budgetWaits << " budget waits" << std::endl;
+	if (textureCompression != TEXTURE_COMPRESSION_NONE) {
+		std::cout << decoderStats.cacheHits << " textures from the texture cache, " << encodedCount << " encoded in " << encodeMilliseconds << " ms";
+		if (encodedCount > 0) {
+			std::cout << " at " << lowestPsnr << " dB PSNR or better";
+		}
+		std::cout << std::endl;
+		if (decoderStats.cacheWriteFailures > 0) {
+			std::cerr << "failed to write " << decoderStats.cacheWriteFailures << " texture cache files" << std::endl;
+		}
 	}
 }
 
@@ -595,7 +1213,18 @@ void Engine::initializeDescriptorSetLayout() {
 	samplerLayoutBinding.pImmutableSamplers = nullptr;
 	samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-	std::array<VkDescriptorSetLayoutBinding, 3> bindings = {uboLayoutBinding, uboMatColorLayoutBinding, samplerLayoutBinding};
+	VkDescriptorSetLayoutBinding matIndexLayoutBinding = {};
+	matIndexLayoutBinding.binding = 3;
+	matIndexLayoutBinding.descriptorCount = 1;
+	matIndexLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	matIndexLayoutBinding.pImmutableSamplers = nullptr;
+	matIndexLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	// the closest hit stage only exists with VK_NV_ray_tracing enabled
+	if (rayTracingSupported) {
+		matIndexLayoutBinding.stageFlags |= VK_SHADER_STAGE_CLOSEST_HIT_BIT_NV;
+	}
+
+	std::array<VkDescriptorSetLayoutBinding, 4> bindings = {uboLayoutBinding, uboMatColorLayoutBinding, samplerLayoutBinding, matIndexLayoutBinding};
 	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
 	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
@@ -612,6 +1241,10 @@ void Engine::initializeUniformBuffer() {
 }
 
 void Engine::initializeRayTracing() {
+	if (!rayTracingSupported) {
+		return;
+	}
+
 	raytracingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PROPERTIES_NV;
 	raytracingProperties.pNext = nullptr;
 	raytracingProperties.maxRecursionDepth = 0;
@@ -623,57 +1256,700 @@ void Engine::initializeRayTracing() {
 	vkGetPhysicalDeviceProperties2(physicalDevice, &props);
 }
 
-void Engine::initializeGeometryInstances() {
-	glm::mat4x4 mat = glm::mat4x4(1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1);
-	mat = glm::rotate(mat, glm::radians(270.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-
-	geometryInstances.push_back({vertexBuffer, vertexCount, 0, indexBuffer, indexCount, 0, mat});
+void Engine::initializeGeometryInstances(const SceneDescription& scene) {
+	VkDeviceSize vertexStride = packedVertices ? packedVertexLayout.stride : sizeof(Vertex);
+	geometryInstances.reserve(scene.instances.size());
+	for (const auto& instance : scene.instances) {
+		const SceneMeshRange& mesh = sceneMeshes[instance.mesh];
+		geometryInstances.push_back({vertexBuffer, mesh.vertexCount, vertexStride * mesh.firstVertex, indexBuffer, mesh.indexCount, sizeof(uint32_t) * mesh.firstIndex, instance.transform, instance.mesh});
+	}
+	std::cout << geometryInstances.size() << " instances of " << sceneMeshes.size() << " meshes" << std::endl;
 }
 
 void Engine::start() {
+	if (headless) {
+		return;
+	}
+
 	while (!glfwWindowShouldClose(window)) {
 		glfwPollEvents();
 	}
 }
 
-void Engine::quit() {
-
-}
-
-VkCommandBuffer Engine::beginSingleTimeCommands() {
-	VkCommandBufferAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandPool = commandPool[0];
-	allocInfo.commandBufferCount = 1;
-
-	VkCommandBuffer commandBuffer;
-	vkAllocateCommandBuffers(logicalDevice, &allocInfo, &commandBuffer);
+void Engine::renderOffscreenFrame(uint32_t frameIndex) {
+	vkWaitForFences(logicalDevice, 1, &fence[frameIndex], VK_TRUE, UINT64_MAX);
+	vkResetFences(logicalDevice, 1, &fence[frameIndex]);
 
 	VkCommandBufferBeginInfo beginInfo = {};
 	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(commandBuffer[frameIndex], &beginInfo);
+
+	std::array<VkClearValue, 2> clearValues = {};
+	clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+	clearValues[1].depthStencil = {1.0f, 0};
+
+	VkRenderPassBeginInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassInfo.renderPass = renderPass;
+	renderPassInfo.framebuffer = framebuffer[frameIndex];
+	renderPassInfo.renderArea.offset = {0, 0};
+	renderPassInfo.renderArea.extent = {static_cast<uint32_t>(frameBufferWidth), static_cast<uint32_t>(frameBufferHeight)};
+	renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+	renderPassInfo.pClearValues = clearValues.data();
+
+	vkCmdBeginRenderPass(commandBuffer[frameIndex], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdNextSubpass(commandBuffer[frameIndex], VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdEndRenderPass(commandBuffer[frameIndex]);
+
+	// the render pass leaves the back buffer in TRANSFER_SRC_OPTIMAL, its writes still have to reach the copy
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = backBuffer[frameIndex];
+	barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+	barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer[frameIndex], VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
 
-	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	VkBufferImageCopy region = {};
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageOffset = {0, 0, 0};
+	region.imageExtent = {static_cast<uint32_t>(frameBufferWidth), static_cast<uint32_t>(frameBufferHeight), 1};
+	vkCmdCopyImageToBuffer(commandBuffer[frameIndex], backBuffer[frameIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffer[frameIndex], 1, &region);
 
-	return commandBuffer;
-}
+	VkMemoryBarrier hostBarrier = {};
+	hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer[frameIndex], VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
 
-void Engine::endSingleTimeCommands(VkCommandBuffer commandBuffer) {
-	vkEndCommandBuffer(commandBuffer);
+	if (vkEndCommandBuffer(commandBuffer[frameIndex]) != VK_SUCCESS) {
+		throw std::runtime_error("failed to record command buffer!");
+	}
 
 	VkSubmitInfo submitInfo = {};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
+	submitInfo.pCommandBuffers = &commandBuffer[frameIndex];
+
+	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, fence[frameIndex]) != VK_SUCCESS) {
+		throw std::runtime_error("failed to submit frame!");
+	}
+}
 
-	vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-	vkQueueWaitIdle(graphicsQueue);
+void Engine::readbackFrame(uint32_t frameIndex, std::vector<uint8_t>& pixels) {
+	vkWaitForFences(logicalDevice, 1, &fence[frameIndex], VK_TRUE, UINT64_MAX);
 
-	vkFreeCommandBuffers(logicalDevice, commandPool[0], 1, &commandBuffer);
+	VkDeviceSize bufferSize = static_cast<VkDeviceSize>(frameBufferWidth) * frameBufferHeight * 4;
+	pixels.resize(static_cast<size_t>(bufferSize));
+
+	memcpy(pixels.data(), readbackBufferMemory[frameIndex].mapped, static_cast<size_t>(bufferSize));
+
+	if (surfaceFormat.format == VK_FORMAT_B8G8R8A8_UNORM) {
+		for (size_t x = 0; x < pixels.size(); x += 4) {
+			std::swap(pixels[x], pixels[x + 2]);
+		}
+	}
+}
+
+void Engine::renderHeadless(uint32_t frameCount, const std::string& outputPath) {
+	if (!headless) {
+		throw std::runtime_error("renderHeadless needs an engine initialized as headless!");
+	}
+	if (frameCount == 0) {
+		return;
+	}
+
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	for (uint32_t x = 0; x < frameCount; x++) {
+		renderOffscreenFrame(x % backBufferCount);
+	}
+	vkWaitForFences(logicalDevice, backBufferCount, fence, VK_TRUE, UINT64_MAX);
+
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+	std::cout << "Rendered " << frameCount << " frames in " << elapsed.count() << " ms (" << elapsed.count() / frameCount << " ms/frame)" << std::endl;
+
+	std::vector<uint8_t> pixels;
+	readbackFrame((frameCount - 1) % backBufferCount, pixels);
+	if (!writePPM(outputPath, frameBufferWidth, frameBufferHeight, pixels)) {
+		std::cerr << "failed to write " << outputPath << std::endl;
+	}
+}
+
+void Engine::renderReference(const std::string& outputPath, TraversalMode traversalMode, float lodPixelError) {
+	if (!retainHostGeometry) {
+		throw std::runtime_error("renderReference needs an engine initialized with the reference renderer!");
+	}
+
+	CpuRayTracer tracer;
+	uint32_t referenceTriangleCount = 0;
+	for (const auto& instance : geometryInstances) {
+		const SceneMeshRange& mesh = sceneMeshes[instance.mesh];
+		tracer.addInstance(hostVertices.data() + mesh.firstVertex, mesh.vertexCount, hostIndices.data() + mesh.firstIndex, mesh.indexCount, hostMaterialIndices.data() + mesh.firstIndex / 3,
+			instance.transform);
+		referenceTriangleCount += mesh.indexCount / 3;
+	}
+	tracer.setMaterials(hostMaterials);
+	tracer.traversalMode = traversalMode;
+	tracer.build();
+
+	std::vector<uint8_t> pixels;
+	auto camera = tracer.fitCamera();
+	tracer.render(camera, frameBufferWidth, frameBufferHeight, pixels);
+	if (!writePPM(outputPath, frameBufferWidth, frameBufferHeight, pixels)) {
+		std::cerr << "failed to write " << outputPath << std::endl;
+	}
+
+	if (lodPixelError > 0.0f) {
+		// the levels picked for this camera, traced from the same viewpoint
+		selectLods(camera.position, camera.fovY, frameBufferHeight, lodPixelError);
+		CpuRayTracer lodTracer;
+		uint32_t triangleCount = 0;
+		std::vector<uint32_t> levelInstances;
+		for (const auto& instance : geometryInstances) {
+			uint32_t firstVertex = sceneMeshes[instance.mesh].firstVertex;
+			uint32_t firstIndex = static_cast<uint32_t>(instance.indexOffset / sizeof(uint32_t));
+			lodTracer.addInstance(hostVertices.data() + firstVertex, instance.vertexCount, hostIndices.data() + firstIndex, instance.indexCount, hostMaterialIndices.data() + firstIndex / 3,
+				instance.transform);
+			triangleCount += instance.indexCount / 3;
+			levelInstances.resize(std::max<size_t>(levelInstances.size(), instance.lod + 1));
+			levelInstances[instance.lod]++;
+		}
+		std::cout << "Instances per level of detail:";
+		for (uint32_t count : levelInstances) {
+			std::cout << " " << count;
+		}
+		std::cout << std::endl;
+		lodTracer.setMaterials(hostMaterials);
+		lodTracer.traversalMode = traversalMode;
+		lodTracer.build();
+
+		std::vector<uint8_t> lodPixels;
+		lodTracer.render(camera, frameBufferWidth, frameBufferHeight, lodPixels);
+		std::string lodPath = suffixedPath(outputPath, "_lod");
+		if (!writePPM(lodPath, frameBufferWidth, frameBufferHeight, lodPixels)) {
+			std::cerr << "failed to write " << lodPath << std::endl;
+		}
+
+		int maxDifference = 0;
+		double psnr = comparePixels(pixels, lodPixels, maxDifference);
+		std::cout << "Levels of detail within " << lodPixelError << " pixels against reference: " << triangleCount << " of " << referenceTriangleCount << " triangles, max difference " << maxDifference
+			<< ", PSNR " << psnr << " dB" << std::endl;
+		selectLods(camera.position, camera.fovY, frameBufferHeight, 0.0f);
+	}
+
+	if (!packedVertices) {
+		return;
+	}
+
+	// the same scene from what the GPU sees
+	std::vector<Vertex> decoded(hostVertices.size());
+	for (size_t x = 0; x < decoded.size(); x++) {
+		UnpackedVertex vertex = decodePackedVertex(hostPackedVertices.data() + x * packedVertexLayout.stride, packedVertexLayout, vertexQuantization);
+		decoded[x].pos = vertex.pos;
+		decoded[x].nrm = vertex.nrm;
+		decoded[x].color = vertex.color;
+		decoded[x].texCoord = vertex.texCoord;
+	}
+
+	CpuRayTracer packedTracer;
+	for (const auto& instance : geometryInstances) {
+		const SceneMeshRange& mesh = sceneMeshes[instance.mesh];
+		packedTracer.addInstance(decoded.data() + mesh.firstVertex, mesh.vertexCount, hostIndices.data() + mesh.firstIndex, mesh.indexCount, hostMaterialIndices.data() + mesh.firstIndex / 3,
+			instance.transform);
+	}
+	packedTracer.setMaterials(hostMaterials);
+	packedTracer.traversalMode = traversalMode;
+	packedTracer.build();
+
+	std::vector<uint8_t> packedPixels;
+	packedTracer.render(camera, frameBufferWidth, frameBufferHeight, packedPixels);
+	std::string packedPath = suffixedPath(outputPath, "_packed");
+	if (!writePPM(packedPath, frameBufferWidth, frameBufferHeight, packedPixels)) {
+		std::cerr << "failed to write " << packedPath << std::endl;
+	}
+
+	int maxDifference = 0;
+	double psnr = comparePixels(pixels, packedPixels, maxDifference);
+	std::cout << "Packed vertices against reference: max difference " << maxDifference << ", PSNR " << psnr << " dB" << std::endl;
+
+	PackedVertexSource source = packedVertexSource(hostVertices.data(), static_cast<uint32_t>(hostVertices.size()));
+	PackedVertexError error = measurePackedVertexError(source, hostPackedVertices.data(), packedVertexLayout, vertexQuantization);
+	PackedVertexError bound = packedVertexErrorBound(packedVertexLayout, vertexQuantization);
+	std::cout << "Packed vertex error (bound): position " << error.position << " (" << bound.position << "), normal " << error.normalDegrees << " (" << bound.normalDegrees << ") degrees, texCoord "
+		<< error.texCoord << " (" << bound.texCoord << "), color " << error.color << " (" << bound.color << ")" << std::endl;
+	if (error.position > bound.position || error.normalDegrees > bound.normalDegrees || error.texCoord > bound.texCoord || error.color > bound.color) {
+		std::cerr << "packed vertices exceed their error bounds" << std::endl;
+	}
+}
+
+void Engine::selectLods(const glm::vec3& cameraPosition, float fovY, uint32_t viewportHeight, float maxPixelError) {
+	for (auto& instance : geometryInstances) {
+		const SceneMeshRange& mesh = sceneMeshes[instance.mesh];
+		instance.lod = maxPixelError > 0.0f ? selectLod(mesh.lods, mesh.center, mesh.radius, instance.transform, cameraPosition, fovY, viewportHeight, maxPixelError) : 0;
+		MeshLod level = instance.lod < mesh.lods.size() ? mesh.lods[instance.lod] : MeshLod{0, mesh.indexCount, 0.0f};
+		instance.indexOffset = sizeof(uint32_t) * (mesh.firstIndex + level.firstIndex);
+		instance.indexCount = level.indexCount;
+	}
+}
+
+struct LoaderBenchmark {
+	double milliseconds = 0.0;
+	size_t vertexCount = 0;
+	// the most a load grew the resident set size by
+	uint64_t peakGrowth = 0;
+};
+
+// Median time ObjLoader<TVert> takes to load path over runs loads.
+template <class TVert>
+static LoaderBenchmark benchmarkObjLoader(const std::string& path, uint32_t runs, bool streaming) {
+	LoaderBenchmark result;
+	std::vector<double> milliseconds;
+	for (uint32_t x = 0; x < runs; x++) {
+		resetPeakResidentBytes();
+		uint64_t residentBefore = residentBytes();
+		auto startTime = std::chrono::high_resolution_clock::now();
+		{
+			ObjLoader<TVert> loader;
+			loader.m_streaming = streaming;
+			loader.loadModel(path);
+			result.vertexCount = loader.m_vertices.size();
+		}
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+		milliseconds.push_back(elapsed.count());
+		uint64_t peak = peakResidentBytes();
+		result.peakGrowth = std::max(result.peakGrowth, peak > residentBefore ? peak - residentBefore : 0);
+	}
+	std::sort(milliseconds.begin(), milliseconds.end());
+	result.milliseconds = milliseconds[runs / 2];
+	return result;
+}
+
+void Engine::benchmarkLoader(uint32_t runs) {
+	struct stat fileStat;
+	if (runs == 0 || modelPath.empty() || stat(modelPath.c_str(), &fileStat) != 0) {
+		std::cerr << "failed to run the loader benchmark without a model" << std::endl;
+		return;
+	}
+
+	const char* names[] = {"Vertex", "Vertex streamed", "TangentVertex", "NormalVertex", "DepthVertex"};
+	LoaderBenchmark results[] = {
+		benchmarkObjLoader<Vertex>(modelPath, runs, false),
+		benchmarkObjLoader<Vertex>(modelPath, runs, true),
+		benchmarkObjLoader<TangentVertex>(modelPath, runs, false),
+		benchmarkObjLoader<NormalVertex>(modelPath, runs, false),
+		benchmarkObjLoader<DepthVertex>(modelPath, runs, false),
+	};
+
+	double megabytes = fileStat.st_size / (1024.0 * 1024.0);
+	std::cout << "ObjLoader over " << runs << " runs of " << modelPath << " (" << megabytes << " MB):" << std::endl;
+	for (size_t x = 0; x < sizeof(results) / sizeof(results[0]); x++) {
+		std::cout << "  " << names[x] << ": median " << results[x].milliseconds << " ms (" << megabytes / (results[x].milliseconds / 1000.0) << " MB/s), " << results[x].vertexCount
+			<< " vertices, peak resident growth " << results[x].peakGrowth / (1024.0 * 1024.0) << " MB" << std::endl;
+	}
+	if (!resetPeakResidentBytes()) {
+		std::cout << "  the peak resident set size cannot be reset here, the growths after the first one are lower bounds" << std::endl;
+	}
+}
+
+void Engine::benchmarkMeshlets(uint32_t runs) {
+	MeshCache cache;
+	if (runs == 0 || !cache.open(MeshCache::cachePathFor(modelPath), modelPath, sizeof(Vertex), meshCacheSettings(streamingObj))) {
+		std::cerr << "failed to open the mesh cache of " << modelPath << " for the meshlet benchmark" << std::endl;
+		return;
+	}
+
+	std::vector<uint32_t> materialStarts;
+	for (const auto& range : cache.materialRanges()) {
+		materialStarts.push_back(range.firstIndex / 3);
+	}
+
+	MeshletData data;
+	MeshletBuildStats stats;
+	std::vector<double> throughput;
+	for (uint32_t x = 0; x < runs; x++) {
+		stats = buildMeshlets(data, cache.vertices<Vertex>(), cache.vertexCount(), cache.indices(), cache.indexCount(), materialStarts);
+		throughput.push_back(stats.trianglesPerSecond);
+	}
+	std::sort(throughput.begin(), throughput.end());
+
+	std::cout << "Meshlet builder over " << runs << " runs of " << stats.triangleCount << " triangles into " << stats.meshletCount << " meshlets: median " << throughput[runs / 2] / 1e6
+		<< " Mtriangles/s, best " << throughput.back() / 1e6 << " Mtriangles/s" << std::endl;
+}
+
+void Engine::benchmarkVertexFrames(uint32_t runs) {
+	std::string failure;
+	if (checkTangentFrames(failure)) {
+		std::cout << "Tangent frame check passed" << std::endl;
+	} else {
+		std::cerr << "Tangent frame check failed: " << failure << std::endl;
+	}
+
+	MeshCache cache;
+	if (runs == 0 || !cache.open(MeshCache::cachePathFor(modelPath), modelPath, sizeof(Vertex), meshCacheSettings(streamingObj))) {
+		std::cerr << "failed to open the mesh cache of " << modelPath << " for the vertex frame benchmark" << std::endl;
+		return;
+	}
+
+	std::vector<TangentVertex> source(cache.vertexCount());
+	for (uint32_t x = 0; x < cache.vertexCount(); x++) {
+		const Vertex& vertex = cache.vertices<Vertex>()[x];
+		source[x] = {vertex.pos, vertex.nrm, vertex.texCoord, glm::vec4(0.0f)};
+	}
+
+	std::cout << "Vertex frames over " << runs << " runs of " << cache.indexCount() / 3 << " triangles:" << std::endl;
+	for (unsigned int threadCount : {1u, defaultThreadCount()}) {
+		std::vector<double> normalThroughput;
+		std::vector<double> tangentThroughput;
+		for (uint32_t x = 0; x < runs; x++) {
+			std::vector<TangentVertex> vertices = source;
+			std::vector<uint32_t> indices(cache.indices(), cache.indices() + cache.indexCount());
+			normalThroughput.push_back(generateNormals(vertices, indices, NORMAL_CREASE_ANGLE, threadCount).trianglesPerSecond);
+			tangentThroughput.push_back(generateTangents(vertices, indices, threadCount).trianglesPerSecond);
+		}
+		std::sort(normalThroughput.begin(), normalThroughput.end());
+		std::sort(tangentThroughput.begin(), tangentThroughput.end());
+		std::cout << "  " << threadCount << " threads: normals median " << normalThroughput[runs / 2] / 1e6 << " Mtriangles/s, tangents median " << tangentThroughput[runs / 2] / 1e6
+			<< " Mtriangles/s" << std::endl;
+	}
+}
+
+// Median milliseconds fn takes over runs calls.
+template <class Fn>
+static double medianMilliseconds(uint32_t runs, Fn fn) {
+	std::vector<double> milliseconds;
+	for (uint32_t x = 0; x < runs; x++) {
+		auto startTime = std::chrono::high_resolution_clock::now();
+		fn();
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+		milliseconds.push_back(elapsed.count());
+	}
+	std::sort(milliseconds.begin(), milliseconds.end());
+	return milliseconds[runs / 2];
+}
+
+// Bounds of count positions stride bytes apart, the same loop for interleaved vertices and a position stream.
+static void positionBounds(const glm::vec3* positions, size_t stride, size_t count, glm::vec3& boundsMin, glm::vec3& boundsMax) {
+	boundsMin = glm::vec3(FLT_MAX);
+	boundsMax = glm::vec3(-FLT_MAX);
+	const uint8_t* position = reinterpret_cast<const uint8_t*>(positions);
+	for (size_t x = 0; x < count; x++, position += stride) {
+		boundsMin = glm::min(boundsMin, *reinterpret_cast<const glm::vec3*>(position));
+		boundsMax = glm::max(boundsMax, *reinterpret_cast<const glm::vec3*>(position));
+	}
+}
+
+void Engine::benchmarkVertexLayouts(uint32_t runs) {
+	if (runs == 0 || modelPath.empty()) {
+		std::cerr << "failed to run the vertex layout benchmark without a model" << std::endl;
+		return;
+	}
+
+	ObjLoader<Vertex> interleaved;
+	interleaved.loadModel(modelPath);
+	ObjLoader<Vertex> streamed;
+	streamed.m_structOfArrays = true;
+	streamed.loadModel(modelPath);
+	const std::vector<Vertex>& vertices = interleaved.m_vertices;
+	const VertexStreams& streams = streamed.m_streams;
+	uint32_t count = static_cast<uint32_t>(vertices.size());
+	uint32_t triangleCount = static_cast<uint32_t>(interleaved.m_indices.size() / 3);
+
+	glm::vec3 boundsMin, boundsMax;
+	Bvh bvh;
+	VertexQuantization quantization;
+	std::vector<Vertex> uploaded(count);
+	double interleavedTimes[] = {
+		medianMilliseconds(runs, [&]() { positionBounds(&vertices[0].pos, sizeof(Vertex), count, boundsMin, boundsMax); }),
+		medianMilliseconds(runs, [&]() {
+			// the CPU tracer gathers the positions of interleaved vertices before it builds
+			std::vector<glm::vec3> positions(count);
+			for (uint32_t x = 0; x < count; x++) {
+				positions[x] = vertices[x].pos;
+			}
+			bvh.build(positions.data(), interleaved.m_indices.data(), triangleCount);
+		}),
+		medianMilliseconds(runs, [&]() { quantization = computeVertexQuantization(packedVertexSource(vertices.data(), count)); }),
+		medianMilliseconds(runs, [&]() {
+			std::vector<Vertex> copy = vertices;
+			std::vector<uint32_t> indices = interleaved.m_indices;
+			generateNormals(copy, indices);
+		}),
+		0.0,
+	};
+	double streamTimes[] = {
+		medianMilliseconds(runs, [&]() { positionBounds(streams.positions.data(), sizeof(glm::vec3), count, boundsMin, boundsMax); }),
+		medianMilliseconds(runs, [&]() { bvh.build(streams.positions.data(), streamed.m_indices.data(), triangleCount); }),
+		medianMilliseconds(runs, [&]() { quantization = computeVertexQuantization(packedVertexSource(streams, 0, count)); }),
+		medianMilliseconds(runs, [&]() {
+			VertexStreams copy = streams;
+			std::vector<uint32_t> indices = streamed.m_indices;
+			generateNormals(copy, indices);
+		}),
+		medianMilliseconds(runs, [&]() { interleaveVertexStreams(streams, 0, count, uploaded.data()); }),
+	};
+
+	const char* names[] = {"bounds", "BVH build", "quantization", "normals (with a copy of the mesh)", "interleave for upload"};
+	std::cout << "Vertex layouts over " << runs << " runs of " << count << " vertices and " << triangleCount << " triangles, median ms interleaved / streams:" << std::endl;
+	for (size_t x = 0; x < sizeof(names) / sizeof(names[0]); x++) {
+		std::cout << "  " << names[x] << ": " << interleavedTimes[x] << " / " << streamTimes[x] << std::endl;
+	}
 }
 
-void Engine::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+// Number tokens for the float parser benchmark, each followed by a '\0' so strtod stops at its end.
+struct FloatTokens {
+	std::string text;
+	std::vector<uint32_t> starts;
+
+	void add(const std::string& token) {
+		starts.push_back(static_cast<uint32_t>(text.size()));
+		text += token;
+		text += '\0';
+	}
+	const char* begin(size_t x) const { return text.data() + starts[x]; }
+	const char* end(size_t x) const { return begin(x) + strlen(begin(x)); }
+};
+
+// Tokens like the ones exporters write: mostly "%.6f", some with other precisions, magnitudes and a '+'.
+static FloatTokens randomFloatTokens(size_t count) {
+	std::mt19937_64 random(42);
+	std::uniform_real_distribution<double> unit(-1.0, 1.0);
+	FloatTokens tokens;
+	char token[64];
+	for (size_t x = 0; x < count; x++) {
+		uint64_t kind = random() % 8;
+		double value = unit(random) * std::pow(10.0, static_cast<double>(random() % 7));
+		if (kind < 5) {
+			snprintf(token, sizeof(token), "%.6f", value);
+		} else if (kind == 5) {
+			snprintf(token, sizeof(token), "%.*f", static_cast<int>(random() % 10), value);
+		} else if (kind == 6) {
+			snprintf(token, sizeof(token), "+%.4f", std::fabs(value));
+		} else {
+			snprintf(token, sizeof(token), "%lld", static_cast<long long>(value));
+		}
+		tokens.add(token);
+	}
+	return tokens;
+}
+
+// Tokens around the limits of the fast path: 15 and 16 significant digits, tokens of 16 bytes and more,
+// leading zeros, missing digits around the '.', exponents and malformed input.
+static FloatTokens adversarialFloatTokens() {
+	FloatTokens tokens;
+	const char* fixed[] = {"0", "-0", "+0", "0.0", "-0.0", ".5", "-.5", "5.", "-5.", ".", "-", "+", "+-1", "--1", "1-", "1..2", "1.2.3",
+		"1e5", "1E5", "1.5e-3", "-2.5E+2", "1e", "1e+", "0x10", "inf", "nan", "00000000000001.5", "000000000000000000001",
+		"999999999999999", "9999999999999999", "123456789012345", "1234567890123456", "9007199254740993", "0.000000000000001",
+		"0.0000000000000001", "3.14159265358979", "3.141592653589793", "-1234567.1234567", "-1234567.12345678", "0.1", "0.2", "0.3",
+		"1.7976931348623157e308", "4.9e-324", "123456789.123456", "12345678901234.5", "-0.000001", "+999999.999999"};
+	for (const char* token : fixed) {
+		tokens.add(token);
+	}
+
+	// every length up to 20 digits with the '.' at every position, with and without a sign
+	std::mt19937_64 random(7);
+	for (uint32_t digits = 1; digits <= 20; digits++) {
+		for (uint32_t dot = 0; dot <= digits; dot++) {
+			for (const char* sign : {"", "-", "+"}) {
+				std::string token = sign;
+				for (uint32_t x = 0; x < digits; x++) {
+					if (x == dot) {
+						token += '.';
+					}
+					token += static_cast<char>('0' + random() % 10);
+				}
+				if (dot == digits) {
+					token += '.';
+				}
+				tokens.add(token);
+			}
+		}
+	}
+	return tokens;
+}
+
+// Mismatches of the fast path against strtod over tokens, each one also parsed ending on a page boundary
+// so that the fast path cannot read past it. Prints the first few.
+static size_t checkFloatParser(const FloatTokens& tokens, size_t& fastCount) {
+	std::vector<char> pages(3 * 4096);
+	char* pageEnd = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(pages.data()) + 2 * 4096) & ~uintptr_t(4095));
+
+	size_t mismatches = 0;
+	fastCount = 0;
+	for (size_t x = 0; x < tokens.starts.size(); x++) {
+		const char* begin = tokens.begin(x);
+		const char* end = tokens.end(x);
+		char* copy = pageEnd - (end - begin);
+		memcpy(copy, begin, end - begin);
+
+		double fast = 0.0;
+		double atPageEnd = 0.0;
+		double generic = 0.0;
+		bool fastParsed = tinyobj::ParseDouble(begin, end, &fast, tinyobj::PARSE_DOUBLE_FAST);
+		bool pageEndParsed = tinyobj::ParseDouble(copy, pageEnd, &atPageEnd, tinyobj::PARSE_DOUBLE_FAST);
+		bool genericParsed = tinyobj::ParseDouble(begin, end, &generic, tinyobj::PARSE_DOUBLE_GENERIC);
+		char* strtodEnd = nullptr;
+		double expected = strtod(begin, &strtodEnd);
+
+		// the fast path only takes whole tokens strtod and the generic parser accept, and matches strtod to the bit
+		bool wrong = fastParsed != pageEndParsed || (fastParsed && (strtodEnd != end || !genericParsed ||
+			memcmp(&fast, &expected, sizeof(double)) != 0 || memcmp(&atPageEnd, &expected, sizeof(double)) != 0));
+		fastCount += fastParsed ? 1 : 0;
+		if (wrong && mismatches++ < 8) {
+			std::cout << "  mismatch on \"" << begin << "\": fast " << (fastParsed ? std::to_string(fast) : "declined") << ", strtod " << expected << std::endl;
+		}
+	}
+	return mismatches;
+}
+
+void Engine::benchmarkFloatParser(uint32_t runs) {
+	if (runs == 0) {
+		return;
+	}
+
+	FloatTokens randomTokens = randomFloatTokens(1 << 21);
+	FloatTokens adversarialTokens = adversarialFloatTokens();
+	size_t randomFast = 0;
+	size_t adversarialFast = 0;
+	size_t mismatches = checkFloatParser(randomTokens, randomFast) + checkFloatParser(adversarialTokens, adversarialFast);
+
+	size_t count = randomTokens.starts.size();
+	std::vector<const char*> ends(count);
+	for (size_t x = 0; x < count; x++) {
+		ends[x] = randomTokens.end(x);
+	}
+	double sum = 0.0;
+	auto parseAll = [&](tinyobj::parse_double_path_t path) {
+		for (size_t x = 0; x < count; x++) {
+			double value = 0.0;
+			tinyobj::ParseDouble(randomTokens.begin(x), ends[x], &value, path);
+			sum += value;
+		}
+	};
+	double defaultTime = medianMilliseconds(runs, [&]() { parseAll(tinyobj::PARSE_DOUBLE_DEFAULT); });
+	double genericTime = medianMilliseconds(runs, [&]() { parseAll(tinyobj::PARSE_DOUBLE_GENERIC); });
+	double strtodTime = medianMilliseconds(runs, [&]() {
+		for (size_t x = 0; x < count; x++) {
+			sum += strtod(randomTokens.begin(x), nullptr);
+		}
+	});
+
+	std::cout << "Float parser over " << count << " random and " << adversarialTokens.starts.size() << " adversarial tokens: " << mismatches << " mismatches against strtod, fast path took "
+		<< 100.0 * randomFast / count << "% of the random and " << 100.0 * adversarialFast / adversarialTokens.starts.size() << "% of the adversarial tokens" << std::endl;
+#if defined(__SSE4_1__)
+	const char* fastPath = "SSE4.1";
+#else
+	const char* fastPath = "scalar";
+#endif
+	std::cout << "  median over " << runs << " runs: " << count / (defaultTime * 1000.0) << " Mfloats/s with the " << fastPath << " fast path, generic parser " << count / (genericTime * 1000.0) << " Mfloats/s, strtod "
+		<< count / (strtodTime * 1000.0) << " Mfloats/s (checksum " << sum << ")" << std::endl;
+}
+
+// A scene large enough that traversal dominates shading: a ground plane, a grid of spheres standing on it
+// and a soup of small triangles above them, about 900k triangles.
+static void addSyntheticScene(CpuRayTracer& tracer) {
+	std::vector<NormalVertex> vertices;
+	std::vector<uint32_t> indices;
+	vertices.push_back({glm::vec3(-60.0f, 0.0f, -60.0f), glm::vec3(0.0f, 1.0f, 0.0f)});
+	vertices.push_back({glm::vec3(60.0f, 0.0f, -60.0f), glm::vec3(0.0f, 1.0f, 0.0f)});
+	vertices.push_back({glm::vec3(60.0f, 0.0f, 60.0f), glm::vec3(0.0f, 1.0f, 0.0f)});
+	vertices.push_back({glm::vec3(-60.0f, 0.0f, 60.0f), glm::vec3(0.0f, 1.0f, 0.0f)});
+	indices.insert(indices.end(), {0, 2, 1, 0, 3, 2});
+
+	const uint32_t segments = 32;
+	const uint32_t rings = 16;
+	for (int gridZ = -12; gridZ < 12; gridZ++) {
+		for (int gridX = -12; gridX < 12; gridX++) {
+			glm::vec3 center(gridX * 4.0f + 2.0f, 1.5f, gridZ * 4.0f + 2.0f);
+			uint32_t first = static_cast<uint32_t>(vertices.size());
+			for (uint32_t ring = 0; ring <= rings; ring++) {
+				float theta = glm::radians(180.0f * ring / rings);
+				for (uint32_t segment = 0; segment <= segments; segment++) {
+					float phi = glm::radians(360.0f * segment / segments);
+					glm::vec3 normal(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+					vertices.push_back({center + normal * 1.5f, normal});
+				}
+			}
+			for (uint32_t ring = 0; ring < rings; ring++) {
+				for (uint32_t segment = 0; segment < segments; segment++) {
+					uint32_t a = first + ring * (segments + 1) + segment;
+					uint32_t b = a + segments + 1;
+					indices.insert(indices.end(), {a, a + 1, b, a + 1, b + 1, b});
+				}
+			}
+		}
+	}
+
+	std::mt19937 random(7);
+	std::uniform_real_distribution<float> spread(-48.0f, 48.0f);
+	std::uniform_real_distribution<float> height(4.0f, 12.0f);
+	std::uniform_real_distribution<float> offset(-0.3f, 0.3f);
+	for (uint32_t x = 0; x < 300000; x++) {
+		glm::vec3 corner(spread(random), height(random), spread(random));
+		uint32_t first = static_cast<uint32_t>(vertices.size());
+		for (uint32_t y = 0; y < 3; y++) {
+			vertices.push_back({corner + glm::vec3(offset(random), offset(random), offset(random)), glm::vec3(0.0f)});
+		}
+		indices.insert(indices.end(), {first, first + 1, first + 2});
+	}
+
+	std::vector<int32_t> triangleMaterials(indices.size() / 3, -1);
+	tracer.addInstance(vertices.data(), static_cast<uint32_t>(vertices.size()), indices.data(), static_cast<uint32_t>(indices.size()), triangleMaterials.data(), glm::mat4(1.0f));
+}
+
+void Engine::benchmarkTraversal(uint32_t runs) {
+	if (runs == 0) {
+		return;
+	}
+
+	CpuRayTracer tracer;
+	addSyntheticScene(tracer);
+	tracer.build();
+	CpuCamera camera;
+	camera.position = glm::vec3(0.0f, 30.0f, 70.0f);
+	camera.target = glm::vec3(0.0f, 0.0f, 0.0f);
+
+	const char* names[] = {"single", "stream", "packet"};
+	TraversalMode modes[] = {TRAVERSAL_SINGLE, TRAVERSAL_STREAM, TRAVERSAL_PACKET};
+	std::vector<uint8_t> singlePixels;
+	std::vector<uint8_t> pixels;
+	std::ostringstream results;
+	for (uint32_t x = 0; x < 3; x++) {
+		tracer.traversalMode = modes[x];
+		std::vector<double> throughput;
+		for (uint32_t y = 0; y < runs; y++) {
+			CpuRenderStats stats = tracer.render(camera, SCREENWIDTH, SCREENHEIGHT, x == 0 ? singlePixels : pixels);
+			throughput.push_back((stats.primaryRays + stats.shadowRays) / (stats.milliseconds * 1000.0));
+		}
+		std::sort(throughput.begin(), throughput.end());
+
+		// the modes only differ in which of two equally near triangles they report
+		uint32_t differentPixels = 0;
+		for (size_t y = 0; x > 0 && y < pixels.size(); y += 4) {
+			differentPixels += memcmp(&pixels[y], &singlePixels[y], 4) != 0 ? 1 : 0;
+		}
+		results << "  " << names[x] << ": median " << throughput[runs / 2] << " Mrays/s, " << differentPixels << " pixels differ from single" << std::endl;
+	}
+	std::cout << "CPU traversal over " << runs << " runs of " << SCREENWIDTH << "x" << SCREENHEIGHT << " on a synthetic scene:" << std::endl << results.str();
+}
+
+void Engine::quit() {
+	stagingRing.destroy();
+	deviceAllocator.destroy();
+}
+
+void Engine::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, DeviceAllocation& bufferMemory) {
 	VkBufferCreateInfo bufferInfo = {};
 	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 	bufferInfo.size = size;
@@ -687,36 +1963,18 @@ void Engine::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryP
 	VkMemoryRequirements memRequirements;
 	vkGetBufferMemoryRequirements(logicalDevice, buffer, &memRequirements);
 
-	VkMemoryAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-	if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-		throw std::runtime_error("failed to allocate buffer memory!");
-	}
-
-	vkBindBufferMemory(logicalDevice, buffer, bufferMemory, 0);
+	bufferMemory = deviceAllocator.allocate(memRequirements, properties, DEVICE_RESOURCE_LINEAR);
+	vkBindBufferMemory(logicalDevice, buffer, bufferMemory.memory, bufferMemory.offset);
 }
 
-void Engine::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
-	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-	VkBufferCopy copyRegion = {};
-	copyRegion.size = size;
-	vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-
-	endSingleTimeCommands(commandBuffer);
-}
-
-void Engine::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory) {
+void Engine::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, DeviceAllocation& imageMemory, uint32_t mipLevels) {
 	VkImageCreateInfo imageInfo = {};
 	imageInfo.sType             = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
 	imageInfo.imageType         = VK_IMAGE_TYPE_2D;
 	imageInfo.extent.width      = width;
 	imageInfo.extent.height     = height;
 	imageInfo.extent.depth      = 1;
-	imageInfo.mipLevels         = 1;
+	imageInfo.mipLevels         = mipLevels;
 	imageInfo.arrayLayers       = 1;
 	imageInfo.format            = format;
 	imageInfo.tiling            = tiling;
@@ -732,27 +1990,20 @@ void Engine::createImage(uint32_t width, uint32_t height, VkFormat format, VkIma
 	VkMemoryRequirements memRequirements;
 	vkGetImageMemoryRequirements(logicalDevice, image, &memRequirements);
 
-	VkMemoryAllocateInfo allocInfo = {};
-	allocInfo.sType                = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize       = memRequirements.size;
-	allocInfo.memoryTypeIndex      = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-	if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-		throw std::runtime_error("failed to allocate image memory!");
-	}
-
-	vkBindImageMemory(logicalDevice, image, imageMemory, 0);
+	imageMemory = deviceAllocator.allocate(memRequirements, properties, tiling == VK_IMAGE_TILING_LINEAR ? DEVICE_RESOURCE_LINEAR : DEVICE_RESOURCE_OPTIMAL);
+	vkBindImageMemory(logicalDevice, image, imageMemory.memory, imageMemory.offset);
 }
 
-VkImageView Engine::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags) {
+VkImageView Engine::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels, VkComponentMapping components) {
 	VkImageViewCreateInfo viewInfo = {};
 	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
 	viewInfo.image = image;
 	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
 	viewInfo.format = format;
+	viewInfo.components = components;
 	viewInfo.subresourceRange.aspectMask = aspectFlags;
 	viewInfo.subresourceRange.baseMipLevel = 0;
-	viewInfo.subresourceRange.levelCount = 1;
+	viewInfo.subresourceRange.levelCount = mipLevels;
 	viewInfo.subresourceRange.baseArrayLayer = 0;
 	viewInfo.subresourceRange.layerCount = 1;
 
@@ -764,110 +2015,27 @@ VkImageView Engine::createImageView(VkImage image, VkFormat format, VkImageAspec
 	return imageView;
 }
 
-void Engine::transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout) {
-	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-	VkImageMemoryBarrier barrier = {};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.oldLayout = oldLayout;
-	barrier.newLayout = newLayout;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-
-	barrier.image = image;
-	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	barrier.subresourceRange.baseMipLevel = 0;
-	barrier.subresourceRange.levelCount = 1;
-	barrier.subresourceRange.baseArrayLayer = 0;
-	barrier.subresourceRange.layerCount = 1;
-
-	barrier.srcAccessMask = 0;
-	barrier.dstAccessMask = 0;
-
-	VkPipelineStageFlags sourceStage;
-	VkPipelineStageFlags destinationStage;
-
-	if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
-		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-
-		if (format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT) {
-			barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
-		}
-	}
-	else {
-		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	}
-
-	if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && (newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL || newLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL)) {
-		barrier.srcAccessMask = 0;
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-		sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-		destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+// Without mips and with more than one level the chain is blitted from level 0 on the GPU, which
+// only works for RGBA8. Block compressed pixels and mips are uploaded as they are.
+void Engine::createTextureImage(uint8_t* pixels, int texWidth, int texHeight, VkFormat format, const uint8_t* mips, uint32_t mipLevels, VkImage& textureImage, DeviceAllocation& textureImageMemory) {
+	bool blitMips = mipLevels > 1 && !mips;
+	VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	if (blitMips) {
+		usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
 	}
-	else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	createImage(texWidth, texHeight, format, VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory, mipLevels);
 
-		sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-		destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-	}
-	else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
-		barrier.srcAccessMask = 0;
-		barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-
-		sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-		destinationStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-	}
-	else {
-		throw std::invalid_argument("unsupported layout transition!");
+	uploadBatch.transitionImageLayout(textureImage, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
+	if (blitMips) {
+		uploadBatch.copyToImage(pixels, texWidth, texHeight, textureImage);
+		uploadBatch.generateMipmaps(textureImage, texWidth, texHeight, mipLevels);
+	} else {
+		uploadBatch.copyToImage(pixels, texWidth, texHeight, textureImage, mips, mipLevels, format);
+		uploadBatch.transitionImageLayout(textureImage, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevels);
 	}
-
-	vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-	endSingleTimeCommands(commandBuffer);
 }
 
-void Engine::createTextureImage(uint8_t* pixels, int texWidth, int texHeight, int texChannels, VkImage& textureImage, VkDeviceMemory& textureImageMemory) {
-	VkDeviceSize imageSize = texWidth * texHeight * 4;
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-	void* data;
-	vkMapMemory(logicalDevice, stagingBufferMemory, 0, imageSize, 0, &data);
-	memcpy(data, pixels, static_cast<size_t>(imageSize));
-	vkUnmapMemory(logicalDevice, stagingBufferMemory);
-
-	createImage(texWidth, texHeight, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
-
-	transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-	copyBufferToImage(stagingBuffer, textureImage, texWidth, texHeight);
-	transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-
-	vkDestroyBuffer(logicalDevice, stagingBuffer, nullptr);
-	vkFreeMemory(logicalDevice, stagingBufferMemory, nullptr);
-}
-
-void Engine::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) {
-	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-	VkBufferImageCopy region = {};
-	region.bufferOffset = 0;
-	region.bufferRowLength = 0;
-	region.bufferImageHeight = 0;
-	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	region.imageSubresource.mipLevel = 0;
-	region.imageSubresource.baseArrayLayer = 0;
-	region.imageSubresource.layerCount = 1;
-	region.imageOffset = {0, 0, 0};
-	region.imageExtent = {width, height, 1};
-
-	vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-	endSingleTimeCommands(commandBuffer);
-}
-
-VkSampler Engine::createTextureSampler() {
+VkSampler Engine::createTextureSampler(uint32_t mipLevels) {
 	VkSamplerCreateInfo samplerInfo = {};
 	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
 	samplerInfo.magFilter = VK_FILTER_LINEAR;
@@ -885,23 +2053,12 @@ VkSampler Engine::createTextureSampler() {
 	samplerInfo.compareEnable = VK_FALSE;
 	samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
 	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerInfo.minLod = 0.0f;
+	samplerInfo.maxLod = static_cast<float>(mipLevels);
 
 	VkSampler textureSampler;
 	if (vkCreateSampler(logicalDevice, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create texture sampler!");
 	}
 	return textureSampler;
-}
-
-uint32_t Engine::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
-	VkPhysicalDeviceMemoryProperties memProperties;
-	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-
-	for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-		if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-			return i;
-		}
-	}
-
-	throw std::runtime_error("failed to find suitable memory type!");
 }
\ No newline at end of file
@@ -8,6 +8,21 @@
 #include <sstream>
 
 #include "obj_loader.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "meshlet.h"
+#include "mesh_simplifier.h"
+#include "mesh_normals.h"
+#include "cpu_raytracer.h"
+#include "staging_ring.h"
+#include "upload_batch.h"
+#include "texture_decoder.h"
+#include "mipmap.h"
+#include "block_compression.h"
+#include "packed_vertex.h"
+#include "device_allocator.h"
+#include "memory_usage.h"
+#include "scene.h"
 
 #define VK_QUEUED_FRAMES 2
 #define VK_MAX_POSSIBLE_BACK_BUFFERS 16
@@ -17,12 +32,30 @@ struct Vertex {
 	glm::vec3 nrm;
 	glm::vec3 color;
 	glm::vec2 texCoord;
-	int matID = 0;
 
 	static auto getBindingDescription();
 	static auto getAttributeDescriptions();
 };
 
+// lean vertex types, ObjLoader skips the attributes they lack. Depth only passes and shadow BVHs need no more
+// than positions, untextured shading adds normals.
+struct DepthVertex {
+	glm::vec3 pos;
+};
+
+struct NormalVertex {
+	glm::vec3 pos;
+	glm::vec3 nrm;
+};
+
+// normal mapped vertex, ObjLoader fills tangent with MikkTSpace compatible frames, bitangent = tangent.w * cross(nrm, tangent)
+struct TangentVertex {
+	glm::vec3 pos;
+	glm::vec3 nrm;
+	glm::vec2 texCoord;
+	glm::vec4 tangent;
+};
+
 struct UniformBufferObject {
 	glm::mat4 model;
 	glm::mat4 view;
@@ -42,10 +75,51 @@ struct GeometryInstance {
 	uint32_t indexCount;
 	VkDeviceSize indexOffset;
 	glm::mat4x4 transform;
+	// scene mesh the instance draws and the level of detail indexOffset and indexCount point at
+	uint32_t mesh = 0;
+	uint32_t lod = 0;
+};
+
+// Where a mesh of the scene lives in the shared buffers. Its indices count from firstVertex, instances point
+// vertexOffset there. Its simplified levels follow its source triangles, level firstIndex counts from firstIndex.
+struct SceneMeshRange {
+	uint32_t firstVertex;
+	uint32_t vertexCount;
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	std::vector<MeshLod> lods;
+	// bounding sphere to pick the levels by
+	glm::vec3 center;
+	float radius;
+};
+
+// a mesh as it comes off a loader thread, defined in engine.cpp
+struct LoadedMesh;
+
+// How Engine::initialize sets the engine up, main.cpp fills it in from the command line.
+struct EngineOptions {
+	// render into offscreen images instead of a window
+	bool headless = false;
+	// keep the geometry on the host for the CPU reference renderer
+	bool referenceRenderer = false;
+	// upload on the graphics queue even when the device has a transfer only queue family
+	bool singleQueue = false;
+	// blit mip chains on the GPU instead of building them on the decode threads
+	bool gpuMipmaps = false;
+	TextureCompression textureCompression = TEXTURE_COMPRESSION_NONE;
+	// quantize the vertex buffer to 16 bytes a vertex
+	bool packedVertices = false;
+	// convert .obj files while they are read in bounded windows
+	bool streamingObj = false;
+	// a scene manifest, see scene.h, without one the engine loads a single corgi
+	std::string scenePath;
 };
 
 class Engine {
 private:
+	// headless engines render into offscreen images instead of a window and never touch GLFW or a surface
+	bool headless = false;
+
 	GLFWwindow* window;
 	VkSurfaceKHR surface;
 
@@ -57,12 +131,28 @@ private:
 	uint32_t graphicsQueueIndex;
 	VkQueue graphicsQueue;
 
+	// the same as the graphics queue when there is no transfer only family or singleQueue is set
+	bool singleQueue = false;
+	uint32_t transferQueueIndex;
+	VkQueue transferQueue;
+
+	// mip chains are blitted on the GPU instead of built by the texture decoder
+	bool gpuMipmaps = false;
+	// textures are encoded to BC formats on the decode threads and cached as KTX2, needs textureCompressionBC
+	TextureCompression textureCompression = TEXTURE_COMPRESSION_NONE;
+	// the vertex buffer holds packedVertexLayout vertices quantized by vertexQuantization instead of Vertex
+	bool packedVertices = false;
+	// .obj files are converted while they are read in bounded windows, instead of mapped and parsed whole
+	bool streamingObj = false;
+	PackedVertexLayout packedVertexLayout;
+	VertexQuantization vertexQuantization;
+
 	VkSurfaceFormatKHR surfaceFormat;
 	VkImageSubresourceRange imageRange;
 	VkPresentModeKHR presentMode;
 
 	VkImage depthImage;
-	VkDeviceMemory depthImageMemory;
+	DeviceAllocation depthImageMemory;
 	VkImageView depthImageView;
 
   	VkCommandPool commandPool[VK_QUEUED_FRAMES];
@@ -73,6 +163,11 @@ private:
 
 	VkDescriptorPool descriptorPool;
 
+	// every buffer and image gets its memory from here, every host to device upload goes through the ring
+	DeviceAllocator deviceAllocator;
+	StagingRing stagingRing;
+	UploadBatch uploadBatch;
+
 	VkSwapchainKHR swapchain;
 	VkRenderPass renderPass;
 
@@ -83,28 +178,56 @@ private:
 	VkImageView backBufferView[VK_MAX_POSSIBLE_BACK_BUFFERS];
 	VkFramebuffer framebuffer[VK_MAX_POSSIBLE_BACK_BUFFERS];
 
+	// headless only, backing memory of the offscreen back buffers and the host buffers they are copied to
+	DeviceAllocation backBufferMemory[VK_MAX_POSSIBLE_BACK_BUFFERS];
+	VkBuffer readbackBuffer[VK_MAX_POSSIBLE_BACK_BUFFERS];
+	DeviceAllocation readbackBufferMemory[VK_MAX_POSSIBLE_BACK_BUFFERS];
+
 	VkDescriptorSetLayout descriptorSetLayout;
 
+	// source triangles and vertices of every mesh of the scene together
 	uint32_t indexCount;
 	uint32_t vertexCount;
 
 	VkBuffer vertexBuffer;
-	VkDeviceMemory vertexBufferMemory;
+	DeviceAllocation vertexBufferMemory;
 
 	VkBuffer indexBuffer;
-	VkDeviceMemory indexBufferMemory;
+	DeviceAllocation indexBufferMemory;
 
 	VkBuffer uniformBuffer;
-	VkDeviceMemory uniformBufferMemory;
+	DeviceAllocation uniformBufferMemory;
 
 	VkBuffer matColorBuffer;
-	VkDeviceMemory matColorBufferMemory;
+	DeviceAllocation matColorBufferMemory;
+	// material of every triangle, shaders look up matColorBuffer with it by primitive ID
+	VkBuffer matIndexBuffer;
+	DeviceAllocation matIndexBufferMemory;
+	// every mesh is sorted by material, one range per material to draw or build geometries from, firstIndex counts
+	// from the start of the index buffer
+	std::vector<MaterialRange> materialRanges;
+	// clusters of the index buffer with bounds and normal cones, for culling and streaming per cluster. Meshlet
+	// ranges number materialRanges, their vertices count from the firstVertex of the mesh of that range.
+	MeshletData meshlets;
+	// the first mesh of the scene, the benchmarks run on it
+	std::string modelPath;
+	// the meshes of the scene packed one after the other into the vertex, index and material index buffers
+	std::vector<SceneMeshRange> sceneMeshes;
 
 	std::vector<VkImage> textureImageList;
-	std::vector<VkDeviceMemory> textureImageMemoryList;
+	std::vector<DeviceAllocation> textureImageMemoryList;
 	std::vector<VkImageView> textureImageViewList;
 	std::vector<VkSampler> textureSamplerList;
 
+	// host copies of the scene buffers, only kept for the CPU reference renderer
+	bool retainHostGeometry = false;
+	std::vector<Vertex> hostVertices;
+	std::vector<uint8_t> hostPackedVertices;
+	std::vector<uint32_t> hostIndices;
+	std::vector<int32_t> hostMaterialIndices;
+	std::vector<MatrialObj> hostMaterials;
+
+	bool rayTracingSupported = false;
 	VkPhysicalDeviceRayTracingPropertiesNV raytracingProperties;
 	std::vector<GeometryInstance> geometryInstances;
 
@@ -115,6 +238,9 @@ private:
 	void initializeSurface();
 	void initializeCommandBuffers();
 	void initializeDescriptorPool();
+	void initializeDeviceAllocator();
+	void initializeStagingRing();
+	void initializeMipmapMode();
 
 	void initializeSwapchain();
 	void initializeRenderPass();
@@ -122,36 +248,65 @@ private:
 	void initializeDepthResources();
 	void initializeFrameBuffer();
 
-	void initializeModel(const std::string& filename);
-	void initializeVertexBuffer(const std::vector<Vertex>& vertex);
-	void initializeIndexBuffer(const std::vector<uint32_t>& indices);
+	void initializeOffscreenFormat();
+	void initializeOffscreenImages();
+	void initializeReadbackBuffers();
+
+	void initializeScene(const SceneDescription& scene);
+	void initializeVertexBuffer(const std::vector<LoadedMesh>& meshes);
+	void initializeIndexBuffer(const std::vector<LoadedMesh>& meshes);
 	void initializeMaterialBuffer(const std::vector<MatrialObj>& materials);
+	void initializeMaterialIndexBuffer(const std::vector<LoadedMesh>& meshes);
+	void initializeHostGeometry(std::vector<LoadedMesh>& meshes, std::vector<MatrialObj>& materials);
 	void initializeTextureImages(const std::vector<std::string>& textures);
 
 	void initializeDescriptorSetLayout();
 	void initializeUniformBuffer();
 
 	void initializeRayTracing();
-	void initializeGeometryInstances();
+	void initializeGeometryInstances(const SceneDescription& scene);
 
-	VkCommandBuffer beginSingleTimeCommands();
-	void endSingleTimeCommands(VkCommandBuffer commandBuffer);
+	void renderOffscreenFrame(uint32_t frameIndex);
+	void readbackFrame(uint32_t frameIndex, std::vector<uint8_t>& pixels);
 
-	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
-	void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
+	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, DeviceAllocation& bufferMemory);
 
-	void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
-	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags);
-	void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout);
+	void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, DeviceAllocation& imageMemory, uint32_t mipLevels = 1);
+	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels = 1, VkComponentMapping components = {});
 
-	void createTextureImage(uint8_t* pixels, int texWidth, int texHeight, int texChannels, VkImage& textureImage, VkDeviceMemory& textureImageMemory);
-	void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
+	void createTextureImage(uint8_t* pixels, int texWidth, int texHeight, VkFormat format, const uint8_t* mips, uint32_t mipLevels, VkImage& textureImage, DeviceAllocation& textureImageMemory);
 
-	VkSampler createTextureSampler();
+	VkSampler createTextureSampler(uint32_t mipLevels);
 
-	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
 public:
-	void initialize();
+	void initialize(const EngineOptions& options = EngineOptions());
 	void start();
 	void quit();
+
+	// Headless only: renders frameCount frames, reports the frame time and writes the last frame to outputPath as a PPM.
+	void renderHeadless(uint32_t frameCount, const std::string& outputPath);
+	// Reference renderer only: traces the geometry instances on the CPU and writes the image to outputPath as a PPM.
+	// With packed vertices it also traces the decoded vertex buffer into outputPath with a _packed suffix and
+	// reports how far both the image and the attributes are off. A lodPixelError above 0 also traces the levels of
+	// detail picked for that error into outputPath with a _lod suffix.
+	void renderReference(const std::string& outputPath, TraversalMode traversalMode = TRAVERSAL_PACKET, float lodPixelError = 0.0f);
+	// Points every geometry instance at the coarsest level of detail that stays within maxPixelError on screen.
+	void selectLods(const glm::vec3& cameraPosition, float fovY, uint32_t viewportHeight, float maxPixelError);
+	// Rebuilds the meshlets of the loaded model from its mesh cache runs times and reports the throughput.
+	void benchmarkMeshlets(uint32_t runs);
+	// Loads the .obj of the loaded model runs times into every vertex type, and streamed into Vertex, and reports the
+	// median load times and how far each grows the resident set size.
+	void benchmarkLoader(uint32_t runs);
+	// Checks the tangent frames of a plain and a mirrored quad, then regenerates the normals and tangents of the loaded
+	// model from its mesh cache runs times, on one thread and on all of them, and reports the throughput.
+	void benchmarkVertexFrames(uint32_t runs);
+	// Loads the .obj of the loaded model as interleaved vertices and as vertex streams and reports how long bounds, BVH
+	// builds, quantization and normal generation take on either, median over runs.
+	void benchmarkVertexLayouts(uint32_t runs);
+	// Checks the fast path of the .obj number parser against strtod on random and adversarial tokens and reports
+	// the median parse throughput of the loader's parser, the generic parser alone and strtod over runs.
+	void benchmarkFloatParser(uint32_t runs);
+	// Renders a synthetic scene of about 900k triangles on the CPU runs times with every traversal mode and
+	// reports the median throughput and how many pixels differ from single ray traversal.
+	void benchmarkTraversal(uint32_t runs);
 };
\ No newline at end of file
@@ -0,0 +1,245 @@
+#include "ktx2.h"
+#include "block_compression.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+static const uint8_t ktx2Identifier[12] = {0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n'};
+
+// keys sort after the standard KTX ones, as the key/value data must be sorted
+static const char* sourceHashKey = "vkray.sourceHash";
+static const char* encoderVersionKey = "vkray.encoderVersion";
+static const char* writerKey = "KTXwriter";
+static const char* writerValue = "vkray texture cache";
+
+struct Ktx2Header {
+	uint8_t identifier[12];
+	uint32_t vkFormat;
+	uint32_t typeSize;
+	uint32_t pixelWidth;
+	uint32_t pixelHeight;
+	uint32_t pixelDepth;
+	uint32_t layerCount;
+	uint32_t faceCount;
+	uint32_t levelCount;
+	uint32_t supercompressionScheme;
+
+	uint32_t dfdByteOffset;
+	uint32_t dfdByteLength;
+	uint32_t kvdByteOffset;
+	uint32_t kvdByteLength;
+	uint64_t sgdByteOffset;
+	uint64_t sgdByteLength;
+};
+static_assert(sizeof(Ktx2Header) == 80, "KTX2 header must not be padded");
+
+struct Ktx2Level {
+	uint64_t byteOffset;
+	uint64_t byteLength;
+	uint64_t uncompressedByteLength;
+};
+
+// Basic data format descriptor of a 4x4 block format: one sample per 64 bit half,
+// channel ids as the Khronos data format spec defines them for the color model.
+static bool describeFormat(VkFormat format, std::vector<uint32_t>& dfd) {
+	uint32_t model;
+	std::vector<uint32_t> channels;
+	switch (format) {
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+		model = 128;
+		channels = {0};
+		break;
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+		model = 131;
+		channels = {0};
+		break;
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+		model = 132;
+		channels = {0, 1};
+		break;
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+		model = 134;
+		channels = {0};
+		break;
+	default:
+		return false;
+	}
+
+	uint32_t blockBytes = formatBlockBytes(format);
+	uint32_t sampleBits = blockBytes * 8 / static_cast<uint32_t>(channels.size());
+	uint32_t blockSize = 24 + 16 * static_cast<uint32_t>(channels.size());
+
+	dfd.clear();
+	dfd.push_back(4 + blockSize);
+	dfd.push_back(0);
+	dfd.push_back(2 | blockSize << 16);
+	// BT.709 primaries, linear transfer, straight alpha
+	dfd.push_back(model | 1 << 8 | 1 << 16);
+	dfd.push_back(3 | 3 << 8);
+	dfd.push_back(blockBytes);
+	dfd.push_back(0);
+	for (size_t x = 0; x < channels.size(); x++) {
+		dfd.push_back(static_cast<uint32_t>(x) * sampleBits | (sampleBits - 1) << 16 | channels[x] << 24);
+		dfd.push_back(0);
+		dfd.push_back(0);
+		dfd.push_back(0xffffffffu);
+	}
+	return true;
+}
+
+static void appendKeyValue(std::vector<uint8_t>& kvd, const char* key, const void* value, uint32_t valueSize) {
+	uint32_t keyLength = static_cast<uint32_t>(strlen(key)) + 1;
+	uint32_t length = keyLength + valueSize;
+	const uint8_t* lengthBytes = reinterpret_cast<const uint8_t*>(&length);
+	kvd.insert(kvd.end(), lengthBytes, lengthBytes + sizeof(length));
+	kvd.insert(kvd.end(), key, key + keyLength);
+	kvd.insert(kvd.end(), static_cast<const uint8_t*>(value), static_cast<const uint8_t*>(value) + valueSize);
+	kvd.resize((kvd.size() + 3) & ~size_t(3));
+}
+
+bool writeKtx2(const std::string& path, const Ktx2Image& image, const uint8_t* levels, uint64_t sourceHash) {
+	std::vector<uint32_t> dfd;
+	if (!describeFormat(image.format, dfd)) {
+		return false;
+	}
+
+	uint32_t encoderVersion = KTX2_ENCODER_VERSION;
+	std::vector<uint8_t> kvd;
+	appendKeyValue(kvd, writerKey, writerValue, static_cast<uint32_t>(strlen(writerValue)) + 1);
+	appendKeyValue(kvd, encoderVersionKey, &encoderVersion, sizeof(encoderVersion));
+	appendKeyValue(kvd, sourceHashKey, &sourceHash, sizeof(sourceHash));
+
+	Ktx2Header header = {};
+	memcpy(header.identifier, ktx2Identifier, sizeof(ktx2Identifier));
+	header.vkFormat = image.format;
+	header.typeSize = 1;
+	header.pixelWidth = image.width;
+	header.pixelHeight = image.height;
+	header.faceCount = 1;
+	header.levelCount = image.mipLevels;
+	header.dfdByteOffset = static_cast<uint32_t>(sizeof(Ktx2Header) + sizeof(Ktx2Level) * image.mipLevels);
+	header.dfdByteLength = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+	header.kvdByteOffset = header.dfdByteOffset + header.dfdByteLength;
+	header.kvdByteLength = static_cast<uint32_t>(kvd.size());
+
+	// level data is aligned to the block size and stored smallest level first
+	std::vector<Ktx2Level> levelIndex(image.mipLevels);
+	std::vector<size_t> packedOffset(image.mipLevels);
+	uint64_t alignment = formatBlockBytes(image.format);
+	uint64_t offset = header.kvdByteOffset + header.kvdByteLength;
+	size_t packed = 0;
+	for (uint32_t level = 0; level < image.mipLevels; level++) {
+		packedOffset[level] = packed;
+		packed += textureLevelSize(image.format, std::max(1u, image.width >> level), std::max(1u, image.height >> level));
+	}
+	for (uint32_t level = image.mipLevels; level-- > 0;) {
+		offset = (offset + alignment - 1) & ~(alignment - 1);
+		levelIndex[level].byteOffset = offset;
+		levelIndex[level].byteLength = textureLevelSize(image.format, std::max(1u, image.width >> level), std::max(1u, image.height >> level));
+		levelIndex[level].uncompressedByteLength = levelIndex[level].byteLength;
+		offset += levelIndex[level].byteLength;
+	}
+
+	// renamed into place once complete, like the mesh cache
+	std::string temporaryPath = path + ".tmp";
+	{
+		std::ofstream stream(temporaryPath, std::ios::binary | std::ios::trunc);
+		if (!stream) {
+			return false;
+		}
+
+		stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		stream.write(reinterpret_cast<const char*>(levelIndex.data()), static_cast<std::streamsize>(levelIndex.size() * sizeof(Ktx2Level)));
+		stream.write(reinterpret_cast<const char*>(dfd.data()), header.dfdByteLength);
+		stream.write(reinterpret_cast<const char*>(kvd.data()), header.kvdByteLength);
+
+		const char padding[16] = {};
+		uint64_t written = header.kvdByteOffset + header.kvdByteLength;
+		for (uint32_t level = image.mipLevels; level-- > 0;) {
+			stream.write(padding, static_cast<std::streamsize>(levelIndex[level].byteOffset - written));
+			stream.write(reinterpret_cast<const char*>(levels + packedOffset[level]), static_cast<std::streamsize>(levelIndex[level].byteLength));
+			written = levelIndex[level].byteOffset + levelIndex[level].byteLength;
+		}
+
+		if (!stream) {
+			return false;
+		}
+	}
+
+	std::remove(path.c_str());
+	return std::rename(temporaryPath.c_str(), path.c_str()) == 0;
+}
+
+// Looks up a value in the key/value data, false when the key is missing or the value has another size.
+static bool findKeyValue(const uint8_t* kvd, uint32_t kvdLength, const char* key, void* value, uint32_t valueSize) {
+	uint32_t keyLength = static_cast<uint32_t>(strlen(key)) + 1;
+	uint32_t offset = 0;
+	while (offset + sizeof(uint32_t) <= kvdLength) {
+		uint32_t length;
+		memcpy(&length, kvd + offset, sizeof(length));
+		offset += sizeof(uint32_t);
+		if (length > kvdLength - offset) {
+			return false;
+		}
+		if (length == keyLength + valueSize && memcmp(kvd + offset, key, keyLength) == 0) {
+			memcpy(value, kvd + offset + keyLength, valueSize);
+			return true;
+		}
+		offset = (offset + length + 3) & ~3u;
+	}
+	return false;
+}
+
+bool readKtx2(const std::string& path, uint64_t sourceHash, Ktx2Image& image, uint8_t*& levels) {
+	MappedFile file;
+	if (!file.open(path) || file.size() < sizeof(Ktx2Header)) {
+		return false;
+	}
+
+	Ktx2Header header;
+	memcpy(&header, file.data(), sizeof(header));
+	VkFormat format = static_cast<VkFormat>(header.vkFormat);
+	if (memcmp(header.identifier, ktx2Identifier, sizeof(ktx2Identifier)) != 0 || !isBlockCompressed(format) || header.pixelWidth == 0 || header.pixelHeight == 0 || header.pixelDepth != 0 ||
+		header.layerCount != 0 || header.faceCount != 1 || header.supercompressionScheme != 0 || header.levelCount == 0 || header.levelCount > 32) {
+		return false;
+	}
+	if (sizeof(Ktx2Header) + sizeof(Ktx2Level) * header.levelCount > file.size() || static_cast<uint64_t>(header.kvdByteOffset) + header.kvdByteLength > file.size()) {
+		return false;
+	}
+
+	uint64_t storedHash = 0;
+	uint32_t storedVersion = 0;
+	const uint8_t* kvd = file.data() + header.kvdByteOffset;
+	if (!findKeyValue(kvd, header.kvdByteLength, sourceHashKey, &storedHash, sizeof(storedHash)) || storedHash != sourceHash ||
+		!findKeyValue(kvd, header.kvdByteLength, encoderVersionKey, &storedVersion, sizeof(storedVersion)) || storedVersion != KTX2_ENCODER_VERSION) {
+		return false;
+	}
+
+	std::vector<Ktx2Level> levelIndex(header.levelCount);
+	memcpy(levelIndex.data(), file.data() + sizeof(Ktx2Header), levelIndex.size() * sizeof(Ktx2Level));
+	size_t packed = 0;
+	for (uint32_t level = 0; level < header.levelCount; level++) {
+		uint64_t size = textureLevelSize(format, std::max(1u, header.pixelWidth >> level), std::max(1u, header.pixelHeight >> level));
+		if (levelIndex[level].byteLength != size || levelIndex[level].byteOffset > file.size() || size > file.size() - levelIndex[level].byteOffset) {
+			return false;
+		}
+		packed += size;
+	}
+
+	levels = new uint8_t[packed];
+	packed = 0;
+	for (uint32_t level = 0; level < header.levelCount; level++) {
+		memcpy(levels + packed, file.data() + levelIndex[level].byteOffset, levelIndex[level].byteLength);
+		packed += levelIndex[level].byteLength;
+	}
+
+	image.format = format;
+	image.width = header.pixelWidth;
+	image.height = header.pixelHeight;
+	image.mipLevels = header.levelCount;
+	return true;
+}
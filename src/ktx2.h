@@ -0,0 +1,27 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+#include <vulkan/vulkan.h>
+
+// Block compressed textures are cached in KTX2 files next to their source image. The
+// key/value data carries a hash of the source file and the encoder version, bump
+// KTX2_ENCODER_VERSION whenever the encoders would write different blocks.
+#define KTX2_ENCODER_VERSION 1
+#define KTX2_EXTENSION ".ktx2"
+
+struct Ktx2Image {
+	VkFormat format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t mipLevels;
+};
+
+// Writes the levels of a BC1, BC4, BC5 or BC7 image, packed level 0 first the way
+// textureLevelSize describes them. KTX2 stores the smallest level first, this takes
+// care of the order.
+bool writeKtx2(const std::string& path, const Ktx2Image& image, const uint8_t* levels, uint64_t sourceHash);
+// Reads a file written by writeKtx2 back into levels, allocated with new[] and packed
+// level 0 first. Returns false when the file is missing, malformed, not built from a
+// source with this hash or written by another encoder version.
+bool readKtx2(const std::string& path, uint64_t sourceHash, Ktx2Image& image, uint8_t*& levels);
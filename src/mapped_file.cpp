@@ -0,0 +1,128 @@
+#include "mapped_file.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+#ifdef _WIN32
+bool MappedFile::open(const std::string& filename) {
+	close();
+
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr) {
+		CloseHandle(file);
+		return false;
+	}
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == nullptr) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	fileHandle = file;
+	mappingHandle = mapping;
+	mappedData = static_cast<const uint8_t*>(view);
+	mappedSize = static_cast<uint64_t>(fileSize.QuadPart);
+	return true;
+}
+
+void MappedFile::close() {
+	if (mappedData) {
+		UnmapViewOfFile(mappedData);
+	}
+	if (mappingHandle) {
+		CloseHandle(mappingHandle);
+	}
+	if (fileHandle) {
+		CloseHandle(fileHandle);
+	}
+
+	mappedData = nullptr;
+	mappedSize = 0;
+	mappingHandle = nullptr;
+	fileHandle = nullptr;
+}
+#else
+bool MappedFile::open(const std::string& filename) {
+	close();
+
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+
+	void* view = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	if (view == MAP_FAILED) {
+		::close(fd);
+		return false;
+	}
+	madvise(view, static_cast<size_t>(fileStat.st_size), MADV_SEQUENTIAL);
+
+	fileDescriptor = fd;
+	mappedData = static_cast<const uint8_t*>(view);
+	mappedSize = static_cast<uint64_t>(fileStat.st_size);
+	return true;
+}
+
+void MappedFile::close() {
+	if (mappedData) {
+		munmap(const_cast<uint8_t*>(mappedData), static_cast<size_t>(mappedSize));
+	}
+	if (fileDescriptor >= 0) {
+		::close(fileDescriptor);
+	}
+
+	mappedData = nullptr;
+	mappedSize = 0;
+	fileDescriptor = -1;
+}
+#endif
+
+uint64_t hashBytes(const uint8_t* data, uint64_t size) {
+	// 64-bit multiply/xorshift over whole words, the tail is folded in byte by byte
+	const uint64_t prime = 0x100000001b3ull;
+	uint64_t hash = 0xcbf29ce484222325ull ^ size;
+
+	uint64_t wordCount = size / sizeof(uint64_t);
+	for (uint64_t x = 0; x < wordCount; x++) {
+		uint64_t word;
+		memcpy(&word, data + x * sizeof(uint64_t), sizeof(uint64_t));
+		hash = (hash ^ word) * prime;
+		hash ^= hash >> 29;
+	}
+	for (uint64_t x = wordCount * sizeof(uint64_t); x < size; x++) {
+		hash = (hash ^ data[x]) * prime;
+	}
+
+	return hash;
+}
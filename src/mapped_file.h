@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+// Read-only memory mapping of a whole file. The mapping stays valid until
+// close() is called or the object is destroyed. Empty files cannot be mapped.
+class MappedFile {
+private:
+	const uint8_t* mappedData = nullptr;
+	uint64_t mappedSize = 0;
+
+#ifdef _WIN32
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#else
+	int fileDescriptor = -1;
+#endif
+
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	bool open(const std::string& filename);
+	void close();
+
+	const uint8_t* data() const { return mappedData; }
+	uint64_t size() const { return mappedSize; }
+	bool isOpen() const { return mappedData != nullptr; }
+};
+
+// Fast non-cryptographic fingerprint of a byte range, used to tell whether a
+// source file changed under a cache built from it.
+uint64_t hashBytes(const uint8_t* data, uint64_t size);
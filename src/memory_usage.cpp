@@ -0,0 +1,80 @@
+#include "memory_usage.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#elif !defined(__linux__)
+#include <sys/resource.h>
+#endif
+
+#ifdef _WIN32
+uint64_t residentBytes() {
+	PROCESS_MEMORY_COUNTERS counters;
+	return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.WorkingSetSize : 0;
+}
+
+uint64_t peakResidentBytes() {
+	PROCESS_MEMORY_COUNTERS counters;
+	return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+}
+
+bool resetPeakResidentBytes() {
+	return false;
+}
+#elif defined(__linux__)
+// value of a "Name:   1234 kB" line of /proc/self/status
+static uint64_t statusKilobytes(const char* name) {
+	FILE* file = fopen("/proc/self/status", "r");
+	if (!file) {
+		return 0;
+	}
+
+	uint64_t kilobytes = 0;
+	size_t nameLength = strlen(name);
+	char line[256];
+	while (fgets(line, sizeof(line), file)) {
+		if (strncmp(line, name, nameLength) == 0 && line[nameLength] == ':') {
+			kilobytes = strtoull(line + nameLength + 1, nullptr, 10);
+			break;
+		}
+	}
+	fclose(file);
+	return kilobytes;
+}
+
+uint64_t residentBytes() {
+	return statusKilobytes("VmRSS") * 1024;
+}
+
+uint64_t peakResidentBytes() {
+	return statusKilobytes("VmHWM") * 1024;
+}
+
+bool resetPeakResidentBytes() {
+	// writing 5 to clear_refs resets VmHWM to the current resident set size
+	FILE* file = fopen("/proc/self/clear_refs", "w");
+	if (!file) {
+		return false;
+	}
+	bool written = fputs("5", file) >= 0;
+	return fclose(file) == 0 && written;
+}
+#else
+uint64_t residentBytes() {
+	return 0;
+}
+
+uint64_t peakResidentBytes() {
+	struct rusage usage;
+	// bytes on macOS
+	return getrusage(RUSAGE_SELF, &usage) == 0 ? static_cast<uint64_t>(usage.ru_maxrss) : 0;
+}
+
+bool resetPeakResidentBytes() {
+	return false;
+}
+#endif
@@ -0,0 +1,11 @@
+#pragma once
+#include <cstdint>
+
+// Resident set size of the process in bytes, 0 where it cannot be queried.
+uint64_t residentBytes();
+// Highest resident set size of the process in bytes since it started or since the last
+// resetPeakResidentBytes(), 0 where it cannot be queried.
+uint64_t peakResidentBytes();
+// Restarts the peak from the current resident set size. Returns false where that is not
+// supported, the peak then covers the whole life of the process.
+bool resetPeakResidentBytes();
@@ -0,0 +1,297 @@
+#include "mesh_cache.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+
+std::string MeshCache::cachePathFor(const std::string& sourcePath) {
+	return sourcePath + MESH_CACHE_EXTENSION;
+}
+
+bool MeshCache::statSource(const std::string& sourcePath, MeshCacheSource& source) {
+	struct stat sourceStat;
+	if (stat(sourcePath.c_str(), &sourceStat) != 0) {
+		return false;
+	}
+
+	source.size = static_cast<uint64_t>(sourceStat.st_size);
+	source.modifiedTime = static_cast<int64_t>(sourceStat.st_mtime);
+	return true;
+}
+
+uint64_t MeshCache::hashFile(const std::string& filename) {
+	MappedFile source;
+	if (!source.open(filename)) {
+		return 0;
+	}
+
+	return hashBytes(source.data(), source.size());
+}
+
+std::vector<std::string> MeshCache::materialLibraries(const std::string& sourcePath) {
+	std::vector<std::string> libraries;
+	MappedFile source;
+	if (!source.open(sourcePath)) {
+		return libraries;
+	}
+
+	size_t separator = sourcePath.find_last_of("\\/");
+	std::string directory = separator == std::string::npos ? std::string() : sourcePath.substr(0, separator + 1);
+
+	const char* data = reinterpret_cast<const char*>(source.data());
+	const char* end = data + source.size();
+	for (const char* line = data; line < end;) {
+		const char* lineEnd = static_cast<const char*>(memchr(line, '\n', end - line));
+		lineEnd = lineEnd ? lineEnd : end;
+		const char* token = line;
+		while (token < lineEnd && (*token == ' ' || *token == '\t')) {
+			token++;
+		}
+		// every file named on the line, tinyobj reads the first one that loads
+		if (lineEnd - token > 6 && strncmp(token, "mtllib", 6) == 0 && (token[6] == ' ' || token[6] == '\t')) {
+			token += 7;
+			while (token < lineEnd) {
+				const char* nameEnd = token;
+				while (nameEnd < lineEnd && *nameEnd != ' ' && *nameEnd != '\t' && *nameEnd != '\r') {
+					nameEnd++;
+				}
+				if (nameEnd > token) {
+					libraries.push_back(directory + std::string(token, nameEnd));
+				}
+				token = nameEnd + 1;
+			}
+		}
+		line = lineEnd + 1;
+	}
+	return libraries;
+}
+
+bool MeshCache::matchesFingerprint(const std::string& path, uint64_t size, int64_t modifiedTime, uint64_t hash, bool& touched) {
+	touched = false;
+	MeshCacheSource source;
+	if (!statSource(path, source)) {
+		// still missing is still the same
+		return size == UINT64_MAX;
+	}
+	if (source.size != size) {
+		return false;
+	}
+	if (source.modifiedTime == modifiedTime) {
+		return true;
+	}
+	touched = true;
+	return hashFile(path) == hash;
+}
+
+void MeshCache::patchCache(const std::string& cachePath, uint64_t offset, const void* data, uint64_t size) {
+	// best effort, a cache that cannot be written to is only hashed again next time
+	std::fstream stream(cachePath, std::ios::binary | std::ios::in | std::ios::out);
+	if (stream) {
+		stream.seekp(static_cast<std::streamoff>(offset));
+		stream.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+	}
+}
+
+bool MeshCache::writeSections(const std::string& cachePath, const std::string& sourcePath, uint32_t vertexStride, const MeshCacheSettings& settings, const void** sectionData,
+	uint64_t* sectionSize) {
+	MeshCacheSource source;
+	if (!statSource(sourcePath, source)) {
+		return false;
+	}
+
+	std::vector<MeshCacheDependency> dependencies;
+	std::string dependencyPaths;
+	for (const auto& library : materialLibraries(sourcePath)) {
+		MeshCacheDependency dependency = {};
+		MeshCacheSource librarySource;
+		if (statSource(library, librarySource)) {
+			dependency.size = librarySource.size;
+			dependency.modifiedTime = librarySource.modifiedTime;
+			dependency.hash = hashFile(library);
+		} else {
+			dependency.size = UINT64_MAX;
+		}
+		dependency.pathOffset = static_cast<uint32_t>(dependencyPaths.size());
+		dependency.pathSize = static_cast<uint32_t>(library.size());
+		dependencyPaths += library;
+		dependencies.push_back(dependency);
+	}
+	sectionData[MESH_CACHE_SECTION_DEPENDENCIES] = dependencies.data();
+	sectionSize[MESH_CACHE_SECTION_DEPENDENCIES] = dependencies.size() * sizeof(MeshCacheDependency);
+	sectionData[MESH_CACHE_SECTION_DEPENDENCY_PATHS] = dependencyPaths.data();
+	sectionSize[MESH_CACHE_SECTION_DEPENDENCY_PATHS] = dependencyPaths.size();
+
+	MeshCacheHeader cacheHeader = {};
+	cacheHeader.magic = MESH_CACHE_MAGIC;
+	cacheHeader.version = MESH_CACHE_VERSION;
+	cacheHeader.vertexStride = vertexStride;
+	cacheHeader.materialStride = sizeof(MatrialObj);
+	cacheHeader.sourceSize = source.size;
+	cacheHeader.sourceModifiedTime = source.modifiedTime;
+	cacheHeader.sourceHash = hashFile(sourcePath);
+	cacheHeader.settings = settings;
+
+	uint64_t offset = sizeof(MeshCacheHeader);
+	for (int x = 0; x < MESH_CACHE_SECTION_COUNT; x++) {
+		offset = (offset + MESH_CACHE_SECTION_ALIGNMENT - 1) & ~uint64_t(MESH_CACHE_SECTION_ALIGNMENT - 1);
+		cacheHeader.sectionOffset[x] = offset;
+		cacheHeader.sectionSize[x] = sectionSize[x];
+		offset += sectionSize[x];
+	}
+
+	// write to a temporary file first so a crash never leaves a truncated cache behind
+	std::string temporaryPath = cachePath + ".tmp";
+	{
+		std::ofstream stream(temporaryPath, std::ios::binary | std::ios::trunc);
+		if (!stream) {
+			return false;
+		}
+
+		stream.write(reinterpret_cast<const char*>(&cacheHeader), sizeof(MeshCacheHeader));
+
+		const char padding[MESH_CACHE_SECTION_ALIGNMENT] = {};
+		uint64_t written = sizeof(MeshCacheHeader);
+		for (int x = 0; x < MESH_CACHE_SECTION_COUNT; x++) {
+			stream.write(padding, static_cast<std::streamsize>(cacheHeader.sectionOffset[x] - written));
+			stream.write(static_cast<const char*>(sectionData[x]), static_cast<std::streamsize>(sectionSize[x]));
+			written = cacheHeader.sectionOffset[x] + sectionSize[x];
+		}
+
+		if (!stream) {
+			return false;
+		}
+	}
+
+	std::remove(cachePath.c_str());
+	return std::rename(temporaryPath.c_str(), cachePath.c_str()) == 0;
+}
+
+bool MeshCache::open(const std::string& cachePath, const std::string& sourcePath, uint32_t vertexStride, const MeshCacheSettings& settings) {
+	close();
+
+	if (!file.open(cachePath) || file.size() < sizeof(MeshCacheHeader)) {
+		close();
+		return false;
+	}
+
+	const MeshCacheHeader* cacheHeader = reinterpret_cast<const MeshCacheHeader*>(file.data());
+	if (cacheHeader->magic != MESH_CACHE_MAGIC || cacheHeader->version != MESH_CACHE_VERSION || cacheHeader->vertexStride != vertexStride || cacheHeader->materialStride != sizeof(MatrialObj)) {
+		close();
+		return false;
+	}
+	if (cacheHeader->settings.weldTolerance != settings.weldTolerance || cacheHeader->settings.creaseAngle != settings.creaseAngle || cacheHeader->settings.streaming != settings.streaming) {
+		close();
+		return false;
+	}
+
+	for (int x = 0; x < MESH_CACHE_SECTION_COUNT; x++) {
+		if (cacheHeader->sectionOffset[x] + cacheHeader->sectionSize[x] > file.size()) {
+			close();
+			return false;
+		}
+	}
+
+	// a touched but unchanged source (checkout, copy) only costs a hash of the file, once
+	bool sourceTouched = false;
+	if (!matchesFingerprint(sourcePath, cacheHeader->sourceSize, cacheHeader->sourceModifiedTime, cacheHeader->sourceHash, sourceTouched) || cacheHeader->sourceSize == UINT64_MAX) {
+		close();
+		return false;
+	}
+
+	// materials and textures come from the libraries, they have to be unchanged too
+	const MeshCacheDependency* dependencies = reinterpret_cast<const MeshCacheDependency*>(file.data() + cacheHeader->sectionOffset[MESH_CACHE_SECTION_DEPENDENCIES]);
+	size_t dependencyCount = static_cast<size_t>(cacheHeader->sectionSize[MESH_CACHE_SECTION_DEPENDENCIES] / sizeof(MeshCacheDependency));
+	const char* dependencyPaths = reinterpret_cast<const char*>(file.data() + cacheHeader->sectionOffset[MESH_CACHE_SECTION_DEPENDENCY_PATHS]);
+	std::vector<size_t> touchedDependencies;
+	for (size_t x = 0; x < dependencyCount; x++) {
+		const MeshCacheDependency& dependency = dependencies[x];
+		if (static_cast<uint64_t>(dependency.pathOffset) + dependency.pathSize > cacheHeader->sectionSize[MESH_CACHE_SECTION_DEPENDENCY_PATHS]) {
+			close();
+			return false;
+		}
+		bool touched = false;
+		std::string path(dependencyPaths + dependency.pathOffset, dependency.pathSize);
+		if (!matchesFingerprint(path, dependency.size, dependency.modifiedTime, dependency.hash, touched)) {
+			close();
+			return false;
+		}
+		if (touched) {
+			touchedDependencies.push_back(x);
+		}
+	}
+
+	header = cacheHeader;
+
+	if (sourceTouched) {
+		MeshCacheSource source;
+		statSource(sourcePath, source);
+		patchCache(cachePath, offsetof(MeshCacheHeader, sourceModifiedTime), &source.modifiedTime, sizeof(source.modifiedTime));
+	}
+	for (size_t x : touchedDependencies) {
+		MeshCacheSource library;
+		statSource(std::string(dependencyPaths + dependencies[x].pathOffset, dependencies[x].pathSize), library);
+		uint64_t offset = cacheHeader->sectionOffset[MESH_CACHE_SECTION_DEPENDENCIES] + x * sizeof(MeshCacheDependency) + offsetof(MeshCacheDependency, modifiedTime);
+		patchCache(cachePath, offset, &library.modifiedTime, sizeof(library.modifiedTime));
+	}
+	return true;
+}
+
+void MeshCache::close() {
+	header = nullptr;
+	file.close();
+}
+
+const void* MeshCache::sectionData(MeshCacheSection section) const {
+	return file.data() + header->sectionOffset[section];
+}
+
+uint64_t MeshCache::sectionSize(MeshCacheSection section) const {
+	return header->sectionSize[section];
+}
+
+std::vector<MatrialObj> MeshCache::materials() const {
+	const MatrialObj* data = static_cast<const MatrialObj*>(sectionData(MESH_CACHE_SECTION_MATERIALS));
+	return std::vector<MatrialObj>(data, data + sectionSize(MESH_CACHE_SECTION_MATERIALS) / sizeof(MatrialObj));
+}
+
+std::vector<MaterialRange> MeshCache::materialRanges() const {
+	const MaterialRange* data = static_cast<const MaterialRange*>(sectionData(MESH_CACHE_SECTION_MATERIAL_RANGES));
+	return std::vector<MaterialRange>(data, data + sectionSize(MESH_CACHE_SECTION_MATERIAL_RANGES) / sizeof(MaterialRange));
+}
+
+MeshletData MeshCache::meshlets() const {
+	MeshletData data;
+	const Meshlet* meshlets = static_cast<const Meshlet*>(sectionData(MESH_CACHE_SECTION_MESHLETS));
+	data.meshlets.assign(meshlets, meshlets + sectionSize(MESH_CACHE_SECTION_MESHLETS) / sizeof(Meshlet));
+	const uint32_t* vertices = static_cast<const uint32_t*>(sectionData(MESH_CACHE_SECTION_MESHLET_VERTICES));
+	data.vertices.assign(vertices, vertices + sectionSize(MESH_CACHE_SECTION_MESHLET_VERTICES) / sizeof(uint32_t));
+	const uint8_t* triangles = static_cast<const uint8_t*>(sectionData(MESH_CACHE_SECTION_MESHLET_TRIANGLES));
+	data.triangles.assign(triangles, triangles + sectionSize(MESH_CACHE_SECTION_MESHLET_TRIANGLES));
+	return data;
+}
+
+MeshLodData MeshCache::lods() const {
+	MeshLodData data;
+	const MeshLod* levels = static_cast<const MeshLod*>(sectionData(MESH_CACHE_SECTION_LODS));
+	data.levels.assign(levels, levels + sectionSize(MESH_CACHE_SECTION_LODS) / sizeof(MeshLod));
+	const uint32_t* indices = static_cast<const uint32_t*>(sectionData(MESH_CACHE_SECTION_LOD_INDICES));
+	data.indices.assign(indices, indices + sectionSize(MESH_CACHE_SECTION_LOD_INDICES) / sizeof(uint32_t));
+	const int32_t* materials = static_cast<const int32_t*>(sectionData(MESH_CACHE_SECTION_LOD_MATERIALS));
+	data.materials.assign(materials, materials + sectionSize(MESH_CACHE_SECTION_LOD_MATERIALS) / sizeof(int32_t));
+	return data;
+}
+
+std::vector<std::string> MeshCache::textures() const {
+	std::vector<std::string> textureList;
+
+	const char* data = static_cast<const char*>(sectionData(MESH_CACHE_SECTION_TEXTURES));
+	const char* end = data + sectionSize(MESH_CACHE_SECTION_TEXTURES);
+	while (data < end) {
+		textureList.push_back(data);
+		data += textureList.back().size() + 1;
+	}
+
+	return textureList;
+}
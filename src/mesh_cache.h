@@ -0,0 +1,173 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+#include "meshlet.h"
+#include "mesh_simplifier.h"
+#include "obj_loader.h"
+
+// Binary snapshot of a loaded model, written next to the source .obj so later
+// runs can map it instead of parsing text. Bump MESH_CACHE_VERSION whenever the
+// layout of the header, a section or a cached struct changes, or the loader starts
+// producing different vertices or indices.
+#define MESH_CACHE_MAGIC 0x4843534d
+#define MESH_CACHE_VERSION 8
+#define MESH_CACHE_EXTENSION ".meshcache"
+#define MESH_CACHE_SECTION_ALIGNMENT 64
+
+enum MeshCacheSection {
+	MESH_CACHE_SECTION_VERTICES = 0,
+	MESH_CACHE_SECTION_INDICES,
+	MESH_CACHE_SECTION_MATERIALS,
+	MESH_CACHE_SECTION_TEXTURES,
+	MESH_CACHE_SECTION_MATERIAL_INDICES,
+	MESH_CACHE_SECTION_MATERIAL_RANGES,
+	MESH_CACHE_SECTION_MESHLETS,
+	MESH_CACHE_SECTION_MESHLET_VERTICES,
+	MESH_CACHE_SECTION_MESHLET_TRIANGLES,
+	MESH_CACHE_SECTION_LODS,
+	MESH_CACHE_SECTION_LOD_INDICES,
+	MESH_CACHE_SECTION_LOD_MATERIALS,
+	MESH_CACHE_SECTION_DEPENDENCIES,
+	MESH_CACHE_SECTION_DEPENDENCY_PATHS,
+	MESH_CACHE_SECTION_COUNT
+};
+
+// ObjLoader settings that change what ends up in the cache, a cache built with others is stale.
+struct MeshCacheSettings {
+	float weldTolerance = 0.0f;
+	float creaseAngle = NORMAL_CREASE_ANGLE;
+	uint32_t streaming = 0;
+
+	template <class TVert>
+	static MeshCacheSettings of(const ObjLoader<TVert>& loader) {
+		MeshCacheSettings settings;
+		settings.weldTolerance = loader.m_weldTolerance;
+		settings.creaseAngle = loader.m_creaseAngle;
+		settings.streaming = loader.m_streaming ? 1 : 0;
+		return settings;
+	}
+};
+
+// Fingerprint of a file other than the source the cache depends on, the .mtl files the source names.
+// A library that did not exist when the cache was written has a size of UINT64_MAX.
+struct MeshCacheDependency {
+	uint64_t size;
+	int64_t modifiedTime;
+	uint64_t hash;
+	// where the path lies in MESH_CACHE_SECTION_DEPENDENCY_PATHS
+	uint32_t pathOffset;
+	uint32_t pathSize;
+};
+
+struct MeshCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vertexStride;
+	uint32_t materialStride;
+
+	// fingerprint of the source file the cache was built from
+	uint64_t sourceSize;
+	int64_t sourceModifiedTime;
+	uint64_t sourceHash;
+
+	MeshCacheSettings settings;
+
+	uint64_t sectionOffset[MESH_CACHE_SECTION_COUNT];
+	uint64_t sectionSize[MESH_CACHE_SECTION_COUNT];
+};
+
+struct MeshCacheSource {
+	uint64_t size = 0;
+	int64_t modifiedTime = 0;
+};
+
+class MeshCache {
+private:
+	MappedFile file;
+	const MeshCacheHeader* header = nullptr;
+
+	static bool statSource(const std::string& sourcePath, MeshCacheSource& source);
+	static uint64_t hashFile(const std::string& filename);
+	// The material libraries the mtllib statements of the source name, relative to the source like tinyobj reads them.
+	static std::vector<std::string> materialLibraries(const std::string& sourcePath);
+	// Whether the file at path is still the one fingerprinted by size, modifiedTime and hash. The hash only runs
+	// when the modification time changed, touched set tells the caller the stored time is out of date.
+	static bool matchesFingerprint(const std::string& path, uint64_t size, int64_t modifiedTime, uint64_t hash, bool& touched);
+	// Overwrites size bytes of the cache at offset, used to refresh modification times without a rebuild.
+	static void patchCache(const std::string& cachePath, uint64_t offset, const void* data, uint64_t size);
+	static bool writeSections(const std::string& cachePath, const std::string& sourcePath, uint32_t vertexStride, const MeshCacheSettings& settings, const void** sectionData,
+		uint64_t* sectionSize);
+
+public:
+	static std::string cachePathFor(const std::string& sourcePath);
+
+	// Maps the cache and checks it against the source file, its material libraries, the vertex layout and
+	// the loader settings. Returns false when the cache is missing, stale or was written for a different
+	// layout or settings. Sources and libraries that were only touched get their new times stored, so the
+	// next open does not hash them again.
+	bool open(const std::string& cachePath, const std::string& sourcePath, uint32_t vertexStride, const MeshCacheSettings& settings = MeshCacheSettings());
+	void close();
+
+	const void* sectionData(MeshCacheSection section) const;
+	uint64_t sectionSize(MeshCacheSection section) const;
+
+	template <class TVert>
+	const TVert* vertices() const { return static_cast<const TVert*>(sectionData(MESH_CACHE_SECTION_VERTICES)); }
+	uint32_t vertexCount() const { return static_cast<uint32_t>(sectionSize(MESH_CACHE_SECTION_VERTICES) / header->vertexStride); }
+
+	const uint32_t* indices() const { return static_cast<const uint32_t*>(sectionData(MESH_CACHE_SECTION_INDICES)); }
+	uint32_t indexCount() const { return static_cast<uint32_t>(sectionSize(MESH_CACHE_SECTION_INDICES) / sizeof(uint32_t)); }
+
+	std::vector<MatrialObj> materials() const;
+	std::vector<std::string> textures() const;
+
+	// one material per triangle, and the ranges of the index buffer they are sorted into
+	const int32_t* materialIndices() const { return static_cast<const int32_t*>(sectionData(MESH_CACHE_SECTION_MATERIAL_INDICES)); }
+	std::vector<MaterialRange> materialRanges() const;
+	MeshletData meshlets() const;
+	MeshLodData lods() const;
+
+	template <class TVert>
+	static bool write(const std::string& cachePath, const std::string& sourcePath, const ObjLoader<TVert>& loader, const MeshletData& meshlets, const MeshLodData& lods);
+};
+
+template <class TVert>
+bool MeshCache::write(const std::string& cachePath, const std::string& sourcePath, const ObjLoader<TVert>& loader, const MeshletData& meshlets, const MeshLodData& lods) {
+	std::string textureBlob;
+	for (const auto& texture : loader.m_textures) {
+		textureBlob.append(texture.c_str(), texture.size() + 1);
+	}
+
+	const void* sectionData[MESH_CACHE_SECTION_COUNT] = {};
+	uint64_t sectionSize[MESH_CACHE_SECTION_COUNT] = {};
+
+	sectionData[MESH_CACHE_SECTION_VERTICES] = loader.m_vertices.data();
+	sectionSize[MESH_CACHE_SECTION_VERTICES] = loader.m_vertices.size() * sizeof(TVert);
+	sectionData[MESH_CACHE_SECTION_INDICES] = loader.m_indices.data();
+	sectionSize[MESH_CACHE_SECTION_INDICES] = loader.m_indices.size() * sizeof(uint32_t);
+	sectionData[MESH_CACHE_SECTION_MATERIALS] = loader.m_materials.data();
+	sectionSize[MESH_CACHE_SECTION_MATERIALS] = loader.m_materials.size() * sizeof(MatrialObj);
+	sectionData[MESH_CACHE_SECTION_TEXTURES] = textureBlob.data();
+	sectionSize[MESH_CACHE_SECTION_TEXTURES] = textureBlob.size();
+	sectionData[MESH_CACHE_SECTION_MATERIAL_INDICES] = loader.m_matIndx.data();
+	sectionSize[MESH_CACHE_SECTION_MATERIAL_INDICES] = loader.m_matIndx.size() * sizeof(int32_t);
+	sectionData[MESH_CACHE_SECTION_MATERIAL_RANGES] = loader.m_materialRanges.data();
+	sectionSize[MESH_CACHE_SECTION_MATERIAL_RANGES] = loader.m_materialRanges.size() * sizeof(MaterialRange);
+	sectionData[MESH_CACHE_SECTION_MESHLETS] = meshlets.meshlets.data();
+	sectionSize[MESH_CACHE_SECTION_MESHLETS] = meshlets.meshlets.size() * sizeof(Meshlet);
+	sectionData[MESH_CACHE_SECTION_MESHLET_VERTICES] = meshlets.vertices.data();
+	sectionSize[MESH_CACHE_SECTION_MESHLET_VERTICES] = meshlets.vertices.size() * sizeof(uint32_t);
+	sectionData[MESH_CACHE_SECTION_MESHLET_TRIANGLES] = meshlets.triangles.data();
+	sectionSize[MESH_CACHE_SECTION_MESHLET_TRIANGLES] = meshlets.triangles.size();
+	sectionData[MESH_CACHE_SECTION_LODS] = lods.levels.data();
+	sectionSize[MESH_CACHE_SECTION_LODS] = lods.levels.size() * sizeof(MeshLod);
+	sectionData[MESH_CACHE_SECTION_LOD_INDICES] = lods.indices.data();
+	sectionSize[MESH_CACHE_SECTION_LOD_INDICES] = lods.indices.size() * sizeof(uint32_t);
+	sectionData[MESH_CACHE_SECTION_LOD_MATERIALS] = lods.materials.data();
+	sectionSize[MESH_CACHE_SECTION_LOD_MATERIALS] = lods.materials.size() * sizeof(int32_t);
+
+	return writeSections(cachePath, sourcePath, sizeof(TVert), MeshCacheSettings::of(loader), sectionData, sectionSize);
+}
@@ -0,0 +1,376 @@
+#include "mesh_normals.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+// marks a corner that starts a new vertex for a vertex an earlier corner already kept, and empty slots
+#define SPLIT_LEADER 0xffffffffu
+
+// Dense ids for the distinct positions, in the order they first appear. Open addressing keeps the
+// probes in one array, the std::unordered_map the simplifier uses costs a node per position.
+static uint32_t assignPositionIds(std::vector<uint32_t>& positionIds, const glm::vec3* positions, uint32_t vertexCount) {
+	size_t slotCount = 16;
+	while (slotCount < static_cast<size_t>(vertexCount) * 2) {
+		slotCount *= 2;
+	}
+	std::vector<uint32_t> slots(slotCount, SPLIT_LEADER);
+	positionIds.resize(vertexCount);
+	uint32_t positionCount = 0;
+	for (uint32_t vertex = 0; vertex < vertexCount; vertex++) {
+		// adding zero turns -0 into 0, they compare equal and have to hash the same
+		glm::vec3 position = positions[vertex] + glm::vec3(0.0f);
+		uint32_t bits[3];
+		memcpy(bits, &position, sizeof(bits));
+		uint64_t hash = (bits[0] * 0x9e3779b97f4a7c15ull) ^ (bits[1] * 0xc2b2ae3d27d4eb4full) ^ (bits[2] * 0x165667b19e3779f9ull);
+		size_t slot = static_cast<size_t>(hash ^ hash >> 29) & (slotCount - 1);
+		while (slots[slot] != SPLIT_LEADER && positions[slots[slot]] != position) {
+			slot = (slot + 1) & (slotCount - 1);
+		}
+		if (slots[slot] == SPLIT_LEADER) {
+			slots[slot] = vertex;
+			positionIds[vertex] = positionCount++;
+		} else {
+			positionIds[vertex] = positionIds[slots[slot]];
+		}
+	}
+	return positionCount;
+}
+
+// The corners of every key, a counting sort keeps them in corner order within a key.
+struct CornerLists {
+	std::vector<uint32_t> offsets;
+	std::vector<uint32_t> corners;
+};
+
+static void buildCornerLists(CornerLists& lists, const uint32_t* keys, size_t cornerCount, uint32_t keyCount) {
+	lists.offsets.assign(keyCount + 1, 0);
+	for (size_t x = 0; x < cornerCount; x++) {
+		lists.offsets[keys[x] + 1]++;
+	}
+	for (uint32_t x = 0; x < keyCount; x++) {
+		lists.offsets[x + 1] += lists.offsets[x];
+	}
+
+	std::vector<uint32_t> fill(lists.offsets.begin(), lists.offsets.end() - 1);
+	lists.corners.resize(cornerCount);
+	for (size_t x = 0; x < cornerCount; x++) {
+		lists.corners[fill[keys[x]]++] = static_cast<uint32_t>(x);
+	}
+}
+
+static size_t blockCount(size_t count) {
+	return (count + NORMAL_BLOCK_SIZE - 1) / NORMAL_BLOCK_SIZE;
+}
+
+// Calls fn(x) for every x of block.
+template <class Fn>
+static void forBlock(size_t block, size_t count, Fn fn) {
+	size_t end = std::min(count, (block + 1) * NORMAL_BLOCK_SIZE);
+	for (size_t x = block * NORMAL_BLOCK_SIZE; x < end; x++) {
+		fn(x);
+	}
+}
+
+// Writes the value of every corner to its vertex, lists holds the corners of every vertex. The
+// first corner of a vertex keeps it, later corners with the same value share it, and every other
+// value gets a new vertex. Vertices are independent: the first pass finds the groups and counts
+// the new vertices of every block, the second hands them out from the running total of the block.
+template <class T>
+static uint32_t splitCorners(std::vector<T>& values, std::vector<uint32_t>& splitSources, uint32_t* indices, const CornerLists& lists, const std::vector<T>& cornerValues, uint32_t vertexCount,
+	unsigned int threadCount) {
+	size_t blocks = blockCount(vertexCount);
+
+	// the corner every corner shares its vertex with, itself, or SPLIT_LEADER when it starts a new one
+	std::vector<uint32_t> leaders(lists.corners.size());
+	std::vector<uint32_t> blockStarts(blocks + 1, 0);
+	parallelFor(blocks, threadCount, [&](size_t block) {
+		uint32_t splits = 0;
+		std::vector<uint32_t> distinct;
+		forBlock(block, vertexCount, [&](size_t vertex) {
+			distinct.clear();
+			for (uint32_t x = lists.offsets[vertex]; x < lists.offsets[vertex + 1]; x++) {
+				uint32_t corner = lists.corners[x];
+				uint32_t leader = corner;
+				for (uint32_t other : distinct) {
+					if (cornerValues[other] == cornerValues[corner]) {
+						leader = other;
+						break;
+					}
+				}
+				if (leader == corner) {
+					if (!distinct.empty()) {
+						leader = SPLIT_LEADER;
+						splits++;
+					}
+					distinct.push_back(corner);
+				}
+				leaders[corner] = leader;
+			}
+		});
+		blockStarts[block + 1] = splits;
+	});
+	for (size_t x = 0; x < blocks; x++) {
+		blockStarts[x + 1] += blockStarts[x];
+	}
+
+	uint32_t splitCount = blockStarts[blocks];
+	values.assign(vertexCount + splitCount, T(0.0f));
+	splitSources.resize(splitCount);
+	parallelFor(blocks, threadCount, [&](size_t block) {
+		uint32_t next = vertexCount + blockStarts[block];
+		forBlock(block, vertexCount, [&](size_t vertex) {
+			// leaders come first in the list of a vertex, so their indices are final by the time they are shared
+			for (uint32_t x = lists.offsets[vertex]; x < lists.offsets[vertex + 1]; x++) {
+				uint32_t corner = lists.corners[x];
+				uint32_t leader = leaders[corner];
+				if (leader == SPLIT_LEADER) {
+					splitSources[next - vertexCount] = static_cast<uint32_t>(vertex);
+					indices[corner] = next++;
+					values[indices[corner]] = cornerValues[corner];
+				} else if (leader == corner) {
+					values[vertex] = cornerValues[corner];
+				} else {
+					indices[corner] = indices[leader];
+				}
+			}
+		});
+	});
+	return splitCount;
+}
+
+static VertexFrameStats finishStats(uint32_t splitCount, size_t triangleCount, std::chrono::high_resolution_clock::time_point startTime) {
+	VertexFrameStats stats;
+	stats.splitVertexCount = splitCount;
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+	stats.milliseconds = elapsed.count();
+	stats.trianglesPerSecond = stats.milliseconds > 0.0 ? triangleCount / (stats.milliseconds / 1000.0) : 0.0;
+	return stats;
+}
+
+// angle between the edges from a corner to the other two corners
+static float cornerAngle(const glm::vec3& edge0, const glm::vec3& edge1) {
+	float lengths = glm::length(edge0) * glm::length(edge1);
+	return lengths > 0.0f ? std::acos(glm::clamp(glm::dot(edge0, edge1) / lengths, -1.0f, 1.0f)) : 0.0f;
+}
+
+VertexFrameStats generateNormals(std::vector<glm::vec3>& normals, std::vector<uint32_t>& splitSources, uint32_t* indices, size_t indexCount, const glm::vec3* positions, uint32_t vertexCount,
+	float creaseAngle, unsigned int threadCount) {
+	auto startTime = std::chrono::high_resolution_clock::now();
+	size_t triangleCount = indexCount / 3;
+
+	// vertices at one position smooth as one, whatever else tells them apart
+	std::vector<uint32_t> positionIds;
+	uint32_t positionCount = assignPositionIds(positionIds, positions, vertexCount);
+
+	// unit face normals, corner angles and corner keys, one streaming pass over the triangles
+	std::vector<glm::vec3> faceNormals(triangleCount);
+	std::vector<float> cornerWeights(triangleCount * 3);
+	std::vector<uint32_t> cornerKeys(triangleCount * 3);
+	parallelFor(blockCount(triangleCount), threadCount, [&](size_t block) {
+		forBlock(block, triangleCount, [&](size_t triangle) {
+			const uint32_t* corners = &indices[triangle * 3];
+			glm::vec3 p[3] = {positions[corners[0]], positions[corners[1]], positions[corners[2]]};
+			glm::vec3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+			float length = glm::length(normal);
+			// slivers thinner than 1e-4 of their longest edge have a normal made of rounding errors
+			float longest = std::max(glm::dot(p[1] - p[0], p[1] - p[0]), std::max(glm::dot(p[2] - p[1], p[2] - p[1]), glm::dot(p[0] - p[2], p[0] - p[2])));
+			faceNormals[triangle] = length > 1e-4f * longest ? normal / length : glm::vec3(0.0f);
+			for (uint32_t corner = 0; corner < 3; corner++) {
+				cornerWeights[triangle * 3 + corner] = cornerAngle(p[(corner + 1) % 3] - p[corner], p[(corner + 2) % 3] - p[corner]);
+				cornerKeys[triangle * 3 + corner] = positionIds[corners[corner]];
+			}
+		});
+	});
+
+	CornerLists lists;
+	buildCornerLists(lists, cornerKeys.data(), triangleCount * 3, positionCount);
+
+	// every corner joins the first crease group around its position whose first face is within the
+	// crease angle of its own, or starts a new one. Degenerate faces have no side to be on and join
+	// the first group. Groups only look at the faces around one position, no two threads share one.
+	float creaseCos = creaseAngle >= 180.0f ? -2.0f : std::cos(glm::radians(creaseAngle));
+	std::vector<glm::vec3> cornerNormals(triangleCount * 3);
+	parallelFor(blockCount(positionCount), threadCount, [&](size_t block) {
+		std::vector<glm::vec3> seeds;
+		std::vector<glm::vec3> sums;
+		std::vector<uint32_t> cornerGroups;
+		forBlock(block, positionCount, [&](size_t key) {
+			const uint32_t* corners = &lists.corners[lists.offsets[key]];
+			uint32_t count = lists.offsets[key + 1] - lists.offsets[key];
+			seeds.clear();
+			sums.clear();
+			cornerGroups.resize(count);
+			for (uint32_t x = 0; x < count; x++) {
+				const glm::vec3& face = faceNormals[corners[x] / 3];
+				if (face == glm::vec3(0.0f)) {
+					cornerGroups[x] = 0;
+					continue;
+				}
+				uint32_t group = 0;
+				while (group < seeds.size() && glm::dot(seeds[group], face) < creaseCos) {
+					group++;
+				}
+				if (group == seeds.size()) {
+					seeds.push_back(face);
+					sums.push_back(glm::vec3(0.0f));
+				}
+				sums[group] += face * cornerWeights[corners[x]];
+				cornerGroups[x] = group;
+			}
+			if (sums.empty()) {
+				sums.push_back(glm::vec3(0.0f));
+			}
+
+			for (glm::vec3& sum : sums) {
+				float length = glm::length(sum);
+				sum = length > 0.0f ? sum / length : glm::vec3(0.0f);
+			}
+			for (uint32_t x = 0; x < count; x++) {
+				cornerNormals[corners[x]] = sums[cornerGroups[x]];
+			}
+		});
+	});
+
+	// the groups are per position, vertices split where their corners ended up in different ones
+	buildCornerLists(lists, indices, triangleCount * 3, vertexCount);
+	uint32_t splitCount = splitCorners(normals, splitSources, indices, lists, cornerNormals, vertexCount, threadCount);
+	return finishStats(splitCount, triangleCount, startTime);
+}
+
+// A unit vector perpendicular to normal, for frames without texture space directions.
+static glm::vec3 anyTangent(const glm::vec3& normal) {
+	glm::vec3 axis = std::abs(normal.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	glm::vec3 tangent = glm::cross(normal, axis);
+	float length = glm::length(tangent);
+	return length > 0.0f ? tangent / length : axis;
+}
+
+// direction projected onto the plane of normal
+static glm::vec3 projectOntoPlane(const glm::vec3& direction, const glm::vec3& normal) {
+	return direction - normal * glm::dot(normal, direction);
+}
+
+static glm::vec3 normalizeOrZero(const glm::vec3& direction) {
+	float length = glm::length(direction);
+	return length > 0.0f ? direction / length : glm::vec3(0.0f);
+}
+
+VertexFrameStats generateTangents(std::vector<glm::vec4>& tangents, std::vector<uint32_t>& splitSources, uint32_t* indices, size_t indexCount, const glm::vec3* positions, const glm::vec3* normals,
+	const glm::vec2* texCoords, uint32_t vertexCount, unsigned int threadCount) {
+	auto startTime = std::chrono::high_resolution_clock::now();
+	size_t triangleCount = indexCount / 3;
+
+	// MikkTSpace flips the unit direction of increasing s on mirrored faces. Every corner projects it
+	// onto the plane of its vertex normal and weights it by its angle in that plane, in one streaming
+	// pass over the triangles. w is 1 on faces that preserve the orientation, -1 on mirrored ones and
+	// 0 on faces without texture space area.
+	std::vector<glm::vec4> cornerTerms(triangleCount * 3);
+	parallelFor(blockCount(triangleCount), threadCount, [&](size_t block) {
+		forBlock(block, triangleCount, [&](size_t triangle) {
+			const uint32_t* corners = &indices[triangle * 3];
+			glm::vec3 p[3] = {positions[corners[0]], positions[corners[1]], positions[corners[2]]};
+			// the differences in v of the file, texCoords hold 1 - v
+			glm::vec2 t21 = texCoords[corners[1]] - texCoords[corners[0]];
+			glm::vec2 t31 = texCoords[corners[2]] - texCoords[corners[0]];
+			t21.y = -t21.y;
+			t31.y = -t31.y;
+			float signedArea = t21.x * t31.y - t21.y * t31.x;
+			if (std::abs(signedArea) <= FLT_MIN) {
+				for (uint32_t corner = 0; corner < 3; corner++) {
+					cornerTerms[triangle * 3 + corner] = glm::vec4(0.0f);
+				}
+				return;
+			}
+			float orientation = signedArea > 0.0f ? 1.0f : -1.0f;
+			glm::vec3 direction = normalizeOrZero(t31.y * (p[1] - p[0]) - t21.y * (p[2] - p[0])) * orientation;
+			for (uint32_t corner = 0; corner < 3; corner++) {
+				const glm::vec3& normal = normals[corners[corner]];
+				float angle = cornerAngle(projectOntoPlane(p[(corner + 1) % 3] - p[corner], normal), projectOntoPlane(p[(corner + 2) % 3] - p[corner], normal));
+				cornerTerms[triangle * 3 + corner] = glm::vec4(normalizeOrZero(projectOntoPlane(direction, normal)) * angle, orientation);
+			}
+		});
+	});
+
+	CornerLists lists;
+	buildCornerLists(lists, indices, triangleCount * 3, vertexCount);
+
+	std::vector<glm::vec4> cornerTangents(triangleCount * 3);
+	parallelFor(blockCount(vertexCount), threadCount, [&](size_t block) {
+		forBlock(block, vertexCount, [&](size_t vertex) {
+			const uint32_t* corners = &lists.corners[lists.offsets[vertex]];
+			uint32_t count = lists.offsets[vertex + 1] - lists.offsets[vertex];
+
+			// orientation preserving corners sum into the first, mirrored ones into the second
+			glm::vec3 sums[2] = {glm::vec3(0.0f), glm::vec3(0.0f)};
+			bool used[2] = {false, false};
+			for (uint32_t x = 0; x < count; x++) {
+				const glm::vec4& term = cornerTerms[corners[x]];
+				if (term.w != 0.0f) {
+					uint32_t group = term.w > 0.0f ? 0 : 1;
+					sums[group] += glm::vec3(term);
+					used[group] = true;
+				}
+			}
+
+			glm::vec4 frames[2];
+			for (uint32_t group = 0; group < 2; group++) {
+				float length = glm::length(sums[group]);
+				frames[group] = glm::vec4(length > 0.0f ? sums[group] / length : anyTangent(normals[vertex]), group == 0 ? 1.0f : -1.0f);
+			}
+			// corners without texture space area join whichever frame the vertex has
+			uint32_t fallback = !used[0] && used[1] ? 1 : 0;
+			for (uint32_t x = 0; x < count; x++) {
+				float orientation = cornerTerms[corners[x]].w;
+				cornerTangents[corners[x]] = frames[orientation > 0.0f ? 0 : orientation < 0.0f ? 1 : fallback];
+			}
+		});
+	});
+
+	uint32_t splitCount = splitCorners(tangents, splitSources, indices, lists, cornerTangents, vertexCount, threadCount);
+	return finishStats(splitCount, triangleCount, startTime);
+}
+
+bool checkTangentFrames(std::string& failure) {
+	// a unit quad in the xy plane facing +z, wound counterclockwise
+	const glm::vec3 positions[4] = {glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(1.0f, 1.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f)};
+	const glm::vec3 normals[4] = {glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, 1.0f)};
+
+	// uv = xy gives MikkTSpace's frame of tangent +x and bitangent +y, mirroring u turns the tangent and w
+	struct Case {
+		const char* name;
+		bool mirrored;
+		glm::vec4 tangent;
+	};
+	const Case cases[] = {
+		{"uv = xy", false, glm::vec4(1.0f, 0.0f, 0.0f, 1.0f)},
+		{"uv = (1 - x, y)", true, glm::vec4(-1.0f, 0.0f, 0.0f, -1.0f)},
+	};
+
+	for (const Case& quad : cases) {
+		glm::vec2 texCoords[4];
+		for (uint32_t x = 0; x < 4; x++) {
+			texCoords[x] = glm::vec2(quad.mirrored ? 1.0f - positions[x].x : positions[x].x, 1.0f - positions[x].y);
+		}
+		uint32_t indices[6] = {0, 1, 2, 0, 2, 3};
+		std::vector<glm::vec4> tangents;
+		std::vector<uint32_t> splitSources;
+		generateTangents(tangents, splitSources, indices, 6, positions, normals, texCoords, 4, 1);
+
+		if (tangents.size() != 4 || !splitSources.empty()) {
+			failure = std::string(quad.name) + ": " + std::to_string(splitSources.size()) + " vertices were split";
+			return false;
+		}
+		for (uint32_t x = 0; x < 4; x++) {
+			if (glm::length(glm::vec3(tangents[x]) - glm::vec3(quad.tangent)) > 1e-5f || tangents[x].w != quad.tangent.w) {
+				failure = std::string(quad.name) + ": vertex " + std::to_string(x) + " has tangent (" + std::to_string(tangents[x].x) + ", " + std::to_string(tangents[x].y) + ", "
+					+ std::to_string(tangents[x].z) + ") w " + std::to_string(tangents[x].w);
+				return false;
+			}
+		}
+	}
+	return true;
+}
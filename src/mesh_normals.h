@@ -0,0 +1,118 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "vertex_streams.h"
+
+// Faces meeting at a sharper angle than this, in degrees, get separate normals where they meet.
+// 180 smooths every face around a position.
+#define NORMAL_CREASE_ANGLE 60.0f
+// Keys and triangles handed to a thread at a time. Big enough to amortize the hand out, small
+// enough that the uneven valences of a mesh balance out.
+#define NORMAL_BLOCK_SIZE 4096
+
+struct VertexFrameStats {
+	// vertices added where corners of one vertex ended up with different normals or tangents
+	uint32_t splitVertexCount = 0;
+	double milliseconds = 0.0;
+	double trianglesPerSecond = 0.0;
+};
+
+// Smooth normals from the faces around every position, each weighted by its angle at the corner
+// (Thürmer and Wüthrich, "Computing Vertex Normals from Polygonal Facets"). Vertices at one position,
+// like the two sides of a texture seam, smooth over the faces of all of them, so seams stay invisible.
+// The faces around a position fall into crease groups: a face joins the first group whose first face
+// is within creaseAngle degrees of it. Corners of one vertex in different groups are split off into
+// new vertices: indices is rewritten to them, normals receives vertexCount plus that many normals and
+// splitSources the vertex each new one copies. Runs on threadCount threads (0 = all cores); every
+// thread writes its own positions and vertices, so the result does not depend on the thread count.
+VertexFrameStats generateNormals(std::vector<glm::vec3>& normals, std::vector<uint32_t>& splitSources, uint32_t* indices, size_t indexCount, const glm::vec3* positions, uint32_t vertexCount,
+	float creaseAngle = NORMAL_CREASE_ANGLE, unsigned int threadCount = 0);
+
+// MikkTSpace compatible tangent frames (Mikkelsen, "Simulation of Wrinkled Surfaces Revisited"):
+// the texture space directions of every face, projected onto the vertex normal and weighted by
+// the angle of the corner in that plane. The bitangent is tangent.w * cross(normal, tangent.xyz).
+// Corners of one vertex on mirrored and unmirrored faces get separate frames, the mirrored ones
+// are split off like generateNormals does. Unlike MikkTSpace, corners are grouped per vertex rather
+// than per fan of edge connected faces, which only differs on non-manifold vertices, and faces
+// without texture space area take part in nothing. texCoords are flipped in v, (u, 1 - v), the way
+// ObjLoader stores them.
+VertexFrameStats generateTangents(std::vector<glm::vec4>& tangents, std::vector<uint32_t>& splitSources, uint32_t* indices, size_t indexCount, const glm::vec3* positions, const glm::vec3* normals,
+	const glm::vec2* texCoords, uint32_t vertexCount, unsigned int threadCount = 0);
+
+// Checks the tangent frames generateTangents gives a quad with plain and mirrored texture coordinates.
+// Returns false with the first wrong frame in failure.
+bool checkTangentFrames(std::string& failure);
+
+// Appends a copy of every split source to vertices.
+template <class TVert>
+void appendSplitVertices(std::vector<TVert>& vertices, const std::vector<uint32_t>& splitSources) {
+	vertices.reserve(vertices.size() + splitSources.size());
+	for (uint32_t source : splitSources) {
+		vertices.push_back(vertices[source]);
+	}
+}
+
+// generateNormals on any vertex type with glm::vec3 pos and nrm.
+template <class TVert>
+VertexFrameStats generateNormals(std::vector<TVert>& vertices, std::vector<uint32_t>& indices, float creaseAngle = NORMAL_CREASE_ANGLE, unsigned int threadCount = 0) {
+	std::vector<glm::vec3> positions(vertices.size());
+	for (size_t x = 0; x < vertices.size(); x++) {
+		positions[x] = vertices[x].pos;
+	}
+	std::vector<glm::vec3> normals;
+	std::vector<uint32_t> splitSources;
+	VertexFrameStats stats = generateNormals(normals, splitSources, indices.data(), indices.size(), positions.data(), static_cast<uint32_t>(vertices.size()), creaseAngle, threadCount);
+	appendSplitVertices(vertices, splitSources);
+	for (size_t x = 0; x < vertices.size(); x++) {
+		vertices[x].nrm = normals[x];
+	}
+	return stats;
+}
+
+// generateTangents on any vertex type with glm::vec3 pos and nrm, glm::vec2 texCoord and glm::vec4 tangent.
+template <class TVert>
+VertexFrameStats generateTangents(std::vector<TVert>& vertices, std::vector<uint32_t>& indices, unsigned int threadCount = 0) {
+	std::vector<glm::vec3> positions(vertices.size());
+	std::vector<glm::vec3> normals(vertices.size());
+	std::vector<glm::vec2> texCoords(vertices.size());
+	for (size_t x = 0; x < vertices.size(); x++) {
+		positions[x] = vertices[x].pos;
+		normals[x] = vertices[x].nrm;
+		texCoords[x] = vertices[x].texCoord;
+	}
+	std::vector<glm::vec4> tangents;
+	std::vector<uint32_t> splitSources;
+	VertexFrameStats stats = generateTangents(tangents, splitSources, indices.data(), indices.size(), positions.data(), normals.data(), texCoords.data(), static_cast<uint32_t>(vertices.size()),
+		threadCount);
+	appendSplitVertices(vertices, splitSources);
+	for (size_t x = 0; x < vertices.size(); x++) {
+		vertices[x].tangent = tangents[x];
+	}
+	return stats;
+}
+
+// generateNormals straight from the position stream, the streams of the split vertices grow with it.
+inline VertexFrameStats generateNormals(VertexStreams& streams, std::vector<uint32_t>& indices, float creaseAngle = NORMAL_CREASE_ANGLE, unsigned int threadCount = 0) {
+	std::vector<glm::vec3> normals;
+	std::vector<uint32_t> splitSources;
+	VertexFrameStats stats = generateNormals(normals, splitSources, indices.data(), indices.size(), streams.positions.data(), static_cast<uint32_t>(streams.size()), creaseAngle, threadCount);
+	streams.appendSplitVertices(splitSources);
+	streams.normals.assign(normals.begin(), normals.end());
+	return stats;
+}
+
+// generateTangents straight from the position, normal and texture coordinate streams.
+inline VertexFrameStats generateTangents(VertexStreams& streams, std::vector<uint32_t>& indices, unsigned int threadCount = 0) {
+	std::vector<glm::vec4> tangents;
+	std::vector<uint32_t> splitSources;
+	VertexFrameStats stats = generateTangents(tangents, splitSources, indices.data(), indices.size(), streams.positions.data(), streams.normals.data(), streams.texCoords.data(),
+		static_cast<uint32_t>(streams.size()), threadCount);
+	streams.appendSplitVertices(splitSources);
+	streams.tangents.assign(tangents.begin(), tangents.end());
+	return stats;
+}
@@ -0,0 +1,291 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+
+VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, uint32_t vertexCount, uint32_t cacheSize) {
+	VertexCacheStats stats;
+	stats.triangleCount = static_cast<uint32_t>(indexCount / 3);
+
+	// a vertex is cached while fewer than cacheSize misses happened since it was loaded
+	std::vector<uint32_t> cacheTime(vertexCount, 0);
+	std::vector<bool> referenced(vertexCount, false);
+	uint32_t time = cacheSize + 1;
+	for (size_t x = 0; x < stats.triangleCount * 3; x++) {
+		uint32_t vertex = indices[x];
+		if (time - cacheTime[vertex] > cacheSize) {
+			cacheTime[vertex] = time++;
+			stats.transformCount++;
+		}
+		if (!referenced[vertex]) {
+			referenced[vertex] = true;
+			stats.vertexCount++;
+		}
+	}
+
+	if (stats.triangleCount > 0) {
+		stats.acmr = static_cast<float>(stats.transformCount) / stats.triangleCount;
+		stats.atvr = static_cast<float>(stats.transformCount) / stats.vertexCount;
+	}
+	return stats;
+}
+
+// Triangles around every vertex, as offsets into one flat list.
+struct TriangleAdjacency {
+	std::vector<uint32_t> offsets;
+	std::vector<uint32_t> triangles;
+};
+
+static void buildAdjacency(TriangleAdjacency& adjacency, const uint32_t* indices, uint32_t triangleCount, uint32_t vertexCount) {
+	adjacency.offsets.assign(vertexCount + 1, 0);
+	for (uint32_t x = 0; x < triangleCount * 3; x++) {
+		adjacency.offsets[indices[x] + 1]++;
+	}
+	std::partial_sum(adjacency.offsets.begin(), adjacency.offsets.end(), adjacency.offsets.begin());
+
+	std::vector<uint32_t> fill(adjacency.offsets.begin(), adjacency.offsets.end() - 1);
+	adjacency.triangles.resize(triangleCount * 3);
+	for (uint32_t x = 0; x < triangleCount * 3; x++) {
+		adjacency.triangles[fill[indices[x]]++] = x / 3;
+	}
+}
+
+void optimizeVertexCache(uint32_t* destination, const uint32_t* indices, size_t indexCount, uint32_t vertexCount, uint32_t cacheSize, std::vector<uint32_t>& clusters) {
+	uint32_t triangleCount = static_cast<uint32_t>(indexCount / 3);
+	clusters.clear();
+	std::copy(indices + triangleCount * 3, indices + indexCount, destination + triangleCount * 3);
+	if (triangleCount == 0) {
+		return;
+	}
+
+	TriangleAdjacency adjacency;
+	buildAdjacency(adjacency, indices, triangleCount, vertexCount);
+
+	std::vector<uint32_t> liveTriangles(vertexCount);
+	for (uint32_t x = 0; x < vertexCount; x++) {
+		liveTriangles[x] = adjacency.offsets[x + 1] - adjacency.offsets[x];
+	}
+
+	std::vector<uint32_t> cacheTime(vertexCount, 0);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<uint32_t> deadEnds;
+	std::vector<uint32_t> candidates;
+	uint32_t time = cacheSize + 1;
+	uint32_t cursor = 0;
+	uint32_t written = 0;
+
+	// the first fan starts cold like every fan after a dead end
+	int64_t fanning = indices[0];
+	bool cold = true;
+	while (fanning >= 0) {
+		if (cold) {
+			clusters.push_back(written / 3);
+		}
+
+		candidates.clear();
+		for (uint32_t x = adjacency.offsets[fanning]; x < adjacency.offsets[fanning + 1]; x++) {
+			uint32_t triangle = adjacency.triangles[x];
+			if (emitted[triangle]) {
+				continue;
+			}
+			emitted[triangle] = true;
+
+			for (uint32_t corner = 0; corner < 3; corner++) {
+				uint32_t vertex = indices[triangle * 3 + corner];
+				destination[written++] = vertex;
+				deadEnds.push_back(vertex);
+				candidates.push_back(vertex);
+				liveTriangles[vertex]--;
+				if (time - cacheTime[vertex] > cacheSize) {
+					cacheTime[vertex] = time++;
+				}
+			}
+		}
+
+		// the oldest neighbor that is still in the cache after its remaining fan is emitted
+		fanning = -1;
+		int64_t bestPriority = -1;
+		for (uint32_t vertex : candidates) {
+			if (liveTriangles[vertex] == 0) {
+				continue;
+			}
+			int64_t priority = 0;
+			if (time - cacheTime[vertex] + 2 * liveTriangles[vertex] <= cacheSize) {
+				priority = time - cacheTime[vertex];
+			}
+			if (priority > bestPriority) {
+				bestPriority = priority;
+				fanning = vertex;
+			}
+		}
+
+		cold = fanning < 0;
+		while (fanning < 0 && !deadEnds.empty()) {
+			uint32_t vertex = deadEnds.back();
+			deadEnds.pop_back();
+			if (liveTriangles[vertex] > 0) {
+				fanning = vertex;
+			}
+		}
+		for (; fanning < 0 && cursor < vertexCount; cursor++) {
+			if (liveTriangles[cursor] > 0) {
+				fanning = cursor;
+			}
+		}
+	}
+}
+
+uint32_t optimizeOverdraw(uint32_t* destination, const uint32_t* indices, size_t indexCount, const glm::vec3* positions, uint32_t vertexCount, const std::vector<uint32_t>& clusters,
+	uint32_t cacheSize, float threshold) {
+	uint32_t triangleCount = static_cast<uint32_t>(indexCount / 3);
+	std::copy(indices + triangleCount * 3, indices + indexCount, destination + triangleCount * 3);
+	if (triangleCount == 0) {
+		return 0;
+	}
+
+	// soft boundaries: a fresh cache at every split, split once a run is about as good as the whole buffer
+	float target = analyzeVertexCache(indices, indexCount, vertexCount, cacheSize).acmr * threshold;
+	std::vector<uint32_t> splits;
+	std::vector<uint32_t> cacheTime(vertexCount, 0);
+	uint32_t time = cacheSize + 1;
+	for (size_t cluster = 0; cluster < clusters.size(); cluster++) {
+		uint32_t end = cluster + 1 < clusters.size() ? clusters[cluster + 1] : triangleCount;
+		uint32_t misses = 0, runLength = 0;
+		splits.push_back(clusters[cluster]);
+		time += cacheSize + 1;
+
+		for (uint32_t triangle = clusters[cluster]; triangle < end; triangle++) {
+			for (uint32_t corner = 0; corner < 3; corner++) {
+				uint32_t vertex = indices[triangle * 3 + corner];
+				if (time - cacheTime[vertex] > cacheSize) {
+					cacheTime[vertex] = time++;
+					misses++;
+				}
+			}
+			runLength++;
+
+			if (triangle + 1 < end && misses <= target * runLength) {
+				splits.push_back(triangle + 1);
+				misses = runLength = 0;
+				time += cacheSize + 1;
+			}
+		}
+	}
+
+	// area weighted centroids and normals, the mesh centroid is the center everything faces away from
+	std::vector<glm::vec3> centroids(splits.size(), glm::vec3(0.0f));
+	std::vector<glm::vec3> normals(splits.size(), glm::vec3(0.0f));
+	std::vector<float> areas(splits.size(), 0.0f);
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+	for (size_t split = 0; split < splits.size(); split++) {
+		uint32_t end = split + 1 < splits.size() ? splits[split + 1] : triangleCount;
+		for (uint32_t triangle = splits[split]; triangle < end; triangle++) {
+			const glm::vec3& p0 = positions[indices[triangle * 3 + 0]];
+			const glm::vec3& p1 = positions[indices[triangle * 3 + 1]];
+			const glm::vec3& p2 = positions[indices[triangle * 3 + 2]];
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float area = glm::length(normal);
+
+			centroids[split] += (p0 + p1 + p2) * (area / 3.0f);
+			normals[split] += normal;
+			areas[split] += area;
+		}
+		meshCentroid += centroids[split];
+		meshArea += areas[split];
+	}
+	if (meshArea > 0.0f) {
+		meshCentroid /= meshArea;
+	}
+
+	std::vector<float> sortKeys(splits.size(), 0.0f);
+	for (size_t split = 0; split < splits.size(); split++) {
+		float normalLength = glm::length(normals[split]);
+		if (areas[split] > 0.0f && normalLength > 0.0f) {
+			sortKeys[split] = glm::dot(centroids[split] / areas[split] - meshCentroid, normals[split] / normalLength);
+		}
+	}
+
+	std::vector<uint32_t> order(splits.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+	uint32_t* out = destination;
+	for (uint32_t split : order) {
+		uint32_t end = split + 1 < splits.size() ? splits[split + 1] : triangleCount;
+		out = std::copy(indices + splits[split] * 3, indices + end * 3, out);
+	}
+	return static_cast<uint32_t>(splits.size());
+}
+
+uint32_t optimizeVertexFetchRemap(uint32_t* remap, uint32_t* indices, size_t indexCount, uint32_t vertexCount) {
+	std::fill(remap, remap + vertexCount, 0xffffffffu);
+	uint32_t next = 0;
+	for (size_t x = 0; x < indexCount; x++) {
+		uint32_t& vertex = remap[indices[x]];
+		if (vertex == 0xffffffffu) {
+			vertex = next++;
+		}
+		indices[x] = vertex;
+	}
+	return next;
+}
+
+MeshOptimizationStats optimizeIndices(std::vector<uint32_t>& indices, const std::vector<uint32_t>& ranges, const glm::vec3* positions, uint32_t vertexCount, std::vector<uint32_t>& remap,
+	uint32_t& usedCount, uint32_t cacheSize) {
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	MeshOptimizationStats stats;
+	stats.before = analyzeVertexCache(indices.data(), indices.size(), vertexCount, cacheSize);
+
+	// every range is a mesh of its own to both passes, the buffer keeps the order of the ranges. Ranges are
+	// renumbered to their own vertices first, so the passes size their per vertex state by the range rather
+	// than by the whole mesh; localIds is reset entry by entry afterwards.
+	uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+	std::vector<uint32_t> localIds(vertexCount, 0xffffffffu);
+	std::vector<uint32_t> globalIds;
+	std::vector<glm::vec3> localPositions;
+	std::vector<uint32_t> localIndices;
+	std::vector<uint32_t> cacheOrder;
+	std::vector<uint32_t> clusters;
+	for (size_t range = 0; range < std::max<size_t>(ranges.size(), 1); range++) {
+		uint32_t first = ranges.empty() ? 0 : ranges[range];
+		uint32_t end = range + 1 < ranges.size() ? ranges[range + 1] : triangleCount;
+		size_t rangeIndexCount = static_cast<size_t>(end - first) * 3;
+		uint32_t* rangeIndices = indices.data() + first * 3;
+
+		globalIds.clear();
+		localPositions.clear();
+		localIndices.resize(rangeIndexCount);
+		for (size_t x = 0; x < rangeIndexCount; x++) {
+			uint32_t& localId = localIds[rangeIndices[x]];
+			if (localId == 0xffffffffu) {
+				localId = static_cast<uint32_t>(globalIds.size());
+				globalIds.push_back(rangeIndices[x]);
+				localPositions.push_back(positions[rangeIndices[x]]);
+			}
+			localIndices[x] = localId;
+		}
+		uint32_t localCount = static_cast<uint32_t>(globalIds.size());
+
+		cacheOrder.resize(rangeIndexCount);
+		optimizeVertexCache(cacheOrder.data(), localIndices.data(), rangeIndexCount, localCount, cacheSize, clusters);
+		stats.clusterCount += optimizeOverdraw(localIndices.data(), cacheOrder.data(), rangeIndexCount, localPositions.data(), localCount, clusters, cacheSize);
+
+		for (size_t x = 0; x < rangeIndexCount; x++) {
+			rangeIndices[x] = globalIds[localIndices[x]];
+		}
+		for (uint32_t vertex : globalIds) {
+			localIds[vertex] = 0xffffffffu;
+		}
+	}
+
+	remap.resize(vertexCount);
+	usedCount = optimizeVertexFetchRemap(remap.data(), indices.data(), indices.size(), vertexCount);
+	stats.after = analyzeVertexCache(indices.data(), indices.size(), usedCount, cacheSize);
+
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+	stats.milliseconds = elapsed.count();
+	return stats;
+}
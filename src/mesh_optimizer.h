@@ -0,0 +1,82 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// FIFO post-transform cache the index order is tuned for and measured against. Current GPUs
+// batch vertices rather than keep a true FIFO, but a 16 entry FIFO still ranks orders the same.
+#define VERTEX_CACHE_SIZE 16
+// Overdraw ordering may give up this much ACMR, relative to the cache optimized order, to cut
+// clusters into smaller pieces that sort better.
+#define OVERDRAW_ACMR_THRESHOLD 1.05f
+
+struct VertexCacheStats {
+	uint32_t triangleCount = 0;
+	// vertices the index buffer references at least once
+	uint32_t vertexCount = 0;
+	// cache misses, every one is a vertex shader invocation
+	uint32_t transformCount = 0;
+	// transforms per triangle, 0.5 at best for a regular grid and 3 at worst
+	float acmr = 0.0f;
+	// transforms per referenced vertex, 1 is perfect
+	float atvr = 0.0f;
+};
+
+struct MeshOptimizationStats {
+	VertexCacheStats before;
+	VertexCacheStats after;
+	uint32_t clusterCount = 0;
+	double milliseconds = 0.0;
+};
+
+// Simulates a FIFO post-transform cache of cacheSize entries over the index buffer.
+VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, uint32_t vertexCount, uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+// Tipsify (Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced
+// Overdraw"): fans around vertices picked by how long they stay in the cache, in linear time.
+// Writes the reordered triangles to destination, which must not alias indices. clusters receives
+// the first triangle of every run that started from a cold cache, starting with 0.
+void optimizeVertexCache(uint32_t* destination, const uint32_t* indices, size_t indexCount, uint32_t vertexCount, uint32_t cacheSize, std::vector<uint32_t>& clusters);
+
+// Splits the clusters further wherever their ACMR stays within threshold of the whole buffer, then
+// sorts them so clusters facing away from the center of the mesh come first. Those tend to occlude
+// the rest from most directions, so less is shaded twice. Keeps the triangle order inside clusters
+// and returns how many there are after splitting.
+uint32_t optimizeOverdraw(uint32_t* destination, const uint32_t* indices, size_t indexCount, const glm::vec3* positions, uint32_t vertexCount, const std::vector<uint32_t>& clusters,
+	uint32_t cacheSize = VERTEX_CACHE_SIZE, float threshold = OVERDRAW_ACMR_THRESHOLD);
+
+// Numbers vertices in the order the index buffer first references them and rewrites the indices to
+// match. remap[old] is the new index, 0xffffffff for vertices nothing references. Returns the number
+// of referenced vertices.
+uint32_t optimizeVertexFetchRemap(uint32_t* remap, uint32_t* indices, size_t indexCount, uint32_t vertexCount);
+
+// The three passes above in order, with the before and after cache statistics. ranges holds the
+// first triangle of every range of triangles that has to stay together, like the triangles of one
+// material, empty for a single range. Triangles are only reordered within their range. Fills remap
+// and usedCount as optimizeVertexFetchRemap does, moving the vertices is left to the caller.
+MeshOptimizationStats optimizeIndices(std::vector<uint32_t>& indices, const std::vector<uint32_t>& ranges, const glm::vec3* positions, uint32_t vertexCount, std::vector<uint32_t>& remap,
+	uint32_t& usedCount, uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+// optimizeIndices on any vertex type with a glm::vec3 pos, unreferenced vertices are dropped.
+template <class TVert>
+MeshOptimizationStats optimizeMesh(std::vector<TVert>& vertices, std::vector<uint32_t>& indices, const std::vector<uint32_t>& ranges = {}, uint32_t cacheSize = VERTEX_CACHE_SIZE) {
+	std::vector<glm::vec3> positions(vertices.size());
+	for (size_t x = 0; x < vertices.size(); x++) {
+		positions[x] = vertices[x].pos;
+	}
+
+	std::vector<uint32_t> remap;
+	uint32_t usedCount = 0;
+	MeshOptimizationStats stats = optimizeIndices(indices, ranges, positions.data(), static_cast<uint32_t>(vertices.size()), remap, usedCount, cacheSize);
+
+	std::vector<TVert> reordered(usedCount);
+	for (size_t x = 0; x < vertices.size(); x++) {
+		if (remap[x] != 0xffffffffu) {
+			reordered[remap[x]] = vertices[x];
+		}
+	}
+	vertices.swap(reordered);
+	return stats;
+}
@@ -0,0 +1,380 @@
+#include "mesh_simplifier.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+
+#include "parallel.h"
+
+// Sum of weighted squared distances to planes, Q(p) = p^T A p + 2 b.p + c. Doubles keep the
+// cancellation close to the planes in check.
+struct Quadric {
+	double a00 = 0.0, a01 = 0.0, a02 = 0.0, a11 = 0.0, a12 = 0.0, a22 = 0.0;
+	double b0 = 0.0, b1 = 0.0, b2 = 0.0;
+	double c = 0.0;
+	double weight = 0.0;
+
+	void addPlane(const glm::vec3& normal, float distance, float planeWeight) {
+		double x = normal.x, y = normal.y, z = normal.z, d = distance, w = planeWeight;
+		a00 += w * x * x; a01 += w * x * y; a02 += w * x * z;
+		a11 += w * y * y; a12 += w * y * z; a22 += w * z * z;
+		b0 += w * x * d; b1 += w * y * d; b2 += w * z * d;
+		c += w * d * d;
+		weight += w;
+	}
+
+	void add(const Quadric& other) {
+		a00 += other.a00; a01 += other.a01; a02 += other.a02;
+		a11 += other.a11; a12 += other.a12; a22 += other.a22;
+		b0 += other.b0; b1 += other.b1; b2 += other.b2;
+		c += other.c;
+		weight += other.weight;
+	}
+
+	// area weighted root mean square distance of p to the planes
+	float error(const glm::vec3& p) const {
+		if (weight <= 0.0) {
+			return 0.0f;
+		}
+		double x = p.x, y = p.y, z = p.z;
+		double squared = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z) + 2.0 * (b0 * x + b1 * y + b2 * z) + c;
+		return static_cast<float>(std::sqrt(std::max(squared / weight, 0.0)));
+	}
+};
+
+struct PositionHash {
+	size_t operator()(const glm::vec3& position) const {
+		uint32_t bits[3];
+		memcpy(bits, &position, sizeof(bits));
+		return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+	}
+};
+
+struct EdgeCollapse {
+	uint32_t vertex;
+	uint32_t target;
+	float error;
+};
+
+static inline uint64_t edgeKey(uint32_t a, uint32_t b) {
+	return static_cast<uint64_t>(a) << 32 | b;
+}
+
+// Whether moving vertex onto target turns any surviving triangle around it over.
+static bool collapseFlips(uint32_t vertex, uint32_t target, const uint32_t* adjacent, uint32_t adjacentCount, const std::vector<uint32_t>& triangles, const std::vector<uint32_t>& remap,
+	const glm::vec3* positions) {
+	for (uint32_t x = 0; x < adjacentCount; x++) {
+		uint32_t corners[3];
+		for (uint32_t corner = 0; corner < 3; corner++) {
+			corners[corner] = remap[triangles[adjacent[x] * 3 + corner]];
+		}
+		if (corners[0] == target || corners[1] == target || corners[2] == target || corners[0] == corners[1] || corners[1] == corners[2] || corners[0] == corners[2]) {
+			continue;
+		}
+
+		glm::vec3 p[3] = {positions[corners[0]], positions[corners[1]], positions[corners[2]]};
+		glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+		for (uint32_t corner = 0; corner < 3; corner++) {
+			if (corners[corner] == vertex) {
+				p[corner] = positions[target];
+			}
+		}
+		glm::vec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+		if (glm::dot(before, after) <= 0.0f) {
+			return true;
+		}
+	}
+	return false;
+}
+
+float simplifyMesh(std::vector<uint32_t>& destination, std::vector<int32_t>& destinationMaterials, const uint32_t* indices, size_t indexCount, const int32_t* triangleMaterials,
+	const glm::vec3* positions, uint32_t vertexCount, size_t targetIndexCount, float targetError) {
+	size_t triangleCount = indexCount / 3;
+	std::vector<uint32_t> triangles(indices, indices + triangleCount * 3);
+	std::vector<int32_t> materials;
+	if (triangleMaterials) {
+		materials.assign(triangleMaterials, triangleMaterials + triangleCount);
+	}
+
+	// vertices sharing a position are wedges of one seam, the first one stands for all of them
+	std::vector<uint32_t> canonical(vertexCount);
+	std::vector<uint32_t> wedgeCount(vertexCount, 0);
+	{
+		std::vector<bool> referenced(vertexCount, false);
+		std::unordered_map<glm::vec3, uint32_t, PositionHash> firstAtPosition;
+		firstAtPosition.reserve(vertexCount);
+		for (uint32_t vertex : triangles) {
+			if (!referenced[vertex]) {
+				referenced[vertex] = true;
+				// adding zero turns -0 into 0, they compare equal and have to hash the same
+				canonical[vertex] = firstAtPosition.emplace(positions[vertex] + glm::vec3(0.0f), vertex).first->second;
+				wedgeCount[canonical[vertex]]++;
+			}
+		}
+	}
+
+	// locked positions: seams, open borders, non-manifold edges and material boundaries
+	std::vector<bool> locked(vertexCount, false);
+	for (uint32_t vertex = 0; vertex < vertexCount; vertex++) {
+		if (wedgeCount[vertex] > 1) {
+			locked[vertex] = true;
+		}
+	}
+	{
+		std::unordered_map<uint64_t, uint32_t> edges;
+		edges.reserve(triangles.size());
+		for (size_t x = 0; x < triangles.size(); x += 3) {
+			for (uint32_t corner = 0; corner < 3; corner++) {
+				edges[edgeKey(canonical[triangles[x + corner]], canonical[triangles[x + (corner + 1) % 3]])]++;
+			}
+		}
+		for (size_t x = 0; x < triangles.size(); x += 3) {
+			for (uint32_t corner = 0; corner < 3; corner++) {
+				uint32_t a = canonical[triangles[x + corner]];
+				uint32_t b = canonical[triangles[x + (corner + 1) % 3]];
+				auto twin = edges.find(edgeKey(b, a));
+				if (edges[edgeKey(a, b)] != 1 || twin == edges.end() || twin->second != 1) {
+					locked[a] = locked[b] = true;
+				}
+			}
+		}
+	}
+	if (!materials.empty()) {
+		std::vector<int32_t> vertexMaterial(vertexCount, INT32_MIN);
+		for (size_t x = 0; x < triangles.size(); x++) {
+			int32_t& material = vertexMaterial[canonical[triangles[x]]];
+			if (material == INT32_MIN) {
+				material = materials[x / 3];
+			} else if (material != materials[x / 3]) {
+				locked[canonical[triangles[x]]] = true;
+			}
+		}
+	}
+
+	std::vector<Quadric> quadrics(vertexCount);
+	for (size_t x = 0; x < triangles.size(); x += 3) {
+		const glm::vec3& p0 = positions[triangles[x + 0]];
+		const glm::vec3& p1 = positions[triangles[x + 1]];
+		const glm::vec3& p2 = positions[triangles[x + 2]];
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		float length = glm::length(normal);
+		if (length <= 0.0f) {
+			continue;
+		}
+		normal /= length;
+		for (uint32_t corner = 0; corner < 3; corner++) {
+			quadrics[canonical[triangles[x + corner]]].addPlane(normal, -glm::dot(normal, p0), length * 0.5f);
+		}
+	}
+
+	// passes of independent collapses, cheapest first, each vertex takes part in one per pass
+	float resultError = 0.0f;
+	std::vector<uint32_t> remap(vertexCount);
+	std::vector<bool> touched(vertexCount);
+	std::vector<uint32_t> adjacencyOffsets;
+	std::vector<uint32_t> adjacency;
+	std::vector<EdgeCollapse> collapses;
+	while (triangles.size() > targetIndexCount) {
+		adjacencyOffsets.assign(vertexCount + 1, 0);
+		for (uint32_t vertex : triangles) {
+			adjacencyOffsets[vertex + 1]++;
+		}
+		std::partial_sum(adjacencyOffsets.begin(), adjacencyOffsets.end(), adjacencyOffsets.begin());
+		std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		adjacency.resize(triangles.size());
+		for (size_t x = 0; x < triangles.size(); x++) {
+			adjacency[fill[triangles[x]]++] = static_cast<uint32_t>(x / 3);
+		}
+
+		collapses.clear();
+		for (uint32_t vertex = 0; vertex < vertexCount; vertex++) {
+			if (locked[canonical[vertex]] || adjacencyOffsets[vertex + 1] == adjacencyOffsets[vertex]) {
+				continue;
+			}
+			EdgeCollapse best = {vertex, vertex, FLT_MAX};
+			for (uint32_t x = adjacencyOffsets[vertex]; x < adjacencyOffsets[vertex + 1]; x++) {
+				for (uint32_t corner = 0; corner < 3; corner++) {
+					uint32_t target = triangles[adjacency[x] * 3 + corner];
+					if (target == vertex) {
+						continue;
+					}
+					Quadric merged = quadrics[vertex];
+					merged.add(quadrics[canonical[target]]);
+					float error = merged.error(positions[target]);
+					if (error < best.error) {
+						best = {vertex, target, error};
+					}
+				}
+			}
+			if (best.target != vertex) {
+				collapses.push_back(best);
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const EdgeCollapse& a, const EdgeCollapse& b) { return a.error < b.error; });
+
+		std::iota(remap.begin(), remap.end(), 0);
+		std::fill(touched.begin(), touched.end(), false);
+		size_t removable = triangles.size() / 3 - targetIndexCount / 3;
+		size_t removed = 0;
+		bool collapsed = false;
+		for (const EdgeCollapse& collapse : collapses) {
+			if (collapse.error > targetError || removed >= removable) {
+				break;
+			}
+			uint32_t vertex = collapse.vertex, target = collapse.target;
+			const uint32_t* adjacent = &adjacency[adjacencyOffsets[vertex]];
+			uint32_t adjacentCount = adjacencyOffsets[vertex + 1] - adjacencyOffsets[vertex];
+			if (touched[vertex] || touched[target] || collapseFlips(vertex, target, adjacent, adjacentCount, triangles, remap, positions)) {
+				continue;
+			}
+
+			for (uint32_t x = 0; x < adjacentCount; x++) {
+				const uint32_t* corners = &triangles[adjacent[x] * 3];
+				removed += remap[corners[0]] == target || remap[corners[1]] == target || remap[corners[2]] == target;
+			}
+			remap[vertex] = target;
+			touched[vertex] = touched[target] = true;
+			quadrics[canonical[target]].add(quadrics[vertex]);
+			resultError = std::max(resultError, collapse.error);
+			collapsed = true;
+		}
+		if (!collapsed) {
+			break;
+		}
+
+		// collapsed triangles drop out, the rest keep their order and material
+		size_t kept = 0;
+		for (size_t x = 0; x < triangles.size() / 3; x++) {
+			uint32_t a = remap[triangles[x * 3 + 0]], b = remap[triangles[x * 3 + 1]], c = remap[triangles[x * 3 + 2]];
+			if (a == b || b == c || a == c) {
+				continue;
+			}
+			triangles[kept * 3 + 0] = a;
+			triangles[kept * 3 + 1] = b;
+			triangles[kept * 3 + 2] = c;
+			if (!materials.empty()) {
+				materials[kept] = materials[x];
+			}
+			kept++;
+		}
+		triangles.resize(kept * 3);
+		if (!materials.empty()) {
+			materials.resize(kept);
+		}
+	}
+
+	destination.swap(triangles);
+	destinationMaterials.swap(materials);
+	return resultError;
+}
+
+// The levels one range simplified to, errors add up along the chain.
+struct RangeLodChain {
+	std::vector<std::vector<uint32_t>> indices;
+	std::vector<std::vector<int32_t>> materials;
+	std::vector<float> errors;
+};
+
+double buildLodChain(MeshLodData& lods, const uint32_t* indices, size_t indexCount, const int32_t* triangleMaterials, const std::vector<uint32_t>& ranges, const glm::vec3* positions,
+	uint32_t levelCount, float reduction, unsigned int threadCount) {
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	uint32_t triangleCount = static_cast<uint32_t>(indexCount / 3);
+	lods.levels.assign(1, {0, triangleCount * 3, 0.0f});
+	lods.indices.clear();
+	lods.materials.clear();
+
+	size_t rangeCount = std::max<size_t>(ranges.size(), 1);
+	std::vector<RangeLodChain> chains(rangeCount);
+	parallelFor(rangeCount, threadCount, [&](size_t range) {
+		uint32_t first = ranges.empty() ? 0 : ranges[range];
+		uint32_t end = range + 1 < ranges.size() ? ranges[range + 1] : triangleCount;
+		RangeLodChain& chain = chains[range];
+
+		// the range's own vertices, numbered in the order of their ids in the whole mesh, so simplifyMesh sizes its
+		// per vertex state by the range and still visits the vertices in the same order
+		std::vector<uint32_t> globalIds(indices + first * 3, indices + end * 3);
+		std::sort(globalIds.begin(), globalIds.end());
+		globalIds.erase(std::unique(globalIds.begin(), globalIds.end()), globalIds.end());
+		std::vector<glm::vec3> localPositions(globalIds.size());
+		for (size_t x = 0; x < globalIds.size(); x++) {
+			localPositions[x] = positions[globalIds[x]];
+		}
+
+		std::vector<uint32_t> previous(indices + first * 3, indices + end * 3);
+		for (uint32_t& vertex : previous) {
+			vertex = static_cast<uint32_t>(std::lower_bound(globalIds.begin(), globalIds.end(), vertex) - globalIds.begin());
+		}
+		std::vector<int32_t> previousMaterials;
+		if (triangleMaterials) {
+			previousMaterials.assign(triangleMaterials + first, triangleMaterials + end);
+		}
+		float error = 0.0f;
+		for (uint32_t level = 1; level < levelCount; level++) {
+			std::vector<uint32_t> levelIndices;
+			std::vector<int32_t> levelMaterials;
+			size_t target = static_cast<size_t>(previous.size() / 3 * reduction) * 3;
+			error += simplifyMesh(levelIndices, levelMaterials, previous.data(), previous.size(), triangleMaterials ? previousMaterials.data() : nullptr, localPositions.data(),
+				static_cast<uint32_t>(globalIds.size()), target);
+
+			chain.indices.push_back(levelIndices);
+			for (uint32_t& vertex : chain.indices.back()) {
+				vertex = globalIds[vertex];
+			}
+			chain.materials.push_back(levelMaterials);
+			chain.errors.push_back(error);
+			previous.swap(levelIndices);
+			previousMaterials.swap(levelMaterials);
+		}
+	});
+
+	// a level that barely shrinks ends the chain
+	for (uint32_t level = 1; level < levelCount; level++) {
+		size_t levelIndexCount = 0;
+		float levelError = 0.0f;
+		for (const RangeLodChain& chain : chains) {
+			levelIndexCount += chain.indices[level - 1].size();
+			levelError = std::max(levelError, chain.errors[level - 1]);
+		}
+		if (levelIndexCount == 0 || levelIndexCount > lods.levels.back().indexCount * LOD_MIN_REDUCTION) {
+			break;
+		}
+
+		MeshLod lod = {triangleCount * 3 + static_cast<uint32_t>(lods.indices.size()), static_cast<uint32_t>(levelIndexCount), levelError};
+		for (const RangeLodChain& chain : chains) {
+			lods.indices.insert(lods.indices.end(), chain.indices[level - 1].begin(), chain.indices[level - 1].end());
+			lods.materials.insert(lods.materials.end(), chain.materials[level - 1].begin(), chain.materials[level - 1].end());
+		}
+		lods.levels.push_back(lod);
+	}
+
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+	return elapsed.count();
+}
+
+float projectedLodError(float error, float distance, float fovY, uint32_t viewportHeight) {
+	float pixelsPerUnit = viewportHeight / (2.0f * std::tan(glm::radians(fovY) * 0.5f));
+	return error / std::max(distance, 1e-6f) * pixelsPerUnit;
+}
+
+uint32_t selectLod(const std::vector<MeshLod>& levels, const glm::vec3& boundsCenter, float boundsRadius, const glm::mat4& transform, const glm::vec3& cameraPosition, float fovY,
+	uint32_t viewportHeight, float maxPixelError) {
+	glm::vec3 center = glm::vec3(transform * glm::vec4(boundsCenter, 1.0f));
+	float scale = std::max(glm::length(glm::vec3(transform[0])), std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+
+	// the closest the mesh gets to the camera
+	float distance = glm::length(center - cameraPosition) - boundsRadius * scale;
+	if (distance <= 0.0f) {
+		return 0;
+	}
+
+	for (uint32_t level = static_cast<uint32_t>(levels.size()); level-- > 1;) {
+		if (projectedLodError(levels[level].error * scale, distance, fovY, viewportHeight) <= maxPixelError) {
+			return level;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <cfloat>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Levels in a LOD chain, the source mesh included, and the share of the triangles of the level
+// before that every level aims for.
+#define LOD_LEVEL_COUNT 5
+#define LOD_REDUCTION 0.5f
+// A level that keeps more than this share of the triangles of the one before ends the chain.
+#define LOD_MIN_REDUCTION 0.9f
+
+// One level of detail: a run of the index buffer, and how far its surface may be from the source
+// mesh in object space units.
+struct MeshLod {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error;
+};
+
+// levels[0] is the source index buffer at firstIndex 0. The other levels follow it: their indices
+// and per triangle materials are stored here, starting at the end of the source buffer, so the two
+// concatenated make one index buffer and one material buffer for the whole chain.
+struct MeshLodData {
+	std::vector<MeshLod> levels;
+	std::vector<uint32_t> indices;
+	std::vector<int32_t> materials;
+};
+
+// Quadric error metric simplification (Garland and Heckbert, "Surface Simplification Using Quadric
+// Error Metrics") by edge collapses onto existing vertices, so every level shares the vertex buffer.
+// Vertices on attribute seams (several vertices at one position), material boundaries, open borders
+// and non-manifold edges never move, though others may collapse onto them. Collapses that would flip
+// a triangle are skipped. Stops at targetIndexCount or before the error would exceed targetError.
+// triangleMaterials may be null, otherwise destinationMaterials receives the materials of the kept
+// triangles, which stay in their source order. Returns the error of the result against the input.
+float simplifyMesh(std::vector<uint32_t>& destination, std::vector<int32_t>& destinationMaterials, const uint32_t* indices, size_t indexCount, const int32_t* triangleMaterials,
+	const glm::vec3* positions, uint32_t vertexCount, size_t targetIndexCount, float targetError = FLT_MAX);
+
+// Builds levelCount levels, each simplified from the one before. ranges holds the first triangle of
+// every independent part, like the material ranges, empty for one. The parts are simplified on
+// threadCount threads (0 = all cores) and joined level by level, so every level keeps the order of
+// the ranges. The error of a level adds up those of the levels before it. Returns milliseconds.
+double buildLodChain(MeshLodData& lods, const uint32_t* indices, size_t indexCount, const int32_t* triangleMaterials, const std::vector<uint32_t>& ranges, const glm::vec3* positions,
+	uint32_t levelCount = LOD_LEVEL_COUNT, float reduction = LOD_REDUCTION, unsigned int threadCount = 0);
+
+// Height in pixels of an object space error seen from distance with a vertical field of view in degrees.
+float projectedLodError(float error, float distance, float fovY, uint32_t viewportHeight);
+
+// The coarsest level whose error stays under maxPixelError on screen, for a mesh with the given
+// object space bounding sphere placed with transform. Level 0 when the camera is inside the sphere.
+uint32_t selectLod(const std::vector<MeshLod>& levels, const glm::vec3& boundsCenter, float boundsRadius, const glm::mat4& transform, const glm::vec3& cameraPosition, float fovY,
+	uint32_t viewportHeight, float maxPixelError);
+
+// buildLodChain on any vertex type with a glm::vec3 pos.
+template <class TVert>
+double buildLodChain(MeshLodData& lods, const TVert* vertices, uint32_t vertexCount, const uint32_t* indices, size_t indexCount, const int32_t* triangleMaterials,
+	const std::vector<uint32_t>& ranges = {}) {
+	std::vector<glm::vec3> positions(vertexCount);
+	for (uint32_t x = 0; x < vertexCount; x++) {
+		positions[x] = vertices[x].pos;
+	}
+	return buildLodChain(lods, indices, indexCount, triangleMaterials, ranges, positions.data());
+}
@@ -0,0 +1,281 @@
+#include "meshlet.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+
+#define MESHLET_NO_VERTEX 0xff
+
+// Triangles of one range around every vertex that are not in a meshlet yet, emitted ones are swapped out.
+// offsets and counts are sized for the whole mesh once, a range only sets the entries of the vertices in
+// it, which are the only ones read while it is built.
+struct LiveAdjacency {
+	std::vector<uint32_t> offsets;
+	std::vector<uint32_t> counts;
+	std::vector<uint32_t> triangles;
+	// the vertices of the range, in the order their lists are laid out
+	std::vector<uint32_t> vertices;
+};
+
+static void buildLiveAdjacency(LiveAdjacency& adjacency, const uint32_t* indices, uint32_t firstTriangle, uint32_t endTriangle, uint32_t vertexCount) {
+	if (adjacency.counts.size() != vertexCount) {
+		adjacency.offsets.assign(vertexCount, 0);
+		adjacency.counts.assign(vertexCount, 0);
+		adjacency.vertices.clear();
+	}
+	for (uint32_t vertex : adjacency.vertices) {
+		adjacency.counts[vertex] = 0;
+	}
+	adjacency.vertices.clear();
+
+	for (uint32_t x = firstTriangle * 3; x < endTriangle * 3; x++) {
+		if (adjacency.counts[indices[x]]++ == 0) {
+			adjacency.vertices.push_back(indices[x]);
+		}
+	}
+	uint32_t offset = 0;
+	for (uint32_t vertex : adjacency.vertices) {
+		adjacency.offsets[vertex] = offset;
+		offset += adjacency.counts[vertex];
+		adjacency.counts[vertex] = 0;
+	}
+
+	adjacency.triangles.resize((endTriangle - firstTriangle) * 3);
+	for (uint32_t x = firstTriangle * 3; x < endTriangle * 3; x++) {
+		uint32_t vertex = indices[x];
+		adjacency.triangles[adjacency.offsets[vertex] + adjacency.counts[vertex]++] = x / 3;
+	}
+}
+
+static void removeTriangle(LiveAdjacency& adjacency, const uint32_t* indices, uint32_t triangle) {
+	for (uint32_t corner = 0; corner < 3; corner++) {
+		uint32_t vertex = indices[triangle * 3 + corner];
+		uint32_t* list = &adjacency.triangles[adjacency.offsets[vertex]];
+		uint32_t& count = adjacency.counts[vertex];
+		for (uint32_t x = 0; x < count; x++) {
+			if (list[x] == triangle) {
+				list[x] = list[--count];
+				break;
+			}
+		}
+	}
+}
+
+static void computeMeshletBounds(Meshlet& meshlet, const MeshletData& data, const glm::vec3* positions) {
+	const uint32_t* vertices = &data.vertices[meshlet.vertexOffset];
+	const uint8_t* triangles = &data.triangles[meshlet.triangleOffset];
+
+	glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+	for (uint32_t x = 0; x < meshlet.vertexCount; x++) {
+		boundsMin = glm::min(boundsMin, positions[vertices[x]]);
+		boundsMax = glm::max(boundsMax, positions[vertices[x]]);
+	}
+	meshlet.center = (boundsMin + boundsMax) * 0.5f;
+	meshlet.radius = 0.0f;
+	for (uint32_t x = 0; x < meshlet.vertexCount; x++) {
+		meshlet.radius = std::max(meshlet.radius, glm::length(positions[vertices[x]] - meshlet.center));
+	}
+
+	// the cone axis averages the unit normals, its angle is the normal furthest from the axis
+	std::vector<glm::vec3> normals;
+	normals.reserve(meshlet.triangleCount);
+	glm::vec3 normalSum(0.0f);
+	for (uint32_t x = 0; x < meshlet.triangleCount; x++) {
+		const glm::vec3& p0 = positions[vertices[triangles[x * 3 + 0]]];
+		const glm::vec3& p1 = positions[vertices[triangles[x * 3 + 1]]];
+		const glm::vec3& p2 = positions[vertices[triangles[x * 3 + 2]]];
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		float area = glm::length(normal);
+		normals.push_back(area > 0.0f ? normal / area : glm::vec3(0.0f));
+		normalSum += normals.back();
+	}
+
+	meshlet.coneApex = meshlet.center;
+	meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+	meshlet.coneCutoff = 2.0f;
+	float axisLength = glm::length(normalSum);
+	if (axisLength <= 0.0f) {
+		return;
+	}
+	glm::vec3 axis = normalSum / axisLength;
+
+	float minDot = 1.0f;
+	for (const glm::vec3& normal : normals) {
+		if (normal != glm::vec3(0.0f)) {
+			minDot = std::min(minDot, glm::dot(normal, axis));
+		}
+	}
+	if (minDot <= 0.0f) {
+		return;
+	}
+
+	// the apex sits on the axis behind the plane of every triangle
+	float apexDistance = 0.0f;
+	for (uint32_t x = 0; x < meshlet.triangleCount; x++) {
+		if (normals[x] == glm::vec3(0.0f)) {
+			continue;
+		}
+		const glm::vec3& p0 = positions[vertices[triangles[x * 3 + 0]]];
+		apexDistance = std::max(apexDistance, glm::dot(meshlet.center - p0, normals[x]) / glm::dot(axis, normals[x]));
+	}
+
+	meshlet.coneApex = meshlet.center - axis * apexDistance;
+	meshlet.coneAxis = axis;
+	meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+}
+
+static Meshlet startMeshlet(const MeshletData& data, uint32_t range) {
+	Meshlet meshlet = {};
+	meshlet.range = range;
+	meshlet.vertexOffset = static_cast<uint32_t>(data.vertices.size());
+	meshlet.triangleOffset = static_cast<uint32_t>(data.triangles.size());
+	return meshlet;
+}
+
+MeshletBuildStats buildMeshlets(MeshletData& meshlets, const uint32_t* indices, size_t indexCount, const std::vector<uint32_t>& ranges, const glm::vec3* positions, uint32_t vertexCount,
+	uint32_t maxVertices, uint32_t maxTriangles) {
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	maxVertices = std::min(std::max(maxVertices, 3u), 255u);
+	maxTriangles = std::max(maxTriangles, 1u);
+	meshlets.meshlets.clear();
+	meshlets.vertices.clear();
+	meshlets.triangles.clear();
+	meshlets.triangles.reserve(indexCount - indexCount % 3);
+
+	uint32_t triangleCount = static_cast<uint32_t>(indexCount / 3);
+	std::vector<uint8_t> localIndex(vertexCount, MESHLET_NO_VERTEX);
+	std::vector<bool> emitted(triangleCount, false);
+	LiveAdjacency adjacency;
+
+	// live neighbors of the meshlet being built, stamped with the meshlet they were added for
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> candidateStamp(triangleCount, 0);
+	uint32_t stamp = 1;
+
+	std::vector<glm::vec3> centroids(triangleCount);
+	for (uint32_t x = 0; x < triangleCount; x++) {
+		centroids[x] = (positions[indices[x * 3 + 0]] + positions[indices[x * 3 + 1]] + positions[indices[x * 3 + 2]]) * (1.0f / 3.0f);
+	}
+
+	for (size_t range = 0; range < std::max<size_t>(ranges.size(), 1); range++) {
+		uint32_t first = ranges.empty() ? 0 : ranges[range];
+		uint32_t end = range + 1 < ranges.size() ? ranges[range + 1] : triangleCount;
+		buildLiveAdjacency(adjacency, indices, first, end, vertexCount);
+
+		Meshlet meshlet = startMeshlet(meshlets, static_cast<uint32_t>(range));
+		glm::vec3 centroidSum(0.0f);
+		uint32_t cursor = first;
+		int64_t next = first < end ? first : -1;
+		while (next >= 0) {
+			uint32_t triangle = static_cast<uint32_t>(next);
+			for (uint32_t corner = 0; corner < 3; corner++) {
+				uint32_t vertex = indices[triangle * 3 + corner];
+				if (localIndex[vertex] == MESHLET_NO_VERTEX) {
+					localIndex[vertex] = static_cast<uint8_t>(meshlet.vertexCount++);
+					meshlets.vertices.push_back(vertex);
+				}
+				meshlets.triangles.push_back(localIndex[vertex]);
+			}
+			meshlet.triangleCount++;
+			emitted[triangle] = true;
+			removeTriangle(adjacency, indices, triangle);
+			centroidSum += centroids[triangle];
+			for (uint32_t corner = 0; corner < 3; corner++) {
+				uint32_t vertex = indices[triangle * 3 + corner];
+				const uint32_t* live = &adjacency.triangles[adjacency.offsets[vertex]];
+				for (uint32_t x = 0; x < adjacency.counts[vertex]; x++) {
+					if (candidateStamp[live[x]] != stamp) {
+						candidateStamp[live[x]] = stamp;
+						candidates.push_back(live[x]);
+					}
+				}
+			}
+			glm::vec3 centroid = centroidSum / static_cast<float>(meshlet.triangleCount);
+
+			// the neighbor that adds the fewest vertices, the closest one among those. Triangles that are
+			// the last ones left around a vertex count as adding none, they would strand it otherwise.
+			next = -1;
+			if (meshlet.triangleCount < maxTriangles) {
+				uint32_t bestPriority = 4;
+				float bestDistance = FLT_MAX;
+				size_t kept = 0;
+				for (uint32_t candidate : candidates) {
+					if (emitted[candidate]) {
+						continue;
+					}
+					candidates[kept++] = candidate;
+
+					uint32_t extra = 0;
+					bool dangling = false;
+					for (uint32_t corner = 0; corner < 3; corner++) {
+						uint32_t candidateVertex = indices[candidate * 3 + corner];
+						extra += localIndex[candidateVertex] == MESHLET_NO_VERTEX;
+						dangling = dangling || adjacency.counts[candidateVertex] == 1;
+					}
+					uint32_t priority = extra == 0 ? 0 : (dangling ? 1 : extra + 1);
+					if (meshlet.vertexCount + extra > maxVertices || priority > bestPriority) {
+						continue;
+					}
+
+					glm::vec3 offset = centroids[candidate] - centroid;
+					float distance = glm::dot(offset, offset);
+					if (priority < bestPriority || distance < bestDistance) {
+						bestPriority = priority;
+						bestDistance = distance;
+						next = candidate;
+					}
+				}
+				candidates.resize(kept);
+			}
+			if (next >= 0) {
+				continue;
+			}
+
+			// the meshlet is done, the next one starts from the closest triangle left around it
+			float bestDistance = FLT_MAX;
+			for (uint32_t x = 0; x < meshlet.vertexCount; x++) {
+				uint32_t vertex = meshlets.vertices[meshlet.vertexOffset + x];
+				const uint32_t* live = &adjacency.triangles[adjacency.offsets[vertex]];
+				for (uint32_t y = 0; y < adjacency.counts[vertex]; y++) {
+					glm::vec3 offset = centroids[live[y]] - centroid;
+					float distance = glm::dot(offset, offset);
+					if (distance < bestDistance) {
+						bestDistance = distance;
+						next = live[y];
+					}
+				}
+				localIndex[vertex] = MESHLET_NO_VERTEX;
+			}
+
+			computeMeshletBounds(meshlet, meshlets, positions);
+			meshlets.meshlets.push_back(meshlet);
+			meshlet = startMeshlet(meshlets, static_cast<uint32_t>(range));
+			centroidSum = glm::vec3(0.0f);
+			candidates.clear();
+			stamp++;
+
+			for (; next < 0 && cursor < end; cursor++) {
+				if (!emitted[cursor]) {
+					next = cursor;
+				}
+			}
+		}
+	}
+
+	MeshletBuildStats stats;
+	stats.meshletCount = static_cast<uint32_t>(meshlets.meshlets.size());
+	stats.triangleCount = triangleCount;
+	if (stats.meshletCount > 0) {
+		stats.averageVertexCount = static_cast<float>(meshlets.vertices.size()) / stats.meshletCount;
+		stats.averageTriangleCount = static_cast<float>(triangleCount) / stats.meshletCount;
+	}
+
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+	stats.milliseconds = elapsed.count();
+	if (stats.milliseconds > 0.0) {
+		stats.trianglesPerSecond = triangleCount / (stats.milliseconds / 1000.0);
+	}
+	return stats;
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Limits of one meshlet. 64 vertices and 124 triangles fill the mesh shader outputs NVIDIA
+// recommends, and local vertex indices fit a byte.
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+struct Meshlet {
+	// bounding sphere of the vertices
+	glm::vec3 center;
+	float radius;
+	// every triangle faces away from a viewer at p when dot(normalize(coneApex - p), coneAxis) >= coneCutoff,
+	// the cutoff is above 1 when the normals spread too far for that to ever hold
+	glm::vec3 coneApex;
+	float coneCutoff;
+	glm::vec3 coneAxis;
+	// which of the ranges given to buildMeshlets the triangles come from
+	uint32_t range;
+	// vertexCount entries of MeshletData::vertices and triangleCount * 3 of MeshletData::triangles
+	uint32_t vertexOffset;
+	uint32_t triangleOffset;
+	uint32_t vertexCount;
+	uint32_t triangleCount;
+};
+
+struct MeshletData {
+	std::vector<Meshlet> meshlets;
+	// mesh vertex indices, meshlets reference a run of them
+	std::vector<uint32_t> vertices;
+	// three indices into the run of vertices of the meshlet per triangle
+	std::vector<uint8_t> triangles;
+};
+
+struct MeshletBuildStats {
+	uint32_t meshletCount = 0;
+	uint32_t triangleCount = 0;
+	float averageVertexCount = 0.0f;
+	float averageTriangleCount = 0.0f;
+	double milliseconds = 0.0;
+	double trianglesPerSecond = 0.0;
+};
+
+// Grows meshlets one triangle at a time from the triangles that share a vertex with it, preferring
+// those that add the fewest vertices and then the ones closest to its centroid. A full meshlet
+// seeds the next one next to it, so meshlets follow the surface. ranges holds the first triangle of
+// every range of triangles that must not share a meshlet, like the triangles of one material, empty
+// for a single range. maxVertices can be 255 at most.
+MeshletBuildStats buildMeshlets(MeshletData& meshlets, const uint32_t* indices, size_t indexCount, const std::vector<uint32_t>& ranges, const glm::vec3* positions, uint32_t vertexCount,
+	uint32_t maxVertices = MESHLET_MAX_VERTICES, uint32_t maxTriangles = MESHLET_MAX_TRIANGLES);
+
+// Cluster backface culling against the normal cone.
+inline bool meshletBackfacing(const Meshlet& meshlet, const glm::vec3& viewer) {
+	glm::vec3 direction = meshlet.coneApex - viewer;
+	float distance = glm::length(direction);
+	return distance > 0.0f && glm::dot(direction, meshlet.coneAxis) >= meshlet.coneCutoff * distance;
+}
+
+// buildMeshlets on any vertex type with a glm::vec3 pos.
+template <class TVert>
+MeshletBuildStats buildMeshlets(MeshletData& meshlets, const TVert* vertices, uint32_t vertexCount, const uint32_t* indices, size_t indexCount, const std::vector<uint32_t>& ranges = {}) {
+	std::vector<glm::vec3> positions(vertexCount);
+	for (uint32_t x = 0; x < vertexCount; x++) {
+		positions[x] = vertices[x].pos;
+	}
+	return buildMeshlets(meshlets, indices, indexCount, ranges, positions.data(), vertexCount);
+}
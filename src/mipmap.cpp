@@ -0,0 +1,91 @@
+#include "mipmap.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+uint32_t mipLevelCount(uint32_t width, uint32_t height) {
+	uint32_t levels = 1;
+	for (uint32_t size = std::max(width, height); size > 1; size >>= 1) {
+		levels++;
+	}
+	return levels;
+}
+
+uint32_t mipLevelWidth(uint32_t width, uint32_t level) {
+	return std::max(1u, width >> level);
+}
+
+size_t mipChainSize(uint32_t width, uint32_t height) {
+	size_t size = 0;
+	uint32_t levels = mipLevelCount(width, height);
+	for (uint32_t level = 1; level < levels; level++) {
+		size += static_cast<size_t>(mipLevelWidth(width, level)) * mipLevelWidth(height, level) * 4;
+	}
+	return size;
+}
+
+void downsampleRgba8(const uint8_t* src, uint32_t width, uint32_t height, uint8_t* dst) {
+	uint32_t dstWidth = mipLevelWidth(width, 1);
+	uint32_t dstHeight = mipLevelWidth(height, 1);
+	size_t srcPitch = static_cast<size_t>(width) * 4;
+	// with a side of 1 the second tap repeats the first, which keeps the rounding of a 2 tap average
+	uint32_t stepX = width > 1 ? 1 : 0;
+	size_t stepY = height > 1 ? srcPitch : 0;
+
+	for (uint32_t y = 0; y < dstHeight; y++) {
+		const uint8_t* row0 = src + srcPitch * y * 2;
+		const uint8_t* row1 = row0 + stepY;
+		uint8_t* out = dst + static_cast<size_t>(dstWidth) * 4 * y;
+		uint32_t x = 0;
+
+#if defined(__SSE2__)
+		// 8 source pixels of both rows become 4 output pixels, summed in 16 bits
+		if (stepX == 1) {
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i round = _mm_set1_epi16(2);
+			for (; x + 4 <= dstWidth; x += 4) {
+				__m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8));
+				__m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8 + 16));
+				__m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8));
+				__m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8 + 16));
+
+				__m128i s01 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+				__m128i s23 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+				__m128i s45 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+				__m128i s67 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+
+				__m128i lo = _mm_add_epi16(_mm_unpacklo_epi64(s01, s23), _mm_unpackhi_epi64(s01, s23));
+				__m128i hi = _mm_add_epi16(_mm_unpacklo_epi64(s45, s67), _mm_unpackhi_epi64(s45, s67));
+				lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 2);
+				hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 2);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * 4), _mm_packus_epi16(lo, hi));
+			}
+		}
+#endif
+
+		for (; x < dstWidth; x++) {
+			const uint8_t* p0 = row0 + x * 8;
+			const uint8_t* p1 = row1 + x * 8;
+			for (uint32_t c = 0; c < 4; c++) {
+				out[x * 4 + c] = static_cast<uint8_t>((p0[c] + p0[stepX * 4 + c] + p1[c] + p1[stepX * 4 + c] + 2) >> 2);
+			}
+		}
+	}
+}
+
+void generateMipChain(const uint8_t* pixels, uint32_t width, uint32_t height, uint8_t* mips) {
+	uint32_t levels = mipLevelCount(width, height);
+	const uint8_t* src = pixels;
+	uint8_t* dst = mips;
+	for (uint32_t level = 1; level < levels; level++) {
+		uint32_t srcWidth = mipLevelWidth(width, level - 1);
+		uint32_t srcHeight = mipLevelWidth(height, level - 1);
+		downsampleRgba8(src, srcWidth, srcHeight, dst);
+
+		src = dst;
+		dst += static_cast<size_t>(mipLevelWidth(width, level)) * mipLevelWidth(height, level) * 4;
+	}
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Levels down to 1x1, each half the size of the one above rounded down.
+uint32_t mipLevelCount(uint32_t width, uint32_t height);
+uint32_t mipLevelWidth(uint32_t width, uint32_t level);
+
+// Bytes of levels 1 and below of an RGBA8 image, packed one after the other.
+size_t mipChainSize(uint32_t width, uint32_t height);
+
+// 2x2 box filter from an RGBA8 level into the next one. A last odd row or column is dropped,
+// the same footprint vkCmdBlitImage uses, and a side that is already 1 is only filtered along
+// the other axis. The values are averaged as stored since textures are sampled as UNORM.
+void downsampleRgba8(const uint8_t* src, uint32_t width, uint32_t height, uint8_t* dst);
+
+// Writes levels 1 and below of pixels into mips, laid out as mipChainSize describes.
+void generateMipChain(const uint8_t* pixels, uint32_t width, uint32_t height, uint8_t* mips);
@@ -2,6 +2,1095 @@
  * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
  *****************************************************************************/
 
-// This file exist only to do the implementation of tiny obj loader
+// This file exist only to do the implementation of tiny obj loader, and of the
+// parallel and streaming loaders which share its (file static) parsing helpers.
+// obj_loader.h comes first, the implementation part of tiny_obj_loader.h is
+// not include guarded.
+#include "obj_loader.h"
+
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
+
+#include <cstdio>
+
+#include "mapped_file.h"
+#include "parallel.h"
+
+namespace tinyobj {
+
+bool ParseDouble(const char* s, const char* s_end, double* result, parse_double_path_t path)
+{
+  if(path == PARSE_DOUBLE_FAST)
+  {
+    return s < s_end && tryParseDoubleFast(s, s_end, result);
+  }
+  if(path == PARSE_DOUBLE_GENERIC)
+  {
+    return tryParseDoubleGeneric(s, s_end, result);
+  }
+  return tryParseDouble(s, s_end, result);
+}
+
+// Face corner whose indices are fixed up once the attribute counts of the
+// preceding chunks are known. Relative (negative) indices are stored relative
+// to the start of their chunk and flagged in 'relative'.
+struct deferred_index_t
+{
+  int           v_idx, vt_idx, vn_idx;
+  unsigned char relative;
+};
+
+enum
+{
+  DEFERRED_RELATIVE_V  = 1,
+  DEFERRED_RELATIVE_VT = 2,
+  DEFERRED_RELATIVE_VN = 4
+};
+
+// Commands whose effect depends on the state left by previous chunks. They are
+// replayed in file order once every chunk is tokenized.
+struct chunk_event_t
+{
+  enum
+  {
+    USEMTL,
+    MTLLIB,
+    GROUP,
+    OBJECT,
+    TAG,
+    PARSE_ERROR
+  } type;
+
+  size_t      face;  // faces of the chunk preceding the command
+  size_t      indexOffset;
+  size_t      polyOffset;
+  std::string text;
+  tag_t       tag;
+};
+
+struct obj_chunk_t
+{
+  const char* begin;
+  const char* end;
+
+  std::vector<real_t> v;
+  std::vector<real_t> vn;
+  std::vector<real_t> vt;
+  std::vector<real_t> vc;
+
+  std::vector<deferred_index_t> corners;
+  std::vector<size_t>           faceCorner;     // first corner of each face, plus end
+  std::vector<unsigned int>     faceSmoothing;  // valid from 'inheritFaces' on
+  std::vector<size_t>           polygonVertexCount;
+  size_t                        inheritFaces = 0;
+  bool                          smoothingSet = false;
+  unsigned int                  smoothing    = 0;
+
+  std::vector<chunk_event_t> events;
+
+  // attribute counts of all preceding chunks and state at the start of the chunk
+  size_t       baseV = 0, baseVn = 0, baseVt = 0;
+  unsigned int startSmoothing = 0;
+
+  shape_t output;  // triangulated faces, material ids are assigned on replay
+  size_t  outputIndexEnd = 0;
+  size_t  outputPolyEnd  = 0;
+};
+
+// Same grammar as parseTriple(), but index fixing is deferred because the
+// attribute counts of the previous chunks are not known yet.
+static bool parseTripleDeferred(const char** token, size_t vsize, size_t vnsize, size_t vtsize, deferred_index_t* ret)
+{
+  deferred_index_t vi = {-1, -1, -1, 0};
+
+  int idx = atoi((*token));
+  if(idx == 0)
+    return false;
+  vi.v_idx = idx > 0 ? idx - 1 : static_cast<int>(vsize) + idx;
+  vi.relative |= idx < 0 ? DEFERRED_RELATIVE_V : 0;
+
+  (*token) += strcspn((*token), "/ \t\r");
+  if((*token)[0] != '/')
+  {
+    (*ret) = vi;
+    return true;
+  }
+  (*token)++;
+
+  // i//k
+  if((*token)[0] == '/')
+  {
+    (*token)++;
+    idx = atoi((*token));
+    if(idx == 0)
+      return false;
+    vi.vn_idx = idx > 0 ? idx - 1 : static_cast<int>(vnsize) + idx;
+    vi.relative |= idx < 0 ? DEFERRED_RELATIVE_VN : 0;
+    (*token) += strcspn((*token), "/ \t\r");
+    (*ret) = vi;
+    return true;
+  }
+
+  // i/j/k or i/j
+  idx = atoi((*token));
+  if(idx == 0)
+    return false;
+  vi.vt_idx = idx > 0 ? idx - 1 : static_cast<int>(vtsize) + idx;
+  vi.relative |= idx < 0 ? DEFERRED_RELATIVE_VT : 0;
+
+  (*token) += strcspn((*token), "/ \t\r");
+  if((*token)[0] != '/')
+  {
+    (*ret) = vi;
+    return true;
+  }
+
+  // i/j/k
+  (*token)++;  // skip '/'
+  idx = atoi((*token));
+  if(idx == 0)
+    return false;
+  vi.vn_idx = idx > 0 ? idx - 1 : static_cast<int>(vnsize) + idx;
+  vi.relative |= idx < 0 ? DEFERRED_RELATIVE_VN : 0;
+  (*token) += strcspn((*token), "/ \t\r");
+
+  (*ret) = vi;
+  return true;
+}
+
+// Tokenizes the lines of one chunk, mirroring the command handling of LoadObj().
+static void tokenizeChunk(obj_chunk_t& chunk, bool triangulate)
+{
+  std::string linebuf;
+
+  const char* p = chunk.begin;
+  while(p < chunk.end)
+  {
+    const char* lineEnd = p;
+    while(lineEnd < chunk.end && *lineEnd != '\n' && *lineEnd != '\r')
+      lineEnd++;
+    linebuf.assign(p, lineEnd);
+
+    p = lineEnd;
+    if(p < chunk.end)
+    {
+      if(*p == '\r' && p + 1 < chunk.end && *(p + 1) == '\n')
+        p++;
+      p++;
+    }
+
+    // Skip if empty line.
+    if(linebuf.empty())
+      continue;
+
+    // Skip leading space.
+    const char* token = linebuf.c_str();
+    token += strspn(token, " \t");
+
+    if(token[0] == '\0')
+      continue;  // empty line
+
+    if(token[0] == '#')
+      continue;  // comment line
+
+    // vertex
+    if(token[0] == 'v' && IS_SPACE((token[1])))
+    {
+      token += 2;
+      real_t x, y, z;
+      real_t r, g, b;
+      parseVertexWithColor(&x, &y, &z, &r, &g, &b, &token);
+      chunk.v.push_back(x);
+      chunk.v.push_back(y);
+      chunk.v.push_back(z);
+
+      chunk.vc.push_back(r);
+      chunk.vc.push_back(g);
+      chunk.vc.push_back(b);
+      continue;
+    }
+
+    // normal
+    if(token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2])))
+    {
+      token += 3;
+      real_t x, y, z;
+      parseReal3(&x, &y, &z, &token);
+      chunk.vn.push_back(x);
+      chunk.vn.push_back(y);
+      chunk.vn.push_back(z);
+      continue;
+    }
+
+    // texcoord
+    if(token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2])))
+    {
+      token += 3;
+      real_t x, y;
+      parseReal2(&x, &y, &token);
+      chunk.vt.push_back(x);
+      chunk.vt.push_back(y);
+      continue;
+    }
+
+    // face
+    if(token[0] == 'f' && IS_SPACE((token[1])))
+    {
+      token += 2;
+      token += strspn(token, " \t");
+
+      size_t first = chunk.corners.size();
+      while(!IS_NEW_LINE(token[0]))
+      {
+        deferred_index_t vi;
+        if(!parseTripleDeferred(&token, chunk.v.size() / 3, chunk.vn.size() / 3, chunk.vt.size() / 2, &vi))
+        {
+          // LoadObj() stops at the first bad face, nothing after it matters
+          chunk.corners.resize(first);
+          chunk_event_t event;
+          event.type = chunk_event_t::PARSE_ERROR;
+          event.face = chunk.faceSmoothing.size();
+          chunk.events.push_back(event);
+          return;
+        }
+
+        chunk.corners.push_back(vi);
+        size_t n = strspn(token, " \t\r");
+        token += n;
+      }
+
+      chunk.faceCorner.push_back(first);
+      chunk.faceSmoothing.push_back(chunk.smoothing);
+      if(!chunk.smoothingSet)
+        chunk.inheritFaces++;
+      if(triangulate && chunk.corners.size() - first > 3)
+        chunk.polygonVertexCount.push_back(chunk.v.size() / 3);
+      continue;
+    }
+
+    // use mtl
+    if((0 == strncmp(token, "usemtl", 6)) && IS_SPACE((token[6])))
+    {
+      chunk_event_t event;
+      event.type = chunk_event_t::USEMTL;
+      event.face = chunk.faceSmoothing.size();
+      event.text = token + 7;
+      chunk.events.push_back(event);
+      continue;
+    }
+
+    // load mtl
+    if((0 == strncmp(token, "mtllib", 6)) && IS_SPACE((token[6])))
+    {
+      chunk_event_t event;
+      event.type = chunk_event_t::MTLLIB;
+      event.face = chunk.faceSmoothing.size();
+      event.text = token + 7;
+      chunk.events.push_back(event);
+      continue;
+    }
+
+    // group name
+    if(token[0] == 'g' && IS_SPACE((token[1])))
+    {
+      std::vector<std::string> names;
+      names.reserve(2);
+
+      while(!IS_NEW_LINE(token[0]))
+      {
+        std::string str = parseString(&token);
+        names.push_back(str);
+        token += strspn(token, " \t\r");  // skip tag
+      }
+
+      chunk_event_t event;
+      event.type = chunk_event_t::GROUP;
+      event.face = chunk.faceSmoothing.size();
+      // names[0] must be 'g', so skip the 0th element.
+      if(names.size() > 1)
+        event.text = names[1];
+      chunk.events.push_back(event);
+      continue;
+    }
+
+    // object name
+    if(token[0] == 'o' && IS_SPACE((token[1])))
+    {
+      chunk_event_t event;
+      event.type = chunk_event_t::OBJECT;
+      event.face = chunk.faceSmoothing.size();
+      event.text = token + 2;
+      chunk.events.push_back(event);
+      continue;
+    }
+
+    if(token[0] == 't' && IS_SPACE(token[1]))
+    {
+      const int max_tag_nums = 8192;
+      tag_t     tag;
+
+      token += 2;
+
+      tag.name = parseString(&token);
+
+      tag_sizes ts = parseTagTriple(&token);
+
+      ts.num_ints    = std::min(std::max(ts.num_ints, 0), max_tag_nums);
+      ts.num_reals   = std::min(std::max(ts.num_reals, 0), max_tag_nums);
+      ts.num_strings = std::min(std::max(ts.num_strings, 0), max_tag_nums);
+
+      tag.intValues.resize(static_cast<size_t>(ts.num_ints));
+      for(size_t i = 0; i < static_cast<size_t>(ts.num_ints); ++i)
+        tag.intValues[i] = parseInt(&token);
+
+      tag.floatValues.resize(static_cast<size_t>(ts.num_reals));
+      for(size_t i = 0; i < static_cast<size_t>(ts.num_reals); ++i)
+        tag.floatValues[i] = parseReal(&token);
+
+      tag.stringValues.resize(static_cast<size_t>(ts.num_strings));
+      for(size_t i = 0; i < static_cast<size_t>(ts.num_strings); ++i)
+        tag.stringValues[i] = parseString(&token);
+
+      chunk_event_t event;
+      event.type = chunk_event_t::TAG;
+      event.face = chunk.faceSmoothing.size();
+      event.tag  = tag;
+      chunk.events.push_back(event);
+      continue;
+    }
+
+    if(token[0] == 's' && IS_SPACE(token[1]))
+    {
+      // smoothing group id
+      token += 2;
+      token += strspn(token, " \t");  // skip space
+
+      if(token[0] == '\0')
+        continue;
+
+      if(token[0] == '\r' || token[1] == '\n')
+        continue;
+
+      if(strlen(token) >= 3)
+      {
+        if(token[0] == 'o' && token[1] == 'f' && token[2] == 'f')
+        {
+          chunk.smoothing    = 0;
+          chunk.smoothingSet = true;
+        }
+      }
+      else
+      {
+        // assume number
+        int smGroupId      = parseInt(&token);
+        chunk.smoothing    = smGroupId < 0 ? 0 : static_cast<unsigned int>(smGroupId);
+        chunk.smoothingSet = true;
+      }
+      continue;
+    }
+
+    // Ignore unknown command.
+  }
+}
+
+static inline int resolveDeferred(int idx, bool relative, size_t base)
+{
+  return relative ? idx + static_cast<int>(base) : idx;
+}
+
+// Fixes up the face indices of a chunk and triangulates its faces. Returns
+// false when a polygon references a vertex defined after it, in which case the
+// result could depend on where the face group gets flushed.
+static bool triangulateChunk(obj_chunk_t& chunk, bool triangulate, const std::vector<real_t>& v)
+{
+  mesh_t& mesh = chunk.output.mesh;
+  mesh.indices.reserve(chunk.corners.size());
+  mesh.num_face_vertices.reserve(chunk.faceSmoothing.size());
+  mesh.smoothing_group_ids.reserve(chunk.faceSmoothing.size());
+
+  const std::vector<tag_t> noTags;
+  const std::string        noName;
+  std::vector<face_t>      polygon(1);
+
+  size_t faceCount = chunk.faceSmoothing.size();
+  chunk.faceCorner.push_back(chunk.corners.size());
+
+  size_t eventIndex   = 0;
+  size_t polygonIndex = 0;
+  for(size_t face = 0; face <= faceCount; face++)
+  {
+    while(eventIndex < chunk.events.size() && chunk.events[eventIndex].face == face)
+    {
+      chunk.events[eventIndex].indexOffset = mesh.indices.size();
+      chunk.events[eventIndex].polyOffset  = mesh.num_face_vertices.size();
+      eventIndex++;
+    }
+    if(face == faceCount)
+      break;
+
+    unsigned int smoothing = face < chunk.inheritFaces ? chunk.startSmoothing : chunk.faceSmoothing[face];
+    size_t       first     = chunk.faceCorner[face];
+    size_t       npolys    = chunk.faceCorner[face + 1] - first;
+
+    if(npolys < 3)
+      continue;
+
+    if(npolys == 3 || !triangulate)
+    {
+      for(size_t k = 0; k < npolys; k++)
+      {
+        const deferred_index_t& corner = chunk.corners[first + k];
+
+        index_t idx;
+        idx.vertex_index   = resolveDeferred(corner.v_idx, corner.relative & DEFERRED_RELATIVE_V, chunk.baseV);
+        idx.normal_index   = resolveDeferred(corner.vn_idx, corner.relative & DEFERRED_RELATIVE_VN, chunk.baseVn);
+        idx.texcoord_index = resolveDeferred(corner.vt_idx, corner.relative & DEFERRED_RELATIVE_VT, chunk.baseVt);
+        mesh.indices.push_back(idx);
+      }
+      mesh.num_face_vertices.push_back(static_cast<unsigned char>(npolys));
+      mesh.smoothing_group_ids.push_back(smoothing);
+      continue;
+    }
+
+    // ear clipping looks at the positions, only hand over vertices already parsed
+    const int vertexCountAtFace = static_cast<int>(chunk.baseV + chunk.polygonVertexCount[polygonIndex++]);
+
+    face_t& f = polygon[0];
+    f.smoothing_group_id = smoothing;
+    f.vertex_indices.resize(npolys);
+    for(size_t k = 0; k < npolys; k++)
+    {
+      const deferred_index_t& corner = chunk.corners[first + k];
+
+      vertex_index_t& vi = f.vertex_indices[k];
+      vi.v_idx           = resolveDeferred(corner.v_idx, corner.relative & DEFERRED_RELATIVE_V, chunk.baseV);
+      vi.vn_idx          = resolveDeferred(corner.vn_idx, corner.relative & DEFERRED_RELATIVE_VN, chunk.baseVn);
+      vi.vt_idx          = resolveDeferred(corner.vt_idx, corner.relative & DEFERRED_RELATIVE_VT, chunk.baseVt);
+
+      if(vi.v_idx >= vertexCountAtFace)
+        return false;
+    }
+
+    exportFaceGroupToShape(&chunk.output, polygon, noTags, 0, noName, triangulate, v);
+  }
+
+  chunk.outputIndexEnd = mesh.indices.size();
+  chunk.outputPolyEnd  = mesh.num_face_vertices.size();
+
+  // material ids are filled in on replay, free what exportFaceGroupToShape() added
+  std::vector<int>().swap(mesh.material_ids);
+  return true;
+}
+
+// Position in the face stream of the file: a face of a chunk.
+struct face_cursor_t
+{
+  size_t chunk;
+  size_t face;
+  size_t indexOffset;
+  size_t polyOffset;
+};
+
+// Equivalent of exportFaceGroupToShape() for the already triangulated faces
+// between two cursors.
+static bool exportFaceRange(shape_t* shape, const std::vector<obj_chunk_t>& chunks, const face_cursor_t& begin,
+                            const face_cursor_t& end, const std::vector<tag_t>& tags, const int material_id,
+                            const std::string& name)
+{
+  size_t faceCount = 0;
+  for(size_t c = begin.chunk; c <= end.chunk; c++)
+  {
+    size_t faceBegin = c == begin.chunk ? begin.face : 0;
+    size_t faceEnd   = c == end.chunk ? end.face : chunks[c].faceSmoothing.size();
+    faceCount += faceEnd - faceBegin;
+  }
+  if(faceCount == 0)
+    return false;
+
+  for(size_t c = begin.chunk; c <= end.chunk; c++)
+  {
+    const mesh_t& source     = chunks[c].output.mesh;
+    size_t        indexBegin = c == begin.chunk ? begin.indexOffset : 0;
+    size_t        indexEnd   = c == end.chunk ? end.indexOffset : chunks[c].outputIndexEnd;
+    size_t        polyBegin  = c == begin.chunk ? begin.polyOffset : 0;
+    size_t        polyEnd    = c == end.chunk ? end.polyOffset : chunks[c].outputPolyEnd;
+
+    shape->mesh.indices.insert(shape->mesh.indices.end(), source.indices.begin() + indexBegin,
+                               source.indices.begin() + indexEnd);
+    shape->mesh.num_face_vertices.insert(shape->mesh.num_face_vertices.end(),
+                                         source.num_face_vertices.begin() + polyBegin,
+                                         source.num_face_vertices.begin() + polyEnd);
+    shape->mesh.smoothing_group_ids.insert(shape->mesh.smoothing_group_ids.end(),
+                                           source.smoothing_group_ids.begin() + polyBegin,
+                                           source.smoothing_group_ids.begin() + polyEnd);
+    shape->mesh.material_ids.insert(shape->mesh.material_ids.end(), polyEnd - polyBegin, material_id);
+  }
+
+  shape->name      = name;
+  shape->mesh.tags = tags;
+
+  return true;
+}
+
+static std::string materialBaseDir(const char* mtl_basedir)
+{
+  std::string baseDir;
+  if(mtl_basedir)
+  {
+    baseDir = mtl_basedir;
+#ifndef _WIN32
+    const char dirsep = '/';
+#else
+    const char dirsep = '\\';
+#endif
+    if(!baseDir.empty() && baseDir[baseDir.length() - 1] != dirsep)
+      baseDir += dirsep;
+  }
+  return baseDir;
+}
+
+// Loads the files of an 'mtllib' line into 'materials', like LoadObj().
+static void loadMaterialLibrary(const std::string& text, MaterialFileReader& matFileReader,
+                                std::vector<material_t>* materials, std::map<std::string, int>* material_map,
+                                std::string* err)
+{
+  std::vector<std::string> filenames;
+  SplitString(text, ' ', filenames);
+
+  if(filenames.empty())
+  {
+    if(err)
+      (*err) += "WARN: Looks like empty filename for mtllib. Use default material. \n";
+    return;
+  }
+
+  for(size_t s = 0; s < filenames.size(); s++)
+  {
+    std::string err_mtl;
+    bool        ok = matFileReader(filenames[s].c_str(), materials, material_map, &err_mtl);
+    if(err && (!err_mtl.empty()))
+      (*err) += err_mtl;  // This should be warn message.
+
+    if(ok)
+      return;
+  }
+
+  if(err)
+    (*err) += "WARN: Failed to load material file(s). Use default material.\n";
+}
+
+// Splits [begin, end) into chunks that start right after a '\n', which always
+// begins a line no matter the line ending style.
+static void splitChunks(std::vector<obj_chunk_t>& chunks, const char* begin, const char* end, size_t chunkSize)
+{
+  while(begin < end)
+  {
+    const char* chunkEnd = begin + std::min<size_t>(chunkSize, end - begin);
+    while(chunkEnd < end && *(chunkEnd - 1) != '\n')
+      chunkEnd++;
+
+    chunks.emplace_back();
+    chunks.back().begin = begin;
+    chunks.back().end   = chunkEnd;
+    begin               = chunkEnd;
+  }
+}
+
+bool LoadObjParallel(attrib_t* attrib, std::vector<shape_t>* shapes, std::vector<material_t>* materials,
+                     std::string* err, const char* filename, const char* mtl_basedir, bool triangulate,
+                     unsigned int threadCount)
+{
+  attrib->vertices.clear();
+  attrib->normals.clear();
+  attrib->texcoords.clear();
+  attrib->colors.clear();
+  shapes->clear();
+
+  MappedFile file;
+  if(!file.open(filename))
+  {
+    // empty files and unreadable ones are left to the reference loader
+    return LoadObj(attrib, shapes, materials, err, filename, mtl_basedir, triangulate);
+  }
+
+  MaterialFileReader matFileReader(materialBaseDir(mtl_basedir));
+
+  if(threadCount == 0)
+    threadCount = defaultThreadCount();
+
+  // Several chunks per thread keep the workers busy when the density of the
+  // file varies.
+  const char* data      = reinterpret_cast<const char*>(file.data());
+  const size_t chunkSize = std::max<size_t>(1 << 20, static_cast<size_t>(file.size()) / (threadCount * 8));
+
+  std::vector<obj_chunk_t> chunks;
+  splitChunks(chunks, data, data + file.size(), chunkSize);
+
+  parallelFor(chunks.size(), threadCount, [&](size_t x) { tokenizeChunk(chunks[x], triangulate); });
+
+  // Nothing after the first bad face line is used by LoadObj().
+  for(size_t c = 0; c < chunks.size(); c++)
+  {
+    if(!chunks[c].events.empty() && chunks[c].events.back().type == chunk_event_t::PARSE_ERROR)
+    {
+      chunks.resize(c + 1);
+      break;
+    }
+  }
+
+  size_t       vertexCount = 0, normalCount = 0, texcoordCount = 0;
+  unsigned int smoothing = 0;
+  for(auto& chunk : chunks)
+  {
+    chunk.baseV          = vertexCount;
+    chunk.baseVn         = normalCount;
+    chunk.baseVt         = texcoordCount;
+    chunk.startSmoothing = smoothing;
+
+    vertexCount += chunk.v.size() / 3;
+    normalCount += chunk.vn.size() / 3;
+    texcoordCount += chunk.vt.size() / 2;
+    if(chunk.smoothingSet)
+      smoothing = chunk.smoothing;
+  }
+
+  std::vector<real_t> v(vertexCount * 3);
+  std::vector<real_t> vn(normalCount * 3);
+  std::vector<real_t> vt(texcoordCount * 2);
+  std::vector<real_t> vc(vertexCount * 3);
+
+  parallelFor(chunks.size(), threadCount, [&](size_t x) {
+    obj_chunk_t& chunk = chunks[x];
+    std::copy(chunk.v.begin(), chunk.v.end(), v.begin() + chunk.baseV * 3);
+    std::copy(chunk.vn.begin(), chunk.vn.end(), vn.begin() + chunk.baseVn * 3);
+    std::copy(chunk.vt.begin(), chunk.vt.end(), vt.begin() + chunk.baseVt * 2);
+    std::copy(chunk.vc.begin(), chunk.vc.end(), vc.begin() + chunk.baseV * 3);
+    std::vector<real_t>().swap(chunk.v);
+    std::vector<real_t>().swap(chunk.vn);
+    std::vector<real_t>().swap(chunk.vt);
+    std::vector<real_t>().swap(chunk.vc);
+  });
+
+  std::atomic<bool> forwardReference(false);
+  parallelFor(chunks.size(), threadCount, [&](size_t x) {
+    if(!triangulateChunk(chunks[x], triangulate, v))
+      forwardReference = true;
+  });
+
+  if(forwardReference)
+  {
+    // invalid but accepted by LoadObj(), keep its exact behaviour
+    file.close();
+    return LoadObj(attrib, shapes, materials, err, filename, mtl_basedir, triangulate);
+  }
+
+  // Replay the state changing commands in file order, exactly like LoadObj().
+  std::vector<tag_t>         tags;
+  std::string                name;
+  std::map<std::string, int> material_map;
+  int                        material = -1;
+  shape_t                    shape;
+  face_cursor_t              groupBegin = {0, 0, 0, 0};
+
+  for(size_t c = 0; c < chunks.size(); c++)
+  {
+    for(const auto& event : chunks[c].events)
+    {
+      face_cursor_t cursor = {c, event.face, event.indexOffset, event.polyOffset};
+
+      if(event.type == chunk_event_t::PARSE_ERROR)
+      {
+        if(err)
+          (*err) = "Failed parse `f' line(e.g. zero value for face index).\n";
+        return false;
+      }
+
+      if(event.type == chunk_event_t::USEMTL)
+      {
+        int newMaterialId = -1;
+        if(material_map.find(event.text) != material_map.end())
+          newMaterialId = material_map[event.text];
+
+        if(newMaterialId != material)
+        {
+          exportFaceRange(&shape, chunks, groupBegin, cursor, tags, material, name);
+          groupBegin = cursor;
+          material   = newMaterialId;
+        }
+      }
+      else if(event.type == chunk_event_t::MTLLIB)
+      {
+        loadMaterialLibrary(event.text, matFileReader, materials, &material_map, err);
+      }
+      else if(event.type == chunk_event_t::GROUP)
+      {
+        exportFaceRange(&shape, chunks, groupBegin, cursor, tags, material, name);
+        if(shape.mesh.indices.size() > 0)
+          shapes->push_back(shape);
+
+        shape      = shape_t();
+        groupBegin = cursor;
+        name       = event.text;
+      }
+      else if(event.type == chunk_event_t::OBJECT)
+      {
+        // faces flushed by an earlier usemtl are in shape already
+        bool ret = exportFaceRange(&shape, chunks, groupBegin, cursor, tags, material, name);
+        if(ret || shape.mesh.indices.size() > 0)
+          shapes->push_back(shape);
+
+        groupBegin = cursor;
+        shape      = shape_t();
+        name       = event.text;
+      }
+      else if(event.type == chunk_event_t::TAG)
+      {
+        tags.push_back(event.tag);
+      }
+    }
+  }
+
+  if(!chunks.empty())
+  {
+    const obj_chunk_t& last = chunks.back();
+    face_cursor_t end = {chunks.size() - 1, last.faceSmoothing.size(), last.outputIndexEnd, last.outputPolyEnd};
+    bool ret = exportFaceRange(&shape, chunks, groupBegin, end, tags, material, name);
+    if(ret || shape.mesh.indices.size())
+      shapes->push_back(shape);
+  }
+
+  attrib->vertices.swap(v);
+  attrib->normals.swap(vn);
+  attrib->texcoords.swap(vt);
+  attrib->colors.swap(vc);
+
+  return true;
+}
+
+// Whether every corner of the triangulated faces of a chunk references
+// attributes read so far.
+static bool validChunkIndices(const obj_chunk_t& chunk, const attrib_t& attrib)
+{
+  const int vertexCount   = static_cast<int>(attrib.vertices.size() / 3);
+  const int normalCount   = static_cast<int>(attrib.normals.size() / 3);
+  const int texcoordCount = static_cast<int>(attrib.texcoords.size() / 2);
+  for(size_t i = 0; i < chunk.outputIndexEnd; i++)
+  {
+    const index_t& idx = chunk.output.mesh.indices[i];
+    if(idx.vertex_index < 0 || idx.vertex_index >= vertexCount || idx.normal_index < -1
+       || idx.normal_index >= normalCount || idx.texcoord_index < -1 || idx.texcoord_index >= texcoordCount)
+      return false;
+  }
+  return true;
+}
+
+bool LoadObjStreaming(attrib_t* attrib, std::vector<material_t>* materials, std::string* err, const char* filename,
+                      triangle_run_cb_t triangle_cb, void* user_data, const char* mtl_basedir, size_t windowSize,
+                      unsigned int threadCount)
+{
+  attrib->vertices.clear();
+  attrib->normals.clear();
+  attrib->texcoords.clear();
+  attrib->colors.clear();
+
+  FILE* file = fopen(filename, "rb");
+  if(!file)
+  {
+    if(err)
+      (*err) = "Cannot open file [" + std::string(filename) + "]\n";
+    return false;
+  }
+
+  MaterialFileReader matFileReader(materialBaseDir(mtl_basedir));
+
+  if(threadCount == 0)
+    threadCount = defaultThreadCount();
+
+  std::vector<char>          window(std::max<size_t>(windowSize, 1 << 16));
+  size_t                     carried = 0;
+  unsigned int               smoothing = 0;
+  std::map<std::string, int> material_map;
+  int                        material = -1;
+  std::vector<obj_chunk_t>   chunks;
+  bool                       ok = true;
+
+  for(bool last = false; ok && !last;)
+  {
+    size_t filled = carried + fread(window.data() + carried, 1, window.size() - carried, file);
+    last          = filled < window.size();
+
+    // the window ends after its last complete line, the rest starts the next one
+    size_t end = filled;
+    if(!last)
+    {
+      while(end > 0 && window[end - 1] != '\n')
+        end--;
+      if(end == 0)
+      {
+        // a line longer than the window
+        carried = filled;
+        window.resize(window.size() * 2);
+        continue;
+      }
+    }
+
+    chunks.clear();
+    splitChunks(chunks, window.data(), window.data() + end, std::max<size_t>(1 << 18, end / (threadCount * 4)));
+    parallelFor(chunks.size(), threadCount, [&](size_t x) { tokenizeChunk(chunks[x], true); });
+
+    for(size_t c = 0; c < chunks.size(); c++)
+    {
+      if(!chunks[c].events.empty() && chunks[c].events.back().type == chunk_event_t::PARSE_ERROR)
+      {
+        chunks.resize(c + 1);
+        last = true;
+        break;
+      }
+    }
+
+    // attributes are appended as they come, faces only ever see those read before them
+    for(auto& chunk : chunks)
+    {
+      chunk.baseV          = attrib->vertices.size() / 3;
+      chunk.baseVn         = attrib->normals.size() / 3;
+      chunk.baseVt         = attrib->texcoords.size() / 2;
+      chunk.startSmoothing = smoothing;
+
+      attrib->vertices.insert(attrib->vertices.end(), chunk.v.begin(), chunk.v.end());
+      attrib->normals.insert(attrib->normals.end(), chunk.vn.begin(), chunk.vn.end());
+      attrib->texcoords.insert(attrib->texcoords.end(), chunk.vt.begin(), chunk.vt.end());
+      attrib->colors.insert(attrib->colors.end(), chunk.vc.begin(), chunk.vc.end());
+      std::vector<real_t>().swap(chunk.v);
+      std::vector<real_t>().swap(chunk.vn);
+      std::vector<real_t>().swap(chunk.vt);
+      std::vector<real_t>().swap(chunk.vc);
+      if(chunk.smoothingSet)
+        smoothing = chunk.smoothing;
+    }
+
+    std::atomic<bool> invalid(false);
+    parallelFor(chunks.size(), threadCount, [&](size_t x) {
+      if(!triangulateChunk(chunks[x], true, attrib->vertices) || !validChunkIndices(chunks[x], *attrib))
+        invalid = true;
+    });
+    if(invalid)
+    {
+      if(err)
+        (*err) = "Streaming needs every face after the attributes it references.\n";
+      ok = false;
+      break;
+    }
+
+    // Replay the material commands in file order and hand over the triangles
+    // between them.
+    for(const auto& chunk : chunks)
+    {
+      const std::vector<index_t>& indices = chunk.output.mesh.indices;
+      size_t                      begin   = 0;
+      for(const auto& event : chunk.events)
+      {
+        if(event.type == chunk_event_t::PARSE_ERROR)
+        {
+          if(err)
+            (*err) = "Failed parse `f' line(e.g. zero value for face index).\n";
+          ok = false;
+          break;
+        }
+
+        if(event.type == chunk_event_t::USEMTL)
+        {
+          int newMaterialId = -1;
+          if(material_map.find(event.text) != material_map.end())
+            newMaterialId = material_map[event.text];
+
+          if(newMaterialId != material)
+          {
+            if(event.indexOffset > begin)
+              triangle_cb(user_data, &indices[begin], (event.indexOffset - begin) / 3, material);
+            begin    = event.indexOffset;
+            material = newMaterialId;
+          }
+        }
+        else if(event.type == chunk_event_t::MTLLIB)
+        {
+          loadMaterialLibrary(event.text, matFileReader, materials, &material_map, err);
+        }
+      }
+      if(!ok)
+        break;
+      if(chunk.outputIndexEnd > begin)
+        triangle_cb(user_data, &indices[begin], (chunk.outputIndexEnd - begin) / 3, material);
+    }
+
+    carried = filled - end;
+    memmove(window.data(), window.data() + end, carried);
+  }
+
+  fclose(file);
+  return ok;
+}
+
+// Appends the vertex, normal and texcoord indices of the corners of every
+// triangle to the std::vector<int> 'user_data', followed by its material.
+static void appendTriangleRun(void* user_data, const index_t* indices, size_t triangleCount, int material_id)
+{
+  std::vector<int>* triangles = static_cast<std::vector<int>*>(user_data);
+  for(size_t t = 0; t < triangleCount; t++)
+  {
+    for(size_t c = 0; c < 3; c++)
+    {
+      const index_t& idx = indices[t * 3 + c];
+      triangles->push_back(idx.vertex_index);
+      triangles->push_back(idx.normal_index);
+      triangles->push_back(idx.texcoord_index);
+    }
+    triangles->push_back(material_id);
+  }
+}
+
+static void appendShapeTriangles(const std::vector<shape_t>& shapes, std::vector<int>* triangles)
+{
+  for(const auto& shape : shapes)
+  {
+    for(size_t f = 0; f < shape.mesh.material_ids.size(); f++)
+      appendTriangleRun(triangles, &shape.mesh.indices[f * 3], 1, shape.mesh.material_ids[f]);
+  }
+}
+
+static bool writeTextFile(const char* path, const std::string& text)
+{
+  FILE* file = fopen(path, "wb");
+  if(!file)
+    return false;
+  bool written = fwrite(text.data(), 1, text.size(), file) == text.size();
+  return fclose(file) == 0 && written;
+}
+
+static const char* const checkObjPath = "obj_loader_check.obj";
+static const char* const checkMtlPath = "obj_loader_check.mtl";
+
+// Loads 'text' with the three loaders, false with the first way the parallel
+// and streaming ones differ from LoadObj() in 'failure'.
+static bool checkObjText(const std::string& caseName, const std::string& text, std::string* failure)
+{
+  if(!writeTextFile(checkObjPath, text))
+  {
+    (*failure) = "cannot write " + std::string(checkObjPath);
+    return false;
+  }
+
+  const char*             names[3] = {"LoadObj()", "LoadObjParallel()", "LoadObjStreaming()"};
+  attrib_t                attrib[3];
+  std::vector<material_t> materials[3];
+  std::vector<int>        triangles[3];
+  std::vector<shape_t>    shapes;
+  std::string             err[3];
+  bool                    loaded[3];
+
+  loaded[0] = LoadObj(&attrib[0], &shapes, &materials[0], &err[0], checkObjPath);
+  appendShapeTriangles(shapes, &triangles[0]);
+  loaded[1] = LoadObjParallel(&attrib[1], &shapes, &materials[1], &err[1], checkObjPath);
+  appendShapeTriangles(shapes, &triangles[1]);
+  // the smallest window, so the generated file spans several
+  loaded[2] = LoadObjStreaming(&attrib[2], &materials[2], &err[2], checkObjPath, appendTriangleRun, &triangles[2],
+                               NULL, 1 << 16);
+  remove(checkObjPath);
+
+  for(int x = 0; x < 3; x++)
+  {
+    if(!loaded[x])
+    {
+      (*failure) = caseName + ": " + names[x] + " failed " + err[x];
+      return false;
+    }
+  }
+
+  for(int x = 1; x < 3; x++)
+  {
+    std::string difference;
+    if(attrib[x].vertices != attrib[0].vertices || attrib[x].normals != attrib[0].normals
+       || attrib[x].texcoords != attrib[0].texcoords)
+      difference = "attributes";
+    else if(materials[x].size() != materials[0].size())
+      difference = "materials";
+    else if(triangles[x] != triangles[0])
+      difference = "triangles, " + std::to_string(triangles[x].size() / 10) + " instead of "
+                   + std::to_string(triangles[0].size() / 10);
+    if(!difference.empty())
+    {
+      (*failure) = caseName + ": the " + difference + " of " + names[x] + " differ from " + names[0];
+      return false;
+    }
+  }
+  return true;
+}
+
+// A file of 'lineCount' random faces, triangles and quads, over 1000 vertices
+// with usemtl, o, g and s lines in between.
+static std::string generatedObjText(uint32_t lineCount)
+{
+  std::string text = "mtllib " + std::string(checkMtlPath) + "\n";
+  for(int x = 0; x < 1000; x++)
+    text += "v " + std::to_string(x % 10) + " " + std::to_string(x / 10 % 10 * 0.5) + " " + std::to_string(x / 100) + "\n";
+
+  uint32_t random = 1;
+  auto     next   = [&random]() {
+    random = random * 1664525u + 1013904223u;
+    return random >> 8;
+  };
+  for(uint32_t line = 0; line < lineCount; line++)
+  {
+    uint32_t pick = next() % 64;
+    if(pick < 2)
+      text += std::string("usemtl ") + "ABCD"[next() % 4] + "\n";
+    else if(pick < 3)
+      text += "o O" + std::to_string(line) + "\n";
+    else if(pick < 4)
+      text += "g G" + std::to_string(line) + "\n";
+    else if(pick < 5)
+      text += "s " + std::to_string(next() % 3) + "\n";
+    else
+    {
+      text += "f";
+      for(uint32_t corner = 0, corners = pick % 2 == 0 ? 3 : 4; corner < corners; corner++)
+        text += " " + std::to_string(next() % 1000 + 1);
+      text += "\n";
+    }
+  }
+  return text;
+}
+
+bool CheckObjLoaders(std::string* failure)
+{
+  if(!writeTextFile(checkMtlPath, "newmtl A\nKd 1 0 0\nnewmtl B\nKd 0 1 0\nnewmtl C\nKd 0 0 1\n"))
+  {
+    (*failure) = "cannot write " + std::string(checkMtlPath);
+    return false;
+  }
+
+  const std::string header = "mtllib " + std::string(checkMtlPath)
+                             + "\nv 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nvt 0 0\nvt 1 0\nvt 1 1\nvn 0 0 1\n";
+  const std::pair<const char*, std::string> cases[] = {
+      {"usemtl then o", header + "usemtl A\nf 1 2 3\nusemtl B\no X\nf 1 3 4\n"},
+      {"usemtl then g", header + "usemtl A\nf 1 2 3\nusemtl B\ng G\nf 1 3 4\ng\nusemtl C\nf 1 2 4\no Z\n"},
+      {"o then usemtl", header + "o X\nusemtl A\nf 1 2 3\no Y\nusemtl B\nf 1 3 4\nusemtl A\nf 2 3 4\n"},
+      {"usemtl at the end", header + "usemtl A\nf 1 2 3\nusemtl B\n"},
+      {"relative indices and quads",
+       header + "usemtl A\nf -4/-3/-1 -3/-2/-1 -2/-1/-1 -1/-1/-1\nusemtl D\nf 1//1 2//1 3//1\nusemtl A\nusemtl A\nf 4 3 2\n"},
+      {"generated", generatedObjText(150000)},
+  };
+
+  bool passed = true;
+  for(const auto& check : cases)
+  {
+    if(!checkObjText(check.first, check.second, failure))
+    {
+      passed = false;
+      break;
+    }
+  }
+  remove(checkMtlPath);
+  return passed;
+}
+
+}  // namespace tinyobj
@@ -5,13 +5,65 @@
 #pragma once
 #include "glm/glm.hpp"
 #include <array>
+#include <chrono>
 #include <glm/glm.hpp>
 #include <glm/gtx/hash.hpp>
 #include <iostream>
+#include <sys/stat.h>
+#include "mesh_normals.h"
 #include "tiny_obj_loader.h"
+#include "vertex_streams.h"
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
+// Bytes of the file LoadObjStreaming() reads and tokenizes at a time.
+#define OBJ_STREAM_WINDOW_SIZE (16 << 20)
+
+namespace tinyobj {
+/// Drop-in replacement for LoadObj() that memory maps the file and tokenizes
+/// newline aligned chunks of it on 'threadCount' threads (0 = all cores).
+/// The results are merged in file order and are identical to LoadObj().
+bool LoadObjParallel(attrib_t* attrib, std::vector<shape_t>* shapes, std::vector<material_t>* materials,
+                     std::string* err, const char* filename, const char* mtl_basedir = NULL,
+                     bool triangulate = true, unsigned int threadCount = 0);
+
+/// Receives a run of triangulated faces sharing one material, 3 indices each.
+typedef void (*triangle_run_cb_t)(void* user_data, const index_t* indices, size_t triangleCount, int material_id);
+
+/// Bounded memory counterpart of LoadObjParallel(). The file is read
+/// 'windowSize' bytes at a time, every window is tokenized on 'threadCount'
+/// threads and its triangles go to 'triangle_cb' in file order. Faces and
+/// shapes are never kept, only 'attrib' and 'materials' grow with the file.
+/// Fails on faces referencing attributes defined after them.
+bool LoadObjStreaming(attrib_t* attrib, std::vector<material_t>* materials, std::string* err, const char* filename,
+                      triangle_run_cb_t triangle_cb, void* user_data, const char* mtl_basedir = NULL,
+                      size_t windowSize = OBJ_STREAM_WINDOW_SIZE, unsigned int threadCount = 0);
+
+/// Which number parser ParseDouble() runs: the one the loaders use, its
+/// fixed-format fast path alone or the generic parser behind it.
+enum parse_double_path_t
+{
+  PARSE_DOUBLE_DEFAULT,
+  PARSE_DOUBLE_FAST,
+  PARSE_DOUBLE_GENERIC
+};
+
+/// Parses the v/vn/vt token [s, s_end) like the loaders do, for checks and
+/// benchmarks of the parsers. PARSE_DOUBLE_FAST returns false for every token
+/// the fast path leaves to the generic parser.
+bool ParseDouble(const char* s, const char* s_end, double* result, parse_double_path_t path = PARSE_DOUBLE_DEFAULT);
+
+/// Loads small files mixing usemtl, o, g and relative indices, and a
+/// generated one spanning several chunks and windows, with LoadObj(),
+/// LoadObjParallel() and LoadObjStreaming() and compares the attributes and
+/// the triangles with their materials. The files are written to and removed
+/// from the working directory. Returns false with the first difference in
+/// 'failure'.
+bool CheckObjLoaders(std::string* failure);
+}  // namespace tinyobj
+
 // Structure holding the material
 struct MatrialObj
 {
@@ -28,16 +80,78 @@ struct MatrialObj
   int textureID = -1;
 };
 
+// A run of m_indices whose triangles all use the same material.
+struct MaterialRange
+{
+  int32_t  material;
+  uint32_t firstIndex;
+  uint32_t indexCount;
+};
+
+// Identifies a unique output vertex: every face corner sharing the same
+// attribute indices is welded into one entry of m_vertices, whatever the
+// material of its face.
+struct ObjVertexKey
+{
+  int vertex_index;
+  int normal_index;
+  int texcoord_index;
+
+  bool operator==(const ObjVertexKey& other) const
+  {
+    return vertex_index == other.vertex_index && normal_index == other.normal_index
+           && texcoord_index == other.texcoord_index;
+  }
+};
+
+struct ObjVertexKeyHash
+{
+  size_t operator()(const ObjVertexKey& key) const
+  {
+    size_t h = std::hash<int>()(key.vertex_index);
+    h ^= std::hash<int>()(key.normal_index) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    h ^= std::hash<int>()(key.texcoord_index) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    return h;
+  }
+};
+
 template <class TVert>
 class ObjLoader
 {
 public:
   void loadModel(const std::string& filename);
 
+  // Positions closer than this distance are welded into a single vertex.
+  // 0 only welds corners that reference the same 'v' entry.
+  float m_weldTolerance = 0.f;
+
+  // Generated normals are smoothed over faces within this many degrees of
+  // each other, sharper edges get a vertex per side.
+  float m_creaseAngle = NORMAL_CREASE_ANGLE;
+
+  // Convert faces as LoadObjStreaming() reads them instead of holding the
+  // mapped file and every shape in memory next to the output.
+  bool   m_streaming        = false;
+  size_t m_streamWindowSize = OBJ_STREAM_WINDOW_SIZE;
+
+  // Weld into m_streams, one aligned stream per attribute of TVert, instead
+  // of m_vertices. Indices, materials and ranges are the same either way.
+  bool          m_structOfArrays = false;
+  VertexStreams m_streams;
+
+  // Where loadModel() reports what it did. Loaders on other threads point
+  // this at a stream of their own so their lines do not interleave.
+  std::ostream* m_log = &std::cout;
+
   std::vector<TVert>       m_vertices;
   std::vector<uint32_t>    m_indices;
   std::vector<MatrialObj>  m_materials;
   std::vector<std::string> m_textures;
+
+  // Material of every triangle, indexed by primitive ID. The triangles are
+  // sorted by material, so m_materialRanges covers each material with one range.
+  std::vector<int32_t>       m_matIndx;
+  std::vector<MaterialRange> m_materialRanges;
 };
 
 //-----------------------------------------------------------------------------
@@ -64,23 +178,252 @@ static inline std::string get_path(const std::string& file)
   return dir;
 }
 
+//-----------------------------------------------------------------------------
+// Map every 'v' entry to the first entry lying within 'tolerance' of it, so
+// that duplicated positions in the file collapse to one canonical index.
+// Entries from remap.size() on are added, so it can catch up with positions
+// as they are read and ends up the same as welding them all at once.
+//
+static inline void weld_positions(const std::vector<tinyobj::real_t>&              positions,
+                                  float                                            tolerance,
+                                  std::unordered_map<glm::ivec3, std::vector<int>>& grid,
+                                  std::vector<int>&                                remap)
+{
+  const int count = static_cast<int>(positions.size() / 3);
+  int       first = static_cast<int>(remap.size());
+  if(first >= count)
+    return;
+  remap.resize(count);
+
+  if(tolerance <= 0.f)
+  {
+    for(int i = first; i < count; ++i)
+      remap[i] = i;
+    return;
+  }
+
+  // Uniform grid with cells of 'tolerance' size, searching the 27 neighbouring
+  // cells guarantees every candidate within the tolerance is visited.
+  grid.reserve(count);
+
+  const float invCell = 1.f / tolerance;
+  const float tol2    = tolerance * tolerance;
+
+  for(int i = first; i < count; ++i)
+  {
+    const glm::vec3  p(positions[3 * i + 0], positions[3 * i + 1], positions[3 * i + 2]);
+    const glm::ivec3 cell(glm::floor(p * invCell));
+
+    int found = -1;
+    for(int z = -1; z <= 1 && found < 0; ++z)
+      for(int y = -1; y <= 1 && found < 0; ++y)
+        for(int x = -1; x <= 1 && found < 0; ++x)
+        {
+          auto it = grid.find(cell + glm::ivec3(x, y, z));
+          if(it == grid.end())
+            continue;
+          for(int candidate : it->second)
+          {
+            const glm::vec3 q(positions[3 * candidate + 0], positions[3 * candidate + 1],
+                              positions[3 * candidate + 2]);
+            const glm::vec3 d = p - q;
+            if(glm::dot(d, d) <= tol2)
+            {
+              found = candidate;
+              break;
+            }
+          }
+        }
+
+    if(found < 0)
+    {
+      grid[cell].push_back(i);
+      found = i;
+    }
+    remap[i] = found;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Weld the face corners of one shape into 'vertices', a std::vector<TVert> or
+// VertexStreams. Every attribute is a template parameter, so each variant only
+// touches the attributes it fills and the checks for them happen once per load
+// instead of once per corner. Corners differing only in attributes TVert does
+// not store weld into one vertex.
+//
+template <class TVert, bool kNormals, bool kTexCoords, bool kColors, class TOutput>
+static void weld_corners(const tinyobj::attrib_t&                                    attrib,
+                         const tinyobj::index_t*                                     corners,
+                         size_t                                                      cornerCount,
+                         const std::vector<int>&                                     positionRemap,
+                         std::unordered_map<ObjVertexKey, uint32_t, ObjVertexKeyHash>& vertexMap,
+                         TOutput&                                                    vertices,
+                         std::vector<uint32_t>&                                      indices)
+{
+  constexpr bool normals   = kNormals && vertex_has_nrm<TVert>::value;
+  constexpr bool texCoords = kTexCoords && vertex_has_texCoord<TVert>::value;
+  constexpr bool colors    = kColors && vertex_has_color<TVert>::value;
+
+  for(size_t corner = 0; corner < cornerCount; corner++)
+  {
+    const tinyobj::index_t& index = corners[corner];
+    const int    vertexIndex = positionRemap[index.vertex_index];
+    ObjVertexKey key = {vertexIndex, normals ? index.normal_index : -1, texCoords ? index.texcoord_index : -1};
+
+    auto found = vertexMap.find(key);
+    if(found != vertexMap.end())
+    {
+      indices.push_back(found->second);
+      continue;
+    }
+
+    TVert        vertex = {};
+    const float* vp     = &attrib.vertices[3 * vertexIndex];
+    vertex.pos          = {*(vp + 0), *(vp + 1), *(vp + 2)};
+
+    if constexpr(normals)
+    {
+      if(key.normal_index >= 0)
+      {
+        const float* np = &attrib.normals[3 * key.normal_index];
+        vertex.nrm      = {*(np + 0), *(np + 1), *(np + 2)};
+      }
+    }
+
+    if constexpr(texCoords)
+    {
+      if(key.texcoord_index >= 0)
+      {
+        const float* tp = &attrib.texcoords[2 * key.texcoord_index + 0];
+        vertex.texCoord = {*tp, 1.0f - *(tp + 1)};
+      }
+    }
+
+    if constexpr(colors)
+    {
+      const float* vc = &attrib.colors[3 * vertexIndex];
+      vertex.color    = {*(vc + 0), *(vc + 1), *(vc + 2)};
+    }
+
+    const uint32_t newIndex = static_cast<uint32_t>(vertices.size());
+    vertexMap.emplace(key, newIndex);
+    vertices.push_back(vertex);
+    indices.push_back(newIndex);
+  }
+}
+
+// Pick the weld_corners variant for the attributes both TVert and the file have.
+template <class TVert, class TOutput>
+static void weld_corners(const tinyobj::attrib_t&                                    attrib,
+                         const tinyobj::index_t*                                     corners,
+                         size_t                                                      cornerCount,
+                         const std::vector<int>&                                     positionRemap,
+                         std::unordered_map<ObjVertexKey, uint32_t, ObjVertexKeyHash>& vertexMap,
+                         TOutput&                                                    vertices,
+                         std::vector<uint32_t>&                                      indices)
+{
+  const int variant = (vertex_has_nrm<TVert>::value && !attrib.normals.empty() ? 1 : 0)
+                      | (vertex_has_texCoord<TVert>::value && !attrib.texcoords.empty() ? 2 : 0)
+                      | (vertex_has_color<TVert>::value && !attrib.colors.empty() ? 4 : 0);
+  switch(variant)
+  {
+    case 0:
+      weld_corners<TVert, false, false, false, TOutput>(attrib, corners, cornerCount, positionRemap, vertexMap, vertices, indices);
+      break;
+    case 1:
+      weld_corners<TVert, true, false, false, TOutput>(attrib, corners, cornerCount, positionRemap, vertexMap, vertices, indices);
+      break;
+    case 2:
+      weld_corners<TVert, false, true, false, TOutput>(attrib, corners, cornerCount, positionRemap, vertexMap, vertices, indices);
+      break;
+    case 3:
+      weld_corners<TVert, true, true, false, TOutput>(attrib, corners, cornerCount, positionRemap, vertexMap, vertices, indices);
+      break;
+    case 4:
+      weld_corners<TVert, false, false, true, TOutput>(attrib, corners, cornerCount, positionRemap, vertexMap, vertices, indices);
+      break;
+    case 5:
+      weld_corners<TVert, true, false, true, TOutput>(attrib, corners, cornerCount, positionRemap, vertexMap, vertices, indices);
+      break;
+    case 6:
+      weld_corners<TVert, false, true, true, TOutput>(attrib, corners, cornerCount, positionRemap, vertexMap, vertices, indices);
+      break;
+    default:
+      weld_corners<TVert, true, true, true, TOutput>(attrib, corners, cornerCount, positionRemap, vertexMap, vertices, indices);
+      break;
+  }
+}
+
 template <class TVert>
 void ObjLoader<TVert>::loadModel(const std::string& filename)
 {
   tinyobj::attrib_t                attrib;
-  std::vector<tinyobj::shape_t>    shapes;
   std::vector<tinyobj::material_t> materials;
   std::string                      err;
 
   std::string materialPath = get_path(filename);
 
-  if(!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, filename.c_str(), materialPath.c_str()))
+  std::unordered_map<glm::ivec3, std::vector<int>>             weldGrid;
+  std::vector<int>                                             positionRemap;
+  std::unordered_map<ObjVertexKey, uint32_t, ObjVertexKeyHash> vertexMap;
+  size_t                                                       cornerCount = 0;
+
+  // Welds a run of triangles sharing a material into the output. The material
+  // IDs are checked once every material is known.
+  auto appendTriangles = [&](const tinyobj::index_t* corners, size_t triangleCount, int matID) {
+    weld_positions(attrib.vertices, m_weldTolerance, weldGrid, positionRemap);
+    m_matIndx.insert(m_matIndx.end(), triangleCount, matID);
+    cornerCount += triangleCount * 3;
+    if(m_structOfArrays)
+      weld_corners<TVert>(attrib, corners, triangleCount * 3, positionRemap, vertexMap, m_streams, m_indices);
+    else
+      weld_corners<TVert>(attrib, corners, triangleCount * 3, positionRemap, vertexMap, m_vertices, m_indices);
+  };
+
+  auto startTime = std::chrono::high_resolution_clock::now();
+  bool loaded    = false;
+  if(m_streaming)
+  {
+    tinyobj::triangle_run_cb_t triangleRun = [](void* user_data, const tinyobj::index_t* indices,
+                                                size_t triangleCount, int material_id) {
+      (*static_cast<decltype(appendTriangles)*>(user_data))(indices, triangleCount, material_id);
+    };
+    loaded = tinyobj::LoadObjStreaming(&attrib, &materials, &err, filename.c_str(), triangleRun, &appendTriangles,
+                                       materialPath.c_str(), m_streamWindowSize);
+  }
+  else
   {
-    std::cerr << "Cannot load: " << filename << std::endl;
-    throw std::runtime_error(err);
+    std::vector<tinyobj::shape_t> shapes;
+    loaded = tinyobj::LoadObjParallel(&attrib, &shapes, &materials, &err, filename.c_str(), materialPath.c_str());
+    for(auto& shape : shapes)
+    {
+      m_indices.reserve(shape.mesh.indices.size() + m_indices.size());
+      vertexMap.reserve(shape.mesh.indices.size() + vertexMap.size());
+
+      const std::vector<int>& materialIds = shape.mesh.material_ids;
+      const size_t            faceCount   = shape.mesh.indices.size() / 3;
+      for(size_t faceID = 0, runEnd = 0; faceID < faceCount; faceID = runEnd)
+      {
+        for(runEnd = faceID + 1; runEnd < faceCount && materialIds[runEnd] == materialIds[faceID]; runEnd++)
+          ;
+        appendTriangles(&shape.mesh.indices[faceID * 3], runEnd - faceID, materialIds[faceID]);
+      }
+      shape = tinyobj::shape_t();
+    }
   }
 
-  m_vertices.reserve(shapes[0].mesh.indices.size());
+  if(!loaded)
+    throw std::runtime_error("Cannot load " + filename + ": " + err);
+
+  {
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+    struct stat                   fileStat;
+    if(stat(filename.c_str(), &fileStat) == 0 && elapsed.count() > 0.0)
+    {
+      (*m_log) << "Parsed " << filename << " at " << fileStat.st_size / (1024.0 * 1024.0) / elapsed.count()
+                << " MB/s" << std::endl;
+    }
+  }
 
   // Collecting the material in the scene
   for(const auto& material : materials)
@@ -108,66 +451,73 @@ void ObjLoader<TVert>::loadModel(const std::string& filename)
   if(m_materials.empty())
     m_materials.emplace_back(MatrialObj());
 
-  for(const auto& shape : shapes)
+  for(int32_t& matID : m_matIndx)
   {
-    m_vertices.reserve(shape.mesh.indices.size() + m_vertices.size());
-    m_indices.reserve(shape.mesh.indices.size() + m_indices.size());
+    if(matID < 0 || matID >= static_cast<int>(m_materials.size()))
+      matID = 0;
+  }
 
-    uint32_t faceID    = 0;
-    int      index_cnt = 0;
+  // Counting sort of the triangles by material, stable so the file order
+  // survives within every material.
+  {
+    std::vector<uint32_t> offsets(m_materials.size() + 1, 0);
+    for(int32_t matID : m_matIndx)
+      offsets[matID + 1]++;
+    for(size_t i = 1; i < offsets.size(); i++)
+      offsets[i] += offsets[i - 1];
 
-    for(const auto& index : shape.mesh.indices)
+    for(size_t matID = 0; matID < m_materials.size(); matID++)
     {
-      TVert  vertex = {};
-      float* vp     = &attrib.vertices[3 * index.vertex_index];
-      vertex.pos    = {*(vp + 0), *(vp + 1), *(vp + 2)};
-
-      if(!attrib.normals.empty() && index.normal_index >= 0)
-      {
-        float* np  = &attrib.normals[3 * index.normal_index];
-        vertex.nrm = {*(np + 0), *(np + 1), *(np + 2)};
-      }
-
-      if(!attrib.texcoords.empty() && index.texcoord_index >= 0)
-      {
-        float* tp       = &attrib.texcoords[2 * index.texcoord_index + 0];
-        vertex.texCoord = {*tp, 1.0f - *(tp + 1)};
-      }
+      if(offsets[matID + 1] > offsets[matID])
+        m_materialRanges.push_back({static_cast<int32_t>(matID), offsets[matID] * 3, (offsets[matID + 1] - offsets[matID]) * 3});
+    }
 
-      if(!attrib.colors.empty())
-      {
-        float* vc    = &attrib.colors[3 * index.vertex_index];
-        vertex.color = {*(vc + 0), *(vc + 1), *(vc + 2)};
-      }
+    std::vector<uint32_t> sortedIndices(m_indices.size());
+    std::vector<int32_t>  sortedMaterials(m_matIndx.size());
+    for(size_t i = 0; i < m_matIndx.size(); i++)
+    {
+      const uint32_t slot   = offsets[m_matIndx[i]]++;
+      sortedMaterials[slot] = m_matIndx[i];
+      std::copy(m_indices.begin() + i * 3, m_indices.begin() + i * 3 + 3, sortedIndices.begin() + slot * 3);
+    }
+    m_indices.swap(sortedIndices);
+    m_matIndx.swap(sortedMaterials);
+  }
 
-      vertex.matID = shape.mesh.material_ids[faceID];
-      if(vertex.matID < 0 || vertex.matID >= m_materials.size())
-        vertex.matID = 0;
-      index_cnt++;
-      if(index_cnt >= 3)
-      {
-        ++faceID;
-        index_cnt = 0;
-      }
+  const size_t vertexCount = m_structOfArrays ? m_streams.size() : m_vertices.size();
+  if(!m_indices.empty())
+  {
+    const double triangles = static_cast<double>(m_indices.size() / 3);
+    (*m_log) << "Welded " << cornerCount << " face corners into " << vertexCount
+              << " vertices (vertex/triangle ratio " << cornerCount / triangles << " -> "
+              << vertexCount / triangles << ")" << std::endl;
+  }
 
-      m_vertices.push_back(vertex);
-      m_indices.push_back(static_cast<int>(m_indices.size()));
+  // Compute normals when none were provided. The faces around every position
+  // are smoothed together up to the crease angle, seams and creases split
+  // vertices, so this runs after the welding and sorting above.
+  if constexpr(vertex_has_nrm<TVert>::value)
+  {
+    if(attrib.normals.empty() && !m_indices.empty())
+    {
+      const VertexFrameStats stats = m_structOfArrays ? generateNormals(m_streams, m_indices, m_creaseAngle) :
+                                                        generateNormals(m_vertices, m_indices, m_creaseAngle);
+      (*m_log) << "Generated normals for " << vertexCount << " vertices in " << stats.milliseconds << " ms ("
+                << stats.trianglesPerSecond / 1e6 << " Mtriangles/s), " << stats.splitVertexCount
+                << " split at creases" << std::endl;
     }
   }
 
-  // Compute normal when no normal were provided.
-  if(attrib.normals.empty())
+  // Tangent frames for normal mapping, MikkTSpace compatible.
+  if constexpr(vertex_has_tangent<TVert>::value && vertex_has_nrm<TVert>::value && vertex_has_texCoord<TVert>::value)
   {
-    for(size_t i = 0; i < m_indices.size(); i += 3)
+    if(!m_indices.empty())
     {
-      TVert& v0 = m_vertices[m_indices[i + 0]];
-      TVert& v1 = m_vertices[m_indices[i + 1]];
-      TVert& v2 = m_vertices[m_indices[i + 2]];
-
-      glm::vec3 n = glm::normalize(glm::cross((v1.pos - v0.pos), (v2.pos - v0.pos)));
-      v0.nrm      = n;
-      v1.nrm      = n;
-      v2.nrm      = n;
+      const VertexFrameStats stats =
+          m_structOfArrays ? generateTangents(m_streams, m_indices) : generateTangents(m_vertices, m_indices);
+      (*m_log) << "Generated tangents in " << stats.milliseconds << " ms (" << stats.trianglesPerSecond / 1e6
+                << " Mtriangles/s), " << stats.splitVertexCount << " vertices split at mirrored texture coordinates"
+                << std::endl;
     }
   }
 }
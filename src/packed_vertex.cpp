@@ -0,0 +1,415 @@
+#include "packed_vertex.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+void PackedVertexLayout::finalize() {
+	positionOffset = 0;
+	normalOffset = positionFormat == PACKED_POSITION_SNORM16 ? 8 : 12;
+	texCoordOffset = normalOffset + 4;
+	colorOffset = color ? texCoordOffset + 4 : 0;
+	stride = texCoordOffset + (color ? 8 : 4);
+}
+
+std::vector<VkVertexInputAttributeDescription> PackedVertexLayout::attributeDescriptions(uint32_t binding) const {
+	std::vector<VkVertexInputAttributeDescription> descriptions = {
+		{0, binding, positionVkFormat(), positionOffset},
+		{1, binding, VK_FORMAT_R16G16_SNORM, normalOffset},
+		{2, binding, texCoordVkFormat(), texCoordOffset},
+	};
+	if (color) {
+		descriptions.push_back({3, binding, VK_FORMAT_R8G8B8A8_UNORM, colorOffset});
+	}
+	return descriptions;
+}
+
+static inline const float* attribute(const float* base, size_t stride, uint32_t index) {
+	return reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(base) + stride * index);
+}
+
+VertexQuantization computeVertexQuantization(const PackedVertexSource& source) {
+	return computeVertexQuantization(&source, 1);
+}
+
+VertexQuantization computeVertexQuantization(const PackedVertexSource* sources, size_t sourceCount) {
+	VertexQuantization quantization;
+	glm::vec3 positionMin(FLT_MAX), positionMax(-FLT_MAX);
+	glm::vec2 texCoordMin(FLT_MAX), texCoordMax(-FLT_MAX);
+	uint32_t count = 0;
+	for (size_t y = 0; y < sourceCount; y++) {
+		const PackedVertexSource& source = sources[y];
+		for (uint32_t x = 0; x < source.count; x++) {
+			const float* position = attribute(source.positions, source.positionStride, x);
+			const float* texCoord = attribute(source.texCoords, source.texCoordStride, x);
+			positionMin = glm::min(positionMin, glm::vec3(position[0], position[1], position[2]));
+			positionMax = glm::max(positionMax, glm::vec3(position[0], position[1], position[2]));
+			texCoordMin = glm::min(texCoordMin, glm::vec2(texCoord[0], texCoord[1]));
+			texCoordMax = glm::max(texCoordMax, glm::vec2(texCoord[0], texCoord[1]));
+		}
+		count += source.count;
+	}
+	if (count == 0) {
+		return quantization;
+	}
+
+	quantization.positionCenter = (positionMin + positionMax) * 0.5f;
+	quantization.positionExtent = (positionMax - positionMin) * 0.5f;
+	quantization.texCoordMin = texCoordMin;
+	quantization.texCoordExtent = texCoordMax - texCoordMin;
+	return quantization;
+}
+
+glm::vec2 octahedralEncode(const glm::vec3& normal) {
+	float sum = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+	float inverse = sum > 0.0f ? 1.0f / sum : 0.0f;
+	float x = normal.x * inverse, y = normal.y * inverse;
+	// the lower half folds over the diagonals
+	if (normal.z < 0.0f) {
+		float foldedX = (1.0f - std::fabs(y)) * std::copysign(1.0f, x);
+		float foldedY = (1.0f - std::fabs(x)) * std::copysign(1.0f, y);
+		x = foldedX;
+		y = foldedY;
+	}
+	return glm::vec2(x, y);
+}
+
+glm::vec3 octahedralDecode(const glm::vec2& encoded) {
+	glm::vec3 normal(encoded.x, encoded.y, 1.0f - std::fabs(encoded.x) - std::fabs(encoded.y));
+	if (normal.z < 0.0f) {
+		float x = normal.x;
+		normal.x = (1.0f - std::fabs(normal.y)) * std::copysign(1.0f, x);
+		normal.y = (1.0f - std::fabs(x)) * std::copysign(1.0f, normal.y);
+	}
+	return glm::normalize(normal);
+}
+
+// round to nearest even like F16C, so both paths write the same bits
+uint16_t floatToHalf(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+	uint32_t magnitude = bits & 0x7fffffff;
+
+	if (magnitude >= 0x7f800000) {
+		return sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0);
+	}
+	// 65520 and up round to infinity
+	if (magnitude >= 0x477ff000) {
+		return sign | 0x7c00;
+	}
+	// subnormal halves are multiples of 2^-24
+	if (magnitude < 0x38800000) {
+		return sign | static_cast<uint16_t>(lrintf(std::fabs(value) * 16777216.0f));
+	}
+	uint32_t rounded = magnitude + 0xfff + ((magnitude >> 13) & 1);
+	return sign | static_cast<uint16_t>((rounded - 0x38000000) >> 13);
+}
+
+float halfToFloat(uint16_t value) {
+	uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+	uint32_t exponent = (value >> 10) & 31;
+	uint32_t mantissa = value & 0x3ff;
+
+	if (exponent == 0) {
+		float magnitude = mantissa / 16777216.0f;
+		return sign ? -magnitude : magnitude;
+	}
+
+	uint32_t bits = sign | (exponent == 31 ? 0x7f800000 : (exponent + 112) << 23) | mantissa << 13;
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+static inline int16_t quantizeSnorm16(float value) {
+	return static_cast<int16_t>(lrintf(std::min(1.0f, std::max(-1.0f, value)) * 32767.0f));
+}
+
+static inline uint16_t quantizeUnorm16(float value) {
+	return static_cast<uint16_t>(lrintf(std::min(1.0f, std::max(0.0f, value)) * 65535.0f));
+}
+
+static inline float decodeSnorm16(int16_t value) {
+	return std::max(value / 32767.0f, -1.0f);
+}
+
+// multipliers that take positions to [-1, 1] and texture coordinates to [0, 1], 0 for flat axes
+struct QuantizationScale {
+	glm::vec3 position;
+	glm::vec2 texCoord;
+};
+
+static QuantizationScale quantizationScale(const VertexQuantization& quantization) {
+	QuantizationScale scale;
+	for (int c = 0; c < 3; c++) {
+		scale.position[c] = quantization.positionExtent[c] > 0.0f ? 1.0f / quantization.positionExtent[c] : 0.0f;
+	}
+	for (int c = 0; c < 2; c++) {
+		scale.texCoord[c] = quantization.texCoordExtent[c] > 0.0f ? 1.0f / quantization.texCoordExtent[c] : 0.0f;
+	}
+	return scale;
+}
+
+static void writeColor(const PackedVertexSource& source, uint32_t index, uint8_t* out) {
+	uint8_t color[4] = {255, 255, 255, 255};
+	if (source.colors) {
+		const float* value = attribute(source.colors, source.colorStride, index);
+		for (int c = 0; c < 3; c++) {
+			color[c] = static_cast<uint8_t>(lrintf(std::min(1.0f, std::max(0.0f, value[c])) * 255.0f));
+		}
+	}
+	memcpy(out, color, sizeof(color));
+}
+
+static void encodeVertex(const PackedVertexSource& source, uint32_t index, const PackedVertexLayout& layout, const VertexQuantization& quantization, const QuantizationScale& scale, uint8_t* out) {
+	const float* position = attribute(source.positions, source.positionStride, index);
+	if (layout.positionFormat == PACKED_POSITION_SNORM16) {
+		int16_t quantized[4] = {0, 0, 0, 0};
+		for (int c = 0; c < 3; c++) {
+			quantized[c] = quantizeSnorm16((position[c] - quantization.positionCenter[c]) * scale.position[c]);
+		}
+		memcpy(out + layout.positionOffset, quantized, sizeof(quantized));
+	} else {
+		memcpy(out + layout.positionOffset, position, sizeof(float) * 3);
+	}
+
+	const float* normal = attribute(source.normals, source.normalStride, index);
+	glm::vec2 encoded = octahedralEncode(glm::vec3(normal[0], normal[1], normal[2]));
+	int16_t quantizedNormal[2] = {quantizeSnorm16(encoded.x), quantizeSnorm16(encoded.y)};
+	memcpy(out + layout.normalOffset, quantizedNormal, sizeof(quantizedNormal));
+
+	const float* texCoord = attribute(source.texCoords, source.texCoordStride, index);
+	uint16_t quantizedTexCoord[2];
+	for (int c = 0; c < 2; c++) {
+		if (layout.texCoordFormat == PACKED_TEXCOORD_HALF) {
+			quantizedTexCoord[c] = floatToHalf(texCoord[c]);
+		} else {
+			quantizedTexCoord[c] = quantizeUnorm16((texCoord[c] - quantization.texCoordMin[c]) * scale.texCoord[c]);
+		}
+	}
+	memcpy(out + layout.texCoordOffset, quantizedTexCoord, sizeof(quantizedTexCoord));
+
+	if (layout.color) {
+		writeColor(source, index, out + layout.colorOffset);
+	}
+}
+
+#if defined(__SSE2__)
+// clamp(value * scale) * range rounded to nearest even, the same float operations as the scalar path
+static inline __m128i quantizeLanes(__m128 value, __m128 low, __m128 range) {
+	value = _mm_min_ps(_mm_max_ps(value, low), _mm_set1_ps(1.0f));
+	return _mm_cvtps_epi32(_mm_mul_ps(value, range));
+}
+
+static inline __m128 selectLanes(__m128 mask, __m128 a, __m128 b) {
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+#endif
+
+void encodePackedVertices(const PackedVertexSource& source, const PackedVertexLayout& layout, const VertexQuantization& quantization, uint8_t* destination) {
+	QuantizationScale scale = quantizationScale(quantization);
+	uint32_t x = 0;
+
+#if defined(__SSE2__)
+	// four vertices at a time, one attribute channel per register
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 minusOne = _mm_set1_ps(-1.0f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+	const __m128 snormRange = _mm_set1_ps(32767.0f);
+	const __m128 unormRange = _mm_set1_ps(65535.0f);
+
+	for (; x + 4 <= source.count; x += 4) {
+		const float* position[4];
+		const float* normal[4];
+		const float* texCoord[4];
+		for (uint32_t lane = 0; lane < 4; lane++) {
+			position[lane] = attribute(source.positions, source.positionStride, x + lane);
+			normal[lane] = attribute(source.normals, source.normalStride, x + lane);
+			texCoord[lane] = attribute(source.texCoords, source.texCoordStride, x + lane);
+		}
+		uint8_t* out = destination + static_cast<size_t>(x) * layout.stride;
+
+		if (layout.positionFormat == PACKED_POSITION_SNORM16) {
+			alignas(16) int32_t quantized[3][4];
+			for (int c = 0; c < 3; c++) {
+				__m128 value = _mm_setr_ps(position[0][c], position[1][c], position[2][c], position[3][c]);
+				value = _mm_mul_ps(_mm_sub_ps(value, _mm_set1_ps(quantization.positionCenter[c])), _mm_set1_ps(scale.position[c]));
+				_mm_store_si128(reinterpret_cast<__m128i*>(quantized[c]), quantizeLanes(value, minusOne, snormRange));
+			}
+			for (uint32_t lane = 0; lane < 4; lane++) {
+				int16_t packed[4] = {static_cast<int16_t>(quantized[0][lane]), static_cast<int16_t>(quantized[1][lane]), static_cast<int16_t>(quantized[2][lane]), 0};
+				memcpy(out + lane * layout.stride + layout.positionOffset, packed, sizeof(packed));
+			}
+		} else {
+			for (uint32_t lane = 0; lane < 4; lane++) {
+				memcpy(out + lane * layout.stride + layout.positionOffset, position[lane], sizeof(float) * 3);
+			}
+		}
+
+		__m128 nx = _mm_setr_ps(normal[0][0], normal[1][0], normal[2][0], normal[3][0]);
+		__m128 ny = _mm_setr_ps(normal[0][1], normal[1][1], normal[2][1], normal[3][1]);
+		__m128 nz = _mm_setr_ps(normal[0][2], normal[1][2], normal[2][2], normal[3][2]);
+		__m128 sum = _mm_add_ps(_mm_add_ps(_mm_andnot_ps(signMask, nx), _mm_andnot_ps(signMask, ny)), _mm_andnot_ps(signMask, nz));
+		__m128 inverse = _mm_and_ps(_mm_cmpgt_ps(sum, zero), _mm_div_ps(one, sum));
+		__m128 ox = _mm_mul_ps(nx, inverse);
+		__m128 oy = _mm_mul_ps(ny, inverse);
+		__m128 foldedX = _mm_mul_ps(_mm_sub_ps(one, _mm_andnot_ps(signMask, oy)), _mm_or_ps(one, _mm_and_ps(signMask, ox)));
+		__m128 foldedY = _mm_mul_ps(_mm_sub_ps(one, _mm_andnot_ps(signMask, ox)), _mm_or_ps(one, _mm_and_ps(signMask, oy)));
+		__m128 lower = _mm_cmplt_ps(nz, zero);
+		alignas(16) int32_t encodedX[4], encodedY[4];
+		_mm_store_si128(reinterpret_cast<__m128i*>(encodedX), quantizeLanes(selectLanes(lower, foldedX, ox), minusOne, snormRange));
+		_mm_store_si128(reinterpret_cast<__m128i*>(encodedY), quantizeLanes(selectLanes(lower, foldedY, oy), minusOne, snormRange));
+		for (uint32_t lane = 0; lane < 4; lane++) {
+			int16_t packed[2] = {static_cast<int16_t>(encodedX[lane]), static_cast<int16_t>(encodedY[lane])};
+			memcpy(out + lane * layout.stride + layout.normalOffset, packed, sizeof(packed));
+		}
+
+		__m128 u = _mm_setr_ps(texCoord[0][0], texCoord[1][0], texCoord[2][0], texCoord[3][0]);
+		__m128 v = _mm_setr_ps(texCoord[0][1], texCoord[1][1], texCoord[2][1], texCoord[3][1]);
+		alignas(16) uint16_t packedU[8], packedV[8];
+		if (layout.texCoordFormat == PACKED_TEXCOORD_HALF) {
+#if defined(__F16C__)
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(packedU), _mm_cvtps_ph(u, _MM_FROUND_TO_NEAREST_INT));
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(packedV), _mm_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+#else
+			for (uint32_t lane = 0; lane < 4; lane++) {
+				packedU[lane] = floatToHalf(texCoord[lane][0]);
+				packedV[lane] = floatToHalf(texCoord[lane][1]);
+			}
+#endif
+		} else {
+			u = _mm_mul_ps(_mm_sub_ps(u, _mm_set1_ps(quantization.texCoordMin.x)), _mm_set1_ps(scale.texCoord.x));
+			v = _mm_mul_ps(_mm_sub_ps(v, _mm_set1_ps(quantization.texCoordMin.y)), _mm_set1_ps(scale.texCoord.y));
+			alignas(16) int32_t quantizedU[4], quantizedV[4];
+			_mm_store_si128(reinterpret_cast<__m128i*>(quantizedU), quantizeLanes(u, zero, unormRange));
+			_mm_store_si128(reinterpret_cast<__m128i*>(quantizedV), quantizeLanes(v, zero, unormRange));
+			for (uint32_t lane = 0; lane < 4; lane++) {
+				packedU[lane] = static_cast<uint16_t>(quantizedU[lane]);
+				packedV[lane] = static_cast<uint16_t>(quantizedV[lane]);
+			}
+		}
+		for (uint32_t lane = 0; lane < 4; lane++) {
+			uint16_t packed[2] = {packedU[lane], packedV[lane]};
+			memcpy(out + lane * layout.stride + layout.texCoordOffset, packed, sizeof(packed));
+			if (layout.color) {
+				writeColor(source, x + lane, out + lane * layout.stride + layout.colorOffset);
+			}
+		}
+	}
+#endif
+
+	for (; x < source.count; x++) {
+		encodeVertex(source, x, layout, quantization, scale, destination + static_cast<size_t>(x) * layout.stride);
+	}
+}
+
+UnpackedVertex decodePackedVertex(const uint8_t* vertex, const PackedVertexLayout& layout, const VertexQuantization& quantization) {
+	UnpackedVertex unpacked;
+
+	if (layout.positionFormat == PACKED_POSITION_SNORM16) {
+		int16_t quantized[3];
+		memcpy(quantized, vertex + layout.positionOffset, sizeof(quantized));
+		for (int c = 0; c < 3; c++) {
+			unpacked.pos[c] = quantization.positionCenter[c] + decodeSnorm16(quantized[c]) * quantization.positionExtent[c];
+		}
+	} else {
+		memcpy(&unpacked.pos.x, vertex + layout.positionOffset, sizeof(float) * 3);
+	}
+
+	int16_t normal[2];
+	memcpy(normal, vertex + layout.normalOffset, sizeof(normal));
+	unpacked.nrm = octahedralDecode(glm::vec2(decodeSnorm16(normal[0]), decodeSnorm16(normal[1])));
+
+	uint16_t texCoord[2];
+	memcpy(texCoord, vertex + layout.texCoordOffset, sizeof(texCoord));
+	for (int c = 0; c < 2; c++) {
+		if (layout.texCoordFormat == PACKED_TEXCOORD_HALF) {
+			unpacked.texCoord[c] = halfToFloat(texCoord[c]);
+		} else {
+			unpacked.texCoord[c] = quantization.texCoordMin[c] + texCoord[c] / 65535.0f * quantization.texCoordExtent[c];
+		}
+	}
+
+	unpacked.color = glm::vec3(1.0f);
+	if (layout.color) {
+		const uint8_t* color = vertex + layout.colorOffset;
+		unpacked.color = glm::vec3(color[0], color[1], color[2]) / 255.0f;
+	}
+	return unpacked;
+}
+
+PackedVertexError packedVertexErrorBound(const PackedVertexLayout& layout, const VertexQuantization& quantization) {
+	PackedVertexError bound;
+
+	// half a quantization step per axis, plus float rounding while decoding
+	if (layout.positionFormat == PACKED_POSITION_SNORM16) {
+		glm::vec3 extent = glm::abs(quantization.positionExtent);
+		glm::vec3 rounding = (glm::abs(quantization.positionCenter) + extent) * (4.0f * FLT_EPSILON);
+		bound.position = glm::length(extent * (0.5f / 32767.0f) + rounding);
+	}
+
+	// half a step in both octahedral coordinates moves the unnormalized normal by at most sqrt(6)
+	// half steps, and normalizing a vector of length 1/sqrt(3) or more stretches that by sqrt(3)
+	bound.normalDegrees = static_cast<float>(glm::degrees(std::sqrt(18.0) * 0.5 / 32767.0 + 16.0 * FLT_EPSILON));
+
+	if (layout.texCoordFormat == PACKED_TEXCOORD_HALF) {
+		// 11 significant bits, and subnormals below 2^-14 are multiples of 2^-24
+		float largest = std::max(std::fabs(quantization.texCoordMin.x), std::fabs(quantization.texCoordMin.x + quantization.texCoordExtent.x));
+		largest = std::max(largest, std::max(std::fabs(quantization.texCoordMin.y), std::fabs(quantization.texCoordMin.y + quantization.texCoordExtent.y)));
+		bound.texCoord = std::max(largest * (1.0f / 2048.0f), 1.0f / 33554432.0f);
+	} else {
+		float extent = std::max(quantization.texCoordExtent.x, quantization.texCoordExtent.y);
+		float largest = std::max(std::fabs(quantization.texCoordMin.x), std::fabs(quantization.texCoordMin.y)) + extent;
+		bound.texCoord = extent * (0.5f / 65535.0f) + largest * (4.0f * FLT_EPSILON);
+	}
+
+	// for colors in [0, 1], the loader never produces anything else
+	if (layout.color) {
+		bound.color = 0.5f / 255.0f + 4.0f * FLT_EPSILON;
+	}
+	return bound;
+}
+
+PackedVertexError measurePackedVertexError(const PackedVertexSource& source, const uint8_t* packed, const PackedVertexLayout& layout, const VertexQuantization& quantization) {
+	PackedVertexError error;
+	for (uint32_t x = 0; x < source.count; x++) {
+		UnpackedVertex unpacked = decodePackedVertex(packed + static_cast<size_t>(x) * layout.stride, layout, quantization);
+
+		const float* position = attribute(source.positions, source.positionStride, x);
+		glm::dvec3 positionError = glm::dvec3(unpacked.pos) - glm::dvec3(position[0], position[1], position[2]);
+		error.position = std::max(error.position, static_cast<float>(glm::length(positionError)));
+
+		// atan2 keeps its precision for tiny angles where acos of the dot product does not
+		const float* normal = attribute(source.normals, source.normalStride, x);
+		glm::dvec3 sourceNormal(normal[0], normal[1], normal[2]);
+		if (glm::length(sourceNormal) > 0.0) {
+			sourceNormal = glm::normalize(sourceNormal);
+			glm::dvec3 decodedNormal(unpacked.nrm);
+			double angle = std::atan2(glm::length(glm::cross(sourceNormal, decodedNormal)), glm::dot(sourceNormal, decodedNormal));
+			error.normalDegrees = std::max(error.normalDegrees, static_cast<float>(glm::degrees(angle)));
+		}
+
+		const float* texCoord = attribute(source.texCoords, source.texCoordStride, x);
+		for (int c = 0; c < 2; c++) {
+			error.texCoord = std::max(error.texCoord, std::fabs(unpacked.texCoord[c] - texCoord[c]));
+		}
+
+		if (layout.color && source.colors) {
+			const float* color = attribute(source.colors, source.colorStride, x);
+			for (int c = 0; c < 3; c++) {
+				error.color = std::max(error.color, std::fabs(unpacked.color[c] - color[c]));
+			}
+		}
+	}
+	return error;
+}
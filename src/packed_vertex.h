@@ -0,0 +1,130 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+
+#include "vertex_streams.h"
+
+// Positions are snorm16 relative to the bounds of the mesh, which acceleration structure builds
+// take as they are, or full floats. Texture coordinates are half floats, which keep repeating
+// coordinates outside [0, 1], or unorm16 relative to their bounds.
+enum PackedPositionFormat {
+	PACKED_POSITION_SNORM16,
+	PACKED_POSITION_FLOAT
+};
+
+enum PackedTexCoordFormat {
+	PACKED_TEXCOORD_HALF,
+	PACKED_TEXCOORD_UNORM16
+};
+
+// What a packed vertex stores and where. Normals are always octahedral snorm16x2 and there is no
+// material id, color is optional RGBA8. The default is 16 bytes against 48 for Vertex. Call
+// finalize() after changing the formats.
+struct PackedVertexLayout {
+	PackedPositionFormat positionFormat = PACKED_POSITION_SNORM16;
+	PackedTexCoordFormat texCoordFormat = PACKED_TEXCOORD_HALF;
+	bool color = false;
+
+	uint32_t positionOffset = 0;
+	uint32_t normalOffset = 8;
+	uint32_t texCoordOffset = 12;
+	uint32_t colorOffset = 0;
+	uint32_t stride = 16;
+
+	void finalize();
+
+	VkFormat positionVkFormat() const { return positionFormat == PACKED_POSITION_SNORM16 ? VK_FORMAT_R16G16B16A16_SNORM : VK_FORMAT_R32G32B32_SFLOAT; }
+	VkFormat texCoordVkFormat() const { return texCoordFormat == PACKED_TEXCOORD_HALF ? VK_FORMAT_R16G16_SFLOAT : VK_FORMAT_R16G16_UNORM; }
+	// locations 0 position, 1 normal, 2 texture coordinate and 3 color when there is one
+	std::vector<VkVertexInputAttributeDescription> attributeDescriptions(uint32_t binding = 0) const;
+};
+
+// Maps quantized attributes back: position = positionCenter + snorm * positionExtent and
+// texCoord = texCoordMin + unorm * texCoordExtent. Shaders need it next to the vertex buffer.
+struct VertexQuantization {
+	glm::vec3 positionCenter = glm::vec3(0.0f);
+	glm::vec3 positionExtent = glm::vec3(1.0f);
+	glm::vec2 texCoordMin = glm::vec2(0.0f);
+	glm::vec2 texCoordExtent = glm::vec2(1.0f);
+};
+
+// Strided view of float vertex attributes, colors may be null for white. Interleaved vertices
+// share one stride, vertex streams have one per attribute.
+struct PackedVertexSource {
+	const float* positions = nullptr;
+	const float* normals = nullptr;
+	const float* texCoords = nullptr;
+	const float* colors = nullptr;
+	size_t positionStride = 0;
+	size_t normalStride = 0;
+	size_t texCoordStride = 0;
+	size_t colorStride = 0;
+	uint32_t count = 0;
+};
+
+struct UnpackedVertex {
+	glm::vec3 pos;
+	glm::vec3 nrm;
+	glm::vec3 color;
+	glm::vec2 texCoord;
+};
+
+// Largest difference between source and decoded attributes: distance for positions, degrees for
+// normals, per component for texture coordinates and colors.
+struct PackedVertexError {
+	float position = 0.0f;
+	float normalDegrees = 0.0f;
+	float texCoord = 0.0f;
+	float color = 0.0f;
+};
+
+VertexQuantization computeVertexQuantization(const PackedVertexSource& source);
+// One quantization over the union of sourceCount sources, for vertex buffers shared by several meshes.
+VertexQuantization computeVertexQuantization(const PackedVertexSource* sources, size_t sourceCount);
+// Writes source.count vertices of layout.stride bytes, four at a time with SSE2.
+void encodePackedVertices(const PackedVertexSource& source, const PackedVertexLayout& layout, const VertexQuantization& quantization, uint8_t* destination);
+UnpackedVertex decodePackedVertex(const uint8_t* vertex, const PackedVertexLayout& layout, const VertexQuantization& quantization);
+
+// What the encoding may lose at most, and what it lost on an actual stream.
+PackedVertexError packedVertexErrorBound(const PackedVertexLayout& layout, const VertexQuantization& quantization);
+PackedVertexError measurePackedVertexError(const PackedVertexSource& source, const uint8_t* packed, const PackedVertexLayout& layout, const VertexQuantization& quantization);
+
+// the scalar building blocks, res/shaders/packed_vertex.glsl decodes the same way
+glm::vec2 octahedralEncode(const glm::vec3& normal);
+glm::vec3 octahedralDecode(const glm::vec2& encoded);
+uint16_t floatToHalf(float value);
+float halfToFloat(uint16_t value);
+
+template <class TVert>
+PackedVertexSource packedVertexSource(const TVert* vertices, uint32_t count) {
+	PackedVertexSource source;
+	source.positions = &vertices->pos.x;
+	source.normals = &vertices->nrm.x;
+	source.texCoords = &vertices->texCoord.x;
+	source.colors = &vertices->color.x;
+	source.positionStride = sizeof(TVert);
+	source.normalStride = sizeof(TVert);
+	source.texCoordStride = sizeof(TVert);
+	source.colorStride = sizeof(TVert);
+	source.count = count;
+	return source;
+}
+
+// count vertices from first on, the streams need normals and texture coordinates.
+inline PackedVertexSource packedVertexSource(const VertexStreams& streams, uint32_t first, uint32_t count) {
+	PackedVertexSource source;
+	source.positions = &streams.positions[first].x;
+	source.normals = &streams.normals[first].x;
+	source.texCoords = &streams.texCoords[first].x;
+	source.colors = streams.colors.empty() ? nullptr : &streams.colors[first].x;
+	source.positionStride = sizeof(glm::vec3);
+	source.normalStride = sizeof(glm::vec3);
+	source.texCoordStride = sizeof(glm::vec2);
+	source.colorStride = sizeof(glm::vec3);
+	source.count = count;
+	return source;
+}
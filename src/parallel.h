@@ -0,0 +1,46 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Number of worker threads to use when the caller passes 0.
+inline unsigned int defaultThreadCount() {
+	unsigned int count = std::thread::hardware_concurrency();
+	return count > 0 ? count : 1;
+}
+
+// Calls fn(i) for every i in [0, count) spread over threadCount threads. Items are
+// handed out one at a time, so uneven items balance out; the calling thread
+// takes part in the work.
+template <class Fn>
+void parallelFor(size_t count, unsigned int threadCount, Fn fn) {
+	if (threadCount == 0) {
+		threadCount = defaultThreadCount();
+	}
+	threadCount = static_cast<unsigned int>(std::min<size_t>(threadCount, count));
+
+	if (threadCount <= 1) {
+		for (size_t x = 0; x < count; x++) {
+			fn(x);
+		}
+		return;
+	}
+
+	std::atomic<size_t> next(0);
+	auto work = [&]() {
+		for (size_t x = next++; x < count; x = next++) {
+			fn(x);
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (unsigned int x = 1; x < threadCount; x++) {
+		workers.emplace_back(work);
+	}
+	work();
+	for (auto& worker : workers) {
+		worker.join();
+	}
+}
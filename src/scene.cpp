@@ -0,0 +1,180 @@
+#include "scene.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+// The directory path is in, with its trailing separator, empty for a bare file name.
+static std::string directoryOf(const std::string& path) {
+	size_t separator = path.find_last_of("/\\");
+	return separator == std::string::npos ? std::string() : path.substr(0, separator + 1);
+}
+
+static bool isAbsolutePath(const std::string& path) {
+	return !path.empty() && (path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':'));
+}
+
+// One spelling for every path to a file, "a/x.obj" and "./a/x.obj" alike. Meshes are loaded and their caches
+// written on several threads at once, two spellings of one file would write the same cache. Paths that do
+// not resolve are left as they are, loading them fails anyway.
+static std::string canonicalPath(const std::string& path) {
+#ifdef _WIN32
+	char resolved[_MAX_PATH];
+	return _fullpath(resolved, path.c_str(), _MAX_PATH) ? std::string(resolved) : path;
+#else
+	char* resolved = realpath(path.c_str(), nullptr);
+	if (!resolved) {
+		return path;
+	}
+	std::string canonical(resolved);
+	free(resolved);
+	return canonical;
+#endif
+}
+
+// Reads up to count numbers from tokens[first] on into values, stops at the first token that is none.
+static size_t readFloats(const std::vector<std::string>& tokens, size_t first, float* values, size_t count) {
+	size_t x = 0;
+	for (; x < count && first + x < tokens.size(); x++) {
+		const char* token = tokens[first + x].c_str();
+		char* end = nullptr;
+		values[x] = strtof(token, &end);
+		if (end == token || *end != '\0') {
+			break;
+		}
+	}
+	return x;
+}
+
+// Applies the operations in tokens[first] on to transform in order.
+static bool parseTransform(const std::vector<std::string>& tokens, size_t first, glm::mat4& transform, std::string& problem) {
+	for (size_t x = first; x < tokens.size();) {
+		const std::string& operation = tokens[x++];
+		float values[16];
+		size_t count = readFloats(tokens, x, values, operation == "matrix" ? 16 : operation == "rotate" ? 4 : 3);
+		x += count;
+
+		if (operation == "translate") {
+			if (count != 3) {
+				problem = "translate needs x y z";
+				return false;
+			}
+			transform = glm::translate(transform, glm::vec3(values[0], values[1], values[2]));
+		} else if (operation == "rotate") {
+			// the axis is only read once all four values are there
+			if (count != 4 || glm::length(glm::vec3(values[1], values[2], values[3])) == 0.0f) {
+				problem = "rotate needs degrees and a nonzero axis x y z";
+				return false;
+			}
+			transform = glm::rotate(transform, glm::radians(values[0]), glm::vec3(values[1], values[2], values[3]));
+		} else if (operation == "scale") {
+			// one value scales uniformly, three scale per axis
+			if (count == 1) {
+				transform = glm::scale(transform, glm::vec3(values[0]));
+			} else if (count == 3) {
+				transform = glm::scale(transform, glm::vec3(values[0], values[1], values[2]));
+			} else {
+				problem = "scale needs s or x y z";
+				return false;
+			}
+		} else if (operation == "matrix") {
+			if (count != 16) {
+				problem = "matrix needs 16 values";
+				return false;
+			}
+			glm::mat4 matrix;
+			for (int column = 0; column < 4; column++) {
+				matrix[column] = glm::vec4(values[column * 4], values[column * 4 + 1], values[column * 4 + 2], values[column * 4 + 3]);
+			}
+			transform = transform * matrix;
+		} else {
+			problem = "unknown transform '" + operation + "'";
+			return false;
+		}
+	}
+	return true;
+}
+
+bool loadSceneDescription(const std::string& path, SceneDescription& scene, std::string& error) {
+	std::ifstream file(path);
+	if (!file) {
+		error = "failed to open scene " + path;
+		return false;
+	}
+
+	scene = SceneDescription();
+	std::string baseDirectory = directoryOf(path);
+	std::unordered_map<std::string, uint32_t> meshByName;
+	std::unordered_map<std::string, uint32_t> meshByPath;
+
+	std::string text;
+	for (uint32_t lineNumber = 1; std::getline(file, text); lineNumber++) {
+		std::istringstream line(text.substr(0, text.find('#')));
+		std::vector<std::string> tokens;
+		for (std::string token; line >> token;) {
+			tokens.push_back(token);
+		}
+		if (tokens.empty()) {
+			continue;
+		}
+
+		std::string problem;
+		const std::string& statement = tokens[0];
+		if (statement == "mesh") {
+			if (tokens.size() != 3) {
+				problem = "mesh needs a name and a path";
+			} else if (meshByName.count(tokens[1]) > 0) {
+				problem = "mesh '" + tokens[1] + "' is already defined";
+			} else {
+				const std::string& name = tokens[1];
+				std::string meshPath = tokens[2];
+				if (!isAbsolutePath(meshPath)) {
+					meshPath = baseDirectory + meshPath;
+				}
+				std::string canonical = canonicalPath(meshPath);
+				auto loaded = meshByPath.find(canonical);
+				if (loaded != meshByPath.end()) {
+					meshByName[name] = loaded->second;
+				} else {
+					uint32_t mesh = static_cast<uint32_t>(scene.meshes.size());
+					scene.meshes.push_back({name, meshPath});
+					meshByName[name] = mesh;
+					meshByPath[canonical] = mesh;
+				}
+			}
+		} else if (statement == "instance") {
+			glm::mat4 transform(1.0f);
+			auto mesh = tokens.size() > 1 ? meshByName.find(tokens[1]) : meshByName.end();
+			if (tokens.size() < 2) {
+				problem = "instance needs a mesh name";
+			} else if (mesh == meshByName.end()) {
+				problem = "instance of unknown mesh '" + tokens[1] + "'";
+			} else if (parseTransform(tokens, 2, transform, problem)) {
+				scene.instances.push_back({transform, mesh->second});
+			}
+		} else {
+			problem = "unknown statement '" + statement + "'";
+		}
+
+		if (!problem.empty()) {
+			error = path + ":" + std::to_string(lineNumber) + ": " + problem;
+			return false;
+		}
+	}
+
+	if (scene.instances.empty()) {
+		error = path + ": scene has no instances";
+		return false;
+	}
+	return true;
+}
+
+SceneDescription singleMeshScene(const std::string& meshPath, const glm::mat4& transform) {
+	SceneDescription scene;
+	scene.meshes.push_back({meshPath, meshPath});
+	scene.instances.push_back({transform, 0});
+	return scene;
+}
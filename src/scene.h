@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Text scene manifests, one statement per line, '#' starts a comment:
+//
+//   mesh <name> <path>
+//   instance <name> [translate x y z] [rotate degrees x y z] [scale s | scale x y z] [matrix m00 m01 ... m33]
+//
+// Mesh paths are relative to the manifest. Instance transforms apply their operations in order, like
+// the glm functions of the same names do, so "translate 0 0 5 rotate 90 0 1 0" turns the mesh before it
+// moves. matrix multiplies in 16 column major values.
+
+// A mesh file the scene loads once, however many instances reference it.
+struct SceneMesh {
+	std::string name;
+	std::string path;
+};
+
+// Instances are walked every time levels of detail are picked, so they are plain values in one array
+// rather than nodes that point at their meshes.
+struct SceneInstance {
+	glm::mat4 transform;
+	// index into SceneDescription::meshes
+	uint32_t mesh;
+};
+
+struct SceneDescription {
+	std::vector<SceneMesh> meshes;
+	std::vector<SceneInstance> instances;
+};
+
+// Parses the manifest at path into scene. Returns false with the file and line of the first
+// problem in error when it cannot be read, has a statement it does not know or names a missing mesh.
+// Meshes with the same path, however it is spelled, are loaded once, later names for it become aliases.
+bool loadSceneDescription(const std::string& path, SceneDescription& scene, std::string& error);
+
+// The scene of a single instance of the mesh at meshPath.
+SceneDescription singleMeshScene(const std::string& meshPath, const glm::mat4& transform);
@@ -0,0 +1,115 @@
+#pragma once
+#include <cstdint>
+
+// Thin wrapper over the widest float vector the compiler targets: 16 lanes with AVX-512,
+// 8 with AVX, 4 with SSE2 (always present on x86-64). Code written against these helpers
+// runs at SIMD_WIDTH lanes without per instruction set variants.
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#define SIMD_WIDTH 16
+typedef __m512 SimdFloat;
+typedef __mmask16 SimdMask;
+
+inline SimdFloat simdSet1(float value) { return _mm512_set1_ps(value); }
+inline SimdFloat simdLoad(const float* data) { return _mm512_loadu_ps(data); }
+inline void simdStore(float* data, SimdFloat value) { _mm512_storeu_ps(data, value); }
+inline SimdFloat simdAdd(SimdFloat a, SimdFloat b) { return _mm512_add_ps(a, b); }
+inline SimdFloat simdSub(SimdFloat a, SimdFloat b) { return _mm512_sub_ps(a, b); }
+inline SimdFloat simdMul(SimdFloat a, SimdFloat b) { return _mm512_mul_ps(a, b); }
+inline SimdFloat simdDiv(SimdFloat a, SimdFloat b) { return _mm512_div_ps(a, b); }
+inline SimdFloat simdMin(SimdFloat a, SimdFloat b) { return _mm512_min_ps(a, b); }
+inline SimdFloat simdMax(SimdFloat a, SimdFloat b) { return _mm512_max_ps(a, b); }
+inline SimdFloat simdAbs(SimdFloat a) { return _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(a), _mm512_set1_epi32(0x7fffffff))); }
+inline SimdMask simdLess(SimdFloat a, SimdFloat b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+inline SimdMask simdLessEqual(SimdFloat a, SimdFloat b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+inline SimdMask simdGreater(SimdFloat a, SimdFloat b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+inline SimdMask simdGreaterEqual(SimdFloat a, SimdFloat b) { return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+inline SimdMask simdAnd(SimdMask a, SimdMask b) { return a & b; }
+inline SimdMask simdAndNot(SimdMask a, SimdMask b) { return a & ~b; }
+inline SimdMask simdMaskFromBits(uint32_t bits) { return static_cast<SimdMask>(bits); }
+inline uint32_t simdMaskBits(SimdMask mask) { return mask; }
+inline SimdFloat simdSelect(SimdMask mask, SimdFloat a, SimdFloat b) { return _mm512_mask_blend_ps(mask, b, a); }
+inline float simdReduceMin(SimdFloat a) { return _mm512_reduce_min_ps(a); }
+#elif defined(__AVX__)
+#include <immintrin.h>
+#define SIMD_WIDTH 8
+typedef __m256 SimdFloat;
+typedef __m256 SimdMask;
+
+inline SimdFloat simdSet1(float value) { return _mm256_set1_ps(value); }
+inline SimdFloat simdLoad(const float* data) { return _mm256_loadu_ps(data); }
+inline void simdStore(float* data, SimdFloat value) { _mm256_storeu_ps(data, value); }
+inline SimdFloat simdAdd(SimdFloat a, SimdFloat b) { return _mm256_add_ps(a, b); }
+inline SimdFloat simdSub(SimdFloat a, SimdFloat b) { return _mm256_sub_ps(a, b); }
+inline SimdFloat simdMul(SimdFloat a, SimdFloat b) { return _mm256_mul_ps(a, b); }
+inline SimdFloat simdDiv(SimdFloat a, SimdFloat b) { return _mm256_div_ps(a, b); }
+inline SimdFloat simdMin(SimdFloat a, SimdFloat b) { return _mm256_min_ps(a, b); }
+inline SimdFloat simdMax(SimdFloat a, SimdFloat b) { return _mm256_max_ps(a, b); }
+inline SimdFloat simdAbs(SimdFloat a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+inline SimdMask simdLess(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline SimdMask simdLessEqual(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+inline SimdMask simdGreater(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+inline SimdMask simdGreaterEqual(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+inline SimdMask simdAnd(SimdMask a, SimdMask b) { return _mm256_and_ps(a, b); }
+inline SimdMask simdAndNot(SimdMask a, SimdMask b) { return _mm256_andnot_ps(b, a); }
+inline SimdMask simdMaskFromBits(uint32_t bits) {
+	__m256i lanes = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	__m256i selected = _mm256_and_si256(_mm256_set1_epi32(static_cast<int>(bits)), lanes);
+	return _mm256_castsi256_ps(_mm256_cmpeq_epi32(selected, lanes));
+}
+inline uint32_t simdMaskBits(SimdMask mask) { return static_cast<uint32_t>(_mm256_movemask_ps(mask)); }
+inline SimdFloat simdSelect(SimdMask mask, SimdFloat a, SimdFloat b) { return _mm256_blendv_ps(b, a, mask); }
+inline float simdReduceMin(SimdFloat a) {
+	__m128 lanes = _mm_min_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+	lanes = _mm_min_ps(lanes, _mm_movehl_ps(lanes, lanes));
+	return _mm_cvtss_f32(_mm_min_ss(lanes, _mm_shuffle_ps(lanes, lanes, 1)));
+}
+#else
+#include <emmintrin.h>
+#define SIMD_WIDTH 4
+typedef __m128 SimdFloat;
+typedef __m128 SimdMask;
+
+inline SimdFloat simdSet1(float value) { return _mm_set1_ps(value); }
+inline SimdFloat simdLoad(const float* data) { return _mm_loadu_ps(data); }
+inline void simdStore(float* data, SimdFloat value) { _mm_storeu_ps(data, value); }
+inline SimdFloat simdAdd(SimdFloat a, SimdFloat b) { return _mm_add_ps(a, b); }
+inline SimdFloat simdSub(SimdFloat a, SimdFloat b) { return _mm_sub_ps(a, b); }
+inline SimdFloat simdMul(SimdFloat a, SimdFloat b) { return _mm_mul_ps(a, b); }
+inline SimdFloat simdDiv(SimdFloat a, SimdFloat b) { return _mm_div_ps(a, b); }
+inline SimdFloat simdMin(SimdFloat a, SimdFloat b) { return _mm_min_ps(a, b); }
+inline SimdFloat simdMax(SimdFloat a, SimdFloat b) { return _mm_max_ps(a, b); }
+inline SimdFloat simdAbs(SimdFloat a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+inline SimdMask simdLess(SimdFloat a, SimdFloat b) { return _mm_cmplt_ps(a, b); }
+inline SimdMask simdLessEqual(SimdFloat a, SimdFloat b) { return _mm_cmple_ps(a, b); }
+inline SimdMask simdGreater(SimdFloat a, SimdFloat b) { return _mm_cmpgt_ps(a, b); }
+inline SimdMask simdGreaterEqual(SimdFloat a, SimdFloat b) { return _mm_cmpge_ps(a, b); }
+inline SimdMask simdAnd(SimdMask a, SimdMask b) { return _mm_and_ps(a, b); }
+inline SimdMask simdAndNot(SimdMask a, SimdMask b) { return _mm_andnot_ps(b, a); }
+inline SimdMask simdMaskFromBits(uint32_t bits) {
+	__m128i lanes = _mm_setr_epi32(1, 2, 4, 8);
+	__m128i selected = _mm_and_si128(_mm_set1_epi32(static_cast<int>(bits)), lanes);
+	return _mm_castsi128_ps(_mm_cmpeq_epi32(selected, lanes));
+}
+inline uint32_t simdMaskBits(SimdMask mask) { return static_cast<uint32_t>(_mm_movemask_ps(mask)); }
+inline SimdFloat simdSelect(SimdMask mask, SimdFloat a, SimdFloat b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+inline float simdReduceMin(SimdFloat a) {
+	__m128 lanes = _mm_min_ps(a, _mm_movehl_ps(a, a));
+	return _mm_cvtss_f32(_mm_min_ss(lanes, _mm_shuffle_ps(lanes, lanes, 1)));
+}
+#endif
+
+#define SIMD_ALL_LANES ((1u << SIMD_WIDTH) - 1u)
+
+struct SimdVec3 {
+	SimdFloat x;
+	SimdFloat y;
+	SimdFloat z;
+};
+
+inline SimdVec3 simdSet1(float x, float y, float z) { return {simdSet1(x), simdSet1(y), simdSet1(z)}; }
+inline SimdVec3 simdSub(const SimdVec3& a, const SimdVec3& b) { return {simdSub(a.x, b.x), simdSub(a.y, b.y), simdSub(a.z, b.z)}; }
+inline SimdFloat simdDot(const SimdVec3& a, const SimdVec3& b) { return simdAdd(simdAdd(simdMul(a.x, b.x), simdMul(a.y, b.y)), simdMul(a.z, b.z)); }
+inline SimdVec3 simdCross(const SimdVec3& a, const SimdVec3& b) {
+	return {simdSub(simdMul(a.y, b.z), simdMul(a.z, b.y)), simdSub(simdMul(a.z, b.x), simdMul(a.x, b.z)), simdSub(simdMul(a.x, b.y), simdMul(a.y, b.x))};
+}
@@ -0,0 +1,296 @@
+#include "staging_ring.h"
+
+#include <stdexcept>
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment) {
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+void StagingRing::create(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex, VkQueue queue, uint32_t acquireQueueFamilyIndex, VkQueue acquireQueue, VkDeviceSize size) {
+	this->device = device;
+	this->queueFamilyIndex = queueFamilyIndex;
+	this->queue = queue;
+	this->acquireQueueFamilyIndex = acquireQueueFamilyIndex;
+	this->acquireQueue = acquireQueue;
+	capacity = alignUp(size, STAGING_RING_ALIGNMENT);
+
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+	if (queueFamilyIndex < queueFamilyCount) {
+		imageTransferGranularity = queueFamilies[queueFamilyIndex].minImageTransferGranularity;
+	}
+
+	VkCommandPoolCreateInfo commandPoolCreateInfo = {};
+	commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	commandPoolCreateInfo.queueFamilyIndex = queueFamilyIndex;
+	if (vkCreateCommandPool(device, &commandPoolCreateInfo, nullptr, &commandPool) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create staging command pool!");
+	}
+	if (hasSeparateQueues()) {
+		commandPoolCreateInfo.queueFamilyIndex = acquireQueueFamilyIndex;
+		if (vkCreateCommandPool(device, &commandPoolCreateInfo, nullptr, &acquireCommandPool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create staging command pool!");
+		}
+	}
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = capacity;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create staging buffer!");
+	}
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+	VkPhysicalDeviceMemoryProperties memProperties;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+	VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	uint32_t memoryTypeIndex = memProperties.memoryTypeCount;
+	for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+		if ((memRequirements.memoryTypeBits & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+			memoryTypeIndex = i;
+			break;
+		}
+	}
+	if (memoryTypeIndex == memProperties.memoryTypeCount) {
+		throw std::runtime_error("failed to find suitable memory type!");
+	}
+
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memRequirements.size;
+	allocInfo.memoryTypeIndex = memoryTypeIndex;
+	if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+		throw std::runtime_error("failed to allocate staging memory!");
+	}
+	vkBindBufferMemory(device, buffer, memory, 0);
+
+	void* data;
+	if (vkMapMemory(device, memory, 0, capacity, 0, &data) != VK_SUCCESS) {
+		throw std::runtime_error("failed to map staging memory!");
+	}
+	mappedData = static_cast<uint8_t*>(data);
+}
+
+void StagingRing::destroy() {
+	if (device == VK_NULL_HANDLE) {
+		return;
+	}
+
+	flush();
+	for (const auto& submission : idleSubmissions) {
+		vkDestroyFence(device, submission.fence, nullptr);
+		if (submission.semaphore != VK_NULL_HANDLE) {
+			vkDestroySemaphore(device, submission.semaphore, nullptr);
+		}
+	}
+	idleSubmissions.clear();
+
+	if (acquireCommandPool != VK_NULL_HANDLE) {
+		vkDestroyCommandPool(device, acquireCommandPool, nullptr);
+		acquireCommandPool = VK_NULL_HANDLE;
+	}
+	vkDestroyCommandPool(device, commandPool, nullptr);
+	vkUnmapMemory(device, memory);
+	vkDestroyBuffer(device, buffer, nullptr);
+	vkFreeMemory(device, memory, nullptr);
+	device = VK_NULL_HANDLE;
+}
+
+bool StagingRing::retireOldest(bool wait) {
+	if (submissions.empty()) {
+		return false;
+	}
+
+	Submission submission = submissions.front();
+	if (wait) {
+		vkWaitForFences(device, 1, &submission.fence, VK_TRUE, UINT64_MAX);
+	} else if (vkGetFenceStatus(device, submission.fence) != VK_SUCCESS) {
+		return false;
+	}
+
+	submissions.pop_front();
+	tail = submission.end;
+	completedSerial = submission.serial;
+	idleSubmissions.push_back(submission);
+	return true;
+}
+
+StagingRegion StagingRing::allocate(VkDeviceSize size, VkDeviceSize alignment) {
+	if (size > capacity) {
+		throw std::runtime_error("staging allocation does not fit into the staging ring!");
+	}
+
+	while (retireOldest(false)) {
+	}
+
+	while (true) {
+		// an idle ring starts over at offset 0, so nothing is lost to wrapping
+		if (head == tail) {
+			head = tail = alignUp(head, capacity);
+		}
+
+		uint64_t position = alignUp(head, alignment);
+		if (position % capacity + size > capacity) {
+			position = alignUp(position, capacity);
+		}
+		if (position + size - tail <= capacity) {
+			head = position + size;
+			stats.uploadedBytes += size;
+			return {position % capacity, mappedData + position % capacity};
+		}
+
+		// the current batch may hold the space we are waiting for, it has to go out first
+		if (recording != VK_NULL_HANDLE) {
+			submit();
+		}
+		stats.stalls++;
+		retireOldest(true);
+	}
+}
+
+VkCommandBuffer StagingRing::allocateCommandBuffer(VkCommandPool pool) {
+	VkCommandBufferAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandPool = pool;
+	allocInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commandBuffer;
+	if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+		throw std::runtime_error("failed to allocate staging command buffer!");
+	}
+	return commandBuffer;
+}
+
+VkCommandBuffer StagingRing::commandBuffer() {
+	if (recording != VK_NULL_HANDLE) {
+		return recording;
+	}
+
+	if (idleSubmissions.empty()) {
+		Submission submission;
+		submission.commandBuffer = allocateCommandBuffer(commandPool);
+		submission.acquireCommandBuffer = VK_NULL_HANDLE;
+		submission.semaphore = VK_NULL_HANDLE;
+		if (hasSeparateQueues()) {
+			submission.acquireCommandBuffer = allocateCommandBuffer(acquireCommandPool);
+
+			VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+			semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+			if (vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &submission.semaphore) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create semaphore!");
+			}
+		}
+
+		VkFenceCreateInfo fenceCreateInfo = {};
+		fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		if (vkCreateFence(device, &fenceCreateInfo, nullptr, &submission.fence) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create fence!");
+		}
+		submission.end = 0;
+		submission.serial = 0;
+		idleSubmissions.push_back(submission);
+	}
+
+	recording = idleSubmissions.back().commandBuffer;
+	recordingAcquire = idleSubmissions.back().acquireCommandBuffer;
+	recordingFence = idleSubmissions.back().fence;
+	recordingSemaphore = idleSubmissions.back().semaphore;
+	idleSubmissions.pop_back();
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkResetCommandBuffer(recording, 0);
+	vkBeginCommandBuffer(recording, &beginInfo);
+	if (recordingAcquire != VK_NULL_HANDLE) {
+		vkResetCommandBuffer(recordingAcquire, 0);
+		vkBeginCommandBuffer(recordingAcquire, &beginInfo);
+	}
+
+	return recording;
+}
+
+VkCommandBuffer StagingRing::acquireCommandBuffer() {
+	commandBuffer();
+	return recordingAcquire != VK_NULL_HANDLE ? recordingAcquire : recording;
+}
+
+UploadTicket StagingRing::submit() {
+	if (recording == VK_NULL_HANDLE) {
+		return {submittedSerial};
+	}
+
+	Submission submission = {recordingFence, recording, recordingAcquire, recordingSemaphore, head, submittedSerial + 1};
+
+	if (vkEndCommandBuffer(recording) != VK_SUCCESS) {
+		throw std::runtime_error("failed to record staging command buffer!");
+	}
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &recording;
+
+	vkResetFences(device, 1, &submission.fence);
+	if (recordingAcquire == VK_NULL_HANDLE) {
+		if (vkQueueSubmit(queue, 1, &submitInfo, submission.fence) != VK_SUCCESS) {
+			throw std::runtime_error("failed to submit staging commands!");
+		}
+	} else {
+		if (vkEndCommandBuffer(recordingAcquire) != VK_SUCCESS) {
+			throw std::runtime_error("failed to record staging command buffer!");
+		}
+
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &recordingSemaphore;
+		if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+			throw std::runtime_error("failed to submit staging commands!");
+		}
+
+		// the fence sits on the acquiring side, which cannot finish before the copies it waits for
+		VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		VkSubmitInfo acquireSubmitInfo = {};
+		acquireSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		acquireSubmitInfo.waitSemaphoreCount = 1;
+		acquireSubmitInfo.pWaitSemaphores = &recordingSemaphore;
+		acquireSubmitInfo.pWaitDstStageMask = &waitStage;
+		acquireSubmitInfo.commandBufferCount = 1;
+		acquireSubmitInfo.pCommandBuffers = &recordingAcquire;
+		if (vkQueueSubmit(acquireQueue, 1, &acquireSubmitInfo, submission.fence) != VK_SUCCESS) {
+			throw std::runtime_error("failed to submit staging commands!");
+		}
+	}
+
+	submissions.push_back(submission);
+	submittedSerial = submission.serial;
+	recording = VK_NULL_HANDLE;
+	recordingAcquire = VK_NULL_HANDLE;
+	stats.submissions++;
+	return {submission.serial};
+}
+
+void StagingRing::flush() {
+	submit();
+	while (retireOldest(true)) {
+	}
+}
+
+bool StagingRing::isComplete(UploadTicket ticket) {
+	while (completedSerial < ticket.serial && retireOldest(false)) {
+	}
+	return completedSerial >= ticket.serial;
+}
+
+void StagingRing::wait(UploadTicket ticket) {
+	while (completedSerial < ticket.serial && retireOldest(true)) {
+	}
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#define STAGING_RING_SIZE (64 * 1024 * 1024)
+// covers the texel size of every format we upload and keeps copies on 16 byte boundaries
+#define STAGING_RING_ALIGNMENT 16
+
+struct StagingRegion {
+	VkDeviceSize offset;
+	void* data;
+};
+
+// Identifies one submission of the ring; submissions complete in the order they were made.
+struct UploadTicket {
+	uint64_t serial = 0;
+};
+
+struct StagingRingStats {
+	uint64_t uploadedBytes = 0;
+	uint32_t submissions = 0;
+	// submissions the host had to wait for because the ring was full
+	uint32_t stalls = 0;
+};
+
+// One persistently mapped host buffer that all uploads are staged through. Space is handed
+// out front to back and wraps around; every submission remembers where the ring stood when
+// it was submitted, and that space only comes back once its fence has signalled. Copies are
+// recorded into one command buffer per batch, so many uploads cost one vkQueueSubmit.
+//
+// The ring may run on a different queue family than the one that consumes the uploads. Every
+// batch then gets a second command buffer for the consuming queue that waits on a semaphore
+// the copies signal, which is where the acquiring halves of ownership transfers go.
+class StagingRing {
+private:
+	struct Submission {
+		VkFence fence;
+		VkCommandBuffer commandBuffer;
+		// only with separate families, both are VK_NULL_HANDLE otherwise
+		VkCommandBuffer acquireCommandBuffer;
+		VkSemaphore semaphore;
+		// ring position one past the last byte the submission reads
+		uint64_t end;
+		uint64_t serial;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	uint32_t queueFamilyIndex = 0;
+	VkQueue queue = VK_NULL_HANDLE;
+	VkCommandPool commandPool = VK_NULL_HANDLE;
+	// (1, 1, 1) on graphics and compute families, transfer only families may ask for coarser copies
+	VkExtent3D imageTransferGranularity = {1, 1, 1};
+
+	uint32_t acquireQueueFamilyIndex = 0;
+	VkQueue acquireQueue = VK_NULL_HANDLE;
+	VkCommandPool acquireCommandPool = VK_NULL_HANDLE;
+
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	uint8_t* mappedData = nullptr;
+	VkDeviceSize capacity = 0;
+
+	// positions grow forever, the offset into the buffer is position % capacity
+	uint64_t head = 0;
+	uint64_t tail = 0;
+
+	// the batch being recorded and what it will be submitted with
+	VkCommandBuffer recording = VK_NULL_HANDLE;
+	VkCommandBuffer recordingAcquire = VK_NULL_HANDLE;
+	VkFence recordingFence = VK_NULL_HANDLE;
+	VkSemaphore recordingSemaphore = VK_NULL_HANDLE;
+	std::deque<Submission> submissions;
+	std::vector<Submission> idleSubmissions;
+	uint64_t submittedSerial = 0;
+	uint64_t completedSerial = 0;
+
+	StagingRingStats stats;
+
+	bool retireOldest(bool wait);
+	VkCommandBuffer allocateCommandBuffer(VkCommandPool pool);
+
+public:
+	// Copies run on queue, their results are used on acquireQueue. Passing the same family twice
+	// gives a plain single queue ring.
+	void create(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex, VkQueue queue, uint32_t acquireQueueFamilyIndex, VkQueue acquireQueue, VkDeviceSize size = STAGING_RING_SIZE);
+	void destroy();
+
+	// Reserves size bytes for the current batch. When the ring is full the batch is submitted
+	// and the oldest submissions are waited for, so call commandBuffer() only afterwards.
+	StagingRegion allocate(VkDeviceSize size, VkDeviceSize alignment = STAGING_RING_ALIGNMENT);
+	// The batch being recorded, begun on first use.
+	VkCommandBuffer commandBuffer();
+	// The part of the batch that runs on the acquiring queue after the copies, the same command
+	// buffer as commandBuffer() when there is only one family.
+	VkCommandBuffer acquireCommandBuffer();
+
+	// Submits the current batch, if anything was recorded. The ticket completes once the batch
+	// and everything submitted before it has finished on the device.
+	UploadTicket submit();
+	// Submits the current batch and waits until every submission has finished.
+	void flush();
+
+	// Never blocks, retires whatever has finished on the way.
+	bool isComplete(UploadTicket ticket);
+	void wait(UploadTicket ticket);
+
+	bool hasSeparateQueues() const { return queueFamilyIndex != acquireQueueFamilyIndex; }
+	uint32_t getQueueFamilyIndex() const { return queueFamilyIndex; }
+	uint32_t getAcquireQueueFamilyIndex() const { return acquireQueueFamilyIndex; }
+	// Image copies on the ring's queue have to start on multiples of this and cover whole multiples of it up to
+	// the edge of the level, in blocks for block formats. 0 allows whole levels only.
+	const VkExtent3D& getImageTransferGranularity() const { return imageTransferGranularity; }
+	VkBuffer getBuffer() const { return buffer; }
+	VkDeviceSize getCapacity() const { return capacity; }
+	const StagingRingStats& getStats() const { return stats; }
+};
@@ -0,0 +1,263 @@
+#include "texture_decoder.h"
+#include "ktx2.h"
+#include "mapped_file.h"
+#include "mipmap.h"
+#include "parallel.h"
+#include "stb_image.h"
+
+#include <algorithm>
+#include <chrono>
+
+TextureDecoder::~TextureDecoder() {
+	finish();
+}
+
+// what a decoded texture holds on to until it is released
+static uint64_t decodedSize(int width, int height, bool generateMips) {
+	uint64_t size = static_cast<uint64_t>(width) * height * 4;
+	if (generateMips) {
+		size += mipChainSize(width, height);
+	}
+	return size;
+}
+
+static uint64_t encodedSize(VkFormat format, int width, int height, uint32_t mipLevels) {
+	return textureLevelSize(format, width, height) + textureMipChainSize(format, width, height, mipLevels);
+}
+
+static uint64_t heldSize(const DecodedTexture& texture, bool generateMips) {
+	if (isBlockCompressed(texture.format)) {
+		return encodedSize(texture.format, texture.width, texture.height, texture.mipLevels);
+	}
+	return decodedSize(texture.width, texture.height, generateMips);
+}
+
+std::string TextureDecoder::cachePathFor(const std::string& sourcePath, TextureCompression compression) {
+	return sourcePath + (compression == TEXTURE_COMPRESSION_BC7 ? ".bc7" : ".bc1") + KTX2_EXTENSION;
+}
+
+static bool loadCached(const std::string& cachePath, uint64_t sourceHash, DecodedTexture& texture) {
+	Ktx2Image image;
+	uint8_t* levels;
+	if (!readKtx2(cachePath, sourceHash, image, levels)) {
+		return false;
+	}
+
+	// one allocation holds every level, the mips point into it
+	texture.format = image.format;
+	texture.pixels = levels;
+	texture.width = static_cast<int>(image.width);
+	texture.height = static_cast<int>(image.height);
+	texture.mipLevels = image.mipLevels;
+	texture.mips = image.mipLevels > 1 ? levels + textureLevelSize(image.format, image.width, image.height) : nullptr;
+	return true;
+}
+
+// Replaces the RGBA8 chain of the texture with its blocks and writes them to the cache,
+// returns false when the cache file could not be written.
+static bool encodeTexture(DecodedTexture& texture, int channels, TextureCompression compression, unsigned int threadCount, const std::string& cachePath, uint64_t sourceHash) {
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	uint32_t width = texture.width, height = texture.height;
+	size_t texelCount = static_cast<size_t>(width) * height;
+	bool hasAlpha = false;
+	for (size_t x = 0; x < texelCount && !hasAlpha; x++) {
+		hasAlpha = texture.pixels[x * 4 + 3] < 255;
+	}
+	VkFormat format = compressedFormat(compression, channels, hasAlpha);
+
+	// grey plus alpha is stored in the red and green channels of BC5
+	if (format == VK_FORMAT_BC5_UNORM_BLOCK) {
+		for (size_t x = 0; x < texelCount; x++) {
+			texture.pixels[x * 4 + 1] = texture.pixels[x * 4 + 3];
+		}
+		for (size_t x = 0; x < mipChainSize(width, height) / 4; x++) {
+			texture.mips[x * 4 + 1] = texture.mips[x * 4 + 3];
+		}
+	}
+
+	size_t levelSize = textureLevelSize(format, width, height);
+	uint8_t* blocks = new uint8_t[encodedSize(format, width, height, texture.mipLevels)];
+	compressLevel(format, texture.pixels, width, height, blocks, threadCount);
+
+	const uint8_t* src = texture.mips;
+	uint8_t* dst = blocks + levelSize;
+	for (uint32_t level = 1; level < texture.mipLevels; level++) {
+		uint32_t levelWidth = mipLevelWidth(width, level);
+		uint32_t levelHeight = mipLevelWidth(height, level);
+		compressLevel(format, src, levelWidth, levelHeight, dst, threadCount);
+		src += static_cast<size_t>(levelWidth) * levelHeight * 4;
+		dst += textureLevelSize(format, levelWidth, levelHeight);
+	}
+
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+	texture.encodeMilliseconds = elapsed.count();
+	texture.psnr = compressedLevelPsnr(format, texture.pixels, width, height, blocks);
+
+	Ktx2Image image = {format, width, height, texture.mipLevels};
+	bool written = writeKtx2(cachePath, image, blocks, sourceHash);
+
+	stbi_image_free(texture.pixels);
+	delete[] texture.mips;
+	texture.format = format;
+	texture.pixels = blocks;
+	texture.mips = texture.mipLevels > 1 ? blocks + levelSize : nullptr;
+	return written;
+}
+
+void TextureDecoder::start(const std::vector<std::string>& paths, bool generateMips, TextureCompression compression, unsigned int threadCount, uint64_t budget) {
+	finish();
+
+	this->paths = paths;
+	this->generateMips = generateMips || compression != TEXTURE_COMPRESSION_NONE;
+	this->compression = compression;
+	this->budget = budget;
+	nextPath = 0;
+	delivered = 0;
+	heldBytes = 0;
+	stats = TextureDecoderStats();
+
+	if (threadCount == 0) {
+		threadCount = defaultThreadCount();
+	}
+	unsigned int workerCount = static_cast<unsigned int>(std::max<size_t>(1, std::min<size_t>(threadCount, paths.size())));
+	encodeThreadCount = std::max(1u, threadCount / workerCount);
+	for (unsigned int x = 0; x < workerCount; x++) {
+		workers.emplace_back(&TextureDecoder::work, this);
+	}
+}
+
+void TextureDecoder::work() {
+	while (true) {
+		size_t index;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (nextPath == paths.size()) {
+				return;
+			}
+			index = nextPath++;
+		}
+
+		auto startTime = std::chrono::high_resolution_clock::now();
+
+		// the header is enough to know what the pixels will cost, unreadable files cost nothing
+		int width = 0, height = 0, channels = 0;
+		uint64_t size = 0;
+		if (stbi_info(paths[index].c_str(), &width, &height, &channels)) {
+			size = decodedSize(width, height, generateMips);
+			// encoding holds the decoded chain and the blocks at the same time
+			if (compression != TEXTURE_COMPRESSION_NONE) {
+				size += encodedSize(VK_FORMAT_BC7_UNORM_BLOCK, width, height, mipLevelCount(width, height));
+			}
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			if (heldBytes > 0 && heldBytes + size > budget) {
+				stats.budgetWaits++;
+				budgetAvailable.wait(lock, [&]() { return heldBytes == 0 || heldBytes + size <= budget; });
+			}
+			heldBytes += size;
+			stats.peakBytes = std::max(stats.peakBytes, heldBytes);
+		}
+
+		DecodedTexture texture = {};
+		texture.index = index;
+		texture.format = VK_FORMAT_R8G8B8A8_UNORM;
+		texture.mipLevels = 1;
+
+		std::string cachePath;
+		uint64_t sourceHash = 0;
+		if (compression != TEXTURE_COMPRESSION_NONE) {
+			cachePath = cachePathFor(paths[index], compression);
+			MappedFile source;
+			if (source.open(paths[index])) {
+				sourceHash = hashBytes(source.data(), source.size());
+				texture.cached = loadCached(cachePath, sourceHash, texture);
+			}
+		}
+
+		bool cacheWritten = true;
+		if (!texture.cached) {
+			texture.pixels = stbi_load(paths[index].c_str(), &texture.width, &texture.height, &channels, STBI_rgb_alpha);
+			if (texture.pixels && generateMips) {
+				texture.mipLevels = mipLevelCount(texture.width, texture.height);
+				texture.mips = new uint8_t[mipChainSize(texture.width, texture.height)];
+				generateMipChain(texture.pixels, texture.width, texture.height, texture.mips);
+			}
+		}
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+		texture.decodeMilliseconds = elapsed.count();
+
+		if (!texture.cached && texture.pixels && compression != TEXTURE_COMPRESSION_NONE) {
+			cacheWritten = encodeTexture(texture, channels, compression, encodeThreadCount, cachePath, sourceHash);
+		}
+		uint64_t textureSize = texture.pixels ? heldSize(texture, generateMips) : 0;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			// the reservation was a guess if the header lied, keep the books on what was decoded
+			heldBytes = heldBytes - size + textureSize;
+			stats.peakBytes = std::max(stats.peakBytes, heldBytes);
+			stats.decodedBytes += textureSize;
+			stats.cacheHits += texture.cached ? 1 : 0;
+			stats.cacheWriteFailures += cacheWritten ? 0 : 1;
+			ready.push_back(texture);
+		}
+		textureReady.notify_one();
+		budgetAvailable.notify_all();
+	}
+}
+
+bool TextureDecoder::next(DecodedTexture& texture) {
+	std::unique_lock<std::mutex> lock(mutex);
+	if (delivered == paths.size()) {
+		return false;
+	}
+
+	textureReady.wait(lock, [&]() { return !ready.empty(); });
+	texture = ready.front();
+	ready.pop_front();
+	delivered++;
+	return true;
+}
+
+void TextureDecoder::release(DecodedTexture& texture) {
+	if (texture.pixels) {
+		// block compressed levels share one allocation
+		if (isBlockCompressed(texture.format)) {
+			delete[] texture.pixels;
+		} else {
+			stbi_image_free(texture.pixels);
+			delete[] texture.mips;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			heldBytes -= heldSize(texture, generateMips);
+		}
+		budgetAvailable.notify_all();
+	}
+	texture.pixels = nullptr;
+	texture.mips = nullptr;
+}
+
+void TextureDecoder::finish() {
+	if (workers.empty()) {
+		return;
+	}
+
+	// workers may be waiting for budget that only undelivered textures hold
+	DecodedTexture texture;
+	while (next(texture)) {
+		release(texture);
+	}
+	for (auto& worker : workers) {
+		worker.join();
+	}
+	workers.clear();
+}
+
+TextureDecoderStats TextureDecoder::getStats() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "block_compression.h"
+
+// Upper bound for decoded pixels that have not been released yet, across all workers.
+#define TEXTURE_DECODE_BUDGET (512ull * 1024 * 1024)
+
+struct DecodedTexture {
+	// position in the path list handed to start()
+	size_t index;
+	// R8G8B8A8_UNORM, or the block format level 0 and the mips are encoded in
+	VkFormat format;
+	// tightly packed level 0, null when the file could not be decoded
+	uint8_t* pixels;
+	int width;
+	int height;
+	// levels 1 and below packed as textureMipChainSize describes, null unless mips were asked for
+	uint8_t* mips;
+	uint32_t mipLevels;
+	// the blocks were read from the KTX2 cache, nothing was decoded or encoded
+	bool cached;
+	double decodeMilliseconds;
+	// encoding only, psnr of level 0 against the decoded source
+	double encodeMilliseconds;
+	double psnr;
+};
+
+struct TextureDecoderStats {
+	uint64_t decodedBytes = 0;
+	uint64_t peakBytes = 0;
+	// workers that had to wait because the budget was used up
+	uint32_t budgetWaits = 0;
+	// compression only, textures loaded from their KTX2 file and cache files that could not be written
+	uint32_t cacheHits = 0;
+	uint32_t cacheWriteFailures = 0;
+};
+
+// Decodes image files to RGBA8 on a pool of worker threads. Textures come out of next() in the
+// order they finish, not the order they were listed. Each worker asks stbi_info for the size of
+// its file first and only decodes once that fits into the budget next to everything decoded but
+// not yet released, so the queue between decoding and uploading is bounded by bytes. A file
+// larger than the whole budget is decoded once nothing else is held.
+//
+// With compression every level is encoded to a block format and written to a KTX2 file next
+// to the source, keyed by a hash of the source. Later runs load the blocks from there and
+// never decode the image.
+class TextureDecoder {
+private:
+	std::vector<std::string> paths;
+	bool generateMips = false;
+	TextureCompression compression = TEXTURE_COMPRESSION_NONE;
+	// threads each worker encodes with, so a single texture still uses every core
+	unsigned int encodeThreadCount = 1;
+	uint64_t budget = TEXTURE_DECODE_BUDGET;
+
+	std::mutex mutex;
+	std::condition_variable budgetAvailable;
+	std::condition_variable textureReady;
+	size_t nextPath = 0;
+	size_t delivered = 0;
+	uint64_t heldBytes = 0;
+	std::deque<DecodedTexture> ready;
+	TextureDecoderStats stats;
+
+	std::vector<std::thread> workers;
+
+	void work();
+
+public:
+	~TextureDecoder();
+
+	// threadCount 0 uses every core. With generateMips the workers also build the full mip chain,
+	// which is counted against the budget together with the pixels. Compression always builds
+	// the chain, block formats cannot be blitted.
+	void start(const std::vector<std::string>& paths, bool generateMips = false, TextureCompression compression = TEXTURE_COMPRESSION_NONE, unsigned int threadCount = 0,
+		uint64_t budget = TEXTURE_DECODE_BUDGET);
+	static std::string cachePathFor(const std::string& sourcePath, TextureCompression compression);
+	// Blocks until the next texture is decoded, returns false once every texture was handed out.
+	bool next(DecodedTexture& texture);
+	// Frees the pixels and mips and gives their bytes back to the budget.
+	void release(DecodedTexture& texture);
+	// Waits for the workers, textures not taken out with next() are freed.
+	void finish();
+
+	unsigned int getThreadCount() const { return static_cast<unsigned int>(workers.size()); }
+	TextureDecoderStats getStats();
+};
@@ -378,6 +378,11 @@ void LoadMtl(std::map<std::string, int> *material_map,
 #include <fstream>
 #include <sstream>
 
+#if defined(__SSE4_1__)
+#include <stdint.h>
+#include <smmintrin.h>
+#endif
+
 namespace tinyobj {
 
 MaterialReader::~MaterialReader() {}
@@ -495,6 +500,123 @@ static inline int parseInt(const char **token) {
   return i;
 }
 
+// Fast path of tryParseDouble() for plain fixed-format decimals such as
+// "-12.345678", which make up nearly all v/vn/vt tokens.
+//
+// Handles a whole token of the form [sign] digits [. digits] with at most 15
+// significant digits. The digits then form an integer that is exact in a
+// double, and 10^fraction_digits is exact as well, so the single division
+// below is correctly rounded and matches strtod(). Returns false for anything
+// else (exponents, longer tokens, malformed input) and the generic parser
+// takes over.
+static bool tryParseDoubleFast(const char *s, const char *s_end,
+                               double *result) {
+  static const double pow10_lut[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                     1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                     1e12, 1e13, 1e14, 1e15};
+
+  int start = (s[0] == '-' || s[0] == '+') ? 1 : 0;
+
+#if defined(__SSE4_1__) && defined(__GNUC__)
+  size_t len = static_cast<size_t>(s_end - s);
+
+  // Load the first 16 bytes of the token. Reading past s_end is safe as long
+  // as the load stays inside the page (the bytes are masked out below),
+  // otherwise the token is copied to a zero filled block first.
+  __m128i chars;
+  if (len >= 16 ||
+      (reinterpret_cast<uintptr_t>(s) & 4095) <= 4096 - 16) {
+    chars = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+  } else {
+    char buf[16] = {0};
+    memcpy(buf, s, len);
+    chars = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf));
+  }
+
+  // bit i of the masks is set when byte i is a digit / a '.'
+  unsigned int valid_mask = len >= 16 ? 0xFFFFu : ((1u << len) - 1u);
+  __m128i values = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+  __m128i is_digit =
+      _mm_cmpeq_epi8(_mm_min_epu8(values, _mm_set1_epi8(9)), values);
+  unsigned int digit_mask =
+      static_cast<unsigned int>(_mm_movemask_epi8(is_digit)) & valid_mask;
+  unsigned int dot_mask =
+      static_cast<unsigned int>(
+          _mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_set1_epi8('.')))) &
+      valid_mask;
+
+  // the inverted masks always have a bit set past the window
+  int int_len = __builtin_ctz(~(digit_mask >> start));
+  if (int_len == 0) return false;
+
+  int end = start + int_len;
+  int dot = 16;
+  int frac_len = 0;
+  if ((dot_mask >> end) & 1u) {
+    dot = end;
+    frac_len = __builtin_ctz(~(digit_mask >> (end + 1)));
+    end += 1 + frac_len;
+  }
+
+  int num_digits = int_len + frac_len;
+  if (static_cast<size_t>(end) != len || num_digits > 15) return false;
+
+  // Gather the digits, without the '.', right aligned into a zero filled
+  // block: lane i takes byte start + i - (16 - num_digits), skipping the dot,
+  // and lanes in front of the number are zeroed (high bit set in the index).
+  __m128i lane = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13,
+                               14, 15);
+  __m128i index = _mm_add_epi8(
+      lane, _mm_set1_epi8(static_cast<char>(start - (16 - num_digits))));
+  index = _mm_sub_epi8(
+      index, _mm_cmpgt_epi8(index, _mm_set1_epi8(static_cast<char>(dot - 1))));
+  index = _mm_or_si128(
+      index,
+      _mm_cmplt_epi8(lane, _mm_set1_epi8(static_cast<char>(16 - num_digits))));
+  __m128i digits = _mm_shuffle_epi8(values, index);
+
+  // 16 digits -> 8 two-digit -> 4 four-digit -> 2 eight-digit numbers
+  __m128i pairs = _mm_maddubs_epi16(
+      digits,
+      _mm_setr_epi8(10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1));
+  __m128i quads =
+      _mm_madd_epi16(pairs, _mm_setr_epi16(100, 1, 100, 1, 100, 1, 100, 1));
+  __m128i packed = _mm_packus_epi32(quads, quads);
+  __m128i octets = _mm_madd_epi16(
+      packed, _mm_setr_epi16(10000, 1, 10000, 1, 10000, 1, 10000, 1));
+  unsigned long long mantissa =
+      static_cast<unsigned int>(_mm_cvtsi128_si32(octets)) * 100000000ull +
+      static_cast<unsigned int>(_mm_extract_epi32(octets, 1));
+#else
+  const char *curr = s + start;
+  unsigned long long mantissa = 0;
+  int num_digits = 0;
+  while (curr != s_end && IS_DIGIT(*curr)) {
+    mantissa = mantissa * 10 + static_cast<unsigned int>(*curr - '0');
+    num_digits++;
+    curr++;
+  }
+  if (num_digits == 0) return false;
+
+  int frac_len = 0;
+  if (curr != s_end && *curr == '.') {
+    curr++;
+    while (curr != s_end && IS_DIGIT(*curr)) {
+      mantissa = mantissa * 10 + static_cast<unsigned int>(*curr - '0');
+      frac_len++;
+      curr++;
+    }
+    num_digits += frac_len;
+  }
+
+  if (curr != s_end || num_digits > 15) return false;
+#endif
+
+  double value = static_cast<double>(mantissa) / pow10_lut[frac_len];
+  *result = (s[0] == '-') ? -value : value;
+  return true;
+}
+
 // Tries to parse a floating point number located at s.
 //
 // s_end should be a location in the string where reading should absolutely
@@ -522,7 +644,8 @@ static inline int parseInt(const char **token) {
 //  - s >= s_end.
 //  - parse failure.
 //
-static bool tryParseDouble(const char *s, const char *s_end, double *result) {
+static bool tryParseDoubleGeneric(const char *s, const char *s_end,
+                                  double *result) {
   if (s >= s_end) {
     return false;
   }
@@ -637,6 +760,19 @@ fail:
   return false;
 }
 
+// Reads a v/vn/vt value, tryParseDoubleFast() first and
+// tryParseDoubleGeneric() for whatever it turns down.
+static bool tryParseDouble(const char *s, const char *s_end, double *result) {
+  if (s >= s_end) {
+    return false;
+  }
+
+  if (tryParseDoubleFast(s, s_end, result)) {
+    return true;
+  }
+  return tryParseDoubleGeneric(s, s_end, result);
+}
+
 static inline real_t parseReal(const char **token, double default_value = 0.0) {
   (*token) += strspn((*token), " \t");
   const char *end = (*token) + strcspn((*token), " \t\r");
@@ -1986,7 +2122,8 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
       // flush previous face group.
       bool ret = exportFaceGroupToShape(&shape, faceGroup, tags, material, name,
                                         triangulate, v);
-      if (ret) {
+      // faces flushed by an earlier usemtl are in shape already
+      if (ret || shape.mesh.indices.size() > 0) {
         shapes->push_back(shape);
       }
 
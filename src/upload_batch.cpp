@@ -0,0 +1,246 @@
+#include "upload_batch.h"
+#include "block_compression.h"
+#include "mipmap.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+void UploadBatch::copyToBuffer(const void* data, VkDeviceSize size, VkBuffer dstBuffer, VkDeviceSize dstOffset) {
+	writeToBuffer(size, dstBuffer, dstOffset, 1, [data](void* destination, VkDeviceSize offset, VkDeviceSize copySize) {
+		memcpy(destination, static_cast<const uint8_t*>(data) + offset, static_cast<size_t>(copySize));
+	});
+}
+
+void UploadBatch::recordBufferCopy(const StagingRegion& region, VkDeviceSize size, VkBuffer dstBuffer, VkDeviceSize dstOffset) {
+	VkBufferCopy copyRegion = {};
+	copyRegion.srcOffset = region.offset;
+	copyRegion.dstOffset = dstOffset;
+	copyRegion.size = size;
+	vkCmdCopyBuffer(ring->commandBuffer(), ring->getBuffer(), dstBuffer, 1, &copyRegion);
+}
+
+void UploadBatch::releaseBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, VkDeviceSize size) {
+	if (ring->hasSeparateQueues()) {
+		VkBufferMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = 0;
+		barrier.srcQueueFamilyIndex = ring->getQueueFamilyIndex();
+		barrier.dstQueueFamilyIndex = ring->getAcquireQueueFamilyIndex();
+		barrier.buffer = dstBuffer;
+		barrier.offset = dstOffset;
+		barrier.size = size;
+		vkCmdPipelineBarrier(ring->commandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+		// the scene buffers are read by rasterization and ray tracing alike
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+		vkCmdPipelineBarrier(ring->acquireCommandBuffer(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+	}
+}
+
+void UploadBatch::copyToImage(const uint8_t* pixels, uint32_t width, uint32_t height, VkImage image, const uint8_t* mips, uint32_t mipLevels, VkFormat format) {
+	struct Band {
+		const uint8_t* data;
+		VkDeviceSize size;
+		VkBufferImageCopy region;
+	};
+
+	// every level is cut into bands of whole rows, then runs of bands small enough to share one
+	// staging allocation go out in one copy, which puts most mip chains into a single command;
+	// for block formats a row is a row of blocks
+	VkDeviceSize chunkSize = ring->getCapacity() / 4;
+	uint32_t blockExtent = formatBlockExtent(format);
+	// bands start on multiples of the queue's granularity, which is in blocks already; 0 takes whole levels
+	uint32_t granularity = ring->getImageTransferGranularity().height;
+	std::vector<Band> bands;
+	const uint8_t* levelPixels = pixels;
+	for (uint32_t level = 0; level < mipLevels; level++) {
+		uint32_t levelWidth = mipLevelWidth(width, level);
+		uint32_t levelHeight = mipLevelWidth(height, level);
+		uint32_t blockRows = (levelHeight + blockExtent - 1) / blockExtent;
+		VkDeviceSize rowPitch = static_cast<VkDeviceSize>((levelWidth + blockExtent - 1) / blockExtent) * formatBlockBytes(format);
+		uint32_t rowsPerChunk = static_cast<uint32_t>(std::max<VkDeviceSize>(1, chunkSize / rowPitch));
+		rowsPerChunk = granularity == 0 ? blockRows : std::max(granularity, rowsPerChunk / granularity * granularity);
+
+		for (uint32_t row = 0; row < blockRows; row += rowsPerChunk) {
+			uint32_t rows = std::min(rowsPerChunk, blockRows - row);
+			uint32_t y = row * blockExtent;
+
+			Band band;
+			band.data = levelPixels + rowPitch * row;
+			band.size = rowPitch * rows;
+			band.region = {};
+			band.region.bufferRowLength = 0;
+			band.region.bufferImageHeight = 0;
+			band.region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			band.region.imageSubresource.mipLevel = level;
+			band.region.imageSubresource.baseArrayLayer = 0;
+			band.region.imageSubresource.layerCount = 1;
+			band.region.imageOffset = {0, static_cast<int32_t>(y), 0};
+			band.region.imageExtent = {levelWidth, std::min(rows * blockExtent, levelHeight - y), 1};
+			bands.push_back(band);
+		}
+		levelPixels = level == 0 ? mips : levelPixels + rowPitch * blockRows;
+	}
+
+	std::vector<VkBufferImageCopy> regions;
+	for (size_t first = 0, last = 0; first < bands.size(); first = last) {
+		VkDeviceSize stagingSize = 0;
+		for (last = first; last < bands.size() && (last == first || stagingSize + bands[last].size <= chunkSize); last++) {
+			stagingSize += bands[last].size;
+		}
+
+		StagingRegion staging = ring->allocate(stagingSize);
+		regions.clear();
+		VkDeviceSize offset = 0;
+		for (size_t x = first; x < last; x++) {
+			memcpy(static_cast<uint8_t*>(staging.data) + offset, bands[x].data, static_cast<size_t>(bands[x].size));
+			regions.push_back(bands[x].region);
+			regions.back().bufferOffset = staging.offset + offset;
+			offset += bands[x].size;
+		}
+
+		vkCmdCopyBufferToImage(ring->commandBuffer(), ring->getBuffer(), image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+	}
+}
+
+static VkImageMemoryBarrier colorImageBarrier(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t baseMipLevel, uint32_t levelCount) {
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = baseMipLevel;
+	barrier.subresourceRange.levelCount = levelCount;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	return barrier;
+}
+
+void UploadBatch::transferOwnership(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels, VkAccessFlags dstAccessMask) {
+	// both halves of the transfer carry the same layout change, it happens once
+	VkImageMemoryBarrier barrier = colorImageBarrier(image, oldLayout, newLayout, 0, mipLevels);
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = 0;
+	barrier.srcQueueFamilyIndex = ring->getQueueFamilyIndex();
+	barrier.dstQueueFamilyIndex = ring->getAcquireQueueFamilyIndex();
+	vkCmdPipelineBarrier(ring->commandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = dstAccessMask;
+	vkCmdPipelineBarrier(ring->acquireCommandBuffer(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void UploadBatch::transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels) {
+	if (newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
+		recordImageLayoutTransition(ring->commandBuffer(), image, format, oldLayout, newLayout, mipLevels);
+	} else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && ring->hasSeparateQueues()) {
+		transferOwnership(image, oldLayout, newLayout, mipLevels, VK_ACCESS_SHADER_READ_BIT);
+	} else {
+		recordImageLayoutTransition(ring->acquireCommandBuffer(), image, format, oldLayout, newLayout, mipLevels);
+	}
+}
+
+void UploadBatch::generateMipmaps(VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels) {
+	// blits need a graphics queue, level 0 is handed over from the transfer queue first
+	if (ring->hasSeparateQueues()) {
+		transferOwnership(image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels, VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+	}
+
+	VkCommandBuffer commandBuffer = ring->acquireCommandBuffer();
+	for (uint32_t level = 1; level < mipLevels; level++) {
+		VkImageMemoryBarrier barrier = colorImageBarrier(image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, level - 1, 1);
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		VkImageBlit blit = {};
+		blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.srcSubresource.mipLevel = level - 1;
+		blit.srcSubresource.baseArrayLayer = 0;
+		blit.srcSubresource.layerCount = 1;
+		blit.srcOffsets[0] = {0, 0, 0};
+		blit.srcOffsets[1] = {static_cast<int32_t>(mipLevelWidth(width, level - 1)), static_cast<int32_t>(mipLevelWidth(height, level - 1)), 1};
+		blit.dstSubresource = blit.srcSubresource;
+		blit.dstSubresource.mipLevel = level;
+		blit.dstOffsets[0] = {0, 0, 0};
+		blit.dstOffsets[1] = {static_cast<int32_t>(mipLevelWidth(width, level)), static_cast<int32_t>(mipLevelWidth(height, level)), 1};
+		vkCmdBlitImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+		barrier = colorImageBarrier(image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, level - 1, 1);
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+
+	VkImageMemoryBarrier barrier = colorImageBarrier(image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevels - 1, 1);
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void recordImageLayoutTransition(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels) {
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = mipLevels;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = 0;
+
+	VkPipelineStageFlags sourceStage;
+	VkPipelineStageFlags destinationStage;
+
+	if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+
+		if (format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT) {
+			barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+		}
+	}
+	else {
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	}
+
+	if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && (newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL || newLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL)) {
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+		sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	}
+	else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+		sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	}
+	else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+		sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		destinationStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	}
+	else {
+		throw std::invalid_argument("unsupported layout transition!");
+	}
+
+	vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+
+#include <vulkan/vulkan.h>
+
+#include "staging_ring.h"
+
+// Records any number of copies and layout transitions into the current batch of a staging ring,
+// without touching the queue. submit() hands the whole batch to the device with one
+// vkQueueSubmit and returns a ticket to poll or wait on, so load time follows the amount of
+// data instead of the number of objects.
+//
+// When the ring copies on a transfer only queue, uploaded buffers and images are released by
+// the transfer family and acquired by the consuming family in the same batch, so they are
+// ready for rendering once the ticket completes.
+class UploadBatch {
+private:
+	StagingRing* ring = nullptr;
+
+	void transferOwnership(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels, VkAccessFlags dstAccessMask);
+	void recordBufferCopy(const StagingRegion& region, VkDeviceSize size, VkBuffer dstBuffer, VkDeviceSize dstOffset);
+	void releaseBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, VkDeviceSize size);
+
+public:
+	UploadBatch() = default;
+	explicit UploadBatch(StagingRing& ring) : ring(&ring) {}
+
+	// Both copies stage in pieces of at most a quarter of the ring, so uploads of any size keep
+	// the ring busy without waiting for all of it to drain.
+	void copyToBuffer(const void* data, VkDeviceSize size, VkBuffer dstBuffer, VkDeviceSize dstOffset = 0);
+	// copyToBuffer for data made on the fly: fill(destination, offset, size) writes bytes offset to offset + size
+	// straight into the mapped staging memory, so the data never needs a buffer of its own. Every piece holds
+	// whole elements of elementSize bytes.
+	template <class Fn>
+	void writeToBuffer(VkDeviceSize size, VkBuffer dstBuffer, VkDeviceSize dstOffset, VkDeviceSize elementSize, Fn fill);
+	// Tightly packed pixels or blocks of format into an image in TRANSFER_DST_OPTIMAL, plus levels
+	// 1 and below from mips, packed as textureMipChainSize describes, when mipLevels is more than 1.
+	void copyToImage(const uint8_t* pixels, uint32_t width, uint32_t height, VkImage image, const uint8_t* mips = nullptr, uint32_t mipLevels = 1, VkFormat format = VK_FORMAT_R8G8B8A8_UNORM);
+	// Transitions into TRANSFER_DST_OPTIMAL run with the copies, transitions out of it also move
+	// the image to the consuming family, everything else runs on the consuming queue.
+	void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels = 1);
+	// Fills levels 1 and below from level 0 with linear blits on the consuming queue. Every level
+	// has to be in TRANSFER_DST_OPTIMAL and ends up in SHADER_READ_ONLY_OPTIMAL, and the format
+	// has to support linear filtering.
+	void generateMipmaps(VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels);
+
+	UploadTicket submit() { return ring->submit(); }
+	bool isComplete(UploadTicket ticket) { return ring->isComplete(ticket); }
+	void wait(UploadTicket ticket) { ring->wait(ticket); }
+};
+
+template <class Fn>
+void UploadBatch::writeToBuffer(VkDeviceSize size, VkBuffer dstBuffer, VkDeviceSize dstOffset, VkDeviceSize elementSize, Fn fill) {
+	VkDeviceSize chunkSize = std::max<VkDeviceSize>(ring->getCapacity() / 4 / elementSize, 1) * elementSize;
+	for (VkDeviceSize offset = 0; offset < size; offset += chunkSize) {
+		VkDeviceSize copySize = std::min(chunkSize, size - offset);
+		StagingRegion region = ring->allocate(copySize);
+		fill(region.data, offset, copySize);
+		recordBufferCopy(region, copySize, dstBuffer, dstOffset + offset);
+	}
+	releaseBuffer(dstBuffer, dstOffset, size);
+}
+
+void recordImageLayoutTransition(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels = 1);
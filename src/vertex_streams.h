@@ -0,0 +1,154 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Streams start on a cache line, so passes over one attribute use every byte they load and SIMD
+// kernels can use aligned loads from the first element on.
+#define VERTEX_STREAM_ALIGNMENT 64
+
+// Compile time detection of the optional vertex attributes. ObjLoader<TVert> and the stream helpers
+// only read and write the members TVert actually has, 'pos' is required.
+template <class TVert, class = void>
+struct vertex_has_nrm : std::false_type {};
+template <class TVert>
+struct vertex_has_nrm<TVert, std::void_t<decltype(std::declval<TVert&>().nrm)>> : std::true_type {};
+
+template <class TVert, class = void>
+struct vertex_has_texCoord : std::false_type {};
+template <class TVert>
+struct vertex_has_texCoord<TVert, std::void_t<decltype(std::declval<TVert&>().texCoord)>> : std::true_type {};
+
+template <class TVert, class = void>
+struct vertex_has_color : std::false_type {};
+template <class TVert>
+struct vertex_has_color<TVert, std::void_t<decltype(std::declval<TVert&>().color)>> : std::true_type {};
+
+template <class TVert, class = void>
+struct vertex_has_tangent : std::false_type {};
+template <class TVert>
+struct vertex_has_tangent<TVert, std::void_t<decltype(std::declval<TVert&>().tangent)>> : std::true_type {};
+
+template <class T>
+struct AlignedAllocator {
+	typedef T value_type;
+
+	AlignedAllocator() = default;
+	template <class U>
+	AlignedAllocator(const AlignedAllocator<U>&) {}
+
+	T* allocate(size_t count) { return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(VERTEX_STREAM_ALIGNMENT))); }
+	void deallocate(T* pointer, size_t) { ::operator delete(pointer, std::align_val_t(VERTEX_STREAM_ALIGNMENT)); }
+
+	template <class U>
+	bool operator==(const AlignedAllocator<U>&) const { return true; }
+	template <class U>
+	bool operator!=(const AlignedAllocator<U>&) const { return false; }
+};
+
+template <class T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// Struct of arrays vertex storage: one tightly packed stream per attribute, so passes that only need
+// positions, like bounds, BVH builds and normal generation, read 12 bytes a vertex instead of whole
+// vertices. Streams of attributes the vertices were made from lack stay empty.
+struct VertexStreams {
+	AlignedVector<glm::vec3> positions;
+	AlignedVector<glm::vec3> normals;
+	AlignedVector<glm::vec2> texCoords;
+	AlignedVector<glm::vec3> colors;
+	AlignedVector<glm::vec4> tangents;
+
+	size_t size() const { return positions.size(); }
+
+	// Appends the attributes TVert has, so ObjLoader can weld into streams like into a vector.
+	template <class TVert>
+	void push_back(const TVert& vertex);
+
+	// Appends a copy of every split source to every stream, like appendSplitVertices.
+	void appendSplitVertices(const std::vector<uint32_t>& splitSources) {
+		appendSplits(positions, splitSources);
+		appendSplits(normals, splitSources);
+		appendSplits(texCoords, splitSources);
+		appendSplits(colors, splitSources);
+		appendSplits(tangents, splitSources);
+	}
+
+private:
+	template <class T>
+	static void appendSplits(AlignedVector<T>& stream, const std::vector<uint32_t>& splitSources) {
+		if (stream.empty()) {
+			return;
+		}
+		stream.reserve(stream.size() + splitSources.size());
+		for (uint32_t source : splitSources) {
+			stream.push_back(stream[source]);
+		}
+	}
+};
+
+template <class TVert>
+void VertexStreams::push_back(const TVert& vertex) {
+	positions.push_back(vertex.pos);
+	if constexpr (vertex_has_nrm<TVert>::value) {
+		normals.push_back(vertex.nrm);
+	}
+	if constexpr (vertex_has_texCoord<TVert>::value) {
+		texCoords.push_back(vertex.texCoord);
+	}
+	if constexpr (vertex_has_color<TVert>::value) {
+		colors.push_back(vertex.color);
+	}
+	if constexpr (vertex_has_tangent<TVert>::value) {
+		tangents.push_back(vertex.tangent);
+	}
+}
+
+// Copies stream entries first to first + count into whole vertices, for uploads that want them
+// interleaved. One attribute at a time, so every stream is read front to back. Attributes TVert
+// has but the streams lack are left as they are.
+template <class TVert>
+void interleaveVertexStreams(const VertexStreams& streams, size_t first, size_t count, TVert* vertices) {
+	for (size_t x = 0; x < count; x++) {
+		vertices[x].pos = streams.positions[first + x];
+	}
+	if constexpr (vertex_has_nrm<TVert>::value) {
+		for (size_t x = 0; x < count && !streams.normals.empty(); x++) {
+			vertices[x].nrm = streams.normals[first + x];
+		}
+	}
+	if constexpr (vertex_has_texCoord<TVert>::value) {
+		for (size_t x = 0; x < count && !streams.texCoords.empty(); x++) {
+			vertices[x].texCoord = streams.texCoords[first + x];
+		}
+	}
+	if constexpr (vertex_has_color<TVert>::value) {
+		for (size_t x = 0; x < count && !streams.colors.empty(); x++) {
+			vertices[x].color = streams.colors[first + x];
+		}
+	}
+	if constexpr (vertex_has_tangent<TVert>::value) {
+		for (size_t x = 0; x < count && !streams.tangents.empty(); x++) {
+			vertices[x].tangent = streams.tangents[first + x];
+		}
+	}
+}
+
+// The other way round: replaces streams with the attributes of count vertices.
+template <class TVert>
+void deinterleaveVertexStreams(const TVert* vertices, size_t count, VertexStreams& streams) {
+	streams = VertexStreams();
+	streams.positions.reserve(count);
+	streams.normals.reserve(vertex_has_nrm<TVert>::value ? count : 0);
+	streams.texCoords.reserve(vertex_has_texCoord<TVert>::value ? count : 0);
+	streams.colors.reserve(vertex_has_color<TVert>::value ? count : 0);
+	streams.tangents.reserve(vertex_has_tangent<TVert>::value ? count : 0);
+	for (size_t x = 0; x < count; x++) {
+		streams.push_back(vertices[x]);
+	}
+}